@@ -58,6 +58,7 @@ void SysTick_Handler(void);
 void CAN1_RX0_IRQHandler(void);
 void OTG_FS_IRQHandler(void);
 /* USER CODE BEGIN EFP */
+void FLASH_IRQHandler(void);
 
 /* USER CODE END EFP */
 
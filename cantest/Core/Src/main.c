@@ -26,6 +26,7 @@
 /* USER CODE BEGIN Includes */
 #include "iap_user.h"
 #include "can_uds_simple.h"
+#include "ram_exec.h"
 
 /* USER CODE END Includes */
 
@@ -69,6 +70,8 @@ int main(void)
 {
 
   /* USER CODE BEGIN 1 */
+  /* IAP_RAM_EXEC: vector table to SRAM before any interrupt is enabled */
+  RamExec_Init();
 
   /* USER CODE END 1 */
 
@@ -22,6 +22,7 @@
 #include "stm32f2xx_it.h"
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
+#include "flash_async.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -228,5 +229,12 @@ void OTG_FS_IRQHandler(void)
 }
 
 /* USER CODE BEGIN 1 */
+/**
+  * @brief This function handles FLASH global interrupt (async erase / program).
+  */
+void FLASH_IRQHandler(void)
+{
+  FLASH_Async_IRQHandler();
+}
 
 /* USER CODE END 1 */
@@ -0,0 +1,761 @@
+/******************************************************************************
+ * @file    app_update.c
+ * @brief   Delta (patch) and sector-diff update of App1 against the installed image.
+ * @author  Jason
+ * @version V1.0.0
+ * @date    2025-3
+ * @copyright (c) 2025, All rights reserved.
+ ******************************************************************************/
+
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+#include "app_update.h"
+#include "crc.h"
+#include "flash_if.h"
+#include "image_crc.h"
+#include "iap_user.h"
+
+/* Private typedef -----------------------------------------------------------*/
+/**
+  * @brief  Patch parser / staging writer
+  */
+typedef struct
+{
+  uint8_t  state;                         /* parser state */
+  uint8_t  op;                            /* command being executed */
+  uint8_t  a_arg[APP_DELTA_HEADER_SIZE];  /* header or command arguments */
+  uint32_t arg_index;                     /* bytes collected in a_arg */
+  uint32_t arg_size;                      /* bytes needed in a_arg */
+  uint32_t old_size;                      /* installed image covered by the patch */
+  uint32_t new_size;                      /* image to build */
+  uint32_t new_crc;                       /* CRC-32 of the image to build */
+  uint32_t offset;                        /* old image offset of the current command */
+  uint32_t remaining;                     /* bytes left in the current command */
+  uint32_t produced;                      /* new image bytes produced */
+  uint32_t written;                       /* new image bytes programmed to Backup */
+  uint32_t fill;                          /* bytes in aDeltaChunk */
+  uint32_t crc;                           /* running CRC-32 of the new image */
+  uint32_t chunk;                         /* sparse stream: next manifest chunk */
+  eAPP_Update_Status_Def status;          /* first error, sticky */
+} AppDelta_TypeDef;
+
+/**
+  * @brief  Manifest of the image to build, chunk hashes and the resulting bitmap
+  */
+typedef struct
+{
+  uint8_t  a_data[APP_MANIFEST_MAX_SIZE]; /* manifest as received */
+  uint32_t length;                        /* bytes in a_data */
+  uint32_t image_size;                    /* size of the new image */
+  uint32_t chunks;                        /* number of APP_MANIFEST_CHUNK_SIZE chunks */
+  uint32_t crc;                           /* CRC-32 of the whole manifest */
+  uint8_t  valid;                         /* bitmap computed, sparse stream accepted */
+  uint8_t  a_bitmap[APP_MANIFEST_BITMAP_SIZE];  /* 1 = chunk differs from App1 */
+  eAPP_Update_Status_Def status;          /* first error, sticky */
+} AppManifest_TypeDef;
+
+/* Private define ------------------------------------------------------------*/
+/* Parser states */
+#define DELTA_STATE_HEADER          ((uint8_t)0)   /* collecting the 20 byte header */
+#define DELTA_STATE_OP              ((uint8_t)1)   /* waiting for an opcode */
+#define DELTA_STATE_ARGS            ((uint8_t)2)   /* collecting command arguments */
+#define DELTA_STATE_DATA            ((uint8_t)3)   /* ADD / INSERT payload */
+#define DELTA_STATE_DONE            ((uint8_t)4)   /* END seen, rest is ignored */
+
+#define OLD_IMAGE                   ((const uint8_t *)APPLICATION_ADDRESS)
+
+/* Private macro -------------------------------------------------------------*/
+#define MANIFEST_CHUNK_NEEDED(chunk) ((AppManifest.a_bitmap[(chunk) / 8u] & (1u << ((chunk) % 8u))) != 0)
+
+/* Private variables ---------------------------------------------------------*/
+static AppDelta_TypeDef AppDelta;
+/* new image bytes waiting to be programmed, 32 bit aligned for FLASH_If_Write */
+static uint32_t aDeltaChunk[APP_UPDATE_CHUNK_SIZE / 4];
+static AppManifest_TypeDef AppManifest;
+/* Backup holds a new image: from DeltaBegin / SparseBegin to the end of AppUpdate_Commit */
+static uint8_t AppUpdateBusy;
+
+/* Private function prototypes -----------------------------------------------*/
+static uint32_t AppUpdate_GetU32(const uint8_t *p_data);
+static eAPP_Update_Status_Def AppUpdate_Flush(void);
+static eAPP_Update_Status_Def AppUpdate_ParseHeader(void);
+static eAPP_Update_Status_Def AppUpdate_StartCommand(void);
+static eAPP_Update_Status_Def AppUpdate_Copy(void);
+static void AppUpdate_SetStatus(eIAP_Status_Def status, uint32_t size, uint32_t crc);
+static uint32_t AppUpdate_ChunkLength(uint32_t chunk);
+static uint32_t AppUpdate_ChunkCrc(uint32_t chunk);
+static eAPP_Update_Status_Def AppUpdate_ParseSparseHeader(void);
+static eAPP_Update_Status_Def AppUpdate_SparseNext(void);
+
+/* Private functions ---------------------------------------------------------*/
+/**
+  * @brief  Read a little endian uint32
+  * @param  p_data: 4 bytes
+  * @retval value
+  */
+static uint32_t AppUpdate_GetU32(const uint8_t *p_data)
+{
+  return (uint32_t)p_data[0] | ((uint32_t)p_data[1] << 8) |
+         ((uint32_t)p_data[2] << 16) | ((uint32_t)p_data[3] << 24);
+}
+
+/**
+  * @brief  Program the staged bytes to the Backup region
+  * @note   A partial chunk (end of image) is padded with 0xFF to a whole word.
+  * @param  None
+  * @retval APP_UPDATE_OK or APP_UPDATE_FLASH_ERR
+  */
+static eAPP_Update_Status_Def AppUpdate_Flush(void)
+{
+  uint8_t *p_chunk = (uint8_t *)aDeltaChunk;
+  uint32_t size = AppDelta.fill;
+
+  if (size == 0)
+  {
+    return APP_UPDATE_OK;
+  }
+  AppDelta.crc = Crc32_Update(AppDelta.crc, p_chunk, size);
+  while ((size % 4) != 0)
+  {
+    p_chunk[size++] = 0xFF;
+  }
+  if (FLASH_If_Write(BACKUP_ADDRESS + AppDelta.written, aDeltaChunk, size / 4) != FLASHIF_OK)
+  {
+    return APP_UPDATE_FLASH_ERR;
+  }
+  AppDelta.written += AppDelta.fill;
+  AppDelta.fill = 0;
+  return APP_UPDATE_OK;
+}
+
+/**
+  * @brief  Check the patch header against the installed image
+  * @param  None
+  * @retval APP_UPDATE_OK, APP_UPDATE_FORMAT_ERR, APP_UPDATE_BASE_ERR or APP_UPDATE_SIZE_ERR
+  */
+static eAPP_Update_Status_Def AppUpdate_ParseHeader(void)
+{
+  uint32_t old_crc;
+
+  if (memcmp(AppDelta.a_arg, APP_DELTA_MAGIC, 4) != 0)
+  {
+    return APP_UPDATE_FORMAT_ERR;
+  }
+  AppDelta.old_size = AppUpdate_GetU32(&AppDelta.a_arg[4]);
+  old_crc = AppUpdate_GetU32(&AppDelta.a_arg[8]);
+  AppDelta.new_size = AppUpdate_GetU32(&AppDelta.a_arg[12]);
+  AppDelta.new_crc = AppUpdate_GetU32(&AppDelta.a_arg[16]);
+
+  /* the patch only applies to the image it was made from */
+  if ((AppDelta.old_size > USER_FLASH_SIZE) || (Crc32_Calc(OLD_IMAGE, AppDelta.old_size) != old_crc))
+  {
+    return APP_UPDATE_BASE_ERR;
+  }
+  if ((AppDelta.new_size == 0) || (AppDelta.new_size > USER_FLASH_SIZE) || (AppDelta.new_size > BACKUP_FLASH_SIZE))
+  {
+    return APP_UPDATE_SIZE_ERR;
+  }
+  return APP_UPDATE_OK;
+}
+
+/**
+  * @brief  Validate the arguments of a COPY / ADD / INSERT command
+  * @param  None
+  * @retval APP_UPDATE_OK, APP_UPDATE_FORMAT_ERR or APP_UPDATE_SIZE_ERR
+  */
+static eAPP_Update_Status_Def AppUpdate_StartCommand(void)
+{
+  if (AppDelta.op == APP_DELTA_OP_INSERT)
+  {
+    AppDelta.offset = 0;
+    AppDelta.remaining = AppUpdate_GetU32(&AppDelta.a_arg[0]);
+  }
+  else
+  {
+    AppDelta.offset = AppUpdate_GetU32(&AppDelta.a_arg[0]);
+    AppDelta.remaining = AppUpdate_GetU32(&AppDelta.a_arg[4]);
+    if ((AppDelta.remaining > AppDelta.old_size) || (AppDelta.offset > (AppDelta.old_size - AppDelta.remaining)))
+    {
+      return APP_UPDATE_FORMAT_ERR;
+    }
+  }
+  if (AppDelta.remaining > (AppDelta.new_size - AppDelta.produced))
+  {
+    return APP_UPDATE_SIZE_ERR;
+  }
+  return APP_UPDATE_OK;
+}
+
+/**
+  * @brief  Execute a COPY command (needs no patch data)
+  * @param  None
+  * @retval APP_UPDATE_OK or APP_UPDATE_FLASH_ERR
+  */
+static eAPP_Update_Status_Def AppUpdate_Copy(void)
+{
+  uint32_t n;
+
+  while (AppDelta.remaining > 0)
+  {
+    n = APP_UPDATE_CHUNK_SIZE - AppDelta.fill;
+    if (n > AppDelta.remaining)
+    {
+      n = AppDelta.remaining;
+    }
+    memcpy((uint8_t *)aDeltaChunk + AppDelta.fill, OLD_IMAGE + AppDelta.offset, n);
+    AppDelta.fill += n;
+    AppDelta.offset += n;
+    AppDelta.produced += n;
+    AppDelta.remaining -= n;
+    if ((AppDelta.fill == APP_UPDATE_CHUNK_SIZE) && (AppUpdate_Flush() != APP_UPDATE_OK))
+    {
+      return APP_UPDATE_FLASH_ERR;
+    }
+  }
+  return APP_UPDATE_OK;
+}
+
+/**
+  * @brief  Record the update state in the status area
+  * @param  status: IAP_COPY_BACKUP, IAP_APP_DONE or IAP_NO_APP
+  * @param  size: image size
+  * @param  crc: ImageCrc of App1 (IAP_APP_DONE), 0 otherwise
+  * @retval None
+  */
+static void AppUpdate_SetStatus(eIAP_Status_Def status, uint32_t size, uint32_t crc)
+{
+  save_data_t rw_data;
+
+  if (EL_FIND_SUCCESS != read_iap_status(&rw_data))
+  {
+    rw_data.iap_msg.version = 1;
+    rw_data.iap_msg.transmitMethod = TRANSMIT_METHOD_USB;
+  }
+  rw_data.header = HEADER;
+  rw_data.iap_msg.status = status;
+  rw_data.iap_msg.size = size;
+  rw_data.ender = ENDER;
+  write_iap_image(size, crc);   /* committed before the status */
+  write_iap_status(&rw_data);
+  commit_iap_status();          /* before App1 is touched / at the end of the update */
+}
+
+/**
+  * @brief  Length of a manifest chunk, the last one can be short
+  * @param  chunk: chunk index
+  * @retval bytes
+  */
+static uint32_t AppUpdate_ChunkLength(uint32_t chunk)
+{
+  uint32_t offset = chunk * APP_MANIFEST_CHUNK_SIZE;
+
+  return ((AppManifest.image_size - offset) < APP_MANIFEST_CHUNK_SIZE) ?
+         (AppManifest.image_size - offset) : APP_MANIFEST_CHUNK_SIZE;
+}
+
+/**
+  * @brief  Expected CRC-32 of a chunk, from the manifest
+  * @param  chunk: chunk index
+  * @retval CRC-32
+  */
+static uint32_t AppUpdate_ChunkCrc(uint32_t chunk)
+{
+  return AppUpdate_GetU32(&AppManifest.a_data[APP_MANIFEST_HEADER_SIZE + 4u * chunk]);
+}
+
+/**
+  * @brief  Check the sparse stream header against the manifest
+  * @param  None
+  * @retval APP_UPDATE_OK, APP_UPDATE_FORMAT_ERR or APP_UPDATE_BASE_ERR
+  */
+static eAPP_Update_Status_Def AppUpdate_ParseSparseHeader(void)
+{
+  if (memcmp(AppDelta.a_arg, APP_SPARSE_MAGIC, 4) != 0)
+  {
+    return APP_UPDATE_FORMAT_ERR;
+  }
+  if ((AppUpdate_GetU32(&AppDelta.a_arg[4]) != AppManifest.image_size) ||
+      (AppUpdate_GetU32(&AppDelta.a_arg[8]) != AppManifest.crc))
+  {
+    return APP_UPDATE_BASE_ERR;
+  }
+  AppDelta.new_size = AppManifest.image_size;
+  return APP_UPDATE_OK;
+}
+
+/**
+  * @brief  Copy unchanged chunks from App1 up to the next chunk the host sends
+  * @note   Sets up DELTA_STATE_DATA for that chunk, DELTA_STATE_DONE after the last one.
+  * @param  None
+  * @retval APP_UPDATE_OK or APP_UPDATE_FLASH_ERR
+  */
+static eAPP_Update_Status_Def AppUpdate_SparseNext(void)
+{
+  eAPP_Update_Status_Def status = APP_UPDATE_OK;
+
+  while ((AppDelta.chunk < AppManifest.chunks) && !MANIFEST_CHUNK_NEEDED(AppDelta.chunk) &&
+         (status == APP_UPDATE_OK))
+  {
+    AppDelta.offset = AppDelta.chunk * APP_MANIFEST_CHUNK_SIZE;
+    AppDelta.remaining = AppUpdate_ChunkLength(AppDelta.chunk);
+    AppDelta.chunk++;
+    status = AppUpdate_Copy();
+  }
+  if (AppDelta.chunk < AppManifest.chunks)
+  {
+    AppDelta.remaining = AppUpdate_ChunkLength(AppDelta.chunk);
+    AppDelta.chunk++;
+    AppDelta.state = DELTA_STATE_DATA;
+  }
+  else
+  {
+    AppDelta.state = DELTA_STATE_DONE;
+  }
+  return status;
+}
+
+/* Public functions ----------------------------------------------------------*/
+/**
+  * @brief  Start a delta update: erase the Backup (staging) region
+  * @note   App1 is not touched until AppUpdate_Commit().
+  * @param  None
+  * @retval APP_UPDATE_OK or APP_UPDATE_FLASH_ERR
+  */
+eAPP_Update_Status_Def AppUpdate_DeltaBegin(void)
+{
+  AppUpdateBusy = 1;
+  memset(&AppDelta, 0, sizeof(AppDelta));
+  AppDelta.state = DELTA_STATE_HEADER;
+  AppDelta.arg_size = APP_DELTA_HEADER_SIZE;
+  AppDelta.crc = CRC32_INIT_VALUE;
+
+  if (FLASH_If_Erase_Backup_Space() != HAL_OK)
+  {
+    AppDelta.status = APP_UPDATE_FLASH_ERR;
+  }
+  return AppDelta.status;
+}
+
+/**
+  * @brief  Apply the next piece of the patch
+  * @note   The patch can be split anywhere (UDS block, Ymodem packet...).
+  *         After the first error every call returns that error.
+  * @param  p_data: patch bytes
+  * @param  length: number of bytes
+  * @retval APP_UPDATE_OK or the first error
+  */
+eAPP_Update_Status_Def AppUpdate_DeltaWrite(const uint8_t *p_data, uint32_t length)
+{
+  uint8_t *p_chunk = (uint8_t *)aDeltaChunk;
+  uint32_t n, i;
+
+  while ((length > 0) && (AppDelta.status == APP_UPDATE_OK))
+  {
+    switch (AppDelta.state)
+    {
+      case DELTA_STATE_HEADER:
+      case DELTA_STATE_ARGS:
+        AppDelta.a_arg[AppDelta.arg_index++] = *p_data++;
+        length--;
+        if (AppDelta.arg_index < AppDelta.arg_size)
+        {
+          break;
+        }
+        if (AppDelta.state == DELTA_STATE_HEADER)
+        {
+          AppDelta.status = AppUpdate_ParseHeader();
+          AppDelta.state = DELTA_STATE_OP;
+        }
+        else
+        {
+          AppDelta.status = AppUpdate_StartCommand();
+          if ((AppDelta.status == APP_UPDATE_OK) && (AppDelta.op == APP_DELTA_OP_COPY))
+          {
+            AppDelta.status = AppUpdate_Copy();
+          }
+          /* ADD / INSERT continue with their payload */
+          AppDelta.state = (AppDelta.remaining > 0) ? DELTA_STATE_DATA : DELTA_STATE_OP;
+        }
+        break;
+      case DELTA_STATE_OP:
+        AppDelta.op = *p_data++;
+        length--;
+        AppDelta.arg_index = 0;
+        AppDelta.state = DELTA_STATE_ARGS;
+        if ((AppDelta.op == APP_DELTA_OP_COPY) || (AppDelta.op == APP_DELTA_OP_ADD))
+        {
+          AppDelta.arg_size = 8;
+        }
+        else if (AppDelta.op == APP_DELTA_OP_INSERT)
+        {
+          AppDelta.arg_size = 4;
+        }
+        else if (AppDelta.op == APP_DELTA_OP_END)
+        {
+          AppDelta.state = DELTA_STATE_DONE;
+        }
+        else
+        {
+          AppDelta.status = APP_UPDATE_FORMAT_ERR;
+        }
+        break;
+      case DELTA_STATE_DATA:
+        n = APP_UPDATE_CHUNK_SIZE - AppDelta.fill;
+        if (n > AppDelta.remaining)
+        {
+          n = AppDelta.remaining;
+        }
+        if (n > length)
+        {
+          n = length;
+        }
+        if (AppDelta.op == APP_DELTA_OP_ADD)
+        {
+          for (i = 0; i < n; i++)
+          {
+            p_chunk[AppDelta.fill + i] = (uint8_t)(OLD_IMAGE[AppDelta.offset + i] + p_data[i]);
+          }
+          AppDelta.offset += n;
+        }
+        else
+        {
+          memcpy(&p_chunk[AppDelta.fill], p_data, n);
+        }
+        p_data += n;
+        length -= n;
+        AppDelta.fill += n;
+        AppDelta.produced += n;
+        AppDelta.remaining -= n;
+        if (AppDelta.fill == APP_UPDATE_CHUNK_SIZE)
+        {
+          AppDelta.status = AppUpdate_Flush();
+        }
+        if (AppDelta.remaining == 0)
+        {
+          AppDelta.state = DELTA_STATE_OP;
+        }
+        break;
+      default:
+        /* DELTA_STATE_DONE: padding after END */
+        length = 0;
+        break;
+    }
+  }
+  return AppDelta.status;
+}
+
+/**
+  * @brief  Finish the patch and verify the image staged in Backup
+  * @param  p_size: new image size
+  * @retval APP_UPDATE_OK when Backup holds the complete, verified new image
+  */
+eAPP_Update_Status_Def AppUpdate_DeltaEnd(uint32_t *p_size)
+{
+  if (AppDelta.status != APP_UPDATE_OK)
+  {
+    return AppDelta.status;
+  }
+  if (AppDelta.state != DELTA_STATE_DONE)
+  {
+    AppDelta.status = APP_UPDATE_FORMAT_ERR;
+  }
+  else if (AppDelta.produced != AppDelta.new_size)
+  {
+    AppDelta.status = APP_UPDATE_SIZE_ERR;
+  }
+  else if (AppUpdate_Flush() != APP_UPDATE_OK)
+  {
+    AppDelta.status = APP_UPDATE_FLASH_ERR;
+  }
+  /* CRC of what was produced, then of what actually is in flash */
+  else if (((AppDelta.crc ^ CRC32_INIT_VALUE) != AppDelta.new_crc) ||
+           (Crc32_Calc((const uint8_t *)BACKUP_ADDRESS, AppDelta.new_size) != AppDelta.new_crc))
+  {
+    AppDelta.status = APP_UPDATE_VERIFY_ERR;
+  }
+  else
+  {
+    *p_size = AppDelta.new_size;
+  }
+  return AppDelta.status;
+}
+
+/**
+  * @brief  Start receiving a manifest
+  * @param  None
+  * @retval APP_UPDATE_OK
+  */
+eAPP_Update_Status_Def AppUpdate_ManifestBegin(void)
+{
+  memset(&AppManifest, 0, sizeof(AppManifest));
+  return APP_UPDATE_OK;
+}
+
+/**
+  * @brief  Collect the next piece of the manifest
+  * @note   Bytes after the declared chunk list (Ymodem padding) are ignored.
+  * @param  p_data: manifest bytes
+  * @param  length: number of bytes
+  * @retval APP_UPDATE_OK or the first error
+  */
+eAPP_Update_Status_Def AppUpdate_ManifestWrite(const uint8_t *p_data, uint32_t length)
+{
+  uint32_t n, expected = APP_MANIFEST_HEADER_SIZE;
+
+  while ((length > 0) && (AppManifest.status == APP_UPDATE_OK))
+  {
+    if (AppManifest.length >= APP_MANIFEST_HEADER_SIZE)
+    {
+      expected = APP_MANIFEST_HEADER_SIZE + 4u * AppManifest.chunks;
+      if (AppManifest.length >= expected)
+      {
+        break;
+      }
+    }
+    n = expected - AppManifest.length;
+    if (n > length)
+    {
+      n = length;
+    }
+    memcpy(&AppManifest.a_data[AppManifest.length], p_data, n);
+    AppManifest.length += n;
+    p_data += n;
+    length -= n;
+
+    if (AppManifest.length == APP_MANIFEST_HEADER_SIZE)
+    {
+      AppManifest.image_size = AppUpdate_GetU32(&AppManifest.a_data[4]);
+      AppManifest.chunks = (AppManifest.image_size + APP_MANIFEST_CHUNK_SIZE - 1u) / APP_MANIFEST_CHUNK_SIZE;
+      if (memcmp(AppManifest.a_data, APP_MANIFEST_MAGIC, 4) != 0)
+      {
+        AppManifest.status = APP_UPDATE_FORMAT_ERR;
+      }
+      else if ((AppManifest.image_size == 0) || (AppManifest.image_size > USER_FLASH_SIZE) ||
+               (AppManifest.image_size > BACKUP_FLASH_SIZE))
+      {
+        AppManifest.status = APP_UPDATE_SIZE_ERR;
+      }
+    }
+  }
+  return AppManifest.status;
+}
+
+/**
+  * @brief  Compare the manifest with App1
+  * @param  p_bitmap: returns (chunks + 7) / 8 bytes, bit set = chunk must be sent
+  * @param  p_chunks: number of chunks in the image
+  * @param  p_needed: number of chunks that must be sent
+  * @retval APP_UPDATE_OK or the first error
+  */
+eAPP_Update_Status_Def AppUpdate_ManifestEnd(uint8_t *p_bitmap, uint32_t *p_chunks, uint32_t *p_needed)
+{
+  uint32_t chunk, needed = 0;
+
+  if ((AppManifest.status == APP_UPDATE_OK) &&
+      ((AppManifest.length < APP_MANIFEST_HEADER_SIZE) ||
+       (AppManifest.length != APP_MANIFEST_HEADER_SIZE + 4u * AppManifest.chunks)))
+  {
+    AppManifest.status = APP_UPDATE_FORMAT_ERR;
+  }
+  if (AppManifest.status != APP_UPDATE_OK)
+  {
+    return AppManifest.status;
+  }
+
+  for (chunk = 0; chunk < AppManifest.chunks; chunk++)
+  {
+    if (Crc32_Calc(OLD_IMAGE + chunk * APP_MANIFEST_CHUNK_SIZE, AppUpdate_ChunkLength(chunk)) !=
+        AppUpdate_ChunkCrc(chunk))
+    {
+      AppManifest.a_bitmap[chunk / 8u] |= (uint8_t)(1u << (chunk % 8u));
+      needed++;
+    }
+  }
+  AppManifest.crc = Crc32_Calc(AppManifest.a_data, AppManifest.length);
+  AppManifest.valid = 1;
+
+  memcpy(p_bitmap, AppManifest.a_bitmap, (AppManifest.chunks + 7u) / 8u);
+  *p_chunks = AppManifest.chunks;
+  *p_needed = needed;
+  return APP_UPDATE_OK;
+}
+
+/**
+  * @brief  Start receiving the chunks requested by AppUpdate_ManifestEnd()
+  * @note   Erases Backup, App1 is not touched until AppUpdate_Commit().
+  * @param  None
+  * @retval APP_UPDATE_OK, APP_UPDATE_FORMAT_ERR (no manifest) or APP_UPDATE_FLASH_ERR
+  */
+eAPP_Update_Status_Def AppUpdate_SparseBegin(void)
+{
+  AppUpdateBusy = 1;
+  memset(&AppDelta, 0, sizeof(AppDelta));
+  AppDelta.state = DELTA_STATE_HEADER;
+  AppDelta.arg_size = APP_SPARSE_HEADER_SIZE;
+  AppDelta.crc = CRC32_INIT_VALUE;
+
+  if (AppManifest.valid == 0)
+  {
+    AppDelta.status = APP_UPDATE_FORMAT_ERR;
+  }
+  else if (FLASH_If_Erase_Backup_Space() != HAL_OK)
+  {
+    AppDelta.status = APP_UPDATE_FLASH_ERR;
+  }
+  return AppDelta.status;
+}
+
+/**
+  * @brief  Stage the next piece of the sparse stream
+  * @note   Can be split anywhere, like AppUpdate_DeltaWrite().
+  * @param  p_data: stream bytes
+  * @param  length: number of bytes
+  * @retval APP_UPDATE_OK or the first error
+  */
+eAPP_Update_Status_Def AppUpdate_SparseWrite(const uint8_t *p_data, uint32_t length)
+{
+  uint32_t n;
+
+  while ((length > 0) && (AppDelta.status == APP_UPDATE_OK))
+  {
+    switch (AppDelta.state)
+    {
+      case DELTA_STATE_HEADER:
+        AppDelta.a_arg[AppDelta.arg_index++] = *p_data++;
+        length--;
+        if (AppDelta.arg_index == AppDelta.arg_size)
+        {
+          AppDelta.status = AppUpdate_ParseSparseHeader();
+          if (AppDelta.status == APP_UPDATE_OK)
+          {
+            AppDelta.status = AppUpdate_SparseNext();
+          }
+        }
+        break;
+      case DELTA_STATE_DATA:
+        n = APP_UPDATE_CHUNK_SIZE - AppDelta.fill;
+        if (n > AppDelta.remaining)
+        {
+          n = AppDelta.remaining;
+        }
+        if (n > length)
+        {
+          n = length;
+        }
+        memcpy((uint8_t *)aDeltaChunk + AppDelta.fill, p_data, n);
+        p_data += n;
+        length -= n;
+        AppDelta.fill += n;
+        AppDelta.produced += n;
+        AppDelta.remaining -= n;
+        if (AppDelta.fill == APP_UPDATE_CHUNK_SIZE)
+        {
+          AppDelta.status = AppUpdate_Flush();
+        }
+        if ((AppDelta.remaining == 0) && (AppDelta.status == APP_UPDATE_OK))
+        {
+          AppDelta.status = AppUpdate_SparseNext();
+        }
+        break;
+      default:
+        /* DELTA_STATE_DONE: padding after the last chunk */
+        length = 0;
+        break;
+    }
+  }
+  return AppDelta.status;
+}
+
+/**
+  * @brief  Finish the sparse stream and verify every chunk staged in Backup
+  * @param  p_size: new image size
+  * @retval APP_UPDATE_OK when Backup holds the complete, verified new image
+  */
+eAPP_Update_Status_Def AppUpdate_SparseEnd(uint32_t *p_size)
+{
+  uint32_t chunk;
+
+  if (AppDelta.status != APP_UPDATE_OK)
+  {
+    return AppDelta.status;
+  }
+  if (AppDelta.state != DELTA_STATE_DONE)
+  {
+    AppDelta.status = APP_UPDATE_FORMAT_ERR;
+  }
+  else if (AppUpdate_Flush() != APP_UPDATE_OK)
+  {
+    AppDelta.status = APP_UPDATE_FLASH_ERR;
+  }
+  for (chunk = 0; (chunk < AppManifest.chunks) && (AppDelta.status == APP_UPDATE_OK); chunk++)
+  {
+    if (Crc32_Calc((const uint8_t *)BACKUP_ADDRESS + chunk * APP_MANIFEST_CHUNK_SIZE, AppUpdate_ChunkLength(chunk)) !=
+        AppUpdate_ChunkCrc(chunk))
+    {
+      AppDelta.status = APP_UPDATE_VERIFY_ERR;
+    }
+  }
+  if (AppDelta.status == APP_UPDATE_OK)
+  {
+    *p_size = AppManifest.image_size;
+  }
+  return AppDelta.status;
+}
+
+/**
+  * @brief  Copy the verified image from Backup to App1
+  * @note   Only sectors whose image bytes differ from Backup are erased and
+  *         rewritten (FLASH_If_Update). The status area holds IAP_COPY_BACKUP while App1 is
+  *         being rewritten, IAP_Init() calls this again after a reset (sectors
+  *         already copied then compare equal). The Backup copy stays valid
+  *         until the next delta / sparse update.
+  * @param  size: image size (AppUpdate_DeltaEnd or iap_msg.size)
+  * @retval APP_UPDATE_OK (status IAP_APP_DONE) or an error (status IAP_NO_APP)
+  */
+eAPP_Update_Status_Def AppUpdate_Commit(uint32_t size)
+{
+  eAPP_Update_Status_Def status = APP_UPDATE_OK;
+  uint32_t crc = 0;
+
+  /* the copy never reads past the Backup image (status bank B or stage behind it) */
+  if ((size == 0) || (size > USER_FLASH_SIZE) || (size > BACKUP_FLASH_SIZE))
+  {
+    AppUpdateBusy = 0;
+    return APP_UPDATE_SIZE_ERR;
+  }
+  AppUpdate_SetStatus(IAP_COPY_BACKUP, size, 0);
+
+  /* unchanged sectors are skipped, the tail word is padded with 0xFF in Backup */
+  if (FLASH_If_Update(APPLICATION_ADDRESS, (const uint32_t *)BACKUP_ADDRESS, (size + 3) / 4) != FLASHIF_OK)
+  {
+    status = APP_UPDATE_FLASH_ERR;
+  }
+  /* both copies by DMA + CRC unit, the App1 CRC is kept for the boot check */
+  if (status == APP_UPDATE_OK)
+  {
+    crc = ImageCrc_Calc(APPLICATION_ADDRESS, size);
+    if (crc != ImageCrc_Calc(BACKUP_ADDRESS, size))
+    {
+      status = APP_UPDATE_VERIFY_ERR;
+    }
+  }
+
+  AppUpdate_SetStatus((status == APP_UPDATE_OK) ? IAP_APP_DONE : IAP_NO_APP, size,
+                      (status == APP_UPDATE_OK) ? crc : 0);
+  AppUpdateBusy = 0;
+  return status;
+}
+
+/**
+  * @brief  Whether Backup holds an image that is still needed
+  * @note   Set by AppUpdate_DeltaBegin / AppUpdate_SparseBegin, cleared when
+  *         AppUpdate_Commit ends. The idle loop does not erase the status stage
+  *         (the end of the Backup sectors, kv_store.c) meanwhile.
+  * @retval 1 busy, 0 otherwise
+  */
+uint8_t AppUpdate_Busy(void)
+{
+  return AppUpdateBusy;
+}
+
+/************************ (C) COPYRIGHT Jason *****END OF FILE****/
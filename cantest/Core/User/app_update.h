@@ -0,0 +1,97 @@
+/******************************************************************************
+ * @file    app_update.h
+ * @brief   Delta (patch) and sector-diff update of App1 against the installed image.
+ * @author  Jason
+ * @version V1.0.0
+ * @date    2025-3
+ * @copyright (c) 2025, All rights reserved.
+ ******************************************************************************/
+
+#ifndef __APP_UPDATE_H
+#define __APP_UPDATE_H
+
+/* Private Includes ----------------------------------------------------------*/
+#include <stdint.h>
+
+/**
+ * 差分升级流程：
+ *  1. AppUpdate_DeltaBegin()  擦除 Backup 区 (sector 6-7，状态区有两个扇区时只有 sector 6)
+ *  2. AppUpdate_DeltaWrite()  按任意分段喂入补丁，新镜像 = 补丁作用于 App1 中的旧镜像，
+ *                             结果写到 Backup 区，App1 在此期间保持不变
+ *  3. AppUpdate_DeltaEnd()    检查长度和 CRC-32，确认 Backup 中的新镜像完整
+ *  4. AppUpdate_Commit()      状态记为 IAP_COPY_BACKUP，只擦除与 Backup 内容不同的 App1 扇区并
+ *                             从 Backup 拷贝、校验，最后记为 IAP_APP_DONE；中途掉电后 IAP_Init 会重新拷贝
+ * 传输量只和改动的大小有关，补丁由 Tools/delta_make 生成。
+ *
+ * 补丁格式 (所有整数为小端 uint32)：
+ *   头 (20 字节)：'D' 'L' 'T' '1', old_size, old_crc32, new_size, new_crc32
+ *   命令 (1 字节操作码 + 参数)：
+ *     'C' offset length          : 从旧镜像 offset 处复制 length 字节
+ *     'A' offset length data[]   : 新字节 = 旧镜像[offset + i] + data[i] (bsdiff 风格，代码移位时
+ *                                  大部分 data 为 0，便于再压缩)
+ *     'I' length data[]          : 插入 length 个新字节
+ *     'E'                        : 结束，之后的字节 (例如 Ymodem 的 0x1A 填充) 被忽略
+ * CRC-32 与 crc.h 中 Crc32_Calc 相同。
+ *
+ * 分块差异升级 (不需要主机保存旧镜像)：
+ *  1. 主机发送清单 (manifest)：新镜像每 4 KB 一块的 CRC-32
+ *       'M' 'F' 'S' '1', image_size, crc32[块数]      块数 = (image_size + 4095) / 4096
+ *     AppUpdate_ManifestBegin/Write/End() 与 App1 中的内容逐块比较，返回位图
+ *     (bit i = 第 i 块需要发送，字节 i/8 的 bit i%8)
+ *  2. 主机只发送位图中置位的块，按块号升序依次拼接：
+ *       'S' 'D' 'F' '1', image_size, manifest_crc32, 块数据...
+ *     manifest_crc32 是整个清单的 CRC-32，保证两步对应同一个镜像。
+ *     AppUpdate_SparseBegin/Write/End() 在 Backup 中拼出新镜像 (未变的块从 App1 复制)，
+ *     并逐块按清单校验
+ *  3. AppUpdate_Commit() 只擦写内容有变化的 App1 扇区
+ * 最后一块可以不满 4 KB，块数据中它只占实际长度。工具：Tools/sparse_make。
+ */
+/* Exported constants --------------------------------------------------------*/
+#define APP_DELTA_MAGIC             "DLT1"
+#define APP_DELTA_HEADER_SIZE       (20u)
+#define APP_DELTA_OP_COPY           ((uint8_t)'C')
+#define APP_DELTA_OP_ADD            ((uint8_t)'A')
+#define APP_DELTA_OP_INSERT         ((uint8_t)'I')
+#define APP_DELTA_OP_END            ((uint8_t)'E')
+#define APP_UPDATE_CHUNK_SIZE       (1024u)          /* staging write unit */
+
+#define APP_MANIFEST_MAGIC          "MFS1"
+#define APP_MANIFEST_HEADER_SIZE    (8u)
+#define APP_MANIFEST_CHUNK_SIZE     (4096u)          /* hashed unit */
+#define APP_MANIFEST_MAX_CHUNKS     (48u)            /* App1 192 KB */
+#define APP_MANIFEST_MAX_SIZE       (APP_MANIFEST_HEADER_SIZE + 4u * APP_MANIFEST_MAX_CHUNKS)
+#define APP_MANIFEST_BITMAP_SIZE    ((APP_MANIFEST_MAX_CHUNKS + 7u) / 8u)
+#define APP_SPARSE_MAGIC            "SDF1"
+#define APP_SPARSE_HEADER_SIZE      (12u)
+
+/* Exported types ------------------------------------------------------------*/
+typedef enum
+{
+  APP_UPDATE_OK,            /* success / more data expected */
+  APP_UPDATE_FORMAT_ERR,    /* not a patch, bad opcode, patch truncated */
+  APP_UPDATE_BASE_ERR,      /* patch made for another installed image / chunks for another manifest */
+  APP_UPDATE_SIZE_ERR,      /* new image does not fit / size mismatch */
+  APP_UPDATE_FLASH_ERR,     /* erase or program failed */
+  APP_UPDATE_VERIFY_ERR     /* CRC of the staged or copied image is wrong */
+} eAPP_Update_Status_Def;
+
+/* Exported macro ------------------------------------------------------------*/
+
+/* Exported variables --------------------------------------------------------*/
+
+/* Exported function prototypes ----------------------------------------------*/
+eAPP_Update_Status_Def AppUpdate_DeltaBegin(void);
+eAPP_Update_Status_Def AppUpdate_DeltaWrite(const uint8_t *p_data, uint32_t length);
+eAPP_Update_Status_Def AppUpdate_DeltaEnd(uint32_t *p_size);
+eAPP_Update_Status_Def AppUpdate_ManifestBegin(void);
+eAPP_Update_Status_Def AppUpdate_ManifestWrite(const uint8_t *p_data, uint32_t length);
+eAPP_Update_Status_Def AppUpdate_ManifestEnd(uint8_t *p_bitmap, uint32_t *p_chunks, uint32_t *p_needed);
+eAPP_Update_Status_Def AppUpdate_SparseBegin(void);
+eAPP_Update_Status_Def AppUpdate_SparseWrite(const uint8_t *p_data, uint32_t length);
+eAPP_Update_Status_Def AppUpdate_SparseEnd(uint32_t *p_size);
+eAPP_Update_Status_Def AppUpdate_Commit(uint32_t size);
+uint8_t AppUpdate_Busy(void);
+
+#endif /* __APP_UPDATE_H */
+
+/************************ (C) COPYRIGHT Jason *****END OF FILE****/
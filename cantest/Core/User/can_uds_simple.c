@@ -10,6 +10,9 @@
 /* Includes ------------------------------------------------------------------*/ 
 #include "can_uds_simple.h" 
 #include "flash_if.h"
+#include "app_update.h"
+#include "iap_stage.h"
+#include "ram_exec.h"
 
 #include <stdint.h>
 #include <string.h>
@@ -18,22 +21,55 @@
 /* Private typedef -----------------------------------------------------------*/ 
 
 /* Private define ------------------------------------------------------------*/ 
+// 请求在暂存区 (IAP_StageCan) 中前空 2 字节: 0x36 的数据 (服务 ID 和块序号之后) 按字对齐, 可以直接写 FLASH
+#define UDS_STAGE_PAD 			2
+// 块标记: 0x36 在中断里已经回过正响应 (UDS_EARLY_ACK)
+#define UDS_STAGE_TAG_ACKED 	1
+// 暂存区放不下首帧声明的长度时回 FC WAIT, 之后每 500 ms 重发一次 (测试端 N_Bs 超时 1 s)
+#define UDS_FC_WAIT_MS 			500
+// 发多帧响应时等测试端流控帧的超时 (N_Bs), 收到 FC WAIT 重新计时
+#define UDS_N_BS_MS 			1000
+// 1: 原始镜像的 0x36 放进暂存区就回正响应, 写 FLASH 在线程中进行, 写入失败在 0x37 时报告.
+// 只有中断在 SRAM 中运行 (IAP_RAM_EXEC) 时擦写期间才收得到后面的块, 否则提前应答没有意义
+#define UDS_EARLY_ACK 			IAP_RAM_EXEC
 
 /* Private macro -------------------------------------------------------------*/ 
 
 /* Private variables ---------------------------------------------------------*/ 
-// 全局缓冲区
-static uint8_t uds_data_buffer[UDS_MAX_PAYLOAD_SIZE];
+// ISO-TP 重组 (CAN 接收中断): 请求直接放进 IAP_StageCan, 完整后发布, can_uds_poll() 在线程中处理
+static uint8_t *p_uds_request = NULL; // 正在重组的请求 (IAP_Stage_Reserve 预留的空间), NULL: 没有
 static uint16_t uds_data_length = 0; // 当前接收数据长度
 static uint16_t expected_data_length = 0; // 总数据长度
-static uint8_t last_seq_number = 0xFF; // 上一个连续帧序号（用于连续性判断）
+static uint8_t last_seq_number = 0; // 上一个连续帧序号（用于连续性判断）
+static uint8_t uds_first_frame[6]; // 暂存区放不下时保存首帧数据, 有空间后再回 CTS
+static volatile uint8_t uds_fc_waiting = 0; // 已回 FC WAIT, 等 can_uds_poll() 腾出空间
+static uint32_t uds_fc_tick = 0; // 上一次发 FC WAIT 的时间
+// ISO-TP 发送 (线程): 首帧和每块连续帧之后等测试端的流控帧, CAN 接收中断填写
+static volatile uint8_t uds_tx_waiting = 0; // 1: 在等流控帧
+static volatile uint8_t uds_tx_fc = 0; // 收到的流控帧 (FLOW_STATUS_xxx), 0: 还没收到
+static volatile uint8_t uds_tx_bs = 0; // 流控帧的 Block Size, 0: 不限
+static volatile uint8_t uds_tx_stmin = 0; // 流控帧的 STmin
+// 服务处理 (线程)
+static uint8_t uds_service_id = 0; // 正在处理的服务 ID (否定响应用)
+static uint8_t uds_early_ack = 0; // 正在处理的 0x36 已经回过正响应
+static volatile uint8_t uds_write_error = 0; // 提前应答的 0x36 写入失败, 0x34 清除, 0x37 报告
 static programmingSessionStatus_t currentSessionStatus = noSession;
 static can_uds_t can_uds = {0};
+static uint8_t staged_format = UDS_DFI_RAW_IMAGE; // 当前下载是差分补丁或分块数据 (在 Backup 区生成新镜像)
+static uint8_t staged_block_seq = 0; // 补丁/分块数据期望的下一个块序号
+static uint32_t uds_image_size = USER_FLASH_SIZE; // 31 01 FF 00 登记的镜像大小, 31 01 FF 01 按它计算镜像 CRC
 
 /* Private function prototypes -----------------------------------------------*/ 
 void send_flow_control_frame(FlowControlType type, uint8_t block_size, uint8_t separation_time);
 void send_uds_error_response(UDS_ErrorCode error_code);
+void send_uds_negative_response(uint8_t service_id, UDS_ErrorCode error_code);
 void send_iso15765_message(uint32_t id, uint8_t *data, uint16_t length);
+static void uds_stage_commit(uint8_t *p_request, uint16_t length);
+static void uds_stage_resume(void);
+static void uds_transfer_error(UDS_ErrorCode error_code);
+static void uds_send_frame(uint32_t canid, uint8_t *frame, uint8_t dlc);
+static uint8_t uds_wait_flow_control(void);
+static uint32_t uds_stmin_ticks(uint8_t stmin);
 
 // 服务处理函数声明
 void uds_handle_session_control(uint8_t *data, uint16_t length);     // 0x10 会话控制
@@ -46,7 +82,9 @@ void send_uds_error_response(UDS_ErrorCode error_code);              // 错误
 void process_uds_service(uint8_t *data, uint16_t length);            // 服务分发函数
 
 /* Private functions ---------------------------------------------------------*/ 
-// ISO15765 主处理函数
+// ISO15765 主处理函数 (CAN 接收中断)
+// 只做 ISO-TP 重组: 完整的请求作为一个块放进 IAP_StageCan, 由 can_uds_poll() 在线程中处理,
+// 写 FLASH 停顿期间照样接收; 暂存区满时单帧回 7F xx 21, 多帧回 FC WAIT
 void can_uds_handle(uint32_t canid, uint8_t *data, uint8_t dlc) {
     // 检查传入的 CAN ID 是否有效
     if (canid != CANID_UPGRADE_TARGET) {
@@ -58,18 +96,46 @@ void can_uds_handle(uint32_t canid, uint8_t *data, uint8_t dlc) {
     switch (data[0] & 0xF0) {
         case 0x00: { // 单帧 Single Frame
             uint8_t sf_length = data[0] & 0x0F; // 提取数据长度
-            memcpy(uds_data_buffer, &data[1], sf_length); // 复制数据到缓冲区
-            uds_data_length = sf_length;
+            uint8_t *p_request;
 
-            // 调用服务处理函数
-            process_uds_service(uds_data_buffer, uds_data_length);
+            p_uds_request = NULL; // 新请求中止正在重组的多帧请求
+            uds_fc_waiting = 0;
+            if (sf_length == 0 || sf_length > dlc - 1) {
+                break;
+            }
+            p_request = IAP_Stage_Reserve(&IAP_StageCan, sf_length + UDS_STAGE_PAD);
+            if (p_request == NULL) {
+                send_uds_negative_response(data[1], UDS_ERROR_BUSY_REPEAT_REQUEST);
+                break;
+            }
+            memcpy(p_request + UDS_STAGE_PAD, &data[1], sf_length); // 复制数据到暂存区
+            uds_stage_commit(p_request, sf_length);
             break;
         }
         case 0x10: { // 首帧 First Frame
+            p_uds_request = NULL;
+            uds_fc_waiting = 0;
             expected_data_length = ((data[0] & 0x0F) << 8) | data[1]; // 提取总数据长度
-            uds_data_length = 0; // 重置当前长度
-            memcpy(uds_data_buffer, &data[2], dlc - 2); // 复制首帧数据
-            uds_data_length += dlc - 2;
+            if (expected_data_length > UDS_MAX_PAYLOAD_SIZE) {
+                send_flow_control_frame(FLOW_STATUS_ABORT, 0, 0); // 超过最大请求长度
+                break;
+            }
+            if (dlc < 8 || expected_data_length <= 6) {
+                break;
+            }
+            memcpy(uds_first_frame, &data[2], 6); // 保存首帧数据
+            uds_data_length = 6;
+            last_seq_number = 0;
+
+            p_uds_request = IAP_Stage_Reserve(&IAP_StageCan, expected_data_length + UDS_STAGE_PAD);
+            if (p_uds_request == NULL) {
+                // 暂存区满 (线程在擦写 FLASH): 让测试端等待, can_uds_poll() 腾出空间后回 CTS
+                uds_fc_waiting = 1;
+                uds_fc_tick = HAL_GetTick();
+                send_flow_control_frame(FLOW_STATUS_WAIT, 0, 0);
+                break;
+            }
+            memcpy(p_uds_request + UDS_STAGE_PAD, uds_first_frame, 6);
 
             // 发送流控帧 (CTS)
             send_flow_control_frame(FLOW_STATUS_CONTINUE, 00, 0x20); // Block Size = 00(无限制), Separation Time = 5ms
@@ -77,19 +143,41 @@ void can_uds_handle(uint32_t canid, uint8_t *data, uint8_t dlc) {
         }
         case 0x20: { // 连续帧 Consecutive Frame
             uint8_t seq_number = data[0] & 0x0F; // 提取连续帧序号
+            uint16_t cf_length = dlc - 1;
+
+            if (p_uds_request == NULL) { // 没有在接收的多帧请求 (或者还在等待暂存区)
+                break;
+            }
 
             // 判断连续性
-            if ((last_seq_number != 0xFF) && ((seq_number != ((last_seq_number + 1) & 0x0F)))) {
+            if (seq_number != ((last_seq_number + 1) & 0x0F)) {
                 printf("Frame sequence error: Expected 0x%X but got 0x%X\n", (last_seq_number + 1) & 0x0F, seq_number);
-                send_uds_error_response(UDS_ERROR_TRANSFER_DATA_ERROR); // 发送无效序列错误
-                uds_data_length = 0;
-                expected_data_length = 0;
+                send_uds_negative_response(p_uds_request[UDS_STAGE_PAD], UDS_ERROR_TRANSFER_DATA_ERROR); // 发送无效序列错误
+                p_uds_request = NULL;
                 return;
             }
 
             last_seq_number = seq_number; // 更新序号
-            memcpy(uds_data_buffer + uds_data_length, &data[1], dlc - 1); // 累加数据
-            uds_data_length += dlc - 1;
+            if (cf_length > expected_data_length - uds_data_length) {
+                cf_length = expected_data_length - uds_data_length; // 最后一帧的填充字节
+            }
+            memcpy(p_uds_request + UDS_STAGE_PAD + uds_data_length, &data[1], cf_length); // 累加数据
+            uds_data_length += cf_length;
+
+            // 检查数据是否接收完整
+            if (uds_data_length >= expected_data_length) {
+                uds_stage_commit(p_uds_request, expected_data_length);
+                p_uds_request = NULL;
+            }
+            break;
+        }
+        case 0x30: { // 流控帧 Flow Control (我们发多帧响应时测试端回的)
+            if (uds_tx_waiting == 0 || dlc < 3) {
+                break;
+            }
+            uds_tx_bs = data[1];
+            uds_tx_stmin = data[2];
+            uds_tx_fc = data[0]; // 最后写, 线程看到状态时 BS/STmin 已经有效
             break;
         }
         default: {
@@ -97,19 +185,75 @@ void can_uds_handle(uint32_t canid, uint8_t *data, uint8_t dlc) {
             break;
         }
     }
+}
+
+// 发布重组好的请求 (CAN 接收中断)
+static void uds_stage_commit(uint8_t *p_request, uint16_t length)
+{
+    uint16_t tag = 0;
+#if UDS_EARLY_ACK
+    uint8_t *data = p_request + UDS_STAGE_PAD;
+
+    // 原始镜像的块由线程按地址写入, 写入失败记在 uds_write_error, 0x37 时报告
+    if (data[0] == UDS_SERVICE_TRANSFER_DATA && length >= 2 && currentSessionStatus == downloadRequested &&
+        staged_format == UDS_DFI_RAW_IMAGE && uds_write_error == 0) {
+        uint8_t response[2] = {0x76, data[1]}; // 正响应
+        send_iso15765_message(CANID_UPGRADE_SENDER, response, sizeof(response));
+        tag = UDS_STAGE_TAG_ACKED;
+    }
+#endif
+    IAP_Stage_Commit(&IAP_StageCan, length + UDS_STAGE_PAD, tag);
+}
+
+// 暂存区腾出空间后继续回了 FC WAIT 的多帧请求 (线程)
+static void uds_stage_resume(void)
+{
+    uint8_t *p_request;
+
+    if (uds_fc_waiting == 0) {
+        return;
+    }
+    __disable_irq(); // 与 CAN 接收中断互斥 (新的首帧/单帧会取消等待)
+    if (uds_fc_waiting != 0) {
+        p_request = IAP_Stage_Reserve(&IAP_StageCan, expected_data_length + UDS_STAGE_PAD);
+        if (p_request != NULL) {
+            memcpy(p_request + UDS_STAGE_PAD, uds_first_frame, 6);
+            p_uds_request = p_request;
+            uds_fc_waiting = 0;
+            send_flow_control_frame(FLOW_STATUS_CONTINUE, 00, 0x20);
+        } else if (HAL_GetTick() - uds_fc_tick >= UDS_FC_WAIT_MS) {
+            uds_fc_tick = HAL_GetTick();
+            send_flow_control_frame(FLOW_STATUS_WAIT, 0, 0);
+        }
+    }
+    __enable_irq();
+}
 
-    // 检查数据是否接收完整
-    if (uds_data_length >= expected_data_length && expected_data_length > 0) {
-        process_uds_service(uds_data_buffer, uds_data_length);
-        // 清理缓冲区
-        uds_data_length = 0;
-        expected_data_length = 0;
-        last_seq_number = 0xFF; // 重置序号
+// 处理暂存区中的请求 (线程, 在 IAP 主循环和等待数据时调用)
+void can_uds_poll(void)
+{
+    uint8_t *p_request;
+    uint16_t length, tag;
+
+    while ((p_request = IAP_Stage_Peek(&IAP_StageCan, &length, &tag)) != NULL) {
+        uds_early_ack = (tag == UDS_STAGE_TAG_ACKED);
+        process_uds_service(p_request + UDS_STAGE_PAD, length - UDS_STAGE_PAD);
+        uds_early_ack = 0;
+        IAP_Stage_Release(&IAP_StageCan);
+        uds_stage_resume();
     }
+    uds_stage_resume();
+}
+
+// 是否在 CAN 下载中 (0x34 到 0x37 之间), 空闲时的擦除 (KV_Idle) 在此期间不做
+uint8_t can_uds_downloading(void)
+{
+    return (currentSessionStatus == downloadRequested) ? 1 : 0;
 }
 
 void process_uds_service(uint8_t *data, uint16_t length) 
 {
+    uds_service_id = 0;
     if (length < 1) {
         DEBUG_PRINT("Error: Data length is insufficient\n");
         send_uds_error_response(UDS_ERROR_REQUEST_OUT_OF_RANGE);
@@ -117,6 +261,7 @@ void process_uds_service(uint8_t *data, uint16_t length)
     }
 
     UDS_ServiceID service_id = (UDS_ServiceID)data[0];
+    uds_service_id = data[0];
 
     // 处理服务ID
     switch (service_id) {
@@ -183,18 +328,16 @@ void send_flow_control_frame(FlowControlType type, uint8_t block_size, uint8_t s
     DEBUG_PRINT("Sending Flow Control Frame: Type=0x%X, Block Size=%u, Separation Time=%u\n",
            type, block_size, separation_time);
 
-	send_iso15765_message(CANID_UPGRADE_SENDER, flow_control_frame, 8);
+	uds_send_frame(CANID_UPGRADE_SENDER, flow_control_frame, 8); // 流控帧本身就是一帧, 不再加单帧/首帧的 PCI
 }
 
-// 错误响应函数
+// 错误响应函数 (正在处理的服务)
 void send_uds_error_response(UDS_ErrorCode error_code) {
-	// uint8_t error_response[3] = {0};
-
-    // error_response[0] = 0x7F; // 通用否定响应
-    // error_response[1] = uds_data_buffer[0]; // 原服务 ID
-    // error_response[2] = error_code; // 错误码
+	send_uds_negative_response(uds_service_id, error_code);
+}
 
-	uint8_t error_response[3] = {0x7F, uds_data_buffer[0], error_code}; // 通用否定响应
+void send_uds_negative_response(uint8_t service_id, UDS_ErrorCode error_code) {
+	uint8_t error_response[3] = {0x7F, service_id, error_code}; // 通用否定响应
 
     DEBUG_PRINT("Sending UDS Error Response: Service ID=0x%X, Error Code=0x%X\n",
                 error_response[1], error_code);
@@ -246,6 +389,12 @@ void uds_handle_ecu_reset(uint8_t *data, uint16_t length)
 void uds_handle_routine_control(uint8_t *data, uint16_t length) 
 {
     save_data_t  rw_data;
+    uint8_t response[4 + APP_MANIFEST_BITMAP_SIZE] = {0x71, 0x01, 0xFF, data[2]}; // 正响应
+    uint32_t chunks = 0, needed = 0;
+    uint32_t image_size = USER_FLASH_SIZE;
+    uint32_t expected_crc = 0;
+    uint32_t image_crc;
+    uint16_t i;
 
     if (currentSessionStatus != activeSession) {
         send_uds_error_response(UDS_ERROR_CONDITIONS_NOT_CORRECT); // 当前状态不支持例行控制
@@ -259,42 +408,77 @@ void uds_handle_routine_control(uint8_t *data, uint16_t length)
 	switch (data[2])
 	{
 	case 00:
-		can_uds.flash_erase_app_func();
+		// 31 01 FF 00 [镜像大小, 3~4 字节大端]: 只擦除镜像需要的扇区, 不带大小时擦除整个 App1
+		// 这里只登记范围, 立即响应; 扇区在 0x36 传输过程中提前一个扇区逐个擦除
+		if (length > 3) {
+			image_size = 0;
+			for (i = 3; i < length && i < 7; i++) {
+				image_size = (image_size << 8) | data[i];
+			}
+		}
+		if (image_size == 0 || image_size > USER_FLASH_SIZE) {
+			send_uds_error_response(UDS_ERROR_REQUEST_OUT_OF_RANGE);
+			return;
+		}
+		if (HAL_OK != can_uds.flash_erase_ahead_func(PROG_START_ADDR, image_size)) {
+			send_uds_error_response(UDS_ERROR_CONDITIONS_NOT_CORRECT);
+			return;
+		}
+		uds_image_size = image_size;
 		rw_data.header = HEADER;
 		rw_data.iap_msg.status = IAP_NO_APP;
 		rw_data.iap_msg.version = 0xA0;
 		rw_data.iap_msg.transmitMethod = TRANSMIT_METHOD_CAN;
+		set_iap_image(&rw_data, 0);
 		rw_data.ender = ENDER;
 		write_iap_status(&rw_data);
+		commit_iap_status(); // 0x36 开始擦除 App1 之前写入
 		break;
 	case 01:
-		if(NEWAPP_VILIBLE == can_uds.IAP_if->funtionCheckFunction())
+		// 31 01 FF 01 [镜像 CRC, 4 字节大端]: 计算 App1 [0, 镜像大小) 的 CRC (image_crc.h) 并记录,
+		// 启动时按它校验整个镜像; 带 CRC 时还必须与测试仪算的一致
+		for (i = 3; i < length && i < 7; i++) {
+			expected_crc = (expected_crc << 8) | data[i];
+		}
+		rw_data.header = HEADER;
+		rw_data.iap_msg.version = 0x0A1;
+		rw_data.iap_msg.transmitMethod = TRANSMIT_METHOD_CAN;
+		rw_data.ender = ENDER;
+		image_crc = set_iap_image(&rw_data, uds_image_size);
+		if(NEWAPP_VILIBLE == can_uds.IAP_if->funtionCheckFunction() &&
+		   (length < 7 || image_crc == expected_crc))
 		{
-				rw_data.header = HEADER;
 				rw_data.iap_msg.status = IAP_APP_DONE;
-				rw_data.iap_msg.version = 0x0A1;
-				rw_data.iap_msg.transmitMethod = TRANSMIT_METHOD_CAN;
-				rw_data.ender = ENDER;
 				write_iap_status(&rw_data);
+				commit_iap_status(); // 下载会话结束
 		}else{
-				rw_data.header = HEADER;
 				rw_data.iap_msg.status = IAP_NO_APP;
-				rw_data.iap_msg.version = 0x0A1;
-				rw_data.iap_msg.transmitMethod = TRANSMIT_METHOD_CAN;
-				rw_data.ender = ENDER;
+				set_iap_image(&rw_data, 0);
 				write_iap_status(&rw_data);
+				commit_iap_status();
 				send_uds_error_response(UDS_ERROR_INVALID_FORMAT); 
 				return;
 		}
 		break;
+	case 02:
+		// 31 01 FF 02 + 清单: 与 App1 逐块比较, 响应 71 01 FF 02 + 位图 (置位的块需要发送)
+		if (length < 3 || APP_UPDATE_OK != AppUpdate_ManifestBegin() ||
+			APP_UPDATE_OK != AppUpdate_ManifestWrite(data + 3, length - 3) ||
+			APP_UPDATE_OK != AppUpdate_ManifestEnd(&response[4], &chunks, &needed))
+		{
+				send_uds_error_response(UDS_ERROR_INVALID_FORMAT);
+				return;
+		}
+		DEBUG_PRINT("Manifest: %u of %u chunks needed\n", needed, chunks);
+		send_iso15765_message(CANID_UPGRADE_SENDER, response, 4 + (chunks + 7) / 8);
+		return;
 	default:
 		send_uds_error_response(UDS_ERROR_REQUEST_OUT_OF_RANGE); 
-		break;
+		return;
 	}
     DEBUG_PRINT("Routine Control Validated (Service ID: 0x31)\n");
 
-    uint8_t response[4] = {0x71, 0x01, 0xFF, data[2]}; // 正响应
-    send_iso15765_message(CANID_UPGRADE_SENDER, response, sizeof(response));
+    send_iso15765_message(CANID_UPGRADE_SENDER, response, 4);
 }
 
 // 服务 0x34: 请求下载 (Request Download)
@@ -305,11 +489,32 @@ void uds_handle_request_download(uint8_t *data, uint16_t length) {
         return;
     }
 
-    if (data[0] != 0x00 || data[1] != 0x44) { // 校验格式标识是否为 0x00 0x44
+    if ((data[0] != UDS_DFI_RAW_IMAGE && data[0] != UDS_DFI_DELTA_PATCH && data[0] != UDS_DFI_SPARSE_CHUNKS) ||
+        data[1] != 0x44) { // 校验格式标识是否为 0x00/0x10/0x20 0x44
         send_uds_error_response(UDS_ERROR_REQUEST_OUT_OF_RANGE);
         return;
     }
 
+    staged_format = data[0];
+    uds_write_error = 0;
+    FLASH_If_ResetStats(); // 0x37 时打印本次下载的编程统计
+    if (staged_format != UDS_DFI_RAW_IMAGE) {
+        // 之前的 31 01 FF 00 还没擦完的扇区现在擦掉 (与一次全擦的结果相同),
+        // 之后 AppUpdate_Commit 写 App1 时不能再触发边写边擦
+        if (FLASH_If_EraseAhead_Left() != 0) {
+            send_uds_error_response(UDS_ERROR_RESPONSE_PENDING);
+        }
+        FLASH_If_EraseAhead_End();
+        // 差分补丁/分块数据: 擦除 Backup 区作为新镜像的暂存区, App1 保持不变
+        // 分块数据必须先发送清单 (31 01 FF 02)
+        if (APP_UPDATE_OK != ((staged_format == UDS_DFI_DELTA_PATCH) ? AppUpdate_DeltaBegin() : AppUpdate_SparseBegin())) {
+            staged_format = UDS_DFI_RAW_IMAGE;
+            send_uds_error_response(UDS_ERROR_CONDITIONS_NOT_CORRECT);
+            return;
+        }
+        staged_block_seq = 1;
+    }
+
     DEBUG_PRINT("Processing Request Download (Service ID: 0x34)\n");
     currentSessionStatus = downloadRequested; // 切换到下载请求状态
     uint8_t response[4] = {0x74, 0x20, UDS_WRITE_BLOCK_SIZE >> 4, UDS_WRITE_BLOCK_SIZE & 0xFF}; // 正响应,告诉最大包为 1024
@@ -324,12 +529,70 @@ void uds_handle_transfer_data(uint8_t *data, uint16_t length) {
     }
 
     DEBUG_PRINT("Processing Transfer Data (Service ID: 0x36, Block Sequence: 0x01)\n");
-    
-    can_uds.flash_write_func(PROG_START_ADDR + ((data[0] - 1) * UDS_WRITE_BLOCK_SIZE), \
-    (uint32_t*)(data + 1), (length - 1) / 4);
 
-    uint8_t response[2] = {0x76, 0x01}; // 正响应
-    send_iso15765_message(CANID_UPGRADE_SENDER, response, sizeof(response));
+    if (uds_write_error != 0) { // 之前提前应答的块没有写成功, 后面的块不再写入
+        uds_transfer_error(UDS_ERROR_TRANSFER_DATA_ERROR);
+        return;
+    }
+
+    if (staged_format != UDS_DFI_RAW_IMAGE) {
+        // 块序号必须连续; 重发的上一块 (没收到正响应) 只回应答, 不再应用
+        if (length < 1 || (data[0] != staged_block_seq && data[0] != (uint8_t)(staged_block_seq - 1))) {
+            send_uds_error_response(UDS_ERROR_REQUEST_SEQUENCE_ERROR);
+            return;
+        }
+        if (data[0] == staged_block_seq) {
+            eAPP_Update_Status_Def status = (staged_format == UDS_DFI_DELTA_PATCH) ?
+                AppUpdate_DeltaWrite(data + 1, length - 1) : AppUpdate_SparseWrite(data + 1, length - 1);
+            if (APP_UPDATE_OK != status) {
+                send_uds_error_response(UDS_ERROR_TRANSFER_DATA_ERROR);
+                return;
+            }
+            staged_block_seq++;
+        }
+        uint8_t response[2] = {0x76, data[0]}; // 正响应
+        send_iso15765_message(CANID_UPGRADE_SENDER, response, sizeof(response));
+        return;
+    }
+
+    if (length < 1) {
+        send_uds_error_response(UDS_ERROR_INVALID_FORMAT);
+        return;
+    }
+
+    // 边写边擦: 写指针进入最后擦除的扇区后擦下一个扇区. 擦除期间 CPU 停顿,
+    // 没有提前应答时在回正响应之前擦, 先回 7F 36 78 让测试端等待;
+    // 提前应答时中断在 SRAM 中运行, 测试端继续发送, 后面的块留在暂存区
+    if (FLASH_If_EraseAhead_Pending()) {
+        if (!uds_early_ack) {
+            send_uds_error_response(UDS_ERROR_RESPONSE_PENDING);
+        }
+        if (HAL_OK != FLASH_If_EraseAhead_Poll()) {
+            uds_transfer_error(UDS_ERROR_TRANSFER_DATA_ERROR);
+            return;
+        }
+    }
+    // 数据从暂存区中的字对齐地址开始 (UDS_STAGE_PAD)
+    if (FLASHIF_OK != can_uds.flash_write_func(PROG_START_ADDR + ((data[0] - 1) * UDS_WRITE_BLOCK_SIZE), \
+    (uint32_t*)(data + 1), (length - 1) / 4)) {
+        uds_transfer_error(UDS_ERROR_TRANSFER_DATA_ERROR);
+        return;
+    }
+
+    if (!uds_early_ack) {
+        uint8_t response[2] = {0x76, data[0]}; // 正响应
+        send_iso15765_message(CANID_UPGRADE_SENDER, response, sizeof(response));
+    }
+}
+
+// 0x36 出错: 已经提前回过正响应的块记下错误, 0x37 时报告
+static void uds_transfer_error(UDS_ErrorCode error_code)
+{
+    if (uds_early_ack) {
+        uds_write_error = 1;
+    } else {
+        send_uds_error_response(error_code);
+    }
 }
 
 
@@ -346,6 +609,37 @@ void uds_handle_transfer_exit(uint8_t *data, uint16_t length) {
     }
 
     DEBUG_PRINT("Processing Transfer Exit (Service ID: 0x37)\n");
+    if (uds_write_error != 0) { // 提前应答的块写入失败
+        FLASH_If_EraseAhead_End();
+        currentSessionStatus = activeSession;
+        send_uds_error_response(UDS_ERROR_TRANSFER_DATA_ERROR);
+        return;
+    }
+    if (staged_format != UDS_DFI_RAW_IMAGE) {
+        // 校验 Backup 中的新镜像, 再把有变化的扇区拷贝到 App1 (状态记录保证掉电后可继续)
+        uint32_t size = 0;
+        eAPP_Update_Status_Def status = (staged_format == UDS_DFI_DELTA_PATCH) ?
+            AppUpdate_DeltaEnd(&size) : AppUpdate_SparseEnd(&size);
+        staged_format = UDS_DFI_RAW_IMAGE;
+        send_uds_error_response(UDS_ERROR_RESPONSE_PENDING); // 拷贝需要几秒
+        if (APP_UPDATE_OK != status || APP_UPDATE_OK != AppUpdate_Commit(size)) {
+            currentSessionStatus = activeSession;
+            send_uds_error_response(UDS_ERROR_TRANSFER_DATA_ERROR);
+            return;
+        }
+    }
+    else if (FLASH_If_EraseAhead_Left() != 0) {
+        // 镜像比登记的范围小: 擦掉剩下的扇区, 结果与一次全擦相同
+        send_uds_error_response(UDS_ERROR_RESPONSE_PENDING);
+        if (HAL_OK != FLASH_If_EraseAhead_End()) {
+            send_uds_error_response(UDS_ERROR_TRANSFER_DATA_ERROR);
+            return;
+        }
+    }
+    FLASH_If_EraseAhead_End();
+    DEBUG_PRINT("Flash words programmed=%u skipped=%u, sectors erased=%u skipped=%u\n",
+                FLASH_If_GetStats()->programmed_words, FLASH_If_GetStats()->skipped_words,
+                FLASH_If_GetStats()->erased_sectors, FLASH_If_GetStats()->skipped_sectors);
     currentSessionStatus = noSession; // 切换到无会话状态
     uint8_t response[1] = {0x77}; // 正响应
     send_iso15765_message(CANID_UPGRADE_SENDER, response, sizeof(response));
@@ -356,42 +650,121 @@ void uds_handle_transfer_exit(uint8_t *data, uint16_t length) {
 void can_uds_init(void) {
     can_uds.tx_msg_func = &can_send;
     can_uds.flash_write_func = &FLASH_If_Write;
-    can_uds.flash_erase_app_func = &FLASH_If_Erase_App_Space;
+    can_uds.flash_erase_ahead_func = &FLASH_If_EraseAhead_Begin;
     can_uds.IAP_if = &iapInterface;
 }
 
+// 发送一帧: 线程 (can_uds_poll) 和 CAN 接收中断都会发送, 关中断保证分配发送邮箱不被打断
+static void uds_send_frame(uint32_t canid, uint8_t *frame, uint8_t dlc)
+{
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    can_uds.tx_msg_func(canid, frame, dlc);
+    __set_PRIMASK(primask);
+}
+
+// 等测试端的流控帧 (线程): 返回 FLOW_STATUS_CONTINUE, 溢出/非法状态/超时返回 FLOW_STATUS_ABORT
+static uint8_t uds_wait_flow_control(void)
+{
+    uint32_t tick = HAL_GetTick();
+    uint8_t fc;
+
+    for (;;) {
+        fc = uds_tx_fc;
+        if (fc == FLOW_STATUS_CONTINUE) {
+            break;
+        }
+        if (fc == FLOW_STATUS_WAIT) {
+            uds_tx_fc = 0; // 测试端要我们再等一个 N_Bs
+            tick = HAL_GetTick();
+        } else if (fc != 0 || HAL_GetTick() - tick >= UDS_N_BS_MS) {
+            fc = FLOW_STATUS_ABORT;
+            break;
+        }
+    }
+    uds_tx_waiting = 0;
+    return fc;
+}
+
+// STmin 换算成两帧之间至少要相隔的 HAL_GetTick 差值: 0x00-0x7F 毫秒, 0xF1-0xF9 100-900 微秒按 1 ms,
+// 其它保留值按 0x7F. 差值 n 只保证经过了 n-1 ms 以上, 所以再加 1
+static uint32_t uds_stmin_ticks(uint8_t stmin)
+{
+    uint32_t ms;
+
+    if (stmin <= 0x7F) {
+        ms = stmin;
+    } else if (stmin >= 0xF1 && stmin <= 0xF9) {
+        ms = 1;
+    } else {
+        ms = 0x7F;
+    }
+    return (ms == 0) ? 0 : ms + 1;
+}
+
 // 封装发送接口函数
+// 多帧响应 (超过 7 字节) 按 ISO 15765-2 发送: 首帧后等流控帧, 每 BS 个连续帧再等一次, 连续帧之间隔 STmin.
+// 会阻塞到发完或测试端超时/中止, 只能在线程中调用 (中断里只发单帧)
 void send_iso15765_message(uint32_t canid, uint8_t *data, uint16_t length) {
     if (length <= 7) {
         // 单帧 (Single Frame)
         uint8_t single_frame[8] = {0};
         single_frame[0] = 0x00 | length; // 帧类型为单帧 (高 4 位为 0x0，低 4 位为数据长度)
         memcpy(&single_frame[1], data, length); // 复制数据
-        can_uds.tx_msg_func(canid, single_frame, length + 1);
+        uds_send_frame(canid, single_frame, length + 1);
     } else {
         // 长数据需要多帧传输
         uint8_t first_frame[8] = {0};
         first_frame[0] = 0x10 | ((length >> 8) & 0x0F); // 帧类型为首帧 (高 4 位为 0x1)
         first_frame[1] = length & 0xFF;                // 总长度低 8 位
         memcpy(&first_frame[2], data, 6);              // 首帧最多包含 6 字节数据
-        can_uds.tx_msg_func(canid, first_frame, 8);
+        uds_tx_fc = 0;
+        uds_tx_waiting = 1; // 先准备好再发首帧, 测试端的流控帧可能马上就到
+        uds_send_frame(canid, first_frame, 8);
 
         // 发送连续帧
         uint16_t remaining_data = length - 6;
         uint8_t *current_data = data + 6;
         uint8_t sequence_number = 1;
+        uint8_t block_left = 0; // 本块还能发的连续帧数, 0: 不限
+        uint32_t gap = 0; // 连续帧之间的最小间隔 (HAL_GetTick 差值)
+        uint32_t tick = 0; // 上一个连续帧的发送时间
+        uint8_t need_fc = 1; // 首帧之后先等流控帧
 
         while (remaining_data > 0) {
+            if (need_fc) {
+                if (uds_wait_flow_control() != FLOW_STATUS_CONTINUE) {
+                    DEBUG_PRINT("Flow Control timeout or abort, %u bytes not sent\n", remaining_data);
+                    return;
+                }
+                block_left = uds_tx_bs;
+                gap = uds_stmin_ticks(uds_tx_stmin);
+                need_fc = 0;
+            } else {
+                while (HAL_GetTick() - tick < gap) {
+                }
+            }
+
             uint8_t consecutive_frame[8] = {0};
             consecutive_frame[0] = 0x20 | (sequence_number & 0x0F); // 帧类型为连续帧 (高 4 位为 0x2)
             uint8_t chunk_size = (remaining_data > 7) ? 7 : remaining_data; // 当前帧传输字节数
             memcpy(&consecutive_frame[1], current_data, chunk_size);        // 复制数据
-            can_uds.tx_msg_func(canid, consecutive_frame, chunk_size + 1);
+            if (block_left == 1 && remaining_data > chunk_size) {
+                uds_tx_fc = 0; // 本块最后一帧: 发之前准备好等下一个流控帧
+                uds_tx_waiting = 1;
+                need_fc = 1;
+            }
+            uds_send_frame(canid, consecutive_frame, chunk_size + 1);
+            tick = HAL_GetTick();
 
             // 更新剩余数据和指针
             remaining_data -= chunk_size;
             current_data += chunk_size;
             sequence_number++;
+            if (block_left != 0) {
+                block_left--;
+            }
         }
     }
 }
@@ -56,6 +56,8 @@
  | 0x04 (PCI)   | 0x31      | 0x01         | 0xFF   | 0x00   | 填充字节 (0x00) |
  -----------------------------------------------------------------------------
  示例发送：04 31 01 FF 00 00 00 00
+ 可选在后面带镜像大小 (3 或 4 字节，大端)，只擦除镜像需要的扇区，例如 30 KB：
+ 示例发送：07 31 01 FF 00 00 78 00
 
 接收 (CAN 帧)：
  -----------------------------------------------------------------------------
@@ -164,6 +166,10 @@
  | 0x04 (PCI)   | 0x31      | 0x01 (启动校验) | 0xFF  |  (0x01)      |
  -----------------------------------------------------------------------------
  示例发送：04 31 01 FF 01 00 00 00
+ BootLoader 计算 App1 中镜像 (31 01 FF 00 登记的大小) 的 CRC 并记录在状态区，每次启动按它校验整个镜像。
+ CRC 是 STM32 CRC 外设的算法 (CRC-32/MPEG-2，按小端 32 位字，末尾不足一个字补 0xFF)，见 image_crc.h。
+ 可选在后面带测试仪算好的 CRC (4 字节，大端)，不一致时返回否定响应，8 字节需用多帧发送：
+ 示例发送：10 08 31 01 FF 01 DF 8A / 21 8A 2B 00 00 00 00 00
  接收 (CAN 帧)：
  -----------------------------------------------------------------------------
  | Byte 0       | Byte 1    | Byte 2       | Byte 3 | Byte 4 ~ Byte 7       |
@@ -210,6 +216,16 @@
 	 #define DEBUG_PRINT(fmt, ...) // 关闭调试输出
 #endif // DEBUG
 
+// 0x34 dataFormatIdentifier: 高 4 位为压缩方式，0x10 表示数据是差分补丁 (见 app_update.h)，
+// 补丁在 Backup 区生成新镜像，0x37 时校验并拷贝到 App1，不需要先执行 31 01 FF 00 擦除
+// 0x20 表示数据是 31 01 FF 02 (清单) 返回位图中要求的块 (格式见 app_update.h)，
+// 未变化的块从 App1 复制，0x37 时只擦写有变化的扇区
+// 超过 7 字节的响应 (如清单位图) 用多帧发送：首帧后等测试仪的流控帧 (30 BS STmin)，按 BS/STmin 发连续帧，
+// 1 s 内没有流控帧 (或回 32 溢出) 则放弃这次响应
+#define UDS_DFI_RAW_IMAGE 		0x00
+#define UDS_DFI_DELTA_PATCH 	0x10
+#define UDS_DFI_SPARSE_CHUNKS 	0x20
+
 #define PROG_START_ADDR 		APPLICATION_ADDRESS
 #define PROG_END_ADDR 			(PROG_START_ADDR + USER_FLASH_SIZE)
 
@@ -246,11 +262,13 @@ typedef enum {
     UDS_ERROR_SERVICE_NOT_SUPPORTED = 0x11, // 服务不支持
     UDS_ERROR_SUB_FUNCTION_NOT_SUPPORTED = 0x12, // 子功能不支持
     UDS_ERROR_INVALID_FORMAT = 0x13,        // 消息长度或格式错误
+    UDS_ERROR_BUSY_REPEAT_REQUEST = 0x21,   // 忙, 请重发 (接收暂存区满)
     UDS_ERROR_CONDITIONS_NOT_CORRECT = 0x22,// 条件不正确
     UDS_ERROR_REQUEST_SEQUENCE_ERROR = 0x24,// 请求序列错误
     UDS_ERROR_REQUEST_OUT_OF_RANGE = 0x31,  // 请求超出范围
     UDS_ERROR_SECURITY_ACCESS_DENIED = 0x33,// 安全访问被拒绝
-    UDS_ERROR_TRANSFER_DATA_ERROR = 0x72    // 数据传输错误
+    UDS_ERROR_TRANSFER_DATA_ERROR = 0x72,   // 数据传输错误
+    UDS_ERROR_RESPONSE_PENDING = 0x78       // 请求已收到，响应稍后发送
 } UDS_ErrorCode;
 
 
@@ -258,7 +276,7 @@ typedef enum {
 typedef struct {
     void (*tx_msg_func)(uint32_t id, uint8_t *data, uint8_t len); // CAN 发送函数
     uint32_t (*flash_write_func)(uint32_t address, uint32_t *p_source, uint32_t length); // Flash 写入函数
-    HAL_StatusTypeDef (*flash_erase_app_func)(void); // Flash 擦除函数
+    HAL_StatusTypeDef (*flash_erase_ahead_func)(uint32_t start, uint32_t size); // Flash 擦除函数 (登记范围, 扇区在写入前逐个擦除)
     IAP_Interface *IAP_if;                            // IAP 接口
 } can_uds_t;
 
@@ -269,6 +287,8 @@ typedef struct {
 /* Exported function prototypes ----------------------------------------------*/
 void can_uds_init();
 void can_uds_handle(uint32_t canid, uint8_t *data, uint8_t dlc);
+void can_uds_poll(void);
+uint8_t can_uds_downloading(void);
 
 #endif /* __CMD_USER_H */
  
@@ -170,6 +170,35 @@ void Serial_PutString(uint8_t *p_string)
 	iapInterface.TransmitFunction(p_string, length, TX_TIMEOUT);
 }
 
+/**
+  * @brief  Print several strings on the HyperTerminal in one transfer
+  * @param  pp_strings: The strings to be printed
+  * @param  count: Number of strings (at most SERIAL_PUTSTRINGV_MAX)
+  * @retval None
+  */
+void Serial_PutStringV(uint8_t **pp_strings, uint8_t count)
+{
+  IAP_IoVec a_iov[SERIAL_PUTSTRINGV_MAX];
+  uint16_t length;
+  uint8_t i;
+
+  if (count > SERIAL_PUTSTRINGV_MAX)
+  {
+    count = SERIAL_PUTSTRINGV_MAX;
+  }
+  for (i = 0; i < count; i++)
+  {
+    length = 0;
+    while (pp_strings[i][length] != '\0')
+    {
+      length++;
+    }
+    a_iov[i].p_base = pp_strings[i];
+    a_iov[i].length = length;
+  }
+  iapInterface.TransmitVFunction(a_iov, count, TX_TIMEOUT);
+}
+
 /**
   * @brief  Transmit a byte to the HyperTerminal
   * @param  param The byte to be sent
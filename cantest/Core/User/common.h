@@ -48,6 +48,7 @@
 #define TX_TIMEOUT          ((uint32_t)10000)
 #define BL_TIMEOUT          (5000)  //  5 sec  
 #define RX_TIMEOUT          HAL_MAX_DELAY    
+#define SERIAL_PUTSTRINGV_MAX  (16)   /* strings per Serial_PutStringV() call */
 
 /* Exported macro ------------------------------------------------------------*/
 #define IS_CAP_LETTER(c)    (((c) >= 'A') && ((c) <= 'F'))
@@ -64,6 +65,7 @@
 void Int2Str(uint8_t *p_str, uint32_t intnum);
 uint32_t Str2Int(uint8_t *inputstr, uint32_t *intnum);
 void Serial_PutString(uint8_t *p_string);
+void Serial_PutStringV(uint8_t **pp_strings, uint8_t count);
 HAL_StatusTypeDef Serial_PutByte(uint8_t param);
 
 #endif  /* __COMMON_H */
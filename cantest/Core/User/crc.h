@@ -0,0 +1,70 @@
+/******************************************************************************
+ * @file    crc.h
+ * @brief   CRC engines used by the transfer protocols (CRC-16/XMODEM, CRC-32).
+ * @author  Jason
+ * @version V1.0.0
+ * @date    2025-3
+ * @copyright (c) 2025, All rights reserved.
+ ******************************************************************************/
+
+#ifndef __CRC_H
+#define __CRC_H
+
+/* Private Includes ----------------------------------------------------------*/
+#include <stdint.h>
+
+/**
+ * CRC-16/XMODEM (CCITT poly 0x1021, init 0x0000, MSB first) as used by Ymodem.
+ * 后端在编译期选择 (CRC16_BACKEND)：
+ *  - CRC16_BACKEND_BITWISE : 逐位移位，每字节 8 次循环，不占表空间
+ *  - CRC16_BACKEND_TABLE   : 256 项查表，每字节一次查表 (512 B flash)
+ *  - CRC16_BACKEND_SLICE4  : slice-by-4，每次处理一个 32 位字 (2 KB flash)
+ * 所有表都是 const，放在 flash 中，不占 RAM。
+ * 定义 CRC16_ALL_BACKENDS 可以把三种后端都编译进来（主机端 benchmark 用）。
+ *
+ * CRC-32 (IEEE 802.3, 与 Zmodem/zip 相同) 用于 Zmodem 的 ZBIN32 帧，单表查表 (1 KB flash)。
+ *
+ * Crc32_UpdateWords() 是 STM32 CRC 外设的软件实现 (poly 0x04C11DB7, MSB first, 不反转,
+ * 按 32 位字输入)，image_crc.c 没有硬件时 (主机端) 用它，结果与外设逐位相同。
+ * 16 项半字节查表 (64 B flash)。
+ */
+/* Exported constants --------------------------------------------------------*/
+#define CRC16_BACKEND_BITWISE       (0)
+#define CRC16_BACKEND_TABLE         (1)
+#define CRC16_BACKEND_SLICE4        (2)
+
+#ifndef CRC16_BACKEND
+#define CRC16_BACKEND               CRC16_BACKEND_SLICE4
+#endif
+
+#define CRC16_INIT_VALUE            ((uint16_t)0x0000)
+#define CRC32_INIT_VALUE            ((uint32_t)0xFFFFFFFF)
+#define CRC32_RESIDUE               ((uint32_t)0xDEBB20E3)  /* Update() over data + CRC (LSB first) */
+#define CRC32_WORD_INIT_VALUE       ((uint32_t)0xFFFFFFFF)  /* STM32 CRC unit after CR.RESET */
+
+/* Exported types ------------------------------------------------------------*/
+
+/* Exported macro ------------------------------------------------------------*/
+
+/* Exported variables --------------------------------------------------------*/
+
+/* Exported function prototypes ----------------------------------------------*/
+uint16_t Crc16_Update(uint16_t crc, const uint8_t *p_data, uint32_t size);
+uint16_t Crc16_Calc(const uint8_t *p_data, uint32_t size);
+uint32_t Crc32_Update(uint32_t crc, const uint8_t *p_data, uint32_t size);
+uint32_t Crc32_Calc(const uint8_t *p_data, uint32_t size);
+uint32_t Crc32_UpdateWords(uint32_t crc, const uint32_t *p_words, uint32_t count);
+
+#if defined(CRC16_ALL_BACKENDS) || (CRC16_BACKEND == CRC16_BACKEND_BITWISE)
+uint16_t Crc16_UpdateBitwise(uint16_t crc, const uint8_t *p_data, uint32_t size);
+#endif
+#if defined(CRC16_ALL_BACKENDS) || (CRC16_BACKEND == CRC16_BACKEND_TABLE)
+uint16_t Crc16_UpdateTable(uint16_t crc, const uint8_t *p_data, uint32_t size);
+#endif
+#if defined(CRC16_ALL_BACKENDS) || (CRC16_BACKEND == CRC16_BACKEND_SLICE4)
+uint16_t Crc16_UpdateSlice4(uint16_t crc, const uint8_t *p_data, uint32_t size);
+#endif
+
+#endif /* __CRC_H */
+
+/************************ (C) COPYRIGHT Jason *****END OF FILE****/
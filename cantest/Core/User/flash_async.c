@@ -0,0 +1,304 @@
+/******************************************************************************
+ * @file    flash_async.c
+ * @brief   Interrupt driven flash erase / program engine with a job queue.
+ * @author  Jason
+ * @version V1.0.0
+ * @date    2025-3
+ * @copyright (c) 2025, All rights reserved.
+ ******************************************************************************/
+
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+#include "flash_async.h"
+#include "flash_if.h"
+
+/* Private typedef -----------------------------------------------------------*/
+
+/* Private define ------------------------------------------------------------*/
+
+/* Private macro -------------------------------------------------------------*/
+#define FLASH_ASYNC_JOB(index)      (&aFlashJobs[(index) & (FLASH_ASYNC_QUEUE_SIZE - 1u)])
+
+/* Private variables ---------------------------------------------------------*/
+static FLASH_Async_JobTypeDef aFlashJobs[FLASH_ASYNC_QUEUE_SIZE];
+static volatile uint32_t JobSubmit;     /* 下一个空位 (线程) */
+static volatile uint32_t JobRun;        /* 正在执行的作业 (中断) */
+static uint32_t JobReport;              /* 下一个待回调的作业 (线程) */
+static volatile uint8_t OpRunning;      /* 一个擦除/编程操作正在进行 */
+static volatile uint8_t OpDone;         /* HAL 回调：操作结束 */
+static volatile uint8_t OpError;        /* HAL 回调：操作出错 */
+static uint8_t EngineUnlocked;          /* 控制器由引擎解锁，队列空后重新上锁 */
+static uint32_t LastError = FLASHIF_OK;
+
+/* Private function prototypes -----------------------------------------------*/
+static void FLASH_Async_Start(void);
+
+/* Private functions ---------------------------------------------------------*/
+/**
+ * @brief  从 JobRun 开始执行队列，直到启动一个擦除/编程操作或队列为空
+ * @note   在 FLASH 中断中，或关闭 FLASH 中断后调用
+ * @retval None
+ */
+static void FLASH_Async_Start(void)
+{
+  FLASH_Async_JobTypeDef *p_job;
+  FLASH_EraseInitTypeDef erase;
+  uint32_t failed = FLASHIF_OK;
+
+  while (JobRun != JobSubmit)
+  {
+    p_job = FLASH_ASYNC_JOB(JobRun);
+    if (failed != FLASHIF_OK)
+    {
+      p_job->status = failed;
+    }
+    if (p_job->status == FLASHIF_OK)
+    {
+      switch (p_job->op)
+      {
+        case FLASH_ASYNC_OP_ERASE:
+          if (p_job->done == 0)
+          {
+            erase.TypeErase = FLASH_TYPEERASE_SECTORS;
+            erase.Sector = FLASH_Layout_GetSector(p_job->address)->sector;
+            erase.NbSectors = 1;
+            erase.VoltageRange = FLASH_VOLTAGE_RANGE_3;
+            p_job->done = 1;
+            OpRunning = 1;
+            if (HAL_FLASHEx_Erase_IT(&erase) == HAL_OK)
+            {
+              return;
+            }
+            /* 没有启动，不会有结束中断 */
+            OpRunning = 0;
+            p_job->status = FLASHIF_ERASEKO;
+          }
+          break;
+        case FLASH_ASYNC_OP_PROGRAM:
+          /* 已经是目标值的字 (擦除后的 0xFFFFFFFF) 不编程 */
+          while ((p_job->done < p_job->length) &&
+                 (*(__IO uint32_t *)(p_job->address + 4u * p_job->done) == p_job->p_source[p_job->done]))
+          {
+            p_job->done++;
+          }
+          if (p_job->done < p_job->length)
+          {
+            OpRunning = 1;
+            if (HAL_FLASH_Program_IT(FLASH_TYPEPROGRAM_WORD, p_job->address + 4u * p_job->done,
+                                     p_job->p_source[p_job->done]) == HAL_OK)
+            {
+              p_job->done++;
+              return;
+            }
+            OpRunning = 0;
+            p_job->status = FLASHIF_WRITINGCTRL_ERROR;
+          }
+          break;
+        case FLASH_ASYNC_OP_VERIFY:
+          if (memcmp((const void *)p_job->address, p_job->p_source, 4u * p_job->length) != 0)
+          {
+            p_job->status = FLASHIF_WRITINGCTRL_ERROR;
+          }
+          break;
+        default:
+          break;
+      }
+    }
+
+    /* 作业结束，失败时后面的作业都以同样的错误结束 */
+    if (p_job->status != FLASHIF_OK)
+    {
+      failed = p_job->status;
+      if (LastError == FLASHIF_OK)
+      {
+        LastError = failed;
+      }
+    }
+    JobRun++;
+  }
+
+  if (EngineUnlocked != 0)
+  {
+    HAL_FLASH_Lock();
+    EngineUnlocked = 0;
+  }
+}
+
+/* Public functions ----------------------------------------------------------*/
+/**
+ * @brief  使能 FLASH 中断 (优先级低于 CAN / USB)
+ * @retval None
+ */
+void FLASH_Async_Init(void)
+{
+  HAL_NVIC_SetPriority(FLASH_IRQn, 1, 0);
+  HAL_NVIC_EnableIRQ(FLASH_IRQn);
+}
+
+/**
+ * @brief  提交一个作业
+ * @param  op: 擦除 / 编程 / 校验
+ * @param  address: 擦除：扇区内任意地址；编程/校验：起始地址 (4 字节对齐)
+ * @param  p_source: 编程/校验数据，作业完成前必须保持有效；擦除时不用
+ * @param  length: 编程/校验的字数
+ * @param  callback: 完成回调，在 FLASH_Async_Poll() 中调用，NULL 表示不回调
+ * @retval HAL_OK 已放入队列，HAL_BUSY 队列已满 (先调用 FLASH_Async_Poll)，HAL_ERROR 地址超出 FLASH
+ */
+HAL_StatusTypeDef FLASH_Async_Submit(FLASH_Async_OpTypeDef op, uint32_t address, const uint32_t *p_source,
+                                     uint32_t length, FLASH_Async_CallbackTypeDef callback)
+{
+  FLASH_Async_JobTypeDef *p_job;
+
+  if (FLASH_Layout_SectorMask(address, (op == FLASH_ASYNC_OP_ERASE) ? 1u : 4u * length) == 0)
+  {
+    return HAL_ERROR;
+  }
+  if ((JobSubmit - JobReport) >= FLASH_ASYNC_QUEUE_SIZE)
+  {
+    return HAL_BUSY;
+  }
+
+  p_job = FLASH_ASYNC_JOB(JobSubmit);
+  p_job->op = op;
+  p_job->address = address;
+  p_job->p_source = p_source;
+  p_job->length = length;
+  p_job->callback = callback;
+  p_job->done = 0;
+  p_job->status = FLASHIF_OK;
+
+  HAL_NVIC_DisableIRQ(FLASH_IRQn);
+  JobSubmit++;
+  if (OpRunning == 0)
+  {
+    /* 引擎空闲：解锁 (同步会话中已经解锁时保持原样) 并从这个作业开始 */
+    if (READ_BIT(FLASH->CR, FLASH_CR_LOCK) != 0)
+    {
+      HAL_FLASH_Unlock();
+      EngineUnlocked = 1;
+    }
+    __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP | FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR |
+                           FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR);
+    FLASH_Async_Start();
+  }
+  HAL_NVIC_EnableIRQ(FLASH_IRQn);
+  return HAL_OK;
+}
+
+/**
+ * @brief  未完成 (排队或正在执行) 的作业数
+ * @retval 0 表示引擎空闲
+ */
+uint32_t FLASH_Async_Busy(void)
+{
+  return JobSubmit - JobRun;
+}
+
+/**
+ * @brief  按提交顺序调用已完成作业的回调并释放队列位置
+ * @note   主循环 / 空闲函数中调用，回调里可以提交新的作业
+ * @retval None
+ */
+void FLASH_Async_Poll(void)
+{
+  FLASH_Async_JobTypeDef *p_job;
+
+  while (JobReport != JobRun)
+  {
+    p_job = FLASH_ASYNC_JOB(JobReport);
+    if (p_job->callback != NULL)
+    {
+      p_job->callback(p_job);
+    }
+    JobReport++;
+  }
+}
+
+/**
+ * @brief  等待队列中的作业全部完成，并调用它们的回调
+ * @note   在优先级不低于 FLASH 中断的上下文里 (UDS 在 CAN 接收中断中写 FLASH) 中断进不来，
+ *         所以这里在操作结束后直接推进引擎；此时 SysTick 也不走，超时不起作用。
+ * @param  timeout: 整个队列的超时 (ms)
+ * @retval HAL_OK，HAL_TIMEOUT 引擎仍在运行
+ */
+HAL_StatusTypeDef FLASH_Async_Wait(uint32_t timeout)
+{
+  uint32_t tick = HAL_GetTick();
+
+  while (FLASH_Async_Busy() != 0)
+  {
+    HAL_NVIC_DisableIRQ(FLASH_IRQn);
+    if ((OpRunning != 0) && (__HAL_FLASH_GET_FLAG(FLASH_FLAG_BSY) == RESET))
+    {
+      FLASH_Async_IRQHandler();
+      HAL_NVIC_ClearPendingIRQ(FLASH_IRQn);
+    }
+    HAL_NVIC_EnableIRQ(FLASH_IRQn);
+    if ((HAL_GetTick() - tick) >= timeout)
+    {
+      return HAL_TIMEOUT;
+    }
+  }
+  FLASH_Async_Poll();
+  return HAL_OK;
+}
+
+/**
+ * @brief  读取并清除上次调用以来第一个失败作业的状态
+ * @retval FLASHIF_OK 或作业的错误状态
+ */
+uint32_t FLASH_Async_GetError(void)
+{
+  uint32_t error = LastError;
+
+  LastError = FLASHIF_OK;
+  return error;
+}
+
+/**
+ * @brief  FLASH 中断处理，由 stm32f2xx_it.c 的 FLASH_IRQHandler 调用
+ * @note   HAL_FLASH_IRQHandler() 在回调之后才结束当前操作，所以下一个操作在它返回后再启动
+ * @retval None
+ */
+void FLASH_Async_IRQHandler(void)
+{
+  FLASH_Async_JobTypeDef *p_job = FLASH_ASYNC_JOB(JobRun);
+
+  HAL_FLASH_IRQHandler();
+  if ((OpRunning == 0) || ((OpDone == 0) && (OpError == 0)))
+  {
+    return;
+  }
+  if (OpError != 0)
+  {
+    p_job->status = (p_job->op == FLASH_ASYNC_OP_ERASE) ? FLASHIF_ERASEKO : FLASHIF_WRITING_ERROR;
+  }
+  OpRunning = 0;
+  OpDone = 0;
+  OpError = 0;
+  FLASH_Async_Start();
+}
+
+/**
+ * @brief  HAL 回调：擦除 (0xFFFFFFFF) 或一个字的编程结束
+ * @param  ReturnValue: 未使用
+ * @retval None
+ */
+void HAL_FLASH_EndOfOperationCallback(uint32_t ReturnValue)
+{
+  (void)ReturnValue;
+  OpDone = 1;
+}
+
+/**
+ * @brief  HAL 回调：操作出错 (写保护、对齐、顺序错误)
+ * @param  ReturnValue: 出错的扇区或地址
+ * @retval None
+ */
+void HAL_FLASH_OperationErrorCallback(uint32_t ReturnValue)
+{
+  (void)ReturnValue;
+  OpError = 1;
+}
+
+/************************ (C) COPYRIGHT Jason *****END OF FILE****/
@@ -0,0 +1,71 @@
+/******************************************************************************
+ * @file    flash_async.h
+ * @brief   Interrupt driven flash erase / program engine with a job queue.
+ * @author  Jason
+ * @version V1.0.0
+ * @date    2025-3
+ * @copyright (c) 2025, All rights reserved.
+ ******************************************************************************/
+
+#ifndef __FLASH_ASYNC_H
+#define __FLASH_ASYNC_H
+
+/* Private Includes ----------------------------------------------------------*/
+#include "main.h"
+
+/**
+ * 使用方法：
+ *  1. FLASH_Async_Submit() 把作业 (擦除扇区 / 编程一段字 / 校验一段字) 放入队列后立即返回，
+ *     引擎在 FLASH 中断 (EOP / ERR) 里一个接一个地执行，空闲时自动解锁，队列空后重新上锁
+ *  2. 主循环调用 FLASH_Async_Poll()，已完成作业的回调在这里 (线程上下文) 按提交顺序执行
+ *  3. FLASH_Async_Busy() 查询未完成的作业数，FLASH_Async_Wait() 等待全部完成
+ * 一个作业失败后，排在它后面的作业全部以同样的错误结束 (不会在擦除失败的扇区上编程)。
+ * flash_if.c 的同步函数在操作 FLASH 之前会先等待引擎空闲，两者不会同时操作控制器。
+ *
+ * 注意：F207 只有一个 bank，擦除/编程期间读 FLASH (取指、读常量) 会让总线停顿到操作结束，
+ * 只有在 RAM 或 ART 缓存中运行的代码 (包括中断) 能在擦除期间继续执行。
+ */
+/* Exported constants --------------------------------------------------------*/
+#define FLASH_ASYNC_QUEUE_SIZE      (8u)             /* jobs, power of 2 */
+#define FLASH_ASYNC_TIMEOUT_MS      (3000u)          /* 128 KB sector erase, worst case */
+
+/* Exported types ------------------------------------------------------------*/
+typedef enum
+{
+  FLASH_ASYNC_OP_ERASE,     /* erase the sector containing address */
+  FLASH_ASYNC_OP_PROGRAM,   /* program length words, unchanged words are skipped */
+  FLASH_ASYNC_OP_VERIFY     /* compare length words with p_source */
+} FLASH_Async_OpTypeDef;
+
+typedef struct FLASH_Async_Job FLASH_Async_JobTypeDef;
+typedef void (*FLASH_Async_CallbackTypeDef)(const FLASH_Async_JobTypeDef *p_job);
+
+struct FLASH_Async_Job
+{
+  FLASH_Async_OpTypeDef op;
+  uint32_t address;                     /* erase: any address in the sector */
+  const uint32_t *p_source;             /* program / verify: kept valid until the job is done */
+  uint32_t length;                      /* words */
+  FLASH_Async_CallbackTypeDef callback; /* NULL: none */
+  uint32_t done;                        /* words programmed / erase started */
+  uint32_t status;                      /* FLASHIF_OK, FLASHIF_ERASEKO, FLASHIF_WRITING_ERROR,
+                                           FLASHIF_WRITINGCTRL_ERROR */
+};
+
+/* Exported macro ------------------------------------------------------------*/
+
+/* Exported variables --------------------------------------------------------*/
+
+/* Exported function prototypes ----------------------------------------------*/
+void FLASH_Async_Init(void);
+HAL_StatusTypeDef FLASH_Async_Submit(FLASH_Async_OpTypeDef op, uint32_t address, const uint32_t *p_source,
+                                     uint32_t length, FLASH_Async_CallbackTypeDef callback);
+uint32_t FLASH_Async_Busy(void);
+void FLASH_Async_Poll(void);
+HAL_StatusTypeDef FLASH_Async_Wait(uint32_t timeout);
+uint32_t FLASH_Async_GetError(void);
+void FLASH_Async_IRQHandler(void);
+
+#endif /* __FLASH_ASYNC_H */
+
+/************************ (C) COPYRIGHT Jason *****END OF FILE****/
@@ -21,12 +21,17 @@
 /* 都是从0开始，0 表示第一个数据*/
 static int32_t  areason_id, data_id;   
 static char     bit_id;
+/* 日志头缓存：el_flash_mount() 找到最新记录 (areason_id, data_id) 后，读写不再扫描 FLASH；
+   擦除状态区时失效，下次读写时重新查找 */
+static uint8_t          el_mounted;
+static eFIND_Status_Def el_head_status;
 /* Private function prototypes -----------------------------------------------*/ 
 /* Private function prototypes -----------------------------------------------*/ 
 static HAL_StatusTypeDef el_erase_flash_area(void);
-static void el_write_flash_data(el_flash_address_t write_addr, void* save_data_p, uint32_t Len);
+static uint32_t el_write_flash_data(el_flash_address_t write_addr, void* save_data_p, uint32_t Len);
 static void el_reset_map_bit(uint32_t areason_id, uint32_t data_id);
 static eFIND_Status_Def el_find_latest_data_address(el_flash_address_t *address_p);
+static eFIND_Status_Def el_locate_latest_data_address(el_flash_address_t *address_p);
 static el_flash_address_t el_get_nextwrite_address(eFIND_Status_Def status);
 /* Private functions ---------------------------------------------------------*/ 
 /**
@@ -34,35 +39,21 @@ static el_flash_address_t el_get_nextwrite_address(eFIND_Status_Def status);
  */
 static HAL_StatusTypeDef el_erase_flash_area() 
 {
-    /* Unlock the Flash to enable the flash control register access *************/ 
-    HAL_FLASH_Unlock();
-  
-    if (HAL_OK != FLASH_WaitForLastOperation(FlASH_WAIT_TIMEMS))
+    const FLASH_Layout_RegionTypeDef *region_p = FLASH_Layout_GetRegion(FLASH_REGION_STATUS);
+
+    el_mounted = 0;
+    /* FLASH_If_Erase_Range 在任何情况下都会重新上锁 (下载会话中保持解锁) */
+    if (HAL_OK != FLASH_If_Erase_Range(region_p->start, region_p->size))
     {
         return HAL_TIMEOUT;
     }
-    for (char i = IAP_STATUS_START_SECTOR; i <= IAP_STATUS_END_SECTOR; i++)
-    {
-        /* Device voltage range supposed to be [2.7V to 3.6V], the operation will
-        be done by word */ 
-
-        FLASH_Erase_Sector(i, FLASH_VOLTAGE_RANGE_3);
-        if (HAL_OK != FLASH_WaitForLastOperation(FlASH_WAIT_TIMEMS))
-        {
-            return HAL_TIMEOUT;
-        }
-    }
-    /* Lock the Flash to disable the flash control register access (recommended
-       to protect the FLASH memory against possible unwanted operation) *********/
-    HAL_FLASH_Lock();
-		
 	return HAL_OK;
 }
 
-static void el_write_flash_data(el_flash_address_t write_addr, void* save_data_p, uint32_t Len)
+static uint32_t el_write_flash_data(el_flash_address_t write_addr, void* save_data_p, uint32_t Len)
 {
     el_reset_map_bit(areason_id, data_id);
-    FLASH_If_Write(write_addr, (uint32_t*)save_data_p, Len / FLASH_PROGRAM_SIZE); 
+    return FLASH_If_Write(write_addr, (uint32_t*)save_data_p, Len / FLASH_PROGRAM_SIZE); 
                                 // len/4 是因为写入的是uint32_t类型的数据
 }
 
@@ -145,6 +136,79 @@ static eFIND_Status_Def el_find_latest_data_address(el_flash_address_t *address_
     }
 }
 
+/**
+ * @brief 快速定位最新的标志数据地址 (el_flash_mount 使用)
+ * @note  利用写入顺序，不用逐个子区、逐个记录倒着查：
+ *        1. 子区按 1, 2, ... 的顺序使用：二分查找最后一个 map 不是全 1 的子区
+ *        2. map 的 bit 从 bit0 开始依次清零：~map 的最高位 (CLZ) 就是最后使用的记录组
+ *        3. 组内记录也按顺序写入：二分查找最后一条有效记录
+ *        日志不符合这个顺序时 (写 map 之后、写数据之前掉电，或者数据被改动)
+ *        退回 el_find_latest_data_address() 逐个查找，结果与原来相同
+ * @return 返回查找状态，成功时 areason_id / data_id 指向最新记录
+ */
+static eFIND_Status_Def el_locate_latest_data_address(el_flash_address_t *address_p)
+{
+    el_table_t      table;
+    int32_t         sonid, group, low, high, mid;
+
+    /* 1. 子区 1..sonid 在使用 */
+    low = 0;
+    high = EL_AREA_SON_SUM;
+    while (low < high)
+    {
+        mid = (low + high + 1) / 2;
+        if (EL_SON_IS_USEING(EL_GET_TABLE(mid).map))
+        {
+            low = mid;
+        }
+        else
+        {
+            high = mid - 1;
+        }
+    }
+    sonid = low;
+    if (0 == sonid)
+    {   /* 第一个子区没有使用：一般是空的，逐个确认 */
+        return el_find_latest_data_address(address_p);
+    }
+    table = EL_GET_TABLE(sonid);
+    if (!EL_CHECK_TABLE(table))
+    {
+        return el_find_latest_data_address(address_p);
+    }
+
+    /* 2. 最后清零的 bit，从 1 开始 (与 el_find_latest_data_address 的 bit_id 相同) */
+    group = (int32_t)EL_MAP_BITS_SUM - (int32_t)__CLZ((el_map_size_t)~table.map);
+    low = ((group - 1) * EL_MAP_BIT2DATA_SUM) + CNT_FIRST;
+    high = group * EL_MAP_BIT2DATA_SUM;
+    if (high > (int32_t)EL_SON2DATA_SUM)
+    {
+        high = EL_SON2DATA_SUM;
+    }
+    if ((low > high) || !EL_CHECK_DATE(EL_GET_DATA(sonid, low)))
+    {
+        return el_find_latest_data_address(address_p);
+    }
+
+    /* 3. 组内 low 有效，找最后一条有效记录 */
+    while (low < high)
+    {
+        mid = (low + high + 1) / 2;
+        if (EL_CHECK_DATE(EL_GET_DATA(sonid, mid)))
+        {
+            low = mid;
+        }
+        else
+        {
+            high = mid - 1;
+        }
+    }
+    areason_id = sonid;
+    data_id = low;
+    *address_p = EL_GET_DATA_ADDR(areason_id, data_id);
+    return EL_FIND_SUCCESS;
+}
+
 static el_flash_address_t el_get_nextwrite_address(eFIND_Status_Def status)
 {
     switch (status)
@@ -186,19 +250,98 @@ static el_flash_address_t el_get_nextwrite_address(eFIND_Status_Def status)
     }
 }
 
+/**
+ * @brief 查找日志头 (最新记录) 并缓存，之后 el_flash_read / el_flash_write 不再扫描
+ * @note  第一次读写时自动调用；状态区擦除后缓存失效，下次读写时重新查找
+ * @return 查找状态，与 el_flash_read 相同
+ */
+eFIND_Status_Def el_flash_mount(void)
+{
+    el_flash_address_t addr;
+
+    el_head_status = el_locate_latest_data_address(&addr);
+    el_mounted = 1;
+    return el_head_status;
+}
+
+/**
+ * @brief 逐个子区、逐个记录倒着查找日志头并缓存
+ * @note  el_flash_mount 遇到不按顺序写入的日志时也用它；
+ *        Tools/flash_bench 用它对比两种查找的开销
+ * @return 查找状态，与 el_flash_read 相同
+ */
+eFIND_Status_Def el_flash_scan(void)
+{
+    el_flash_address_t addr;
+
+    el_head_status = el_find_latest_data_address(&addr);
+    el_mounted = 1;
+    return el_head_status;
+}
+
+/**
+ * @brief 只读查找键值存储之前的格式 (el_legacy_data_t) 的最新记录，KV_Mount() 迁移用
+ * @note  逐个子区、逐个记录倒着查，记录表按旧记录的大小检查，与 EL_DATA_SIZE 无关；
+ *        不缓存日志头，也不擦除 (el_flash_read 遇到 EL_FIND_ERR 会擦除状态区)
+ * @param recv_date_p 最新的旧记录
+ * @return EL_FIND_SUCCESS，有子区在使用但没有旧记录返回 EL_FIND_ERR，空返回 EL_NOT_FOUND
+ */
+eFIND_Status_Def el_flash_read_legacy(el_legacy_data_t* recv_date_p)
+{
+    el_table_t              table;
+    const el_legacy_data_t *data_p;
+    int32_t                 sonid, dataid;
+    char                    havedata_flg = 0;
+
+    for (sonid = EL_AREA_SON_SUM; sonid > 0; sonid--)
+    {
+        table = EL_GET_TABLE(sonid);
+        if (!EL_SON_IS_USEING(table.map))
+        {
+            continue;
+        }
+        havedata_flg = 1;
+        if (!EL_LEGACY_CHECK_TABLE(table))
+        {
+            continue;
+        }
+        for (dataid = EL_LEGACY_SON2DATA_SUM; dataid > 0; dataid--)
+        {
+            data_p = (const el_legacy_data_t *)EL_GET_LEGACY_DATA_ADDR(sonid, dataid);
+            if (EL_CHECK_DATE(*data_p))
+            {
+                *recv_date_p = *data_p;
+                return EL_FIND_SUCCESS;
+            }
+        }
+    }
+    return (1 == havedata_flg) ? EL_FIND_ERR : EL_NOT_FOUND;
+}
+
 /**
  * @brief 将数据写入Flash存储器
- * 该函数首先查找最新的数据地址，然后计算下一个写入地址，并将数据写入Flash存储器。
+ * 该函数从缓存的日志头计算下一个写入地址，并将数据写入Flash存储器，新记录成为日志头。
  * @param save_data_p 指向要保存的数据的指针
  * @return 无
  */
 void el_flash_write(el_savedata_t* save_date_p) 
 {
     el_flash_address_t next_write_addr;
-    el_flash_address_t addr;
-  
-    next_write_addr = el_get_nextwrite_address(el_find_latest_data_address(&addr));
-    el_write_flash_data(next_write_addr, (uint32_t*)save_date_p, EL_DATA_SIZE);
+
+    if (0 == el_mounted)
+    {
+        el_flash_mount();
+    }
+    next_write_addr = el_get_nextwrite_address(el_head_status);   /* 写满时擦除 (缓存失效) */
+    if (FLASHIF_OK == el_write_flash_data(next_write_addr, (uint32_t*)save_date_p, EL_DATA_SIZE))
+    {
+        el_head_status = EL_FIND_SUCCESS;
+        el_mounted = 1;
+    }
+    else
+    {   /* 写入失败：下次读写时重新查找 */
+        el_mounted = 0;
+    }
 }
 
 /**
@@ -208,13 +351,17 @@ void el_flash_write(el_savedata_t* save_date_p)
  */
 eFIND_Status_Def el_flash_read(el_savedata_t* recv_date_p) 
 {
-    el_flash_address_t latest_addr;
     eFIND_Status_Def status;
 
-    status = el_find_latest_data_address(&latest_addr);    
+    if ((0 == el_mounted) ||
+        ((EL_FIND_SUCCESS == el_head_status) && !EL_CHECK_DATE(EL_GET_DATA(areason_id, data_id))))
+    {   /* 第一次读，或者缓存的记录已经不在了 */
+        el_flash_mount();
+    }
+    status = el_head_status;
     if(EL_FIND_SUCCESS == status)
     {
-        *recv_date_p =  *(el_savedata_t*)latest_addr;
+        *recv_date_p = EL_GET_DATA(areason_id, data_id);
         // memcpy(recv_date_p, latest_addr, sizeof(el_savedata_t)); // 使用 memcpy 复制数据
     }
     if (EL_FIND_ERR == status)
@@ -23,6 +23,10 @@
  * 依次写入新数据，不直接覆盖旧数据。
  * 读数据时，找到 最后一个有效数据 作为当前标志值。
  * 当整个块写满时，擦除整个块，然后从头开始。
+ * 查找最新数据 (el_flash_mount) 只在第一次读写时做一次：子区二分查找，map 用 CLZ 找最后
+ * 使用的记录组，组内再二分查找；之后读写直接用缓存的位置，擦除时缓存失效。
+ * 状态区现在由 kv_store.c 按键值记录使用，之前写入的记录 (el_legacy_data_t) 只在
+ * KV_Mount() 迁移旧的升级状态时由 el_flash_read_legacy() 只读查找。
  * 
  * 
  *  3. map 中某个bit是0表示 正在使用 或者 全部使用完
@@ -49,6 +53,18 @@ typedef struct
     el_map_size_t map;
     uint16_t dataSize;
 }el_table_t;
+
+/* 键值存储之前写入状态区的记录：iap_msg_t 16 字节 (两个 enum 各占 4 字节)，整条 24 字节。
+   KV_Mount() 迁移旧的升级状态时按这个格式读取，不随 save_data_t 改变 */
+typedef struct  
+{   
+    uint16_t header;
+    uint32_t status;            /* eIAP_Status_Def */
+    uint32_t transmitMethod;    /* eIAP_TransmitMethod_Def */
+    uint16_t version;
+    uint32_t size;
+    uint16_t ender;
+}el_legacy_data_t;
 #pragma pack(pop)  
 
 /* Exported macro ------------------------------------------------------------*/
@@ -60,6 +76,8 @@ typedef struct
 #define EL_DATA_SIZE                   (sizeof(el_savedata_t))                   /* 每次要存储的字节数（最好要跟flash写入的单位对应） */
 #define EL_SON2DATA_SUM                ((AREA_SON_SIZE - EL_TABLE_SIZE) / EL_DATA_SIZE)   /* 子区域中可以存储数据的总个数 */
 #define EL_MAP_BITS_SUM                (sizeof(el_map_size_t) * 8)
+#define EL_LEGACY_DATA_SIZE            (24u)                                     /* sizeof(el_legacy_data_t)，写在旧记录表中 */
+#define EL_LEGACY_SON2DATA_SUM         ((AREA_SON_SIZE - EL_TABLE_SIZE) / EL_LEGACY_DATA_SIZE)
 
 #define EL_MAP_BIT2DATA_SUM            \
     ((0 != (EL_SON2DATA_SUM % EL_MAP_BITS_SUM)) ? \
@@ -82,6 +100,9 @@ typedef struct
 #define EL_ID_2_ADDRID(id2addrIDX)      (id2addrIDX - 1)		
 #define EL_CHECK_DATE(data)             ((HEADER == (data).header) && (ENDER == (data).ender) ? 1 : 0)
 #define EL_CHECK_TABLE(table)           ((EL_DATA_SIZE == table.dataSize) ? 1 : 0)
+#define EL_LEGACY_CHECK_TABLE(table)    ((EL_LEGACY_DATA_SIZE == table.dataSize) ? 1 : 0)
+#define EL_GET_LEGACY_DATA_ADDR(sonid, dataid) \
+    ((el_flash_address_t)((EL_GET_SON_START_ADDR(sonid) + EL_TABLE_SIZE + ((dataid - 1) * EL_LEGACY_DATA_SIZE))))
 #define EL_SON_IS_USEING(map)           ((EL_AREA_SON_UNUSE_VALUE != map) ? 1 : 0)
 
 /* Exported variables --------------------------------------------------------*/
@@ -90,6 +111,9 @@ typedef struct
 /* Exported function prototypes ----------------------------------------------*/
 void el_flash_write(el_savedata_t* save_date_p);
 eFIND_Status_Def el_flash_read(el_savedata_t* recv_date_p);
+eFIND_Status_Def el_flash_mount(void);
+eFIND_Status_Def el_flash_scan(void);
+eFIND_Status_Def el_flash_read_legacy(el_legacy_data_t* recv_date_p);
 void el_test(void);
 
 #endif /* __FLASH_E_LEVEL_H */
@@ -40,17 +40,129 @@
   */
 
 /* Includes ------------------------------------------------------------------*/
+#include <string.h>
 #include "flash_if.h"
+#include "flash_async.h"
 #include "iap_user.h"
 /* Private typedef -----------------------------------------------------------*/
+/* Area erased sector by sector just ahead of the writes (end == 0: none) */
+typedef struct
+{
+  uint32_t start;         /* first address of the area */
+  uint32_t end;           /* end of the area */
+  uint32_t erased;        /* [start, erased) is erased */
+  uint32_t last_sector;   /* start of the sector erased last */
+  uint32_t written;       /* end of the highest write into the area */
+  uint32_t erasing;       /* end of the sector the async engine is erasing, 0: none */
+  uint8_t  failed;        /* an async erase failed */
+} FLASH_If_EraseAheadTypeDef;
+
 /* Private define ------------------------------------------------------------*/
 #define DEBUG_FLASH 1
 /* Private macro -------------------------------------------------------------*/
 /* Private variables ---------------------------------------------------------*/
+static FLASH_If_EraseAheadTypeDef EraseAhead;
+static FLASH_If_StatsTypeDef FlashStats;
+static uint8_t FlashSessionOpen;    /* FLASH_If_Open() called, controller unlocked */
 /* Private function prototypes -----------------------------------------------*/
+static HAL_StatusTypeDef FLASH_If_EraseAhead_Next(void);
+static void FLASH_If_EraseAhead_Done(const FLASH_Async_JobTypeDef *p_job);
+static HAL_StatusTypeDef FLASH_If_EraseAhead_Settle(void);
+static HAL_StatusTypeDef FLASH_If_EraseAhead_Cover(uint32_t address, uint32_t size);
 
 /* Private functions ---------------------------------------------------------*/
 
+/**
+  * @brief  Erases the next sector of the erase-ahead area
+  * @param  None
+  * @retval HAL_StatusTypeDef result of the erase
+  */
+static HAL_StatusTypeDef FLASH_If_EraseAhead_Next(void)
+{
+  const FLASH_Layout_SectorTypeDef *p_sector = FLASH_Layout_GetSector(EraseAhead.erased);
+
+  if (FLASH_If_Erase_Sector(p_sector->sector) != HAL_OK)
+  {
+    return HAL_TIMEOUT;
+  }
+  EraseAhead.last_sector = p_sector->start;
+  EraseAhead.erased = p_sector->start + p_sector->size;
+  return HAL_OK;
+}
+
+/**
+  * @brief  Completion of a sector erase started by FLASH_If_EraseAhead_Poll()
+  * @param  p_job: the erase job
+  * @retval None
+  */
+static void FLASH_If_EraseAhead_Done(const FLASH_Async_JobTypeDef *p_job)
+{
+  const FLASH_Layout_SectorTypeDef *p_sector = FLASH_Layout_GetSector(p_job->address);
+
+  EraseAhead.erasing = 0;
+  if (p_job->status != FLASHIF_OK)
+  {
+    EraseAhead.failed = 1;
+    return;
+  }
+  FlashStats.erased_sectors++;
+  EraseAhead.last_sector = p_sector->start;
+  EraseAhead.erased = p_sector->start + p_sector->size;
+}
+
+/**
+  * @brief  Waits for the async engine, the erase-ahead state is then current
+  * @param  None
+  * @retval HAL_OK, HAL_TIMEOUT if an async erase failed or did not end
+  */
+static HAL_StatusTypeDef FLASH_If_EraseAhead_Settle(void)
+{
+  if (FLASH_Async_Wait(FLASH_ASYNC_TIMEOUT_MS) != HAL_OK)
+  {
+    return HAL_TIMEOUT;
+  }
+  return (EraseAhead.failed != 0) ? HAL_TIMEOUT : HAL_OK;
+}
+
+/**
+  * @brief  Makes sure a range about to be written is erased
+  * @note   Erases synchronously when the writes overtake the erase-ahead
+  *         (nothing was idle long enough).
+  * @param  address: first address to be written
+  * @param  size: bytes to be written
+  * @retval HAL_StatusTypeDef result of the erase
+  */
+static HAL_StatusTypeDef FLASH_If_EraseAhead_Cover(uint32_t address, uint32_t size)
+{
+  uint32_t end = address + size;
+
+  if ((EraseAhead.end == 0) || (address >= EraseAhead.end) || (end <= EraseAhead.start))
+  {
+    return HAL_OK;
+  }
+  if (end > EraseAhead.end)
+  {
+    end = EraseAhead.end;
+  }
+  if (end > EraseAhead.written)
+  {
+    EraseAhead.written = end;
+  }
+  /* the sector may still be erasing in the background */
+  if (FLASH_If_EraseAhead_Settle() != HAL_OK)
+  {
+    return HAL_TIMEOUT;
+  }
+  while (EraseAhead.erased < end)
+  {
+    if (FLASH_If_EraseAhead_Next() != HAL_OK)
+    {
+      return HAL_TIMEOUT;
+    }
+  }
+  return HAL_OK;
+}
+
 /**
   * @brief  Unlocks Flash for write access
   * @param  None
@@ -78,82 +190,466 @@ void FLASH_If_Init(void)
  */
 HAL_StatusTypeDef FLASH_If_Erase_App_Space(void)
 {
-#if DEBUG_FLASH
-  /* Unlock the Flash to enable the flash control register access *************/ 
-  HAL_FLASH_Unlock();
+	return FLASH_If_Erase_Range(APPLICATION_ADDRESS, USER_FLASH_SIZE);
+}
 
-	if(HAL_OK != FLASH_WaitForLastOperation(FlASH_WAIT_TIMEMS))
+/**
+ * @brief  Erases the backup space (delta update staging) in the FLASH memory.
+ * @return HAL_StatusTypeDef
+ *         - HAL_OK: if the erase operation is successful.
+ *         - HAL_TIMEOUT: if any FLASH operation times out.
+ */
+HAL_StatusTypeDef FLASH_If_Erase_Backup_Space(void)
+{
+	return FLASH_If_Erase_Range(BACKUP_ADDRESS, BACKUP_FLASH_SIZE);
+}
+
+/**
+ * @brief  Erases one sector of the FLASH memory.
+ * @param  sector: FLASH_SECTOR_x
+ * @return HAL_StatusTypeDef
+ *         - HAL_OK: if the erase operation is successful.
+ *         - HAL_ERROR: if the sector does not exist.
+ *         - HAL_TIMEOUT: if any FLASH operation times out.
+ */
+HAL_StatusTypeDef FLASH_If_Erase_Sector(uint32_t sector)
+{
+	const FLASH_Layout_SectorTypeDef *p_sector = FLASH_Layout_GetSectorByIndex(sector);
+
+	if (p_sector == NULL)
+	{
+		return HAL_ERROR;
+	}
+	return FLASH_If_Erase_Range(p_sector->start, p_sector->size);
+}
+
+/**
+ * @brief  Erases the sectors covering [start, start + size).
+ * @note   Only the sectors the range touches are erased, a 30 KB image
+ *         erases sector 4 (64 KB) instead of the whole application space.
+ *         The bootloader sectors are never erased.
+ * @param  start: first address of the range
+ * @param  size: length of the range in bytes, 0 erases nothing
+ * @return HAL_StatusTypeDef
+ *         - HAL_OK: if the erase operation is successful.
+ *         - HAL_ERROR: if the range is outside the FLASH memory, touches
+ *           the bootloader, or the controller could not be unlocked.
+ *         - HAL_TIMEOUT: if any FLASH operation times out.
+ */
+HAL_StatusTypeDef FLASH_If_Erase_Range(uint32_t start, uint32_t size)
+{
+	uint32_t sectors = FLASH_Layout_SectorMask(start, size);
+	uint32_t sector;
+	HAL_StatusTypeDef status = HAL_OK;
+	uint8_t own_session;
+
+	if (size == 0)
+	{
+		return HAL_OK;
+	}
+	if ((sectors == 0) || ((sectors & FLASH_Layout_GetRegion(FLASH_REGION_BOOTLOADER)->sector_mask) != 0))
+	{
+		return HAL_ERROR;
+	}
+#if DEBUG_FLASH
+	/* the async engine must be idle before the controller is used here */
+	if (FLASH_Async_Wait(FLASH_ASYNC_TIMEOUT_MS) != HAL_OK)
 	{
 		return HAL_TIMEOUT;
 	}
-  for(char i = APP_START_SECTOR; i <= APP_END_SECTOR; i++)
-  {
+	/* inside a session the flash stays unlocked */
+	own_session = (FlashSessionOpen == 0) ? 1 : 0;
+	if (FLASH_If_Open() != HAL_OK)
+	{
+		return HAL_ERROR;
+	}
+
+	status = FLASH_WaitForLastOperation(FlASH_WAIT_TIMEMS);
+	for (sector = 0; (status == HAL_OK) && (sector < FLASH_LAYOUT_SECTOR_COUNT); sector++)
+	{
+		if ((sectors & (1u << sector)) == 0)
+		{
+			continue;
+		}
     /* Device voltage range supposed to be [2.7V to 3.6V], the operation will
        be done by word */ 
-
-		FLASH_Erase_Sector(i, FLASH_VOLTAGE_RANGE_3);
-		if(HAL_OK != FLASH_WaitForLastOperation(FlASH_WAIT_TIMEMS))
+		FLASH_Erase_Sector(sector, FLASH_VOLTAGE_RANGE_3);
+		status = FLASH_WaitForLastOperation(FlASH_WAIT_TIMEMS);
+		CLEAR_BIT(FLASH->CR, (FLASH_CR_SER | FLASH_CR_SNB));
+		if (status == HAL_OK)
 		{
-			return HAL_TIMEOUT;
+			FlashStats.erased_sectors++;
 		}
-  }
-  /* Lock the Flash to disable the flash control register access (recommended
-     to protect the FLASH memory against possible unwanted operation) *********/
-  HAL_FLASH_Lock();
-	return HAL_OK;
+	}
+	if (own_session != 0)
+	{
+		FLASH_If_Close();
+	}
+#else
+	(void)sector;
+	(void)own_session;
 #endif
+	return (status == HAL_OK) ? HAL_OK : HAL_TIMEOUT;
 }
 
+/**
+ * @brief  Starts erasing an area progressively instead of all at once.
+ * @note   Nothing is erased here. FLASH_If_EraseAhead_Poll() erases one
+ *         sector ahead of the write pointer while the transport is idle, and
+ *         FLASH_If_Write() erases whatever it is about to write into if the
+ *         poll did not get there first. FLASH_If_EraseAhead_End() erases the
+ *         rest, the area then holds the same content as after an erase-all.
+ *         Single flash bank: the total erase time is unchanged, a write into
+ *         a sector still waits for its erase (see flash_if.h).
+ * @param  start: first address of the area (sector aligned)
+ * @param  size: length of the area in bytes
+ * @return HAL_StatusTypeDef
+ *         - HAL_OK: if the area is valid.
+ *         - HAL_ERROR: if the area is outside the FLASH memory.
+ */
+HAL_StatusTypeDef FLASH_If_EraseAhead_Begin(uint32_t start, uint32_t size)
+{
+	/* an erase of the previous area must not update the new one */
+	FLASH_If_EraseAhead_Settle();
+	EraseAhead.end = 0;
+	EraseAhead.failed = 0;
+	if (FLASH_Layout_SectorMask(start, size) == 0)
+	{
+		return (size == 0) ? HAL_OK : HAL_ERROR;
+	}
+	EraseAhead.start = start;
+	EraseAhead.erased = start;
+	EraseAhead.last_sector = start;
+	EraseAhead.written = start;
+	EraseAhead.end = start + size;
+	return HAL_OK;
+}
 
+/**
+ * @brief  Tells whether a sector erase is running or the next poll starts one.
+ * @note   A sector is erased when nothing is erased yet, or when the writes
+ *         have entered the sector erased last.
+ * @return 1 if the next write has to wait for an erase (up to a second or
+ *         two), 0 otherwise
+ */
+uint8_t FLASH_If_EraseAhead_Pending(void)
+{
+	return ((EraseAhead.erasing != 0) ||
+	        ((EraseAhead.end != 0) && (EraseAhead.erased < EraseAhead.end) &&
+	         ((EraseAhead.erased == EraseAhead.start) || (EraseAhead.written > EraseAhead.last_sector)))) ? 1 : 0;
+}
+
+/**
+ * @brief  Bytes of the erase-ahead area not erased yet.
+ * @return 0 when everything is erased or no erase-ahead is running
+ */
+uint32_t FLASH_If_EraseAhead_Left(void)
+{
+	return (EraseAhead.end != 0) ? (EraseAhead.end - EraseAhead.erased) : 0;
+}
+
+/**
+ * @brief  Erases the next sector of the area if the writes are getting close.
+ * @note   Call while waiting for the transport (IAP_Interface IdleFunction).
+ *         The erase runs on the async engine (flash_async.c), the call
+ *         returns at once and a later poll or write picks up the result.
+ * @return HAL_StatusTypeDef
+ *         - HAL_OK: nothing to do, erase started or finished.
+ *         - HAL_TIMEOUT: if any FLASH operation failed or timed out.
+ */
+HAL_StatusTypeDef FLASH_If_EraseAhead_Poll(void)
+{
+	const FLASH_Layout_SectorTypeDef *p_sector;
+
+	/* result of the erase started by an earlier poll */
+	FLASH_Async_Poll();
+	if (EraseAhead.failed != 0)
+	{
+		return HAL_TIMEOUT;
+	}
+	if ((EraseAhead.erasing != 0) || (FLASH_If_EraseAhead_Pending() == 0))
+	{
+		return HAL_OK;
+	}
+	p_sector = FLASH_Layout_GetSector(EraseAhead.erased);
+	EraseAhead.erasing = p_sector->start + p_sector->size;
+	if (FLASH_Async_Submit(FLASH_ASYNC_OP_ERASE, p_sector->start, NULL, 0, FLASH_If_EraseAhead_Done) != HAL_OK)
+	{
+		/* queue full: erase here */
+		EraseAhead.erasing = 0;
+		return FLASH_If_EraseAhead_Next();
+	}
+	return HAL_OK;
+}
+
+/**
+ * @brief  Erases the rest of the area and stops the erase-ahead.
+ * @note   Call on every exit of a download (also on errors) so that the
+ *         area looks exactly as with FLASH_If_Erase_Range().
+ * @return HAL_StatusTypeDef
+ *         - HAL_OK: if the erase operation is successful.
+ *         - HAL_TIMEOUT: if any FLASH operation times out.
+ */
+HAL_StatusTypeDef FLASH_If_EraseAhead_End(void)
+{
+	HAL_StatusTypeDef status = FLASH_If_EraseAhead_Settle();
+
+	while ((EraseAhead.end != 0) && (EraseAhead.erased < EraseAhead.end) && (status == HAL_OK))
+	{
+		status = FLASH_If_EraseAhead_Next();
+	}
+	EraseAhead.end = 0;
+	return status;
+}
 
 
 /* Public functions ---------------------------------------------------------*/
+/**
+  * @brief  Opens a programming session: unlocks the flash controller once
+  *         for a whole transfer.
+  * @note   FLASH_If_Write and the erase functions called inside the session
+  *         leave the controller unlocked. FLASH_If_Close() must be called on
+  *         every exit path of the transfer. Opening twice does nothing.
+  * @param  None
+  * @retval HAL_OK, HAL_ERROR if the controller could not be unlocked or the
+  *         async engine did not finish
+  */
+HAL_StatusTypeDef FLASH_If_Open(void)
+{
+  if (FlashSessionOpen == 0)
+  {
+    /* the engine relocks the controller when its queue drains */
+    if ((FLASH_Async_Wait(FLASH_ASYNC_TIMEOUT_MS) != HAL_OK) || (HAL_FLASH_Unlock() != HAL_OK))
+    {
+      return HAL_ERROR;
+    }
+    /* errors of earlier operations would fail the first program */
+    __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP | FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR |
+                           FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR);
+    FlashSessionOpen = 1;
+  }
+  return HAL_OK;
+}
+
+/**
+  * @brief  Closes the programming session, the controller is always locked
+  *         again (also when no session is open).
+  * @param  None
+  * @retval None
+  */
+void FLASH_If_Close(void)
+{
+  FLASH_Async_Wait(FLASH_ASYNC_TIMEOUT_MS);
+  CLEAR_BIT(FLASH->CR, FLASH_CR_PG);
+  HAL_FLASH_Lock();
+  FlashSessionOpen = 0;
+}
+
+/**
+  * @brief  Tells whether a programming session is open.
+  * @param  None
+  * @retval 1 between FLASH_If_Open() and FLASH_If_Close(), 0 otherwise
+  */
+uint8_t FLASH_If_IsOpen(void)
+{
+  return FlashSessionOpen;
+}
+
+/**
+  * @brief  Programs a run of words, the session must be open.
+  * @note   PG stays set for the whole run and each word is a single store
+  *         (a store while the previous word is still being programmed
+  *         stalls the bus until it is done), the error flags are checked
+  *         once at the end. Words that already hold the value are not
+  *         programmed. The result is not read back: see FLASH_If_Verify.
+  * @param  destination: start address for target location
+  * @param  p_source: pointer on buffer with data to write
+  * @param  length: length of data buffer (unit is 32-bit word)
+  * @retval FLASHIF_OK, FLASHIF_WRITING_ERROR (no session, programming error)
+  */
+uint32_t FLASH_If_Program(uint32_t destination, const uint32_t *p_source, uint32_t length)
+{
+  uint32_t i;
+  HAL_StatusTypeDef status;
+
+  if ((FlashSessionOpen == 0) || (FLASH_Async_Wait(FLASH_ASYNC_TIMEOUT_MS) != HAL_OK) ||
+      (FLASH_WaitForLastOperation(FlASH_WAIT_TIMEMS) != HAL_OK))
+  {
+    return (FLASHIF_WRITING_ERROR);
+  }
+  /* Device voltage range supposed to be [2.7V to 3.6V], the operation will
+     be done by word */
+  CLEAR_BIT(FLASH->CR, FLASH_CR_PSIZE);
+  SET_BIT(FLASH->CR, FLASH_PSIZE_WORD | FLASH_CR_PG);
+  for (i = 0; i < length; i++)
+  {
+    /* Compare before write: nothing to program */
+    if (*(__IO uint32_t*)destination != p_source[i])
+    {
+      *(__IO uint32_t*)destination = p_source[i];
+      FlashStats.programmed_words++;
+    }
+    else
+    {
+      FlashStats.skipped_words++;
+    }
+    destination += 4;
+  }
+  status = FLASH_WaitForLastOperation(FlASH_WAIT_TIMEMS);
+  CLEAR_BIT(FLASH->CR, FLASH_CR_PG);
+
+  return (status == HAL_OK) ? FLASHIF_OK : FLASHIF_WRITING_ERROR;
+}
+
+/**
+  * @brief  Checks a programmed range in one compare pass.
+  * @param  destination: start address of the programmed range
+  * @param  p_source: data that was programmed
+  * @param  length: length of data buffer (unit is 32-bit word)
+  * @retval FLASHIF_OK, FLASHIF_WRITINGCTRL_ERROR if the flash content differs
+  */
+uint32_t FLASH_If_Verify(uint32_t destination, const uint32_t *p_source, uint32_t length)
+{
+  if (memcmp((const void *)destination, p_source, length * 4) != 0)
+  {
+    /* Flash content doesn't match SRAM content */
+    return (FLASHIF_WRITINGCTRL_ERROR);
+  }
+  return (FLASHIF_OK);
+}
+
 /**
   * @brief  This function writes a data buffer in flash (data are 32-bit aligned).
-  * @note   After writing data buffer, the flash content is checked.
+  * @note   After writing data buffer, the flash content is checked. Inside an
+  *         erase-ahead area the sectors written are erased first. Words that
+  *         already hold the value (0xFFFFFFFF padding in an erased sector,
+  *         unchanged words) are not programmed. Outside a session the flash
+  *         is unlocked and locked again here, on every path.
   * @param  destination: start address for target location
   * @param  p_source: pointer on buffer with data to write
   * @param  length: length of data buffer (unit is 32-bit word)
   * @retval uint32_t 0: Data successfully written to Flash memory
   *         1: Error occurred while writing data in Flash memory
   *         2: Written Data in flash memory is different from expected one
+  *         FLASHIF_ERASEKO: the erase-ahead failed
   */
 uint32_t FLASH_If_Write(uint32_t destination, uint32_t *p_source, uint32_t length)
 {
-  uint32_t i = 0;
+  uint32_t status = FLASHIF_OK;
+  uint8_t own_session;
+
+  /* erase-ahead area: the sectors written must be erased first */
+  if (FLASH_If_EraseAhead_Cover(destination, length * 4) != HAL_OK)
+  {
+    return (FLASHIF_ERASEKO);
+  }
+  if (length > (FLASH_LAYOUT_END - destination) / 4)
+  {
+    length = (FLASH_LAYOUT_END - destination) / 4;
+  }
 #if DEBUG_FLASH
   /* Unlock the Flash to enable the flash control register access *************/
-  HAL_FLASH_Unlock();
+  own_session = (FlashSessionOpen == 0) ? 1 : 0;
+  if (FLASH_If_Open() != HAL_OK)
+  {
+    return (FLASHIF_WRITING_ERROR);
+  }
 
-  for (i = 0; (i < length) && (destination <= (USER_FLASH_END_ADDRESS-4)); i++)
+  status = FLASH_If_Program(destination, p_source, length);
+  if (status == FLASHIF_OK)
   {
-    /* Device voltage range supposed to be [2.7V to 3.6V], the operation will
-       be done by word */ 
-    if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, destination, *(uint32_t*)(p_source+i)) == HAL_OK)      
+    status = FLASH_If_Verify(destination, p_source, length);
+  }
+
+  /* Lock the Flash to disable the flash control register access (recommended
+     to protect the FLASH memory against possible unwanted operation) *********/
+  if (own_session != 0)
+  {
+    FLASH_If_Close();
+  }
+#else
+  (void)own_session;
+#endif
+  return status;
+}
+
+/**
+  * @brief  Updates a flash area in place, sector by sector.
+  * @note   A sector whose content already matches the data is neither erased
+  *         nor programmed. Otherwise the sector is erased and the data is
+  *         written with FLASH_If_Write (0xFFFFFFFF words skipped). The source
+  *         must not lie in the area (e.g. the Backup region or RAM).
+  *         destination must be sector aligned, the rest of the last sector
+  *         is left erased if it had to be rewritten.
+  * @param  destination: start address for target location
+  * @param  p_source: pointer on buffer with data to write
+  * @param  length: length of data buffer (unit is 32-bit word)
+  * @retval FLASHIF_OK, FLASHIF_ERASEKO or the FLASH_If_Write error
+  */
+uint32_t FLASH_If_Update(uint32_t destination, const uint32_t *p_source, uint32_t length)
+{
+  const FLASH_Layout_SectorTypeDef *p_sector;
+  uint32_t end = destination + length * 4;
+  uint32_t chunk_end, words, status;
+
+  while (destination < end)
+  {
+    p_sector = FLASH_Layout_GetSector(destination);
+    if (p_sector == NULL)
     {
-     /* Check the written value */
-      if (*(uint32_t*)destination != *(uint32_t*)(p_source+i))
-      {
-        /* Flash content doesn't match SRAM content */
-        return(FLASHIF_WRITINGCTRL_ERROR);
-      }
-      /* Increment FLASH destination address */
-      destination += 4;
+      return (FLASHIF_WRITING_ERROR);
+    }
+    chunk_end = p_sector->start + p_sector->size;
+    if (chunk_end > end)
+    {
+      chunk_end = end;
+    }
+    words = (chunk_end - destination) / 4;
+
+    if (memcmp((const void *)destination, p_source, chunk_end - destination) == 0)
+    {
+      FlashStats.skipped_sectors++;
+      FlashStats.skipped_words += words;
     }
     else
     {
-      /* Error occurred while writing data in Flash memory */
-      return (FLASHIF_WRITING_ERROR);
+      if (FLASH_If_Erase_Sector(p_sector->sector) != HAL_OK)
+      {
+        return (FLASHIF_ERASEKO);
+      }
+      status = FLASH_If_Write(destination, (uint32_t *)p_source, words);
+      if (status != FLASHIF_OK)
+      {
+        return status;
+      }
     }
+    destination = chunk_end;
+    p_source += words;
   }
-
-  /* Lock the Flash to disable the flash control register access (recommended
-     to protect the FLASH memory against possible unwanted operation) *********/
-  HAL_FLASH_Lock();
-#endif
   return (FLASHIF_OK);
 }
 
+/**
+  * @brief  Programming statistics (words programmed / skipped, sectors
+  *         erased / skipped) since FLASH_If_ResetStats().
+  * @param  None
+  * @retval pointer to the statistics
+  */
+const FLASH_If_StatsTypeDef *FLASH_If_GetStats(void)
+{
+  return &FlashStats;
+}
+
+/**
+  * @brief  Clears the programming statistics, call at the start of a download.
+  * @param  None
+  * @retval None
+  */
+void FLASH_If_ResetStats(void)
+{
+  memset(&FlashStats, 0, sizeof(FlashStats));
+}
+
 /**
   * @brief  Returns the write protection status of application flash area.
   * @param  None
@@ -0,0 +1,140 @@
+/******************************************************************************
+ * @file    flash_layout.c
+ * @brief   STM32F207xE flash sector geometry and region map.
+ * @author  Jason
+ * @version V1.0.0
+ * @date    2025-3
+ * @copyright (c) 2025, All rights reserved.
+ ******************************************************************************/
+
+/* Includes ------------------------------------------------------------------*/
+#include "flash_layout.h"
+
+/* Private typedef -----------------------------------------------------------*/
+
+/* Private define ------------------------------------------------------------*/
+#define FLASH_LAYOUT_GRAIN_COUNT    (FLASH_LAYOUT_SIZE >> FLASH_LAYOUT_GRAIN_SHIFT)
+
+/* Private macro -------------------------------------------------------------*/
+#define FLASH_LAYOUT_SECTOR(n)          { (n), FLASH_LAYOUT_SECTOR_START(n), FLASH_LAYOUT_SECTOR_SIZE(n) }
+#define FLASH_LAYOUT_REGION(first, last)                                      \
+    { FLASH_LAYOUT_SECTOR_START(first), FLASH_LAYOUT_RANGE_SIZE(first, last), \
+      (first), (last), FLASH_LAYOUT_RANGE_MASK(first, last) }
+
+/* Private variables ---------------------------------------------------------*/
+static const FLASH_Layout_SectorTypeDef aFlashSectors[FLASH_LAYOUT_SECTOR_COUNT] =
+{
+  FLASH_LAYOUT_SECTOR(FLASH_SECTOR_0),
+  FLASH_LAYOUT_SECTOR(FLASH_SECTOR_1),
+  FLASH_LAYOUT_SECTOR(FLASH_SECTOR_2),
+  FLASH_LAYOUT_SECTOR(FLASH_SECTOR_3),
+  FLASH_LAYOUT_SECTOR(FLASH_SECTOR_4),
+  FLASH_LAYOUT_SECTOR(FLASH_SECTOR_5),
+  FLASH_LAYOUT_SECTOR(FLASH_SECTOR_6),
+  FLASH_LAYOUT_SECTOR(FLASH_SECTOR_7),
+};
+
+/* 每 16 KB 所在的扇区，地址 -> 扇区只需一次移位和一次查表 */
+static const uint8_t aGrainSector[FLASH_LAYOUT_GRAIN_COUNT] =
+{
+  0, 1, 2, 3,                     /* 16 KB */
+  4, 4, 4, 4,                     /* 64 KB */
+  5, 5, 5, 5, 5, 5, 5, 5,         /* 128 KB */
+  6, 6, 6, 6, 6, 6, 6, 6,
+  7, 7, 7, 7, 7, 7, 7, 7,
+};
+
+static const FLASH_Layout_RegionTypeDef aFlashRegions[FLASH_REGION_COUNT] =
+{
+  FLASH_LAYOUT_REGION(FLASH_LAYOUT_BOOT_FIRST,   FLASH_LAYOUT_BOOT_LAST),
+  FLASH_LAYOUT_REGION(FLASH_LAYOUT_STATUS_FIRST, FLASH_LAYOUT_STATUS_LAST),
+  FLASH_LAYOUT_REGION(FLASH_LAYOUT_APP_FIRST,    FLASH_LAYOUT_APP_LAST),
+  FLASH_LAYOUT_REGION(FLASH_LAYOUT_BACKUP_FIRST, FLASH_LAYOUT_BACKUP_LAST),
+#if FLASH_LAYOUT_STATUS_BANKS > 1
+  FLASH_LAYOUT_REGION(FLASH_LAYOUT_STATUS_B_FIRST, FLASH_LAYOUT_STATUS_B_LAST),
+#endif
+};
+
+/* Private function prototypes -----------------------------------------------*/
+
+/* Private functions ---------------------------------------------------------*/
+
+/* Public functions ----------------------------------------------------------*/
+/**
+ * @brief  查找地址所在的扇区
+ * @param  address: FLASH 地址
+ * @retval 扇区描述，地址不在 FLASH 中时返回 NULL
+ */
+const FLASH_Layout_SectorTypeDef *FLASH_Layout_GetSector(uint32_t address)
+{
+  uint32_t offset = address - FLASH_LAYOUT_BASE;
+
+  if (offset >= FLASH_LAYOUT_SIZE)
+  {
+    return NULL;
+  }
+  return &aFlashSectors[aGrainSector[offset >> FLASH_LAYOUT_GRAIN_SHIFT]];
+}
+
+/**
+ * @brief  按编号取扇区描述
+ * @param  sector: FLASH_SECTOR_x
+ * @retval 扇区描述，扇区不存在时返回 NULL
+ */
+const FLASH_Layout_SectorTypeDef *FLASH_Layout_GetSectorByIndex(uint32_t sector)
+{
+  return (sector < FLASH_LAYOUT_SECTOR_COUNT) ? &aFlashSectors[sector] : NULL;
+}
+
+/**
+ * @brief  一段地址 [start, start + size) 覆盖的扇区集合
+ * @param  start: 起始地址
+ * @param  size: 字节数
+ * @retval bit n 为 1 表示扇区 n 被覆盖；size 为 0 或超出 FLASH 时返回 0
+ */
+uint32_t FLASH_Layout_SectorMask(uint32_t start, uint32_t size)
+{
+  const FLASH_Layout_SectorTypeDef *p_first = FLASH_Layout_GetSector(start);
+
+  if ((size == 0) || (p_first == NULL) || (size > FLASH_LAYOUT_END - start))
+  {
+    return 0;
+  }
+  return FLASH_LAYOUT_RANGE_MASK(p_first->sector, FLASH_Layout_GetSector(start + size - 1u)->sector);
+}
+
+/**
+ * @brief  取分区描述
+ * @param  region: FLASH_REGION_xxx
+ * @retval 分区描述，编号无效时返回 NULL
+ */
+const FLASH_Layout_RegionTypeDef *FLASH_Layout_GetRegion(FLASH_Layout_RegionIdTypeDef region)
+{
+  return ((uint32_t)region < FLASH_REGION_COUNT) ? &aFlashRegions[region] : NULL;
+}
+
+/**
+ * @brief  查找地址所在的分区
+ * @param  address: FLASH 地址
+ * @retval 分区描述，地址不在任何分区中时返回 NULL
+ */
+const FLASH_Layout_RegionTypeDef *FLASH_Layout_FindRegion(uint32_t address)
+{
+  const FLASH_Layout_SectorTypeDef *p_sector = FLASH_Layout_GetSector(address);
+  uint32_t i;
+
+  if (p_sector == NULL)
+  {
+    return NULL;
+  }
+  for (i = 0; i < FLASH_REGION_COUNT; i++)
+  {
+    if ((aFlashRegions[i].sector_mask & (1u << p_sector->sector)) != 0)
+    {
+      return &aFlashRegions[i];
+    }
+  }
+  return NULL;
+}
+
+/************************ (C) COPYRIGHT Jason *****END OF FILE****/
@@ -0,0 +1,140 @@
+/******************************************************************************
+ * @file    flash_layout.h
+ * @brief   STM32F207xE flash sector geometry and region map.
+ * @author  Jason
+ * @version V1.0.0
+ * @date    2025-3
+ * @copyright (c) 2025, All rights reserved.
+ ******************************************************************************/
+
+#ifndef __FLASH_LAYOUT_H
+#define __FLASH_LAYOUT_H
+
+/* Private Includes ----------------------------------------------------------*/
+#include "stm32f2xx_hal.h"
+
+/* Flash Memory Layout -------------------------------------------------------
++--------------+------------+----------------------------+-----------+----------------------------+
+| Flash Region | Name       | Block Base Addresses       | Size      | Comment                    |
++--------------+------------+----------------------------+-----------+----------------------------+
+| Main Memory  | Sector 0   | 0x0800 0000 - 0x0800 3FFF  | 16 Kbyte  | Bootloader    48 KB        |
+|              | Sector 1   | 0x0800 4000 - 0x0800 7FFF  | 16 Kbyte  |                            |
+|              | Sector 2   | 0x0800 8000 - 0x0800 BFFF  | 16 Kbyte  |                            |
+|              +------------+----------------------------+-----------+----------------------------+
+|              | Sector 3   | 0x0800 C000 - 0x0800 FFFF  | 16 Kbyte  | Upgrade flag storage 16 KB |
+|              +------------+----------------------------+-----------+----------------------------+
+|              | Sector 4   | 0x0801 0000 - 0x0801 FFFF  | 64 Kbyte  | App1          192 KB       |
+|              | Sector 5   | 0x0802 0000 - 0x0803 FFFF  | 128 Kbyte |                            |
+|              +------------+----------------------------+-----------+----------------------------+
+|              | Sector 6   | 0x0804 0000 - 0x0805 FFFF  | 128 Kbyte | Backup        256 KB       |
+|              | Sector 7   | 0x0806 0000 - 0x0807 FFFF  | 128 Kbyte | (last 64 KB: status stage) |
++--------------+------------+----------------------------+-----------+----------------------------+
+FLASH_LAYOUT_STATUS_BANKS = 1: the last 64 KB of sector 7 stage the status during a compaction,
+  the Backup image is limited to the first 192 KB.
+FLASH_LAYOUT_STATUS_BANKS = 2: sector 7 is upgrade flag bank B, Backup is sector 6 only (128 KB).
+------------------------------------------------------------------------------*/
+
+/**
+ * 扇区几何和分区只在这里定义一次，其它模块 (iap_user.h 的地址/大小、擦除、校验、均衡磨损)
+ * 都从这里取值：
+ *  - 编译期：FLASH_LAYOUT_SECTOR_START(n) / FLASH_LAYOUT_SECTOR_SIZE(n) 和各分区的首/末扇区
+ *  - 运行期：FLASH_Layout_GetSector() 按 16 KB 粒度查表，O(1) 找到地址所在扇区；
+ *    FLASH_Layout_SectorMask() 给出一段地址覆盖的扇区集合 (bit n = 扇区 n)；
+ *    FLASH_Layout_GetRegion() / FLASH_Layout_FindRegion() 返回分区描述
+ * 换芯片或调整分区时只改这个文件和 flash_layout.c 的两张表。
+ */
+/* Exported constants --------------------------------------------------------*/
+#define FLASH_LAYOUT_BASE             ((uint32_t)0x08000000)
+#define FLASH_LAYOUT_SIZE             ((uint32_t)0x00080000)   /* STM32F207xE, 512 KB */
+#define FLASH_LAYOUT_END              (FLASH_LAYOUT_BASE + FLASH_LAYOUT_SIZE)
+#define FLASH_LAYOUT_SECTOR_COUNT     (8u)
+#define FLASH_LAYOUT_GRAIN_SHIFT      (14u)                    /* 16 KB, smallest sector */
+
+/* 状态区的扇区数，默认 1。2 时状态区在 Sector 3 和 Sector 7 之间乒乓 (kv_store.c)，
+   压缩写到另一个扇区，旧扇区空闲时再擦除；代价是 Backup 只剩 Sector 6 (128 KB)，
+   差分 / 分块升级的新镜像不能超过 128 KB，而且空闲时擦除 128 KB 的 Sector 7 要 1~2 s，
+   不开 IAP_RAM_EXEC 时这段时间 CPU 停在取指上。只在镜像不超过 128 KB 且 IAP_RAM_EXEC = 1 时打开 */
+#ifndef FLASH_LAYOUT_STATUS_BANKS
+#define FLASH_LAYOUT_STATUS_BANKS     (1u)
+#endif
+
+/* Region sectors (FLASH_SECTOR_x) */
+#define FLASH_LAYOUT_BOOT_FIRST       FLASH_SECTOR_0           /* Bootloader */
+#define FLASH_LAYOUT_BOOT_LAST        FLASH_SECTOR_2
+#define FLASH_LAYOUT_STATUS_FIRST     FLASH_SECTOR_3           /* IAP status (wear leveling) */
+#define FLASH_LAYOUT_STATUS_LAST      FLASH_SECTOR_3
+#define FLASH_LAYOUT_APP_FIRST        FLASH_SECTOR_4           /* App1 */
+#define FLASH_LAYOUT_APP_LAST         FLASH_SECTOR_5
+#define FLASH_LAYOUT_BACKUP_FIRST     FLASH_SECTOR_6           /* Backup / delta staging */
+#if FLASH_LAYOUT_STATUS_BANKS > 1
+#define FLASH_LAYOUT_BACKUP_LAST      FLASH_SECTOR_6
+#define FLASH_LAYOUT_STATUS_B_FIRST   FLASH_SECTOR_7           /* IAP status, second bank */
+#define FLASH_LAYOUT_STATUS_B_LAST    FLASH_SECTOR_7
+#else
+#define FLASH_LAYOUT_BACKUP_LAST      FLASH_SECTOR_7
+#endif
+
+/* 只有一个状态扇区时，压缩前先把有效的值写到 Sector 7 末尾的暂存区 (kv_store.c)，提交后才擦除 Sector 3，
+   擦除到重新提交之间掉电也能从暂存区恢复。暂存区属于 Backup 的扇区 (擦除 Backup 时一起擦掉，那时已经不需要)，
+   但不放镜像：Backup 可用 192 KB，正好是 App1 的大小 */
+#if FLASH_LAYOUT_STATUS_BANKS > 1
+#define FLASH_LAYOUT_STATUS_STAGE_SIZE  (0u)
+#else
+#define FLASH_LAYOUT_STATUS_STAGE_SIZE  (0x10000u)
+#endif
+
+/* Exported types ------------------------------------------------------------*/
+/* Geometry of one Flash sector */
+typedef struct
+{
+  uint32_t sector;    /* FLASH_SECTOR_x */
+  uint32_t start;     /* first address */
+  uint32_t size;      /* bytes */
+} FLASH_Layout_SectorTypeDef;
+
+typedef enum
+{
+  FLASH_REGION_BOOTLOADER,
+  FLASH_REGION_STATUS,
+  FLASH_REGION_APP,
+  FLASH_REGION_BACKUP,
+#if FLASH_LAYOUT_STATUS_BANKS > 1
+  FLASH_REGION_STATUS_B,
+#endif
+  FLASH_REGION_COUNT
+} FLASH_Layout_RegionIdTypeDef;
+
+/* A run of whole sectors with one purpose */
+typedef struct
+{
+  uint32_t start;         /* first address */
+  uint32_t size;          /* bytes */
+  uint32_t first_sector;  /* FLASH_SECTOR_x */
+  uint32_t last_sector;   /* FLASH_SECTOR_x */
+  uint32_t sector_mask;   /* bit n: sector n belongs to the region */
+} FLASH_Layout_RegionTypeDef;
+
+/* Exported macro ------------------------------------------------------------*/
+/* 4 x 16 KB, 1 x 64 KB, 3 x 128 KB; n == FLASH_LAYOUT_SECTOR_COUNT gives the end of the flash */
+#define FLASH_LAYOUT_SECTOR_START(n)                                          \
+    (((n) < 4u) ? (FLASH_LAYOUT_BASE + 0x4000u * (n)) :                       \
+     ((n) == 4u) ? (FLASH_LAYOUT_BASE + 0x10000u) :                           \
+     (FLASH_LAYOUT_BASE + 0x20000u * ((n) - 4u)))
+#define FLASH_LAYOUT_SECTOR_SIZE(n)   (FLASH_LAYOUT_SECTOR_START((n) + 1u) - FLASH_LAYOUT_SECTOR_START(n))
+
+/* Sectors first..last */
+#define FLASH_LAYOUT_RANGE_SIZE(first, last)    (FLASH_LAYOUT_SECTOR_START((last) + 1u) - FLASH_LAYOUT_SECTOR_START(first))
+#define FLASH_LAYOUT_RANGE_MASK(first, last)    (((2u << (last)) - 1u) & ~((1u << (first)) - 1u))
+
+/* Exported variables --------------------------------------------------------*/
+
+/* Exported function prototypes ----------------------------------------------*/
+const FLASH_Layout_SectorTypeDef *FLASH_Layout_GetSector(uint32_t address);
+const FLASH_Layout_SectorTypeDef *FLASH_Layout_GetSectorByIndex(uint32_t sector);
+uint32_t FLASH_Layout_SectorMask(uint32_t start, uint32_t size);
+const FLASH_Layout_RegionTypeDef *FLASH_Layout_GetRegion(FLASH_Layout_RegionIdTypeDef region);
+const FLASH_Layout_RegionTypeDef *FLASH_Layout_FindRegion(uint32_t address);
+
+#endif /* __FLASH_LAYOUT_H */
+
+/************************ (C) COPYRIGHT Jason *****END OF FILE****/
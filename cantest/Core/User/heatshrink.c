@@ -0,0 +1,228 @@
+/******************************************************************************
+ * @file    heatshrink.c
+ * @brief   Streaming heatshrink (LZSS) decoder for compressed firmware images.
+ * @author  Jason
+ * @version V1.0.0
+ * @date    2025-3
+ * @copyright (c) 2025, All rights reserved.
+ ******************************************************************************/
+
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+#include "heatshrink.h"
+
+/* Private typedef -----------------------------------------------------------*/
+
+/* Private define ------------------------------------------------------------*/
+/* Decoder states */
+#define HS_STATE_TAG                ((uint8_t)0)   /* 1 bit: literal or back-reference */
+#define HS_STATE_LITERAL            ((uint8_t)1)   /* 8 bits: literal byte */
+#define HS_STATE_INDEX              ((uint8_t)2)   /* W bits: distance - 1 */
+#define HS_STATE_COUNT              ((uint8_t)3)   /* L bits: length - 1 */
+#define HS_STATE_COPY               ((uint8_t)4)   /* copying from the window */
+
+/* Private macro -------------------------------------------------------------*/
+#define HS_WINDOW_MASK(p_dec)       ((1u << (p_dec)->window_bits) - 1u)
+
+/* Private variables ---------------------------------------------------------*/
+
+/* Private function prototypes -----------------------------------------------*/
+static uint8_t Heatshrink_GetBits(HEATSHRINK_DecoderTypeDef *p_dec, uint8_t bits,
+                                  const uint8_t **pp_in, const uint8_t *p_in_end, uint32_t *p_value);
+static void Heatshrink_Emit(HEATSHRINK_DecoderTypeDef *p_dec, uint8_t byte, uint8_t **pp_out);
+
+/* Private functions ---------------------------------------------------------*/
+/**
+ * @brief  从输入中取 bits 位 (MSB 在前)
+ * @param  p_dec: 解码器
+ * @param  bits: 需要的位数 (1..16)
+ * @param  pp_in: 输入指针，取走的字节会前移
+ * @param  p_in_end: 输入结束
+ * @param  p_value: 输出值
+ * @retval 1 成功，0 输入不够 (已取的位保存在 bit_buffer 中，下次继续)
+ */
+static uint8_t Heatshrink_GetBits(HEATSHRINK_DecoderTypeDef *p_dec, uint8_t bits,
+                                  const uint8_t **pp_in, const uint8_t *p_in_end, uint32_t *p_value)
+{
+  while (p_dec->bit_count < bits)
+  {
+    if (*pp_in >= p_in_end)
+    {
+      return 0;
+    }
+    p_dec->bit_buffer = (p_dec->bit_buffer << 8) | *(*pp_in)++;
+    p_dec->bit_count += 8;
+  }
+  p_dec->bit_count -= bits;
+  *p_value = (p_dec->bit_buffer >> p_dec->bit_count) & ((1u << bits) - 1u);
+  return 1;
+}
+
+/**
+ * @brief  输出一个字节并记入窗口
+ * @param  p_dec: 解码器
+ * @param  byte: 输出字节
+ * @param  pp_out: 输出指针
+ * @retval None
+ */
+static void Heatshrink_Emit(HEATSHRINK_DecoderTypeDef *p_dec, uint8_t byte, uint8_t **pp_out)
+{
+  p_dec->a_window[p_dec->head & HS_WINDOW_MASK(p_dec)] = byte;
+  p_dec->head++;
+  p_dec->total++;
+  *(*pp_out)++ = byte;
+}
+
+/* Public functions ----------------------------------------------------------*/
+/**
+ * @brief  初始化解码器
+ * @param  p_dec: 解码器
+ * @param  window_bits: W，必须与压缩时的 -w 相同
+ * @param  lookahead_bits: L，必须与压缩时的 -l 相同
+ * @retval HEATSHRINK_OK，参数超出范围时 HEATSHRINK_ERROR
+ */
+HEATSHRINK_StatusTypeDef Heatshrink_Init(HEATSHRINK_DecoderTypeDef *p_dec, uint8_t window_bits, uint8_t lookahead_bits)
+{
+  if ((window_bits < HEATSHRINK_WINDOW_BITS_MIN) || (window_bits > HEATSHRINK_WINDOW_BITS_MAX) ||
+      (lookahead_bits < HEATSHRINK_LOOKAHEAD_BITS_MIN) || (lookahead_bits >= window_bits))
+  {
+    return HEATSHRINK_ERROR;
+  }
+  memset(p_dec, 0, sizeof(*p_dec));
+  p_dec->state = HS_STATE_TAG;
+  p_dec->window_bits = window_bits;
+  p_dec->lookahead_bits = lookahead_bits;
+  return HEATSHRINK_OK;
+}
+
+/**
+ * @brief  解码一段输入
+ * @note   输入在任意位置截断都可以，未用完的位保存在解码器中；
+ *         返回 HEATSHRINK_OUTPUT_FULL 时用新的输出缓冲区和剩余输入再调用。
+ * @param  p_dec: 解码器
+ * @param  p_in, in_size: 压缩数据
+ * @param  p_used: 返回本次消耗的输入字节数
+ * @param  p_out, out_size: 输出缓冲区
+ * @param  p_produced: 返回本次输出的字节数
+ * @retval HEATSHRINK_OK 输入已用完 / HEATSHRINK_OUTPUT_FULL 输出已满
+ */
+HEATSHRINK_StatusTypeDef Heatshrink_Decode(HEATSHRINK_DecoderTypeDef *p_dec,
+                                           const uint8_t *p_in, uint32_t in_size, uint32_t *p_used,
+                                           uint8_t *p_out, uint32_t out_size, uint32_t *p_produced)
+{
+  const uint8_t *p_in_next = p_in;
+  const uint8_t *p_in_end = p_in + in_size;
+  uint8_t *p_out_next = p_out;
+  uint8_t *p_out_end = p_out + out_size;
+  HEATSHRINK_StatusTypeDef status = HEATSHRINK_OK;
+  uint32_t value;
+  uint8_t more = 1;
+
+  while (more != 0)
+  {
+    switch (p_dec->state)
+    {
+      case HS_STATE_TAG:
+        if (Heatshrink_GetBits(p_dec, 1, &p_in_next, p_in_end, &value) == 0)
+        {
+          more = 0;
+        }
+        else
+        {
+          p_dec->state = (value != 0) ? HS_STATE_LITERAL : HS_STATE_INDEX;
+        }
+        break;
+      case HS_STATE_LITERAL:
+        if (p_out_next >= p_out_end)
+        {
+          status = HEATSHRINK_OUTPUT_FULL;
+          more = 0;
+        }
+        else if (Heatshrink_GetBits(p_dec, 8, &p_in_next, p_in_end, &value) == 0)
+        {
+          more = 0;
+        }
+        else
+        {
+          Heatshrink_Emit(p_dec, (uint8_t)value, &p_out_next);
+          p_dec->state = HS_STATE_TAG;
+        }
+        break;
+      case HS_STATE_INDEX:
+        if (Heatshrink_GetBits(p_dec, p_dec->window_bits, &p_in_next, p_in_end, &value) == 0)
+        {
+          more = 0;
+        }
+        else
+        {
+          p_dec->distance = (uint16_t)(value + 1u);
+          p_dec->state = HS_STATE_COUNT;
+        }
+        break;
+      case HS_STATE_COUNT:
+        if (Heatshrink_GetBits(p_dec, p_dec->lookahead_bits, &p_in_next, p_in_end, &value) == 0)
+        {
+          more = 0;
+        }
+        else
+        {
+          p_dec->count = (uint16_t)(value + 1u);
+          p_dec->state = HS_STATE_COPY;
+        }
+        break;
+      case HS_STATE_COPY:
+        /* 窗口初始为 0，与压缩端一致 */
+        while ((p_dec->count > 0) && (p_out_next < p_out_end))
+        {
+          Heatshrink_Emit(p_dec, p_dec->a_window[(p_dec->head - p_dec->distance) & HS_WINDOW_MASK(p_dec)], &p_out_next);
+          p_dec->count--;
+        }
+        if (p_dec->count > 0)
+        {
+          status = HEATSHRINK_OUTPUT_FULL;
+          more = 0;
+        }
+        else
+        {
+          p_dec->state = HS_STATE_TAG;
+        }
+        break;
+      default:
+        status = HEATSHRINK_ERROR;
+        more = 0;
+        break;
+    }
+  }
+
+  *p_used = (uint32_t)(p_in_next - p_in);
+  *p_produced = (uint32_t)(p_out_next - p_out);
+  return status;
+}
+
+/**
+ * @brief  检查压缩流是否在符号边界结束
+ * @note   最后一个字节的填充位是 0，会被读成一个不完整的回溯引用，
+ *         只要剩下的位都来自最后一个字节并且全为 0 就算正常结束。
+ * @param  p_dec: 解码器
+ * @retval HEATSHRINK_OK 正常结束，HEATSHRINK_ERROR 数据被截断
+ */
+HEATSHRINK_StatusTypeDef Heatshrink_Finish(const HEATSHRINK_DecoderTypeDef *p_dec)
+{
+  uint32_t pending_bits = p_dec->bit_count;
+
+  if (p_dec->state == HS_STATE_INDEX)
+  {
+    pending_bits += 1;      /* the 0 tag bit */
+  }
+  else if (p_dec->state != HS_STATE_TAG)
+  {
+    return HEATSHRINK_ERROR;
+  }
+  if ((pending_bits >= 8) || ((p_dec->bit_buffer & ((1u << p_dec->bit_count) - 1u)) != 0))
+  {
+    return HEATSHRINK_ERROR;
+  }
+  return HEATSHRINK_OK;
+}
+
+/************************ (C) COPYRIGHT Jason *****END OF FILE****/
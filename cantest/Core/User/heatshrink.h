@@ -0,0 +1,73 @@
+/******************************************************************************
+ * @file    heatshrink.h
+ * @brief   Streaming heatshrink (LZSS) decoder for compressed firmware images.
+ * @author  Jason
+ * @version V1.0.0
+ * @date    2025-3
+ * @copyright (c) 2025, All rights reserved.
+ ******************************************************************************/
+
+#ifndef __HEATSHRINK_H
+#define __HEATSHRINK_H
+
+/* Private Includes ----------------------------------------------------------*/
+#include <stdint.h>
+
+/**
+ * 与 heatshrink 工具 (https://github.com/atomicobject/heatshrink) 的位流兼容：
+ *   heatshrink -e -w 10 -l 4 app.bin app.bin.hs
+ * 位流按字节 MSB 在前：
+ *  - 标志位 1 : 后面 8 位是一个字面字节
+ *  - 标志位 0 : 后面 W 位是 (距离 - 1)，再 L 位是 (长度 - 1)，从窗口中复制
+ * 末尾不足一个字节的填充位被忽略，流中没有结束标记。
+ *
+ * 解码器只需要一个 2^W 字节的窗口 (W=10 时 1 KB)，输入和输出都可以按任意
+ * 长度分段喂入/取出，适合一边接收 Ymodem 包一边解压写 flash。
+ */
+/* Exported constants --------------------------------------------------------*/
+#define HEATSHRINK_WINDOW_BITS_MIN  (4u)
+#define HEATSHRINK_WINDOW_BITS_MAX  (10u)            /* window buffer size, 1 KB RAM */
+#define HEATSHRINK_LOOKAHEAD_BITS_MIN (3u)
+
+/* Exported types ------------------------------------------------------------*/
+/**
+  * @brief  Result of Heatshrink_Decode / Heatshrink_Finish
+  */
+typedef enum
+{
+  HEATSHRINK_OK          = 0x00,  /* all input consumed (Decode) / stream complete (Finish) */
+  HEATSHRINK_OUTPUT_FULL = 0x01,  /* output buffer full, call again with a new one */
+  HEATSHRINK_ERROR       = 0x02   /* bad parameters / stream ends inside a symbol */
+} HEATSHRINK_StatusTypeDef;
+
+/**
+  * @brief  Decoder context, fully static (no heap)
+  */
+typedef struct
+{
+  uint8_t  state;                         /* symbol being decoded */
+  uint8_t  window_bits;                   /* W */
+  uint8_t  lookahead_bits;                /* L */
+  uint8_t  bit_count;                     /* valid bits in bit_buffer */
+  uint32_t bit_buffer;                    /* input bits, MSB first */
+  uint16_t distance;                      /* back-reference distance */
+  uint16_t count;                         /* back-reference bytes still to copy */
+  uint32_t head;                          /* bytes written to the window */
+  uint32_t total;                         /* bytes produced since Init */
+  uint8_t  a_window[1u << HEATSHRINK_WINDOW_BITS_MAX];
+} HEATSHRINK_DecoderTypeDef;
+
+/* Exported macro ------------------------------------------------------------*/
+
+/* Exported variables --------------------------------------------------------*/
+
+/* Exported function prototypes ----------------------------------------------*/
+HEATSHRINK_StatusTypeDef Heatshrink_Init(HEATSHRINK_DecoderTypeDef *p_dec, uint8_t window_bits, uint8_t lookahead_bits);
+HEATSHRINK_StatusTypeDef Heatshrink_Decode(HEATSHRINK_DecoderTypeDef *p_dec,
+                                           const uint8_t *p_in, uint32_t in_size, uint32_t *p_used,
+                                           uint8_t *p_out, uint32_t out_size, uint32_t *p_produced);
+HEATSHRINK_StatusTypeDef Heatshrink_Finish(const HEATSHRINK_DecoderTypeDef *p_dec);
+
+#endif /* __HEATSHRINK_H */
+
+/************************ (C) COPYRIGHT Jason *****END OF FILE****/
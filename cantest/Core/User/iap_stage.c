@@ -0,0 +1,221 @@
+/******************************************************************************
+ * @file    iap_stage.c
+ * @brief   Transport staging FIFOs in SRAM2: received data is queued as
+ *          chunks while the flash is busy and drained by the flash writer.
+ * @author  Jason
+ * @version V1.0.0
+ * @date    2025-3
+ * @copyright (c) 2025, All rights reserved.
+ ******************************************************************************/
+
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+#include "iap_stage.h"
+
+/* Private typedef -----------------------------------------------------------*/
+typedef struct
+{
+  uint16_t length;              /* data bytes, IAP_STAGE_WRAP: rest of the buffer unused */
+  uint16_t tag;                 /* owner defined */
+} IAP_Stage_HeaderTypeDef;
+
+/* Private define ------------------------------------------------------------*/
+#define IAP_STAGE_WRAP              (0xFFFFu)
+
+#if (IAP_STAGE_USB_SIZE + IAP_STAGE_CAN_SIZE) > IAP_STAGE_SRAM2_SIZE
+#error "iap_stage.h: the staging FIFOs do not fit in SRAM2"
+#endif
+
+/* Private macro -------------------------------------------------------------*/
+/* 分散加载文件 (MDK-ARM/cantest.sct) 把 IAP_STAGE 段放到 RW_IRAM2 */
+#if defined(__CC_ARM)
+#define IAP_STAGE_SRAM2             __attribute__((section("IAP_STAGE"), zero_init, aligned(4)))
+#else
+#define IAP_STAGE_SRAM2             __attribute__((aligned(4)))
+#endif
+
+#define IAP_STAGE_HEADER(p_stage, position) \
+  ((IAP_Stage_HeaderTypeDef *)(void *)&(p_stage)->p_buffer[(position) & ((p_stage)->size - 1u)])
+
+/* Private variables ---------------------------------------------------------*/
+static uint8_t aStageUsb[IAP_STAGE_USB_SIZE] IAP_STAGE_SRAM2;
+static uint8_t aStageCan[IAP_STAGE_CAN_SIZE] IAP_STAGE_SRAM2;
+
+IAP_Stage_TypeDef IAP_StageUsb = { aStageUsb, IAP_STAGE_USB_SIZE, 0, 0, 0, 0, 0 };
+IAP_Stage_TypeDef IAP_StageCan = { aStageCan, IAP_STAGE_CAN_SIZE, 0, 0, 0, 0, 0 };
+
+/* Private function prototypes -----------------------------------------------*/
+static uint32_t IAP_Stage_Gap(const IAP_Stage_TypeDef *p_stage, uint32_t footprint);
+
+/* Private functions ---------------------------------------------------------*/
+/**
+ * @brief  块放在写指针处放不下时，缓冲区尾部要跳过的字节数
+ * @param  p_stage: FIFO
+ * @param  footprint: IAP_STAGE_CHUNK_SIZE(length)
+ * @retval 0：块从写指针处开始；否则块从缓冲区头部开始
+ */
+static uint32_t IAP_Stage_Gap(const IAP_Stage_TypeDef *p_stage, uint32_t footprint)
+{
+  uint32_t position = p_stage->in & (p_stage->size - 1u);
+
+  return (position + footprint > p_stage->size) ? (p_stage->size - position) : 0;
+}
+
+/* Public functions ----------------------------------------------------------*/
+/**
+ * @brief  生产者：为一个块预留连续空间
+ * @note   不改变 FIFO，IAP_Stage_Commit() 之前重复调用得到同一个位置
+ * @param  p_stage: FIFO
+ * @param  length: 块的数据字节数
+ * @retval 数据区 (4 字节对齐)，放不下时返回 NULL
+ */
+uint8_t *IAP_Stage_Reserve(const IAP_Stage_TypeDef *p_stage, uint16_t length)
+{
+  uint32_t footprint = IAP_STAGE_CHUNK_SIZE(length);
+  uint32_t gap = IAP_Stage_Gap(p_stage, footprint);
+
+  if ((length == IAP_STAGE_WRAP) ||
+      (p_stage->size - (p_stage->in - p_stage->out) < gap + footprint))
+  {
+    return NULL;
+  }
+  return (uint8_t *)IAP_STAGE_HEADER(p_stage, p_stage->in + gap) + IAP_STAGE_HEADER_SIZE;
+}
+
+/**
+ * @brief  生产者：发布 IAP_Stage_Reserve() 预留的块
+ * @param  p_stage: FIFO
+ * @param  length: 实际写入的字节数，不超过预留的长度
+ * @param  tag: 随块保存的标记
+ * @retval None
+ */
+void IAP_Stage_Commit(IAP_Stage_TypeDef *p_stage, uint16_t length, uint16_t tag)
+{
+  uint32_t footprint = IAP_STAGE_CHUNK_SIZE(length);
+  uint32_t gap = IAP_Stage_Gap(p_stage, footprint);
+  IAP_Stage_HeaderTypeDef *p_header;
+
+  if (gap != 0)
+  {
+    IAP_STAGE_HEADER(p_stage, p_stage->in)->length = IAP_STAGE_WRAP;
+  }
+  p_header = IAP_STAGE_HEADER(p_stage, p_stage->in + gap);
+  p_header->length = length;
+  p_header->tag = tag;
+  __DMB();                      /* 数据和块头先于写指针可见 */
+  p_stage->data_in += length;
+  p_stage->in += gap + footprint;
+}
+
+/**
+ * @brief  生产者：复制一段数据作为一个块
+ * @param  p_stage: FIFO
+ * @param  p_data: 数据
+ * @param  length: 字节数
+ * @param  tag: 随块保存的标记
+ * @retval HAL_OK，放不下时返回 HAL_BUSY
+ */
+HAL_StatusTypeDef IAP_Stage_Put(IAP_Stage_TypeDef *p_stage, const void *p_data, uint16_t length, uint16_t tag)
+{
+  uint8_t *p_chunk = IAP_Stage_Reserve(p_stage, length);
+
+  if (p_chunk == NULL)
+  {
+    return HAL_BUSY;
+  }
+  memcpy(p_chunk, p_data, length);
+  IAP_Stage_Commit(p_stage, length, tag);
+  return HAL_OK;
+}
+
+/**
+ * @brief  消费者：取最早的块
+ * @param  p_stage: FIFO
+ * @param  p_length: 块的数据字节数
+ * @param  p_tag: 块的标记，可以为 NULL
+ * @retval 数据区，FIFO 为空时返回 NULL
+ */
+uint8_t *IAP_Stage_Peek(IAP_Stage_TypeDef *p_stage, uint16_t *p_length, uint16_t *p_tag)
+{
+  IAP_Stage_HeaderTypeDef *p_header;
+
+  if (p_stage->in == p_stage->out)
+  {
+    return NULL;
+  }
+  __DMB();
+  p_header = IAP_STAGE_HEADER(p_stage, p_stage->out);
+  if (p_header->length == IAP_STAGE_WRAP)
+  {
+    /* 生产者跳过了尾部，块在缓冲区头部 */
+    p_stage->out += p_stage->size - (p_stage->out & (p_stage->size - 1u));
+    p_header = IAP_STAGE_HEADER(p_stage, p_stage->out);
+  }
+  *p_length = p_header->length;
+  if (p_tag != NULL)
+  {
+    *p_tag = p_header->tag;
+  }
+  return (uint8_t *)p_header + IAP_STAGE_HEADER_SIZE;
+}
+
+/**
+ * @brief  消费者：释放 IAP_Stage_Peek() 取得的块
+ * @param  p_stage: FIFO
+ * @retval None
+ */
+void IAP_Stage_Release(IAP_Stage_TypeDef *p_stage)
+{
+  uint16_t length;
+
+  if (IAP_Stage_Peek(p_stage, &length, NULL) != NULL)
+  {
+    p_stage->offset = 0;
+    p_stage->data_out += length;
+    __DMB();                    /* 块读完后才交还空间 */
+    p_stage->out += IAP_STAGE_CHUNK_SIZE(length);
+  }
+}
+
+/**
+ * @brief  消费者：还没有读取的数据字节数
+ * @param  p_stage: FIFO
+ * @retval 字节数
+ */
+uint32_t IAP_Stage_Count(const IAP_Stage_TypeDef *p_stage)
+{
+  return p_stage->data_in - p_stage->data_out - p_stage->offset;
+}
+
+/**
+ * @brief  消费者：把块当作字节流读取，读完的块自动释放
+ * @param  p_stage: FIFO
+ * @param  p_data: 目的缓冲区
+ * @param  length: 最多读取的字节数
+ * @retval 读到的字节数
+ */
+uint32_t IAP_Stage_Read(IAP_Stage_TypeDef *p_stage, uint8_t *p_data, uint32_t length)
+{
+  const uint8_t *p_chunk;
+  uint32_t count, done = 0;
+  uint16_t chunk_length;
+
+  while ((done < length) && ((p_chunk = IAP_Stage_Peek(p_stage, &chunk_length, NULL)) != NULL))
+  {
+    count = chunk_length - p_stage->offset;
+    if (count > length - done)
+    {
+      count = length - done;
+    }
+    memcpy(&p_data[done], &p_chunk[p_stage->offset], count);
+    done += count;
+    p_stage->offset += count;
+    if (p_stage->offset == chunk_length)
+    {
+      IAP_Stage_Release(p_stage);
+    }
+  }
+  return done;
+}
+
+/************************ (C) COPYRIGHT Jason *****END OF FILE****/
@@ -0,0 +1,68 @@
+/******************************************************************************
+ * @file    iap_stage.h
+ * @brief   Transport staging FIFOs in SRAM2: received data is queued as
+ *          chunks while the flash is busy and drained by the flash writer.
+ * @author  Jason
+ * @version V1.0.0
+ * @date    2025-3
+ * @copyright (c) 2025, All rights reserved.
+ ******************************************************************************/
+
+#ifndef __IAP_STAGE_H
+#define __IAP_STAGE_H
+
+/* Private Includes ----------------------------------------------------------*/
+#include "main.h"
+
+/**
+ * F207 的 SRAM2 (0x2001C000, 16 KB) 分给两个传输通道作为接收暂存区：
+ *  - IAP_StageUsb：CDC_Receive_FS 把每个 OUT 包作为一个块追加进来，ReceiveAdapter 按字节流读取
+ *  - IAP_StageCan：ISO-TP 直接在这里重组，一个完整的 UDS 请求是一个块，can_uds_poll() 在线程中处理
+ * 擦除扇区 (128 KB 需要 1~2 s) 期间写 FLASH 的线程停顿，中断 (IAP_RAM_EXEC 时在 SRAM 中运行)
+ * 继续把数据放进暂存区；只有暂存区真的放不下时才流控 (USB 端点 NAK，ISO-TP FC WAIT)。
+ *
+ * 每个 FIFO 只有一个生产者 (中断) 和一个消费者 (线程)，不需要关中断：
+ *  - 生产者：IAP_Stage_Reserve() 取得连续空间 (不改变 FIFO)，写入数据后 IAP_Stage_Commit() 发布；
+ *    发布前可以多次 Reserve，总是得到同一个位置
+ *  - 消费者：IAP_Stage_Peek() 取最早的块，处理完 IAP_Stage_Release()；
+ *    或者 IAP_Stage_Read() 把块当作字节流读取 (读完一个块自动释放)
+ * 块的数据从 4 字节对齐的地址开始，放不下的块从缓冲区头部开始 (尾部空间作废)。
+ */
+/* Exported constants --------------------------------------------------------*/
+#define IAP_STAGE_SRAM2_SIZE        (16u * 1024u)
+#define IAP_STAGE_USB_SIZE          (8u * 1024u)     /* power of 2 */
+#define IAP_STAGE_CAN_SIZE          (8u * 1024u)     /* power of 2 */
+#define IAP_STAGE_HEADER_SIZE       (4u)             /* length + tag */
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+  uint8_t *p_buffer;            /* SRAM2 */
+  uint32_t size;                /* bytes, power of 2 */
+  volatile uint32_t in;         /* bytes committed (producer), free running */
+  volatile uint32_t out;        /* bytes released (consumer), free running */
+  volatile uint32_t data_in;    /* payload bytes committed */
+  volatile uint32_t data_out;   /* payload bytes released */
+  uint32_t offset;              /* IAP_Stage_Read: bytes read from the oldest chunk */
+} IAP_Stage_TypeDef;
+
+/* Exported macro ------------------------------------------------------------*/
+/* Footprint of a chunk: header + data rounded up to a word */
+#define IAP_STAGE_CHUNK_SIZE(length)    (IAP_STAGE_HEADER_SIZE + (((uint32_t)(length) + 3u) & ~3u))
+
+/* Exported variables --------------------------------------------------------*/
+extern IAP_Stage_TypeDef IAP_StageUsb;
+extern IAP_Stage_TypeDef IAP_StageCan;
+
+/* Exported function prototypes ----------------------------------------------*/
+uint8_t *IAP_Stage_Reserve(const IAP_Stage_TypeDef *p_stage, uint16_t length);
+void IAP_Stage_Commit(IAP_Stage_TypeDef *p_stage, uint16_t length, uint16_t tag);
+HAL_StatusTypeDef IAP_Stage_Put(IAP_Stage_TypeDef *p_stage, const void *p_data, uint16_t length, uint16_t tag);
+uint8_t *IAP_Stage_Peek(IAP_Stage_TypeDef *p_stage, uint16_t *p_length, uint16_t *p_tag);
+void IAP_Stage_Release(IAP_Stage_TypeDef *p_stage);
+uint32_t IAP_Stage_Count(const IAP_Stage_TypeDef *p_stage);
+uint32_t IAP_Stage_Read(IAP_Stage_TypeDef *p_stage, uint8_t *p_data, uint32_t length);
+
+#endif /* __IAP_STAGE_H */
+
+/************************ (C) COPYRIGHT Jason *****END OF FILE****/
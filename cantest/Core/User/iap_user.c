@@ -8,45 +8,100 @@
  ******************************************************************************/
 
 /* Includes ------------------------------------------------------------------*/
+#include <string.h>
 #include "iap_user.h"
 #include "flash_e_level.h"
+#include "kv_store.h"
+#include "app_update.h"
+#include "flash_async.h"
+#include "ram_exec.h"
+#include "image_crc.h"
+#include "iap_stage.h"
+#include "can_uds_simple.h"
 /* Private typedef -----------------------------------------------------------*/
 typedef void (*pFunction)(void);
 
+/* 镜像 CRC 曾经放在 iap_msg_t 末尾时的 KV_KEY_IAP_STATUS (28 字节)，读到时拆成 save_data_t 和 iap_image_t */
+#pragma pack(push, FLASH_PROGRAM_SIZE)
+typedef struct
+{
+    uint16_t header;
+    iap_msg_t iap_msg;
+    uint32_t crc;
+    uint16_t ender;
+}save_data_crc_t;
+#pragma pack(pop)
+
 /* Private define ------------------------------------------------------------*/
+#define IAP_TX_BUFFER_SIZE      (1024 + 16)     /* 一个 1K Ymodem 包 + 包头 + CRC 可以一次发完 */
+#define IAP_TX_POLL_MS          (1)             /* 等上一次 USB 发送完成的轮询间隔 */
+#define IAP_RX_POLL_MS          (1)             /* 等接收数据的轮询间隔，决定超时的分辨率 */
 
 /* Private macro -------------------------------------------------------------*/
 
 /* Private variables ---------------------------------------------------------*/
 IAP_Interface iapInterface;
 IAP_Receive_Struct iap_recive;
+/* 发送缓冲区：CDC_Transmit_FS 是异步的，数据必须拷贝出来，不能直接用调用者的缓冲区；
+   两个缓冲区交替使用，拷贝下一包时上一包还可以在发送 */
+static uint8_t aTxBuffer[2][IAP_TX_BUFFER_SIZE];
+static uint8_t tx_index;
 static uint32_t JumpAddress;
 static pFunction JumpToApplication;
+/* 升级状态的写回缓存：write_iap_status() 只改 RAM，commit_iap_status() 才写 FLASH */
+static save_data_t IapStatusCache;
+static uint8_t IapStatusCached;         /* IapStatusCache 与状态区一致或更新 */
+static uint8_t IapStatusDirty;          /* IapStatusCache 还没有写入状态区 */
+static uint32_t IapStatusDirtyTick;     /* 第一次没有写入的修改的时间 (状态或镜像 CRC) */
+static iap_image_t IapImageCache;       /* KV_KEY_IMAGE_CRC 的写回缓存，同样由 commit_iap_status() 写入 */
+static uint8_t IapImageCached;
+static uint8_t IapImageDirty;
 
 /* Private function prototypes -----------------------------------------------*/
 
 /* Private functions ---------------------------------------------------------*/
 
+/**
+  * @brief  检查 App1 中的应用是否可以运行
+  * @note   向量表的栈指针必须在 SRAM 中；下载完成 (IAP_APP_DONE) 时记录了镜像 CRC (KV_KEY_IMAGE_CRC)
+  *         且大小与状态中的相同的，整个镜像的 CRC 还必须与记录相同 (ImageCrc，DMA 计算，192 KB 只要几 ms)。
+  *         没有记录 CRC 的旧状态只检查栈指针。
+  * @retval NEWAPP_VILIBLE / NEWAPP_NOT_VILIBLE
+  */
 eNEWAPP_Status_Def funtionCheck()
 {
+    save_data_t rw_data;
+    iap_image_t image;
+
     /* Test if user code is programmed starting from address "APPLICATION_ADDRESS" */
-    if (((*(__IO uint32_t*)APPLICATION_ADDRESS) & 0x2FFE0000 ) == 0x20000000)
-    {   
-        return NEWAPP_VILIBLE;
+    if (((*(__IO uint32_t*)APPLICATION_ADDRESS) & 0x2FFE0000 ) != 0x20000000)
+    {
+        return NEWAPP_NOT_VILIBLE;
     }
-    else
+    if ((EL_FIND_SUCCESS == read_iap_status(&rw_data)) &&
+        (IAP_APP_DONE == rw_data.iap_msg.status) &&
+        (0 != rw_data.iap_msg.size) &&
+        ((rw_data.iap_msg.size > USER_FLASH_SIZE) ||
+         ((EL_FIND_SUCCESS == read_iap_image(&image)) && (image.size == rw_data.iap_msg.size) &&
+          (ImageCrc_Calc(APPLICATION_ADDRESS, image.size) != image.crc))))
     {
-        return NEWAPP_NOT_VILIBLE;   
+        return NEWAPP_NOT_VILIBLE;
     }
+    return NEWAPP_VILIBLE;
 }
 
 static void funtionJump()
 {
-    /* Test if user code is programmed starting from address "APPLICATION_ADDRESS" */
-    if (((*(__IO uint32_t*)APPLICATION_ADDRESS) & 0x2FFE0000 ) == 0x20000000)
+    commit_iap_status();    /* 跳转后不会再回来写状态 */
+    /* Test if user code is programmed starting from address "APPLICATION_ADDRESS" and is intact */
+    if (NEWAPP_VILIBLE == funtionCheck())
     {   
         HAL_DeInit();
         __disable_irq();  /* 禁止全局中断*/
+#if IAP_RAM_EXEC
+        /* SRAM 中的向量表在应用初始化 RAM 后失效，先切回应用的向量表 */
+        SCB->VTOR = APPLICATION_ADDRESS;
+#endif
         /* Jump to user application */
         JumpAddress = *(__IO uint32_t*) (APPLICATION_ADDRESS + 4);
         JumpToApplication = (pFunction) JumpAddress;
@@ -57,9 +112,64 @@ static void funtionJump()
 }
 
 
+/**
+ * @brief USB虚拟串口聚合发送 (gather)，把多个数据段合并成一次 USB 传输发送。
+ *        数据段先拷贝到发送缓冲区（超过缓冲区大小时分多次发送），
+ *        如果上一次传输还没发完，函数会等待直到成功提交或超时。
+ * 
+ * @param p_iov 数据段数组
+ * @param iovcnt 数据段个数
+ * @param timeout 发送超时时间（单位：毫秒）
+ * @retval HAL_StatusTypeDef 返回状态，HAL_OK表示成功，HAL_TIMEOUT表示超时
+ */
+static HAL_StatusTypeDef TransmitVAdapter(const IAP_IoVec *p_iov, uint8_t iovcnt, uint32_t timeout)
+{
+    uint8_t *p_buf;
+    uint16_t fill, count, offset = 0;
+    uint8_t seg = 0;
+
+    while (seg < iovcnt)
+    {
+        p_buf = aTxBuffer[tx_index];
+        fill = 0;
+        while ((seg < iovcnt) && (fill < IAP_TX_BUFFER_SIZE))
+        {
+            count = p_iov[seg].length - offset;
+            if (count > (IAP_TX_BUFFER_SIZE - fill))
+            {
+                count = IAP_TX_BUFFER_SIZE - fill;
+            }
+            memcpy(&p_buf[fill], (const uint8_t *)p_iov[seg].p_base + offset, count);
+            fill += count;
+            offset += count;
+            if (offset == p_iov[seg].length)
+            {
+                seg++;
+                offset = 0;
+            }
+        }
+        if (0 == fill)
+        {
+            break;
+        }
+
+        while (USBD_OK != CDC_Transmit_FS(p_buf, fill)) 
+        {
+            iapInterface.DelayTimeMsFunction(IAP_TX_POLL_MS);
+            timeout -= IAP_TX_POLL_MS;
+            if (timeout <= IAP_TX_POLL_MS)  // 超时
+            {
+                return HAL_TIMEOUT;  
+            }
+        }
+        tx_index ^= 1;  // 下一次用另一个缓冲区
+    }
+    return HAL_OK;
+}
+
 /**
  * @brief USB虚拟串口阻塞式发送函数，用于通过CDC接口发送数据。
- *        如果发送缓冲区繁忙，函数会等待直到数据成功发送或超时。
+ *        只有一个数据段的 TransmitVAdapter。
  * 
  * @param buffer 指向发送数据缓冲区的指针
  * @param len 需要发送的数据长度
@@ -68,23 +178,68 @@ static void funtionJump()
  */
 static HAL_StatusTypeDef TransmitAdapter(void* buffer, uint16_t len, uint32_t timeout) 
 {
-    while (USBD_OK != CDC_Transmit_FS((uint8_t*)buffer, len)) 
+    IAP_IoVec iov;
+
+    iov.p_base = buffer;
+    iov.length = len;
+    return TransmitVAdapter(&iov, 1, timeout);
+}
+
+
+/**
+ * @brief 暂存区腾出空间后恢复 USB 接收。
+ * @note  CDC_Receive_FS 在暂存区放不下下一包时不会重新打开端点 (rx_paused)，
+ *        主机收到 NAK 后暂停发送，这里有空间后再重新打开。
+ *        USB 中断里也会修改 rx_paused，因此要关中断。
+ */
+static void ReceiveResume(void)
+{
+    __disable_irq();
+    if ((0 != iap_recive.rx_paused) &&
+        (NULL != IAP_Stage_Reserve(&IAP_StageUsb, CDC_DATA_FS_MAX_PACKET_SIZE)))
     {
-        iapInterface.DelayTimeMsFunction(10);  // 每次等待10ms
-        timeout -= 10;
-        if (timeout <= 10)  // 超时
+        iap_recive.rx_paused = 0;
+        CDC_ResumeReceive_FS();
+    }
+    __enable_irq();
+}
+
+/**
+ * @brief 等暂存区 (IAP_StageUsb) 中至少有 needlength 字节。
+ * @note  USB 中断把每个 OUT 包作为一个块放进 SRAM2 暂存区，写 FLASH 停顿期间收到的数据
+ *        (最多 8 KB) 都留在暂存区里，满了才 NAK 流控。
+ *        超时按 GetTickFunction 计时，等待期间 IdleFunction 花的时间也算在内，
+ *        所以 Ymodem 的自适应超时（几十 ms）是准确的。
+ * @param needlength 需要的字节数
+ * @param timeout 超时时间（单位：毫秒）
+ * @retval HAL_OK，超时时数据仍然不够返回 HAL_TIMEOUT
+ */
+static HAL_StatusTypeDef ReceiveWait(uint16_t needlength, uint32_t timeout)
+{
+    uint32_t start = iapInterface.GetTickFunction();
+
+    while (IAP_Stage_Count(&IAP_StageUsb) < needlength)
+    {
+        if (NULL != iapInterface.IdleFunction)
+        {   // 等数据的空闲时间里做别的事（例如把上一包写进 flash）
+            iapInterface.IdleFunction();
+        }
+        iapInterface.DelayTimeMsFunction(IAP_RX_POLL_MS);   
+        // 空闲处理可能停顿很久 (写 FLASH、等擦除)，期间到的数据够了就不算超时
+        if ((IAP_Stage_Count(&IAP_StageUsb) < needlength) &&
+            ((iapInterface.GetTickFunction() - start) >= timeout))
         {
-            return HAL_TIMEOUT;  
+            return HAL_TIMEOUT;
         }
     }
     return HAL_OK;
 }
 
-
 /**
  * @brief 通过USB虚拟串口进行阻塞式数据接收。
- * @note  如果一次接收的数据过多，函数会只返回当前所需的数据，并在下次调用时继续传输剩余的数据。
- * 在这种二次获取数据的情况下，如果剩余数据不足，函数会只传输当前剩余的字节数，并返回错误状态。
+ * @note  从暂存区按字节流取走，因此 Ymodem-G 这种连续发送、包与包之间没有停顿的数据流
+ *        也不会丢数据或重复读取。
+ *        超时时如果数据不足，函数会只传输当前剩余的字节数，并返回超时状态。
  * 
  * @param data 指向接收数据缓冲区的指针，用于存储接收到的数据。
  * @param needlength 需要接收的数据长度（单位：字节）。
@@ -93,61 +248,57 @@ static HAL_StatusTypeDef TransmitAdapter(void* buffer, uint16_t len, uint32_t ti
  * @retval HAL_StatusTypeDef 返回状态：
  *         - HAL_OK: 接收成功。
  *         - HAL_TIMEOUT: 接收超时。
- *         - HAL_ERROR: 接收过程中发生错误。
  * （这里的错误返回一定要按照 HAL_StatusTypeDef 里面带来写，因为 Ymodem 是stm32官方的，
  *  官方的协议栈就是按照这样的返回值做处理的，不然会出错！！）
  */
 static HAL_StatusTypeDef ReceiveAdapter(uint8_t *data, uint16_t needlength, uint32_t timeout) 
 { 
-    uint16_t recive_cnt = 0, remainingLength;
-    HAL_StatusTypeDef status = HAL_OK;  
+    HAL_StatusTypeDef status = ReceiveWait(needlength, timeout);
 
-    switch (iap_recive.iap_pkgtatus) 
-    {
-        case PKG_NOT_DONE:
-            // 当有数据后，等到10ms内没有新数据更新才认为是一包结束
-            while ((0 == iap_recive.length) || (recive_cnt < iap_recive.length)) 
-            {
-                recive_cnt = iap_recive.length; 
-                iapInterface.DelayTimeMsFunction(10);   
-                timeout -= 10;
-                if (timeout <= 10)  
-                {
-                    return  HAL_TIMEOUT;  
-                }
-            }
-            iap_recive.iap_pkgtatus = PKG_COMPLETE;
-        case PKG_COMPLETE:
-            iap_recive.handle_cnt = 0;
-            iap_recive.iap_pkgtatus = PKG_HANDLE_ING;
-        case PKG_HANDLE_ING:
-            remainingLength = iap_recive.length - iap_recive.handle_cnt;  
-            if (needlength <= remainingLength)
-            {
-                memcpy(data, &iap_recive.recivebuf[iap_recive.handle_cnt], needlength);
-                iap_recive.handle_cnt += needlength;
-            }
-            else
-            {
-                memcpy(data, &iap_recive.recivebuf[iap_recive.handle_cnt], remainingLength);
-                iap_recive.handle_cnt += remainingLength;
-                status = HAL_TIMEOUT;  
-            }
-            // 如果全部处理完，就重新开始接受
-            if (iap_recive.length == iap_recive.handle_cnt)
-            {
-                memset(&iap_recive, 0, sizeof(IAP_Receive_Struct)); // 将结构体的所有字节设置为零
-            }
-            break;
+    (void)IAP_Stage_Read(&IAP_StageUsb, data, needlength);
+    ReceiveResume();
+    return status; 
+}
 
-        default:
-            status = HAL_ERROR;  // HAL_ERROR
-            break;
+/**
+ * @brief 批量接收：等到有数据后，一次取走暂存区中已有的数据 (最多 length 字节)。
+ * @note  一个 1K 包只调用一次，关中断的 ReceiveResume 也只做一次，不再逐字节调用。
+ * @param data 接收缓冲区
+ * @param length 缓冲区字节数
+ * @param timeout 等第一个字节的超时时间（单位：毫秒）
+ * @retval 取到的字节数，超时返回 0
+ */
+static uint16_t ReceiveAnyAdapter(uint8_t *data, uint16_t length, uint32_t timeout)
+{
+    uint16_t count;
+
+    if (HAL_OK != ReceiveWait(1, timeout))
+    {
+        return 0;
     }
-    return status; 
+    count = (uint16_t)IAP_Stage_Read(&IAP_StageUsb, data, length);
+    ReceiveResume();
+    return count;
 }
 
 
+/**
+  * @brief  等数据时的空闲处理：把上一个 Ymodem 包写进 flash，处理暂存区中的 UDS 请求，
+  *         写入放了 IAP_STATUS_FLUSH_MS 的升级状态，不在下载或差分/分块升级时擦除状态区的旧 bank 或暂存区
+  * @retval None
+  */
+static void IdleAdapter(void)
+{
+    Ymodem_FlashPoll();
+    can_uds_poll();
+    if (((0 != IapStatusDirty) || (0 != IapImageDirty)) && (HAL_GetTick() - IapStatusDirtyTick >= IAP_STATUS_FLUSH_MS)) {
+        commit_iap_status();
+    }
+    if ((can_uds_downloading() == 0) && (AppUpdate_Busy() == 0)) {
+        KV_Idle();      /* 擦除状态区压缩后留下的旧 bank 或暂存区 (在 Backup 的扇区中) */
+    }
+}
+
 /**
   * @brief  用户自动补充 延时函数 单位 ms
   * @param  delaytime 延时的毫秒数。
@@ -162,17 +313,172 @@ static void DelayTimeAdapter(uint32_t delaytime)
     }
 }
 
+/**
+  * @brief  读取升级状态 (状态区 KV 存储的 KV_KEY_IAP_STATUS)
+  * @note   读到的是写回缓存中的最新值，包括还没有写入 FLASH 的修改。
+  *         记录是 save_data_t (24 字节)；带镜像 CRC 的 28 字节记录 (save_data_crc_t) 也接受，
+  *         其中的 CRC 在没有 KV_KEY_IMAGE_CRC 时转入镜像 CRC 的写回缓存，下次提交时写入
+  * @param  read_data 读到的数据
+  * @retval EL_FIND_SUCCESS，没有记录或记录不完整返回 EL_NOT_FOUND
+  */
 eFIND_Status_Def read_iap_status(save_data_t *read_data)
 {
-    eFIND_Status_Def find_status = EL_NOT_FOUND;
+    save_data_crc_t record;
+    iap_image_t image;
+    uint16_t length = 0;
 
-    find_status = el_flash_read(read_data);
-    return find_status;
+    if (0 == IapStatusCached)
+    {
+        if (HAL_OK != KV_Get(KV_KEY_IAP_STATUS, &record, sizeof(record), &length))
+        {
+            return EL_NOT_FOUND;
+        }
+        if (sizeof(save_data_t) == length)
+        {
+            memcpy(&IapStatusCache, &record, sizeof(IapStatusCache));
+        }
+        else if (sizeof(record) == length)
+        {
+            IapStatusCache.header = record.header;
+            IapStatusCache.iap_msg = record.iap_msg;
+            IapStatusCache.ender = record.ender;
+            if (EL_FIND_SUCCESS != read_iap_image(&image))
+            {
+                write_iap_image(record.iap_msg.size, record.crc);
+            }
+        }
+        else
+        {
+            return EL_NOT_FOUND;
+        }
+        if (!EL_CHECK_DATE(IapStatusCache))
+        {
+            return EL_NOT_FOUND;
+        }
+        IapStatusCached = 1;
+    }
+    *read_data = IapStatusCache;
+    return EL_FIND_SUCCESS;
 }
 
+/**
+  * @brief  修改升级状态 (写回缓存)，与当前值相同时什么也不做
+  * @note   只改 RAM：连续的修改合并为一次写入，commit_iap_status() (跳转前、会话结束、
+  *         擦除 App1 / 拷贝 Backup 之前) 或者 IAP_STATUS_FLUSH_MS 后的空闲处理写入 FLASH。
+  *         掉电后必须看到的状态，调用者写完后马上 commit_iap_status()
+  * @param  write_data 要写入的数据
+  * @retval None
+  */
 void write_iap_status(save_data_t *write_data)
 {
-    el_flash_write(write_data);
+    if ((0 != IapStatusCached) && (0 == memcmp(&IapStatusCache, write_data, sizeof(IapStatusCache))))
+    {
+        return;
+    }
+    if ((0 == IapStatusDirty) && (0 == IapImageDirty))
+    {
+        IapStatusDirtyTick = HAL_GetTick();
+    }
+    IapStatusCache = *write_data;
+    IapStatusCached = 1;
+    IapStatusDirty = 1;
+    if (0 == IAP_STATUS_FLUSH_MS)
+    {
+        commit_iap_status();
+    }
+}
+
+/**
+  * @brief  把写回缓存中的升级状态写入状态区，没有修改时不写 (KV_Set 还会跳过相同的值)
+  * @note   镜像 CRC 先写：状态变成 IAP_APP_DONE 时 CRC 一定已经在状态区中
+  * @retval None
+  */
+void commit_iap_status(void)
+{
+    if (0 != IapImageDirty)
+    {
+        if (HAL_OK != KV_Set(KV_KEY_IMAGE_CRC, &IapImageCache, sizeof(IapImageCache)))
+        {
+            IapStatusDirtyTick = HAL_GetTick();     /* 过 IAP_STATUS_FLUSH_MS 再试 */
+            return;
+        }
+        IapImageDirty = 0;
+    }
+    if (0 == IapStatusDirty)
+    {
+        return;
+    }
+    if (HAL_OK == KV_Set(KV_KEY_IAP_STATUS, &IapStatusCache, sizeof(IapStatusCache)))
+    {
+        IapStatusDirty = 0;
+    }
+    else
+    {
+        IapStatusDirtyTick = HAL_GetTick();     /* 过 IAP_STATUS_FLUSH_MS 再试 */
+    }
+}
+
+/**
+  * @brief  读取 App1 镜像的大小和 CRC (KV_KEY_IMAGE_CRC)，同样先查写回缓存
+  * @param  read_image 读到的数据
+  * @retval EL_FIND_SUCCESS，没有记录返回 EL_NOT_FOUND
+  */
+eFIND_Status_Def read_iap_image(iap_image_t *read_image)
+{
+    uint16_t length = 0;
+
+    if (0 == IapImageCached)
+    {
+        if ((HAL_OK != KV_Get(KV_KEY_IMAGE_CRC, &IapImageCache, sizeof(IapImageCache), &length)) ||
+            (sizeof(IapImageCache) != length))
+        {
+            return EL_NOT_FOUND;
+        }
+        IapImageCached = 1;
+    }
+    *read_image = IapImageCache;
+    return EL_FIND_SUCCESS;
+}
+
+/**
+  * @brief  修改 App1 镜像的大小和 CRC (写回缓存)，与升级状态一起由 commit_iap_status() 写入
+  * @param  size 镜像字节数，0 表示不记录 (启动时只检查栈指针)
+  * @param  crc ImageCrc of App1 [0, size)
+  * @retval None
+  */
+void write_iap_image(uint32_t size, uint32_t crc)
+{
+    iap_image_t image;
+
+    image.size = size;
+    image.crc = crc;
+    if ((0 != IapImageCached) && (0 == memcmp(&IapImageCache, &image, sizeof(image))))
+    {
+        return;
+    }
+    if ((0 == IapStatusDirty) && (0 == IapImageDirty))
+    {
+        IapStatusDirtyTick = HAL_GetTick();
+    }
+    IapImageCache = image;
+    IapImageCached = 1;
+    IapImageDirty = 1;
+}
+
+/**
+  * @brief  记录 App1 镜像的大小和 CRC，启动时 funtionCheck() 据此校验整个镜像
+  * @note   下载 (并逐包回读校验) 完成后、写入 IAP_APP_DONE 之前调用
+  * @param  write_data 要写入状态区的数据 (只设置 iap_msg.size)
+  * @param  size 镜像字节数，0 表示不记录 (启动时只检查栈指针)
+  * @retval 镜像的 CRC，size 为 0 时返回 0
+  */
+uint32_t set_iap_image(save_data_t *write_data, uint32_t size)
+{
+    uint32_t crc = (0 != size) ? ImageCrc_Calc(APPLICATION_ADDRESS, size) : 0;
+
+    write_data->iap_msg.size = size;
+    write_iap_image(size, crc);
+    return crc;
 }
 
 /**
@@ -187,22 +493,39 @@ void IAP_Init(void)
 
     /* Initialise Flash */
     FLASH_If_Init();
+    FLASH_Async_Init();
+    ImageCrc_Init();
 		
     iapInterface.TransmitFunction = TransmitAdapter;
+    iapInterface.TransmitVFunction = TransmitVAdapter;
     iapInterface.ReceiveFunction = ReceiveAdapter;
+    iapInterface.ReceiveAnyFunction = ReceiveAnyAdapter;
     iapInterface.DelayTimeMsFunction = DelayTimeAdapter;
     iapInterface.funtionJumpFunction = funtionJump;
     iapInterface.funtionCheckFunction = funtionCheck;
+    iapInterface.IdleFunction = IdleAdapter;
+    iapInterface.GetTickFunction = HAL_GetTick;
 
-    find_status = el_flash_read(&rw_data);
+    KV_Mount();         /* 状态区只扫描一次，之后读写状态只查 RAM 中的索引 */
+    find_status = read_iap_status(&rw_data);
     if(EL_FIND_SUCCESS != find_status)
     { // 说明是第一次，或者之前的数据有误已擦除区域，那就先写入一组初始值
         rw_data.header = HEADER;
         rw_data.iap_msg.status = IAP_NO_APP;
         rw_data.iap_msg.version = 1;
         rw_data.iap_msg.transmitMethod = TRANSMIT_METHOD_USB;
+        rw_data.iap_msg.size = 0;
         rw_data.ender = ENDER;
         write_iap_status(&rw_data);
+    }
+    else if(IAP_COPY_BACKUP == rw_data.iap_msg.status)
+    { // 差分升级拷贝 Backup -> App1 时掉电，Backup 中是已校验的新镜像，重新拷贝
+        if(APP_UPDATE_OK != AppUpdate_Commit(rw_data.iap_msg.size))
+        { // 记录的大小无效时 Commit 不改状态，App1 可能只拷了一半，记为无 App 等待重新下载
+            rw_data.iap_msg.status = IAP_NO_APP;
+            rw_data.iap_msg.size = 0;
+            write_iap_status(&rw_data);
+        }
     }
 		//el_test();
 }
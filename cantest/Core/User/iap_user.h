@@ -17,39 +17,35 @@
 #include "menu.h"
 
 /* Flash Memory Layout -------------------------------------------------------
-    Define the address from where user application will be loaded.
-    Note: this area is reserved for the IAP code   
-+--------------+------------+----------------------------+-----------+----------------------------+
-| Flash Region | Name       | Block Base Addresses       | Size      | Comment                    |
-+--------------+------------+----------------------------+-----------+----------------------------+
-| Main Memory  | Sector 0   | 0x0800 0000 - 0x0800 3FFF  | 16 Kbyte  | Bootloader    48 KB        |
-|              | Sector 1   | 0x0800 4000 - 0x0800 7FFF  | 16 Kbyte  |                            |
-|              | Sector 2   | 0x0800 8000 - 0x0800 BFFF  | 16 Kbyte  |                            |
-|              +------------+----------------------------+-----------+----------------------------+
-|              | Sector 3   | 0x0800 C000 - 0x0800 FFFF  | 16 Kbyte  | Upgrade flag storage 16 KB |
-|              +------------+----------------------------+-----------+----------------------------+
-|              | Sector 4   | 0x0801 0000 - 0x0801 FFFF  | 64 Kbyte  | App1          192 KB       |
-|              | Sector 5   | 0x0802 0000 - 0x0803 FFFF  | 128 Kbyte |                            |
-|              +------------+----------------------------+-----------+----------------------------+
-|              | Sector 6   | 0x0804 0000 - 0x0805 FFFF  | 128 Kbyte | Backup        256 KB       |
-|              | Sector 7   | 0x0806 0000 - 0x0807 FFFF  | 128 Kbyte |                            |
-+--------------+------------+----------------------------+-----------+----------------------------+
+    Sector geometry and the Bootloader / status / App1 / Backup regions are
+    defined in flash_layout.h, the constants below are derived from it.
 ------------------------------------------------------------------------------*/
 
 /* Exported constants ------------------------------------------------------------*/
-#define IAP_STATUS_ADDRESS                  ((uint32_t)0x0800C000)  /* Start user code address: Sector 3 */
-#define IAP_STATUS_START_SECTOR             FLASH_SECTOR_3          /* Use for IAP status space */
-#define IAP_STATUS_END_SECTOR               FLASH_SECTOR_3          /* Use for IAP status space */
-#define IAP_STATUS_SIZE                     ((uint32_t)0x00004000)  /* 16 KB */
+#define IAP_STATUS_ADDRESS                  FLASH_LAYOUT_SECTOR_START(IAP_STATUS_START_SECTOR) /* Start user code address: Sector 3 */
+#define IAP_STATUS_START_SECTOR             FLASH_LAYOUT_STATUS_FIRST                /* Use for IAP status space */
+#define IAP_STATUS_END_SECTOR               FLASH_LAYOUT_STATUS_LAST                 /* Use for IAP status space */
+#define IAP_STATUS_SIZE                     FLASH_LAYOUT_RANGE_SIZE(IAP_STATUS_START_SECTOR, IAP_STATUS_END_SECTOR) /* 16 KB */
+#if FLASH_LAYOUT_STATUS_BANKS > 1
+#define IAP_STATUS_B_ADDRESS                FLASH_LAYOUT_SECTOR_START(FLASH_LAYOUT_STATUS_B_FIRST) /* Second status bank: Sector 7 */
+#endif
+#define IAP_STATUS_STAGE_ADDRESS            (FLASH_LAYOUT_END - FLASH_LAYOUT_STATUS_STAGE_SIZE)    /* One status bank: compaction stage, end of Sector 7 */
+#define IAP_STATUS_STAGE_SIZE               FLASH_LAYOUT_STATUS_STAGE_SIZE                         /* 64 KB, 0 with two status banks */
+
+#define IAP_STATUS_FLUSH_MS                 (1000u)                                  /* Write-behind: the idle hook flushes write_iap_status() after this long, 0: at once */
 
 #define HEADER                              (0x55AA)
 #define ENDER                               (0xAA55)
-#define APPLICATION_ADDRESS                 ((uint32_t)0x08010000)  /* Start user code address: Sector 4 */
-#define APP_START_SECTOR                    FLASH_SECTOR_4          /* Use for IAP erase the app space */
-#define APP_END_SECTOR                      FLASH_SECTOR_5          /* Use for IAP erase the app space */
-#define USER_FLASH_SIZE                     ((uint32_t)0x00030000)  /* Application size 192 KB */
+#define APPLICATION_ADDRESS                 FLASH_LAYOUT_SECTOR_START(APP_START_SECTOR) /* Start user code address: Sector 4 */
+#define APP_START_SECTOR                    FLASH_LAYOUT_APP_FIRST                   /* Use for IAP erase the app space */
+#define APP_END_SECTOR                      FLASH_LAYOUT_APP_LAST                    /* Use for IAP erase the app space */
+#define USER_FLASH_SIZE                     FLASH_LAYOUT_RANGE_SIZE(APP_START_SECTOR, APP_END_SECTOR) /* Application size 192 KB */
+#define BACKUP_ADDRESS                      FLASH_LAYOUT_SECTOR_START(BACKUP_START_SECTOR) /* Backup / delta staging: Sector 6 */
+#define BACKUP_START_SECTOR                 FLASH_LAYOUT_BACKUP_FIRST                /* Use for IAP erase the backup space */
+#define BACKUP_END_SECTOR                   FLASH_LAYOUT_BACKUP_LAST                 /* Use for IAP erase the backup space */
+#define BACKUP_FLASH_SIZE                   (FLASH_LAYOUT_RANGE_SIZE(BACKUP_START_SECTOR, BACKUP_END_SECTOR) - IAP_STATUS_STAGE_SIZE) /* Backup image size 192 KB (128 KB with two status banks) */
 
-#define USER_FLASH_END_ADDRESS              ((uint32_t)0x0807FFFF)  /* Notable Flash addresses */
+#define USER_FLASH_END_ADDRESS              (FLASH_LAYOUT_END - 1u)                  /* Notable Flash addresses */
 
 /* Exported types -----------------------------------------------------------*/
 typedef enum {
@@ -70,6 +66,7 @@ typedef enum
   IAP_NO_APP,
   IAP_DOWNING_BIN,
   IAP_APP_DONE,
+  IAP_COPY_BACKUP,      /* verified image in Backup, copy to App1 not finished (size valid) */
 } eIAP_Status_Def;
 
 typedef enum
@@ -98,26 +95,32 @@ typedef struct
 }save_data_t;
 #pragma pack(pop)   
 
-typedef enum {
-  PKG_NOT_DONE = 0,     /* Not received a complete package */
-  PKG_COMPLETE = 1,     /* Received a complete package */
-  PKG_HANDLE_ING = 2    /* Processing the package (means there is still unprocessed data) */
-} eReceiveStatus;
+/* KV_KEY_IMAGE_CRC: 启动时校验 App1 用，save_data_t 的格式 (状态区的旧记录) 不变 */
+typedef struct
+{
+  uint32_t size;                /* 镜像字节数，与 IAP_APP_DONE 时的 iap_msg.size 相同才校验 */
+  uint32_t crc;                 /* ImageCrc of App1 [0, size) */
+}iap_image_t;
+
+typedef struct {
+  uint8_t rx_paused;            /* OUT endpoint left NAKing because IAP_StageUsb is full */
+} IAP_Receive_Struct;           /* Received data is queued in IAP_StageUsb (iap_stage.h) */
 
 typedef struct {
-  char recivebuf[1200];         /* Data buffer */
-  uint16_t length;              /* Total data length */
-  uint16_t handle_cnt;          /* Number of processed data (for STM32 official Ymodem protocol) */
-  uint8_t pack64_cnt;           /* Number of 64-byte packages */
-  eReceiveStatus iap_pkgtatus;  /* Current IAP status */
-} IAP_Receive_Struct;
+  const void *p_base;           /* Segment start */
+  uint16_t length;              /* Segment length in bytes */
+} IAP_IoVec;
 
 typedef struct {
   HAL_StatusTypeDef (*TransmitFunction)(void *data, uint16_t length, uint32_t timeout);  /* Transmit function pointer */
+  HAL_StatusTypeDef (*TransmitVFunction)(const IAP_IoVec *p_iov, uint8_t iovcnt, uint32_t timeout); /* Gather transmit pointer */
   HAL_StatusTypeDef (*ReceiveFunction)(uint8_t *data, uint16_t length, uint32_t timeout); /* Receive function pointer */
+  uint16_t (*ReceiveAnyFunction)(uint8_t *data, uint16_t length, uint32_t timeout);     /* Bulk receive: what is queued, up to length, 0 on timeout */
   void (*DelayTimeMsFunction)(uint32_t delaytime);                                      /* Delay function pointer */
   eNEWAPP_Status_Def (*funtionCheckFunction)(void);                                     /* Function check pointer */
   void (*funtionJumpFunction)(void);                                                    /* Function jump pointer */
+  void (*IdleFunction)(void);                                                           /* Called while waiting for data */
+  uint32_t (*GetTickFunction)(void);                                                    /* Millisecond time base */
 } IAP_Interface;
 
 /* Exported macro -------------------------------------------------------------*/
@@ -130,5 +133,9 @@ extern IAP_Interface iapInterface;
 void IAP_Init(void);
 eFIND_Status_Def read_iap_status(save_data_t *read_data);
 void write_iap_status(save_data_t *write_data);
+void commit_iap_status(void);
+eFIND_Status_Def read_iap_image(iap_image_t *read_image);
+void write_iap_image(uint32_t size, uint32_t crc);
+uint32_t set_iap_image(save_data_t *write_data, uint32_t size);
 #endif /* __IAP_USER_H */
 
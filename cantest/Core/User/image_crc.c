@@ -0,0 +1,128 @@
+/******************************************************************************
+ * @file    image_crc.c
+ * @brief   Image CRC engine: CRC peripheral fed by DMA2 memory-to-memory.
+ * @author  Jason
+ * @version V1.0.0
+ * @date    2025-3
+ * @copyright (c) 2025, All rights reserved.
+ ******************************************************************************/
+
+/* Includes ------------------------------------------------------------------*/
+#include "image_crc.h"
+#include "crc.h"
+
+/* Private typedef -----------------------------------------------------------*/
+
+/* Private define ------------------------------------------------------------*/
+
+/* Private macro -------------------------------------------------------------*/
+
+/* Private variables ---------------------------------------------------------*/
+#if IMAGE_CRC_HW
+static DMA_HandleTypeDef hdma_crc;
+static uint8_t DmaReady;                /* HAL_DMA_Init 成功 */
+#endif
+
+/* Private function prototypes -----------------------------------------------*/
+
+/* Private functions ---------------------------------------------------------*/
+#if IMAGE_CRC_HW
+/**
+ * @brief  用 DMA 把 count 个字送进 CRC->DR
+ * @note   CRC 外设的结果累加，不在这里复位
+ * @param  address: 字对齐的源地址
+ * @param  count: 字数
+ * @retval HAL_OK，DMA 出错或超时返回错误 (CRC 结果无效)
+ */
+static HAL_StatusTypeDef ImageCrc_Dma(uint32_t address, uint32_t count)
+{
+  uint32_t words;
+
+  while (count > 0)
+  {
+    words = (count > IMAGE_CRC_DMA_MAX_WORDS) ? IMAGE_CRC_DMA_MAX_WORDS : count;
+    /* 存储器到存储器：外设端口是源 (PAR)，存储器端口是目的 (M0AR) */
+    if ((HAL_DMA_Start(&hdma_crc, address, (uint32_t)&CRC->DR, words) != HAL_OK) ||
+        (HAL_DMA_PollForTransfer(&hdma_crc, HAL_DMA_FULL_TRANSFER, IMAGE_CRC_TIMEOUT_MS) != HAL_OK))
+    {
+      (void)HAL_DMA_Abort(&hdma_crc);
+      return HAL_ERROR;
+    }
+    address += 4u * words;
+    count -= words;
+  }
+  return HAL_OK;
+}
+#endif
+
+/* Public functions ----------------------------------------------------------*/
+/**
+ * @brief  打开 CRC 和 DMA2 时钟，配置 DMA2 Stream0 (存储器到存储器, 字)
+ * @retval None
+ */
+void ImageCrc_Init(void)
+{
+#if IMAGE_CRC_HW
+  __HAL_RCC_CRC_CLK_ENABLE();
+  __HAL_RCC_DMA2_CLK_ENABLE();
+
+  hdma_crc.Instance = DMA2_Stream0;
+  hdma_crc.Init.Channel = DMA_CHANNEL_0;
+  hdma_crc.Init.Direction = DMA_MEMORY_TO_MEMORY;
+  hdma_crc.Init.PeriphInc = DMA_PINC_ENABLE;           /* 源：FLASH 递增 */
+  hdma_crc.Init.MemInc = DMA_MINC_DISABLE;             /* 目的：CRC->DR 固定 */
+  hdma_crc.Init.PeriphDataAlignment = DMA_PDATAALIGN_WORD;
+  hdma_crc.Init.MemDataAlignment = DMA_MDATAALIGN_WORD;
+  hdma_crc.Init.Mode = DMA_NORMAL;
+  hdma_crc.Init.Priority = DMA_PRIORITY_LOW;
+  hdma_crc.Init.FIFOMode = DMA_FIFOMODE_ENABLE;        /* 存储器到存储器不能用直接模式 */
+  hdma_crc.Init.FIFOThreshold = DMA_FIFO_THRESHOLD_FULL;
+  hdma_crc.Init.MemBurst = DMA_MBURST_SINGLE;
+  hdma_crc.Init.PeriphBurst = DMA_PBURST_SINGLE;
+  DmaReady = (HAL_DMA_Init(&hdma_crc) == HAL_OK) ? 1u : 0u;
+#endif
+}
+
+/**
+ * @brief  计算 [address, address + size) 的镜像 CRC
+ * @note   整字由 DMA 送入 CRC 外设 (或软件计算)，最后不足一个字的字节补 0xFF 后由 CPU 写入
+ * @param  address: 字对齐的起始地址
+ * @param  size: 字节数
+ * @retval CRC-32/MPEG-2 (STM32 CRC 外设)
+ */
+uint32_t ImageCrc_Calc(uint32_t address, uint32_t size)
+{
+  uint32_t words = size / 4u;
+  uint32_t tail = 0xFFFFFFFFu;
+  uint32_t crc;
+  uint32_t i;
+
+  for (i = 0; i < (size & 3u); i++)
+  {
+    ((uint8_t *)&tail)[i] = *(const uint8_t *)(address + 4u * words + i);
+  }
+
+#if IMAGE_CRC_HW
+  if (DmaReady != 0)
+  {
+    CRC->CR = CRC_CR_RESET;
+    if (ImageCrc_Dma(address, words) == HAL_OK)
+    {
+      if ((size & 3u) != 0)
+      {
+        CRC->DR = tail;
+      }
+      return CRC->DR;
+    }
+  }
+#endif
+
+  crc = Crc32_UpdateWords(CRC32_WORD_INIT_VALUE, (const uint32_t *)address, words);
+  if ((size & 3u) != 0)
+  {
+    crc = Crc32_UpdateWords(crc, &tail, 1);
+  }
+  return crc;
+}
+
+/************************ (C) COPYRIGHT Jason *****END OF FILE****/
@@ -0,0 +1,47 @@
+/******************************************************************************
+ * @file    image_crc.h
+ * @brief   Image CRC engine: CRC peripheral fed by DMA2 memory-to-memory.
+ * @author  Jason
+ * @version V1.0.0
+ * @date    2025-3
+ * @copyright (c) 2025, All rights reserved.
+ ******************************************************************************/
+
+#ifndef __IMAGE_CRC_H
+#define __IMAGE_CRC_H
+
+/* Private Includes ----------------------------------------------------------*/
+#include "main.h"
+
+/**
+ * 整个镜像的 CRC，用于下载结束后记录/比较镜像，以及启动时 funtionCheck() 校验 App1。
+ *  - 硬件 (IMAGE_CRC_HW = 1)：DMA2 Stream0 存储器到存储器，源为 FLASH (地址递增)，
+ *    目的为 CRC->DR (地址固定)，每个字由 CRC 外设计算，CPU 只等待传输完成；
+ *    DMA 出错时自动改用软件计算，结果相同
+ *  - 软件 (IMAGE_CRC_HW = 0，主机端)：crc.c 的 Crc32_UpdateWords()
+ * 算法就是 F2 CRC 外设的算法 (CRC-32/MPEG-2：poly 0x04C11DB7, init 0xFFFFFFFF,
+ * 不反转，无结果异或)，按小端 32 位字输入；长度不是 4 的倍数时最后一个字用 0xFF 补齐。
+ * 注意它不是 Zmodem / 差分文件用的 IEEE CRC-32 (crc.h Crc32_Calc)。
+ * 地址必须按字对齐。CRC 外设只有一个，不要在中断里调用。
+ */
+/* Exported constants --------------------------------------------------------*/
+#ifndef IMAGE_CRC_HW
+#define IMAGE_CRC_HW                (1)
+#endif
+
+#define IMAGE_CRC_DMA_MAX_WORDS     (0xFFFFu)        /* NDTR is 16 bits */
+#define IMAGE_CRC_TIMEOUT_MS        (100u)           /* one DMA block, a few ms at 120 MHz */
+
+/* Exported types ------------------------------------------------------------*/
+
+/* Exported macro ------------------------------------------------------------*/
+
+/* Exported variables --------------------------------------------------------*/
+
+/* Exported function prototypes ----------------------------------------------*/
+void ImageCrc_Init(void);
+uint32_t ImageCrc_Calc(uint32_t address, uint32_t size);
+
+#endif /* __IMAGE_CRC_H */
+
+/************************ (C) COPYRIGHT Jason *****END OF FILE****/
@@ -0,0 +1,763 @@
+/******************************************************************************
+ * @file    kv_store.c
+ * @brief   Log-structured key/value store in the status sector: keyed,
+ *          variable-length records, RAM index, compaction into the other
+ *          status bank (or through a stage snapshot with one bank) when full.
+ * @author  Jason
+ * @version V1.0.0
+ * @date    2025-3
+ * @copyright (c) 2025, All rights reserved.
+ ******************************************************************************/
+
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+#include "kv_store.h"
+#include "flash_e_level.h"
+#include "flash_async.h"
+#include "crc.h"
+
+/* Private typedef -----------------------------------------------------------*/
+typedef struct
+{
+  uint32_t magic;               /* KV_MAGIC */
+  uint32_t erase_count;         /* generation, the bank with the higher one is current */
+} KV_AreaHeaderTypeDef;
+
+typedef struct
+{
+  uint16_t key;                 /* KV_KEY_FREE: free space */
+  uint16_t length;              /* value bytes, 0: key deleted */
+} KV_RecordHeaderTypeDef;
+
+typedef struct
+{
+  uint16_t key;
+  uint16_t length;
+  uint32_t address;             /* value in flash */
+} KV_IndexTypeDef;
+
+/* Private define ------------------------------------------------------------*/
+#define KV_AREA_END             (KvArea + KV_AREA_SPAN(KvArea))
+#define KV_FIRST_RECORD         (KvArea + sizeof(KV_AreaHeaderTypeDef))
+#define KV_KEY_FREE             (0xFFFFu)
+#define KV_ERASED_WORD          (0xFFFFFFFFu)
+#define KV_STAGE_SLOTS          (KV_STAGE_SIZE / KV_STAGE_SLOT_SIZE)
+
+/* Private macro -------------------------------------------------------------*/
+/* Value rounded up to a word; record = header + value + CRC-32 */
+#define KV_VALUE_SIZE(length)   (((uint32_t)(length) + 3u) & ~3u)
+#define KV_RECORD_SIZE(length)  (sizeof(KV_RecordHeaderTypeDef) + KV_VALUE_SIZE(length) + 4u)
+/* Bytes of a bank or of a stage slot (KV_STAGE_START is the end of the flash with two banks) */
+#define KV_AREA_SPAN(area)      (((area) >= KV_STAGE_START) ? KV_STAGE_SLOT_SIZE : KV_AREA_SIZE)
+/* The bank compaction writes to; itself with one bank */
+#define KV_OTHER_AREA(area)     (((area) == KV_AREA_START) ? KV_AREA_B_START : KV_AREA_START)
+
+/* Private variables ---------------------------------------------------------*/
+static KV_IndexTypeDef aKvIndex[KV_MAX_KEYS];
+static uint32_t KvKeys;
+static uint32_t KvArea = KV_AREA_START;  /* current bank (a stage slot when Sector 3 could not be rewritten) */
+static uint32_t KvFree;                 /* address of the next record */
+static uint32_t KvEraseCount;
+static uint8_t KvMounted;
+static uint8_t KvDirty;                 /* 记录头损坏或写入失败，不能再追加，先压缩 */
+static uint32_t KvEraseArea;            /* 压缩后留下的旧 bank 或用掉一半的暂存区，KV_Idle() 擦除，0：没有 */
+static volatile uint8_t KvErasing;      /* KvEraseArea 的擦除已交给 flash_async.c */
+static uint32_t aKvRecord[KV_RECORD_SIZE(KV_MAX_VALUE) / 4u];   /* 正在写的记录 */
+static uint8_t aKvCompact[KV_MAX_KEYS * KV_MAX_VALUE];          /* 压缩时保存有效的值 */
+
+/* Private function prototypes -----------------------------------------------*/
+static KV_IndexTypeDef *KV_Find(uint16_t key);
+static void KV_IndexUpdate(uint16_t key, uint16_t length, uint32_t address);
+static uint8_t KV_RecordValid(uint32_t address, uint16_t length);
+static uint8_t KV_AreaBlank(uint32_t area);
+static uint8_t KV_AreaValid(uint32_t area);
+static void KV_Scan(uint32_t area);
+static void KV_EraseDone(const FLASH_Async_JobTypeDef *p_job);
+static void KV_EraseSettle(void);
+static HAL_StatusTypeDef KV_Format(uint32_t area, uint32_t erase_count);
+static HAL_StatusTypeDef KV_Commit(void);
+static HAL_StatusTypeDef KV_Append(uint16_t key, const void *p_value, uint16_t length);
+static uint32_t KV_Collect(KV_IndexTypeDef *p_live, uint16_t key, const void *p_value, uint16_t length);
+static HAL_StatusTypeDef KV_Fill(uint32_t area, uint32_t erase_count, const KV_IndexTypeDef *p_live, uint32_t count);
+#if KV_STAGE_SIZE != 0
+static uint32_t KV_StageFree(void);
+static uint32_t KV_StageLatest(void);
+static uint32_t KV_StageUsed(void);
+static void KV_StageCheck(void);
+#endif
+static HAL_StatusTypeDef KV_CompactWith(uint16_t key, const void *p_value, uint16_t length);
+static HAL_StatusTypeDef KV_Write(uint16_t key, const void *p_value, uint16_t length);
+
+/* Private functions ---------------------------------------------------------*/
+static KV_IndexTypeDef *KV_Find(uint16_t key)
+{
+  uint32_t i;
+
+  for (i = 0; i < KvKeys; i++)
+  {
+    if (aKvIndex[i].key == key)
+    {
+      return &aKvIndex[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief  索引中记下 key 的最新记录
+ * @param  key: 键
+ * @param  length: 值的字节数，0：删除
+ * @param  address: 值在 FLASH 中的地址
+ * @retval None
+ */
+static void KV_IndexUpdate(uint16_t key, uint16_t length, uint32_t address)
+{
+  KV_IndexTypeDef *p_entry = KV_Find(key);
+
+  if (length == 0)
+  {
+    if (p_entry != NULL)
+    {
+      *p_entry = aKvIndex[--KvKeys];
+    }
+    return;
+  }
+  if (p_entry == NULL)
+  {
+    if (KvKeys >= KV_MAX_KEYS)
+    {
+      return;                   /* KV_Set 不会写出更多的 key */
+    }
+    p_entry = &aKvIndex[KvKeys++];
+    p_entry->key = key;
+  }
+  p_entry->length = length;
+  p_entry->address = address;
+}
+
+/**
+ * @brief  检查记录的 CRC (头和补齐的值)
+ * @param  address: 记录地址
+ * @param  length: 记录头中的值长度
+ * @retval 1：记录完整
+ */
+static uint8_t KV_RecordValid(uint32_t address, uint16_t length)
+{
+  uint32_t size = sizeof(KV_RecordHeaderTypeDef) + KV_VALUE_SIZE(length);
+
+  return (Crc32_Calc((const uint8_t *)address, size) == *(const uint32_t *)(address + size)) ? 1u : 0u;
+}
+
+/**
+ * @brief  bank (或暂存区的槽) 是否整个为空 (擦除后没有写过)
+ * @param  area: bank 或槽的起始地址
+ * @retval 1：空
+ */
+static uint8_t KV_AreaBlank(uint32_t area)
+{
+  const uint32_t *p_word = (const uint32_t *)area;
+  const uint32_t *p_end = (const uint32_t *)(area + KV_AREA_SPAN(area));
+
+  while ((p_word < p_end) && (*p_word == KV_ERASED_WORD))
+  {
+    p_word++;
+  }
+  return (p_word == p_end) ? 1u : 0u;
+}
+
+/**
+ * @brief  bank 是否已提交 (扇区头在全部记录之后写入)
+ * @param  area: bank 起始地址
+ * @retval 1：扇区头正确
+ */
+static uint8_t KV_AreaValid(uint32_t area)
+{
+  return (((const KV_AreaHeaderTypeDef *)area)->magic == KV_MAGIC) ? 1u : 0u;
+}
+
+/**
+ * @brief  扫描已提交的 bank，建立索引，找到空闲空间
+ * @note   暂存区的槽只读：扫描后 KvDirty 置位，下一次写入先压缩回 Sector 3；
+ *         没有提交的区域索引为空，同样先压缩
+ * @param  area: bank (或槽) 起始地址，之后在这个 bank 中追加
+ * @retval None
+ */
+static void KV_Scan(uint32_t area)
+{
+  KV_RecordHeaderTypeDef header;
+  uint32_t address = area + sizeof(KV_AreaHeaderTypeDef);
+
+  KvArea = area;
+  KvKeys = 0;
+  KvDirty = 0;
+  KvEraseCount = ((const KV_AreaHeaderTypeDef *)area)->erase_count;
+  if (KV_AreaValid(area) == 0)
+  {
+    KvEraseCount = 0;
+    KvFree = KV_FIRST_RECORD;
+    KvDirty = 1;                /* 没有提交 (旧格式或压缩写了一半)：不建索引，下一次写入先压缩 */
+    return;
+  }
+  while (address + sizeof(KV_RecordHeaderTypeDef) <= KV_AREA_END)
+  {
+    header = *(const KV_RecordHeaderTypeDef *)address;
+    if (*(const uint32_t *)address == KV_ERASED_WORD)
+    {
+      break;                    /* 空闲空间 */
+    }
+    if ((header.key == KV_KEY_FREE) || (header.length > KV_MAX_VALUE) ||
+        (KV_RECORD_SIZE(header.length) > KV_AREA_END - address))
+    {
+      KvDirty = 1;              /* 记录头写坏了，不知道下一条从哪里开始 */
+      break;
+    }
+    if (KV_RecordValid(address, header.length))
+    {
+      KV_IndexUpdate(header.key, header.length, address + sizeof(KV_RecordHeaderTypeDef));
+    }
+    address += KV_RECORD_SIZE(header.length);
+  }
+  KvFree = address;
+  if (area >= KV_STAGE_START)
+  {
+    KvDirty = 1;
+  }
+}
+
+/**
+ * @brief  KV_Idle() 交给 flash_async.c 的擦除结束 (FLASH_Async_Poll() 中调用)
+ * @param  p_job: 擦除作业
+ * @retval None
+ */
+static void KV_EraseDone(const FLASH_Async_JobTypeDef *p_job)
+{
+  if ((p_job->status == FLASHIF_OK) && (p_job->address == KvEraseArea))
+  {
+    KvEraseArea = 0;
+  }
+  KvErasing = 0;              /* 失败时下次空闲重新擦除 */
+}
+
+/**
+ * @brief  等待空闲时开始的擦除结束
+ * @retval None
+ */
+static void KV_EraseSettle(void)
+{
+  if (KvErasing != 0)
+  {
+    (void)FLASH_Async_Wait(FLASH_ASYNC_TIMEOUT_MS);
+    FLASH_Async_Poll();
+  }
+}
+
+/**
+ * @brief  擦除 bank (已经是空的就不擦)，之后在这个 bank 中追加，索引清空
+ * @note   扇区头由 KV_Commit() 在全部记录写完之后写入，之前掉电时这个 bank 不会被挂载。
+ *         暂存区的槽必须是空的，不单独擦除 (整个暂存区由 KV_Idle() 擦除)
+ * @param  area: bank 或槽的起始地址
+ * @param  erase_count: 写入扇区头的擦除次数
+ * @retval HAL_OK，擦除失败返回 HAL_ERROR (区域不能追加)
+ */
+static HAL_StatusTypeDef KV_Format(uint32_t area, uint32_t erase_count)
+{
+  KV_EraseSettle();
+  if (area == KvEraseArea)
+  {
+    KvEraseArea = 0;            /* 等不到空闲了，在这里擦除 */
+  }
+  KvArea = area;
+  KvKeys = 0;
+  KvFree = KV_FIRST_RECORD;
+  KvEraseCount = erase_count;
+  KvDirty = 1;
+  /* FLASH_If_Erase_Range 在任何情况下都会重新上锁 (下载会话中保持解锁) */
+  if ((KV_AreaBlank(area) == 0) &&
+      ((area >= KV_STAGE_START) || (FLASH_If_Erase_Range(area, KV_AREA_SIZE) != HAL_OK)))
+  {
+    return HAL_ERROR;
+  }
+  return HAL_OK;
+}
+
+/**
+ * @brief  写入扇区头，bank 从此有效
+ * @retval HAL_OK，写入失败返回 HAL_ERROR
+ */
+static HAL_StatusTypeDef KV_Commit(void)
+{
+  KV_AreaHeaderTypeDef header;
+
+  header.magic = KV_MAGIC;
+  header.erase_count = KvEraseCount;
+  if (FLASH_If_Write(KvArea, (uint32_t *)&header, sizeof(header) / 4u) != FLASHIF_OK)
+  {
+    return HAL_ERROR;
+  }
+  KvDirty = 0;
+  return HAL_OK;
+}
+
+/**
+ * @brief  在空闲空间追加一条记录并更新索引
+ * @note   调用前已确认放得下
+ * @param  key: 键
+ * @param  p_value: 值
+ * @param  length: 值的字节数，0：删除
+ * @retval HAL_OK，写入失败返回 HAL_ERROR (之后先压缩再追加)
+ */
+static HAL_StatusTypeDef KV_Append(uint16_t key, const void *p_value, uint16_t length)
+{
+  KV_RecordHeaderTypeDef *p_header = (KV_RecordHeaderTypeDef *)aKvRecord;
+  uint32_t size = sizeof(KV_RecordHeaderTypeDef) + KV_VALUE_SIZE(length);
+  uint32_t address = KvFree;
+
+  memset(aKvRecord, 0xFF, sizeof(aKvRecord));
+  p_header->key = key;
+  p_header->length = length;
+  if (length != 0)
+  {
+    memcpy(&p_header[1], p_value, length);
+  }
+  aKvRecord[size / 4u] = Crc32_Calc((const uint8_t *)aKvRecord, size);
+
+  KvFree += size + 4u;
+  if (FLASH_If_Write(address, aKvRecord, size / 4u + 1u) != FLASHIF_OK)
+  {
+    KvDirty = 1;
+    return HAL_ERROR;
+  }
+  KV_IndexUpdate(key, length, address + sizeof(KV_RecordHeaderTypeDef));
+  return HAL_OK;
+}
+
+/**
+ * @brief  有效的值拷贝到 RAM (aKvCompact)，压缩或恢复时写入新的 bank
+ * @param  p_live: 结果，address 是值在 aKvCompact 中的偏移，KV_MAX_KEYS 项
+ * @param  key: 不保留这个 key 原来的值，KV_KEY_FREE：全部保留
+ * @param  p_value: key 的新值，放在最后
+ * @param  length: 新值的字节数，0：删除 key
+ * @retval 值的个数
+ */
+static uint32_t KV_Collect(KV_IndexTypeDef *p_live, uint16_t key, const void *p_value, uint16_t length)
+{
+  uint32_t count = 0, offset = 0, i;
+
+  for (i = 0; i < KvKeys; i++)
+  {
+    if (aKvIndex[i].key != key)
+    {
+      p_live[count] = aKvIndex[i];
+      p_live[count].address = offset;
+      memcpy(&aKvCompact[offset], (const void *)aKvIndex[i].address, aKvIndex[i].length);
+      offset += aKvIndex[i].length;
+      count++;
+    }
+  }
+  if ((key != KV_KEY_FREE) && (length != 0))
+  {
+    p_live[count].key = key;
+    p_live[count].length = length;
+    p_live[count].address = offset;
+    memcpy(&aKvCompact[offset], p_value, length);
+    count++;
+  }
+  return count;
+}
+
+/**
+ * @brief  格式化 bank (或暂存区的槽)，写入 KV_Collect() 收集的值后提交
+ * @param  area: bank 或槽的起始地址
+ * @param  erase_count: 写入扇区头的擦除次数
+ * @param  p_live: KV_Collect() 的结果
+ * @param  count: 值的个数
+ * @retval HAL_OK，失败 (没有提交) 返回 HAL_ERROR
+ */
+static HAL_StatusTypeDef KV_Fill(uint32_t area, uint32_t erase_count, const KV_IndexTypeDef *p_live, uint32_t count)
+{
+  HAL_StatusTypeDef status = KV_Format(area, erase_count);
+  uint32_t i;
+
+  for (i = 0; (i < count) && (status == HAL_OK); i++)
+  {
+    status = (KV_RECORD_SIZE(p_live[i].length) <= KV_AREA_END - KvFree) ?
+             KV_Append(p_live[i].key, &aKvCompact[p_live[i].address], p_live[i].length) : HAL_ERROR;
+  }
+  if (status == HAL_OK)
+  {
+    status = KV_Commit();
+  }
+  return status;
+}
+
+#if KV_STAGE_SIZE != 0
+/**
+ * @brief  暂存区中第一个空的槽 (槽按顺序使用，暂存区擦除后从头开始)
+ * @retval 槽地址，暂存区已满返回 0
+ */
+static uint32_t KV_StageFree(void)
+{
+  uint32_t slot;
+
+  for (slot = KV_STAGE_START; slot < KV_STAGE_START + KV_STAGE_SIZE; slot += KV_STAGE_SLOT_SIZE)
+  {
+    if (KV_AreaBlank(slot) != 0)
+    {
+      return slot;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief  暂存区中擦除次数最大的已提交槽
+ * @retval 槽地址，没有返回 0
+ */
+static uint32_t KV_StageLatest(void)
+{
+  uint32_t slot, latest = 0;
+
+  for (slot = KV_STAGE_START; slot < KV_STAGE_START + KV_STAGE_SIZE; slot += KV_STAGE_SLOT_SIZE)
+  {
+    if ((KV_AreaValid(slot) != 0) &&
+        ((latest == 0) || ((int32_t)(((const KV_AreaHeaderTypeDef *)slot)->erase_count -
+                                     ((const KV_AreaHeaderTypeDef *)latest)->erase_count) > 0)))
+    {
+      latest = slot;
+    }
+  }
+  return latest;
+}
+
+/**
+ * @brief  暂存区擦除后用过的槽数
+ * @retval 0 ~ KV_STAGE_SLOTS
+ */
+static uint32_t KV_StageUsed(void)
+{
+  uint32_t slot = KV_StageFree();
+
+  return (slot == 0) ? KV_STAGE_SLOTS : (slot - KV_STAGE_START) / KV_STAGE_SLOT_SIZE;
+}
+
+/**
+ * @brief  Sector 3 已提交且槽用掉一半时，让 KV_Idle() 擦除暂存区
+ * @retval None
+ */
+static void KV_StageCheck(void)
+{
+  if ((KvArea == KV_AREA_START) && (KvEraseArea == 0) && (KV_StageUsed() >= KV_STAGE_SLOTS / 2u))
+  {
+    KvEraseArea = KV_STAGE_START;
+  }
+}
+#endif
+
+/**
+ * @brief  压缩：有效的值拷贝到 RAM，写入另一个 bank 后提交，旧 bank 留给 KV_Idle() 擦除
+ * @note   另一个 bank 通常已经在空闲时擦好，压缩只写不擦。提交 (写入扇区头) 之前掉电，
+ *         KV_Mount() 仍然使用旧 bank。只有一个 bank 时先写入暂存区的一个槽并提交，
+ *         之后才原地擦除 Sector 3 重新写入，中间掉电 KV_Mount() 从槽恢复；暂存区满时不压缩
+ * @param  key: 不保留这个 key 原来的值，KV_KEY_FREE：全部保留
+ * @param  p_value: key 的新值，和有效的值一起写入新 bank
+ * @param  length: 新值的字节数，0：删除 key
+ * @retval HAL_OK，失败返回 HAL_ERROR
+ */
+static HAL_StatusTypeDef KV_CompactWith(uint16_t key, const void *p_value, uint16_t length)
+{
+  KV_IndexTypeDef aLive[KV_MAX_KEYS];
+  HAL_StatusTypeDef status;
+  uint32_t old_area = KvArea;
+  uint32_t erase_count = KvEraseCount + 1u;
+  uint32_t count;
+#if KV_STAGE_SIZE != 0
+  uint32_t slot;
+#endif
+
+  count = KV_Collect(aLive, key, p_value, length);
+  KV_EraseSettle();
+
+#if KV_STAGE_SIZE != 0
+  slot = KV_StageFree();
+  status = (slot != 0) ? KV_Fill(slot, erase_count, aLive, count) : HAL_ERROR;
+  if (status != HAL_OK)
+  {
+    KV_Scan(old_area);          /* Sector 3 没有动过 */
+    KV_StageCheck();            /* 暂存区满：空闲时擦除，写回缓存稍后再写 */
+    return status;
+  }
+  KvEraseArea = 0;              /* 暂存区中的槽现在是唯一完整的副本 */
+#endif
+
+  status = KV_Fill(KV_OTHER_AREA(old_area), erase_count, aLive, count);
+#if KV_STAGE_SIZE != 0
+  if (status == HAL_OK)
+  {
+    KV_StageCheck();
+  }
+  else
+  {
+    KV_Scan(slot);              /* Sector 3 没有提交：从槽读，下一次写入再压缩 */
+  }
+#else
+  if (KvArea != old_area)
+  {
+    if (status == HAL_OK)
+    {
+      KvEraseArea = old_area;
+    }
+    else
+    {
+      KV_Scan(old_area);        /* 新 bank 没有提交，继续使用旧 bank */
+    }
+  }
+#endif
+  return status;
+}
+
+/**
+ * @brief  写一条记录，放不下或区域不能追加时压缩 (新值随压缩一起写入)
+ * @param  key: 键
+ * @param  p_value: 值
+ * @param  length: 值的字节数，0：删除
+ * @retval HAL_OK，失败返回 HAL_ERROR
+ */
+static HAL_StatusTypeDef KV_Write(uint16_t key, const void *p_value, uint16_t length)
+{
+  if ((KvDirty != 0) || (KV_RECORD_SIZE(length) > KV_AREA_END - KvFree))
+  {
+    return KV_CompactWith(key, p_value, length);
+  }
+  return KV_Append(key, p_value, length);
+}
+
+/* Public functions ----------------------------------------------------------*/
+/**
+ * @brief  扫描状态区，在 RAM 中建立索引
+ * @note   第一次读写时自动调用。使用擦除次数较大的已提交 bank，另一个 bank 不是空的
+ *         (旧 bank、没有提交完的压缩) 时留给 KV_Idle() 擦除。只有一个 bank 时暂存区中有更新的槽
+ *         (压缩擦除 Sector 3 之后没有提交) 先从槽恢复。两个 bank 都没有提交时，Sector 3 是空的
+ *         才格式化；键值存储之前 flash_e_level.c 格式 (el_legacy_data_t) 中最新的升级状态
+ *         按压缩的方式迁移到 KV_KEY_IAP_STATUS (bank B，或者先写暂存区的槽，提交之前旧记录不动)；
+ *         其它内容不擦除，第一次写入时再压缩
+ * @retval HAL_OK，格式化或迁移失败返回 HAL_ERROR
+ */
+HAL_StatusTypeDef KV_Mount(void)
+{
+  const KV_AreaHeaderTypeDef *p_a = (const KV_AreaHeaderTypeDef *)KV_AREA_START;
+  const KV_AreaHeaderTypeDef *p_b = (const KV_AreaHeaderTypeDef *)KV_AREA_B_START;
+  el_legacy_data_t legacy;
+  save_data_t converted;
+  HAL_StatusTypeDef status = HAL_OK;
+#if KV_STAGE_SIZE != 0
+  KV_IndexTypeDef aLive[KV_MAX_KEYS];
+  uint32_t slot, count;
+#endif
+
+  KvMounted = 1;
+  KV_EraseSettle();
+  KvEraseArea = 0;
+#if KV_STAGE_SIZE != 0
+  slot = KV_StageLatest();
+  if ((slot != 0) &&
+      ((KV_AreaValid(KV_AREA_START) == 0) ||
+       ((int32_t)(((const KV_AreaHeaderTypeDef *)slot)->erase_count - p_a->erase_count) > 0)))
+  {
+    KV_Scan(slot);
+    count = KV_Collect(aLive, KV_KEY_FREE, NULL, 0);
+    status = KV_Fill(KV_AREA_START, KvEraseCount, aLive, count);
+    if (status != HAL_OK)
+    {
+      KV_Scan(slot);            /* 下一次写入再试 */
+    }
+  }
+  else
+#endif
+  if ((KV_AreaValid(KV_AREA_B_START) != 0) &&
+      ((KV_AreaValid(KV_AREA_START) == 0) || ((int32_t)(p_b->erase_count - p_a->erase_count) > 0)))
+  {
+    KV_Scan(KV_AREA_B_START);
+  }
+  else if (KV_AreaValid(KV_AREA_START) != 0)
+  {
+    KV_Scan(KV_AREA_START);
+  }
+  else if (KV_AreaBlank(KV_AREA_START) != 0)
+  {
+    status = KV_Format(KV_AREA_START, 0u);
+    if (status == HAL_OK)
+    {
+      status = KV_Commit();
+    }
+  }
+  else
+  {
+    /* 不是已提交的 bank：不擦除，只迁移旧格式的升级状态，其它情况第一次写入时再压缩 */
+    KV_Scan(KV_AREA_START);
+    if (el_flash_read_legacy(&legacy) == EL_FIND_SUCCESS)
+    {
+#if KV_STAGE_SIZE != 0
+      if (KV_StageFree() == 0)
+      { /* 旧版本没有暂存区，这里可能还是原来 Backup 的内容 */
+        (void)FLASH_If_Erase_Range(KV_STAGE_START, KV_STAGE_SIZE);
+      }
+#endif
+      memset(&converted, 0, sizeof(converted));
+      converted.header = HEADER;
+      converted.iap_msg.status = (eIAP_TransmitMethod_Def)legacy.status;
+      converted.iap_msg.transmitMethod = (eIAP_Status_Def)legacy.transmitMethod;
+      converted.iap_msg.version = legacy.version;
+      converted.iap_msg.size = legacy.size;
+      converted.ender = ENDER;
+      status = KV_CompactWith(KV_KEY_IAP_STATUS, &converted, sizeof(converted));
+    }
+  }
+#if KV_STAGE_SIZE != 0
+  if (status == HAL_OK)
+  {
+    KV_StageCheck();
+  }
+#else
+  if ((status == HAL_OK) && (KV_AreaBlank(KV_OTHER_AREA(KvArea)) == 0))
+  {
+    KvEraseArea = KV_OTHER_AREA(KvArea);
+  }
+#endif
+  return status;
+}
+
+/**
+ * @brief  读取一个值
+ * @param  key: 键
+ * @param  p_value: 目的缓冲区
+ * @param  size: 缓冲区字节数，值更长时只拷贝前 size 字节
+ * @param  p_length: 值的字节数，可以为 NULL
+ * @retval HAL_OK，没有这个 key 返回 HAL_ERROR
+ */
+HAL_StatusTypeDef KV_Get(uint16_t key, void *p_value, uint16_t size, uint16_t *p_length)
+{
+  const KV_IndexTypeDef *p_entry;
+
+  if (KvMounted == 0)
+  {
+    (void)KV_Mount();
+  }
+  p_entry = KV_Find(key);
+  if (p_entry == NULL)
+  {
+    return HAL_ERROR;
+  }
+  memcpy(p_value, (const void *)p_entry->address, (p_entry->length < size) ? p_entry->length : size);
+  if (p_length != NULL)
+  {
+    *p_length = p_entry->length;
+  }
+  return HAL_OK;
+}
+
+/**
+ * @brief  写入一个值，和当前值相同时不写
+ * @param  key: 键，不能是 0xFFFF
+ * @param  p_value: 值
+ * @param  length: 1 ~ KV_MAX_VALUE 字节
+ * @retval HAL_OK，参数错误、key 超过 KV_MAX_KEYS 个或写入失败返回 HAL_ERROR
+ */
+HAL_StatusTypeDef KV_Set(uint16_t key, const void *p_value, uint16_t length)
+{
+  const KV_IndexTypeDef *p_entry;
+
+  if ((key == KV_KEY_FREE) || (length == 0) || (length > KV_MAX_VALUE))
+  {
+    return HAL_ERROR;
+  }
+  if (KvMounted == 0)
+  {
+    (void)KV_Mount();
+  }
+  p_entry = KV_Find(key);
+  if (p_entry == NULL)
+  {
+    if (KvKeys >= KV_MAX_KEYS)
+    {
+      return HAL_ERROR;
+    }
+  }
+  else if ((p_entry->length == length) && (memcmp((const void *)p_entry->address, p_value, length) == 0))
+  {
+    return HAL_OK;
+  }
+  return KV_Write(key, p_value, length);
+}
+
+/**
+ * @brief  删除一个值
+ * @param  key: 键
+ * @retval HAL_OK，写入失败返回 HAL_ERROR
+ */
+HAL_StatusTypeDef KV_Delete(uint16_t key)
+{
+  if (KvMounted == 0)
+  {
+    (void)KV_Mount();
+  }
+  if (KV_Find(key) == NULL)
+  {
+    return HAL_OK;
+  }
+  return KV_Write(key, NULL, 0);
+}
+
+/**
+ * @brief  空闲时擦除压缩后留下的旧 bank (或用掉一半的暂存区)，之后的压缩不用等待擦除
+ * @note   在 IAP_Interface 的 IdleFunction 中调用，擦除交给 flash_async.c，立即返回。
+ *         下载会话打开 (FLASH_If_Open) 或边收边擦进行中时不擦除，CAN 下载期间和 Backup 中
+ *         有还要用的镜像时 (暂存区与 Backup 共用 Sector 7) 由调用者跳过，
+ *         传输中写状态和写镜像都不会等待扇区擦除
+ * @retval None
+ */
+void KV_Idle(void)
+{
+  FLASH_Async_Poll();
+  if ((KvEraseArea == 0) || (KvErasing != 0) || (FLASH_If_IsOpen() != 0) ||
+      (FLASH_If_EraseAhead_Left() != 0) || (FLASH_Async_Busy() != 0))
+  {
+    return;
+  }
+  KvErasing = 1;
+  if (FLASH_Async_Submit(FLASH_ASYNC_OP_ERASE, KvEraseArea, NULL, 0, KV_EraseDone) != HAL_OK)
+  {
+    KvErasing = 0;
+  }
+}
+
+/**
+ * @brief  区域使用情况
+ * @param  p_stats: 结果
+ * @retval None
+ */
+void KV_GetStats(KV_StatsTypeDef *p_stats)
+{
+  uint32_t i;
+
+  if (KvMounted == 0)
+  {
+    (void)KV_Mount();
+  }
+  p_stats->keys = KvKeys;
+  p_stats->used = KvFree - KvArea;
+  p_stats->live = sizeof(KV_AreaHeaderTypeDef);
+  for (i = 0; i < KvKeys; i++)
+  {
+    p_stats->live += KV_RECORD_SIZE(aKvIndex[i].length);
+  }
+  p_stats->erase_count = KvEraseCount;
+  p_stats->area = KvArea;
+  p_stats->erase_pending = (KvEraseArea != 0) ? 1u : 0u;
+#if KV_STAGE_SIZE != 0
+  p_stats->stage_used = KV_StageUsed();
+#else
+  p_stats->stage_used = 0;
+#endif
+}
+
+/************************ (C) COPYRIGHT Jason *****END OF FILE****/
@@ -0,0 +1,89 @@
+/******************************************************************************
+ * @file    kv_store.h
+ * @brief   Log-structured key/value store in the status sector: keyed,
+ *          variable-length records, RAM index, compaction into the other
+ *          status bank when full.
+ * @author  Jason
+ * @version V1.0.0
+ * @date    2025-3
+ * @copyright (c) 2025, All rights reserved.
+ ******************************************************************************/
+
+#ifndef __KV_STORE_H
+#define __KV_STORE_H
+
+/* Private Includes ----------------------------------------------------------*/
+#include "iap_user.h"
+
+/**
+ * 状态扇区 (Sector 3, 16 KB) 按循环日志的方式保存多个独立的数据项 (升级状态、节点号、
+ * CAN 波特率、断点续传、启动计数 ...)，不用再为每一项单独占一个扇区：
+ *  - 扇区头：KV_MAGIC + 擦除次数
+ *  - 之后顺序追加记录：{key, length} + 值 (补 0xFF 到字对齐) + CRC-32 (头和值)，
+ *    length 为 0 表示删除；同一个 key 以最后一条 CRC 正确的记录为准
+ *  - KV_Mount() 扫描一次，在 RAM 中建立索引 (key -> 值的地址)，之后 KV_Get() 只查索引
+ *    和拷贝值 (几 us)，KV_Set() 只追加一条记录 (值没变时不写)
+ *  - 两个 bank 乒乓 (Sector 3 和 Sector 7，FLASH_LAYOUT_STATUS_BANKS = 2，默认不开)：写满时把有效的值
+ *    写到另一个 bank，最后写扇区头作为提交，扇区头中的擦除次数较大的 bank 是当前 bank；
+ *    旧 bank 不在写的路径上擦除，KV_Idle() 在空闲 (没有下载) 时交给 flash_async.c 擦除
+ *  - 写状态从不等待扇区擦除，除非两次空闲之间连续写满了一个 bank (16 KB)
+ *  - 只有一个 bank 时 (默认，FLASH_LAYOUT_STATUS_BANKS = 1) 压缩要原地擦除 Sector 3：先把有效的值
+ *    (和新值) 写到暂存区 (Sector 7 最后 64 KB，每次用一个 KV_STAGE_SLOT_SIZE 的槽，格式与 bank 相同，
+ *    槽头最后写入作为提交)，然后才擦除 Sector 3 并重新写入。KV_Mount() 发现已提交的槽比 Sector 3 新
+ *    (擦除次数较大，或者 Sector 3 没有提交) 时从槽恢复。槽用掉一半后 KV_Idle() 擦除 Sector 7
+ *    (调用者保证这时 Backup 中没有还要用的镜像)，一直没有空闲、槽用完时压缩失败，写回缓存稍后再写
+ * 写到一半掉电的记录 CRC 不对，被忽略；压缩或迁移提交之前掉电，KV_Mount() 仍然使用旧 bank 或暂存区中的槽，
+ * 不会丢失数据。原来 flash_e_level.c 格式的升级状态在第一次 KV_Mount() 时迁移到 KV_KEY_IAP_STATUS。
+ */
+/* Exported constants --------------------------------------------------------*/
+#define KV_AREA_START           IAP_STATUS_ADDRESS
+#define KV_AREA_SIZE            IAP_STATUS_SIZE          /* per bank, bank B uses the start of Sector 7 */
+#if FLASH_LAYOUT_STATUS_BANKS > 1
+#define KV_AREA_B_START         IAP_STATUS_B_ADDRESS
+#else
+#define KV_AREA_B_START         KV_AREA_START
+#endif
+#define KV_STAGE_START          IAP_STATUS_STAGE_ADDRESS /* one bank only: compaction snapshots */
+#define KV_STAGE_SIZE           IAP_STATUS_STAGE_SIZE    /* 0 with two banks */
+#define KV_STAGE_SLOT_SIZE      (0x800u)        /* one snapshot: header + KV_MAX_KEYS full records fit */
+#define KV_MAGIC                (0x3130564Bu)   /* "KV01" */
+#define KV_MAX_KEYS             (16u)           /* RAM index entries */
+#define KV_MAX_VALUE            (64u)           /* bytes per value */
+
+/* Exported types ------------------------------------------------------------*/
+typedef enum
+{
+  KV_KEY_IAP_STATUS = 1,        /* save_data_t, read_iap_status() / write_iap_status() */
+  KV_KEY_NODE_ID,               /* reserved: CAN node ID */
+  KV_KEY_CAN_BITRATE,           /* reserved: CAN bit rate, bit/s */
+  KV_KEY_RESUME,                /* Zmodem: size and ZFILE identity of the interrupted download */
+  KV_KEY_BOOT_COUNT,            /* reserved: boot counter */
+  KV_KEY_IMAGE_CRC,             /* iap_image_t, read_iap_image() / write_iap_image() */
+} KV_KeyTypeDef;
+
+typedef struct
+{
+  uint32_t keys;                /* keys in the index */
+  uint32_t used;                /* bytes of the current bank in use (header and records) */
+  uint32_t live;                /* bytes the live records would take after a compaction */
+  uint32_t erase_count;         /* compactions / formats of the area */
+  uint32_t area;                /* current bank */
+  uint32_t erase_pending;       /* 1: the other bank (or the stage) waits for KV_Idle() */
+  uint32_t stage_used;          /* one bank: stage slots written since the stage was erased */
+} KV_StatsTypeDef;
+
+/* Exported macro ------------------------------------------------------------*/
+
+/* Exported variables --------------------------------------------------------*/
+
+/* Exported function prototypes ----------------------------------------------*/
+HAL_StatusTypeDef KV_Mount(void);
+HAL_StatusTypeDef KV_Get(uint16_t key, void *p_value, uint16_t size, uint16_t *p_length);
+HAL_StatusTypeDef KV_Set(uint16_t key, const void *p_value, uint16_t length);
+HAL_StatusTypeDef KV_Delete(uint16_t key);
+void KV_Idle(void);
+void KV_GetStats(KV_StatsTypeDef *p_stats);
+
+#endif /* __KV_STORE_H */
+
+/************************ (C) COPYRIGHT Jason *****END OF FILE****/
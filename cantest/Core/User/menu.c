@@ -48,8 +48,10 @@
 #include "flash_if.h"
 #include "menu.h"
 #include "ymodem.h"
+#include "zmodem.h"
 #include "iap_user.h"
 #include "can_uds_simple.h"
+#include "app_update.h"
 
 /* Private typedef -----------------------------------------------------------*/
 #define 	IAP_APP_READ  0
@@ -63,37 +65,156 @@ uint32_t FlashProtection = 0;
 uint8_t aFileName[FILE_NAME_LENGTH];
 
 /* Private function prototypes -----------------------------------------------*/
-static void SerialDownload(void);
+static void SerialDownload(uint8_t use_zmodem);
+static void SerialLinkStats(void);
+static void SerialFlashStats(void);
+static void SerialManifestResult(const uint8_t *p_bitmap, uint32_t chunks, uint32_t needed);
 #if IAP_TODO
 static void SerialUpload(void);
 #endif
 /* Private functions ---------------------------------------------------------*/
 
 /**
-  * @brief  Download a file via serial port
+  * @brief  Print the link statistics of the last Ymodem session
   * @param  None
   * @retval None
   */
-static void SerialDownload(void)
+static void SerialLinkStats(void)
+{
+  const YMODEM_StatsTypeDef *p_stats = Ymodem_GetStats();
+  uint8_t a_numbers[4][11] = {0};
+  uint8_t *a_lines[9];
+
+  Int2Str(a_numbers[0], p_stats->srtt_ms);
+  Int2Str(a_numbers[1], p_stats->rto_ms);
+  Int2Str(a_numbers[2], p_stats->packet_interval_ms);
+  Int2Str(a_numbers[3], p_stats->timeouts);
+  a_lines[0] = "\n\r RTT(ms): ";
+  a_lines[1] = a_numbers[0];
+  a_lines[2] = "  RTO(ms): ";
+  a_lines[3] = a_numbers[1];
+  a_lines[4] = "  Packet interval(ms): ";
+  a_lines[5] = a_numbers[2];
+  a_lines[6] = "  Timeouts: ";
+  a_lines[7] = a_numbers[3];
+  a_lines[8] = "\r\n";
+  Serial_PutStringV(a_lines, 9);
+}
+
+/**
+  * @brief  Print the programming statistics of the last download
+  * @note   Skipped words already held the value (0xFF padding, unchanged
+  *         data), skipped sectors were found identical by FLASH_If_Update.
+  * @param  None
+  * @retval None
+  */
+static void SerialFlashStats(void)
+{
+  const FLASH_If_StatsTypeDef *p_stats = FLASH_If_GetStats();
+  uint8_t a_numbers[4][11] = {0};
+  uint8_t *a_lines[9];
+
+  Int2Str(a_numbers[0], p_stats->programmed_words);
+  Int2Str(a_numbers[1], p_stats->skipped_words);
+  Int2Str(a_numbers[2], p_stats->erased_sectors);
+  Int2Str(a_numbers[3], p_stats->skipped_sectors);
+  a_lines[0] = "\n\r Words programmed: ";
+  a_lines[1] = a_numbers[0];
+  a_lines[2] = "  skipped: ";
+  a_lines[3] = a_numbers[1];
+  a_lines[4] = "  Sectors erased: ";
+  a_lines[5] = a_numbers[2];
+  a_lines[6] = "  skipped: ";
+  a_lines[7] = a_numbers[3];
+  a_lines[8] = "\r\n";
+  Serial_PutStringV(a_lines, 9);
+}
+
+/**
+  * @brief  Print the chunk bitmap of a received manifest (.mfs)
+  * @note   The host reads the "Bitmap:" line and sends the chunks whose bit
+  *         is set (byte i/8, bit i%8) as a .sdf file.
+  * @param  p_bitmap: (chunks + 7) / 8 bytes
+  * @param  chunks: chunks in the new image
+  * @param  needed: chunks that differ from App1
+  * @retval None
+  */
+static void SerialManifestResult(const uint8_t *p_bitmap, uint32_t chunks, uint32_t needed)
+{
+  static const uint8_t a_hex[] = "0123456789abcdef";
+  uint8_t a_numbers[2][11] = {0};
+  uint8_t a_bits[APP_MANIFEST_BITMAP_SIZE * 2 + 1] = {0};
+  uint8_t *a_lines[7];
+  uint32_t i;
+
+  for (i = 0; i < (chunks + 7) / 8; i++)
+  {
+    a_bits[2 * i] = a_hex[p_bitmap[i] >> 4];
+    a_bits[2 * i + 1] = a_hex[p_bitmap[i] & 0x0F];
+  }
+  Int2Str(a_numbers[0], needed);
+  Int2Str(a_numbers[1], chunks);
+  a_lines[0] = "\n\r Manifest received, chunks to send: ";
+  a_lines[1] = a_numbers[0];
+  a_lines[2] = "/";
+  a_lines[3] = a_numbers[1];
+  a_lines[4] = "\r\n Bitmap: ";
+  a_lines[5] = a_bits;
+  a_lines[6] = "\r\n";
+  Serial_PutStringV(a_lines, 7);
+}
+
+/**
+  * @brief  Download a file via serial port
+  * @param  use_zmodem: 0 Ymodem, 1 Zmodem (resumes an interrupted Zmodem download)
+  * @retval None
+  */
+static void SerialDownload(uint8_t use_zmodem)
 {
   uint8_t number[11] = {0};
-  uint32_t size = 0;
+  uint8_t *a_lines[6];
+  uint32_t size = 0, chunks, needed;
+  const uint8_t *p_bitmap = NULL;
   COM_StatusTypeDef result;
   save_data_t  rw_data;
   eFIND_Status_Def find_status;
 
   Serial_PutString("Waiting for the file to be sent ... (press 'a' to abort)\n\r");
-  result = Ymodem_Receive( &size );
-  if (result == COM_OK)
+  FLASH_If_ResetStats();
+  if (use_zmodem)
+  {
+    result = Zmodem_Receive( &size );
+  }
+  else
+  {
+    /* Ymodem erases the whole area: forget an interrupted Zmodem download */
+    if ((EL_FIND_SUCCESS == read_iap_status(&rw_data)) && (IAP_DOWNING_BIN == rw_data.iap_msg.status))
+    {
+      rw_data.iap_msg.status = IAP_NO_APP;
+      write_iap_status(&rw_data);
+      commit_iap_status();      /* Ymodem erases App1 next */
+    }
+    result = Ymodem_Receive( &size );
+    SerialLinkStats();
+    p_bitmap = Ymodem_GetManifest(&chunks, &needed);
+  }
+  if ((result == COM_OK) && (p_bitmap != NULL))
+  {
+    /* manifest only: App1 and the status area are unchanged */
+    SerialManifestResult(p_bitmap, chunks, needed);
+  }
+  else if (result == COM_OK)
   {
 		iapInterface.DelayTimeMsFunction(100);
-    Serial_PutString("\n\n\r Recive Completed Successfully!\n\r--------------------------------\r\n Name: ");
-    Serial_PutString(aFileName);
     Int2Str(number, size);
-    Serial_PutString("\n\r Size: ");
-    Serial_PutString(number);
-    Serial_PutString(" Bytes\r\n");
-    Serial_PutString("-------------------\n");
+    a_lines[0] = "\n\n\r Recive Completed Successfully!\n\r--------------------------------\r\n Name: ";
+    a_lines[1] = aFileName;
+    a_lines[2] = "\n\r Size: ";
+    a_lines[3] = number;
+    a_lines[4] = " Bytes\r\n";
+    a_lines[5] = "-------------------\n";
+    Serial_PutStringV(a_lines, 6);
+    SerialFlashStats();
 
     find_status = read_iap_status(&rw_data);
     if(EL_FIND_SUCCESS == find_status)
@@ -102,8 +223,10 @@ static void SerialDownload(void)
       rw_data.iap_msg.status = IAP_APP_DONE;
       rw_data.iap_msg.version++;
       rw_data.iap_msg.transmitMethod = TRANSMIT_METHOD_USB;
+      set_iap_image(&rw_data, size);   /* CRC of the programmed image, checked at every boot */
       rw_data.ender = ENDER;
       write_iap_status(&rw_data);
+      commit_iap_status();
       Serial_PutString("\n\n\r Programming Completed Successfully!\n\r--------------------------------\r\n ");
     }
   }
@@ -165,15 +288,18 @@ void Main_Menu(void)
 {
   uint8_t key = 0;
   save_data_t iap_data;
+  uint8_t *a_lines[SERIAL_PUTSTRINGV_MAX];  /* menu text, sent as one transfer */
+  uint8_t lines;
 
-  Serial_PutString("\r\n======================================================================");
-  Serial_PutString("\r\n=              (C) COPYRIGHT 2025 Jason Bourne                       =");
-  Serial_PutString("\r\n=                                                                    =");
-  Serial_PutString("\r\n=  STM32F2xx In-Application Programming Application  (Version 1.0.0) =");
-  Serial_PutString("\r\n=                                                                    =");
-  Serial_PutString("\r\n=                                                     By Jason       =");
-  Serial_PutString("\r\n======================================================================");
-  Serial_PutString("\r\n\r\n");
+  a_lines[0] = "\r\n======================================================================";
+  a_lines[1] = "\r\n=              (C) COPYRIGHT 2025 Jason Bourne                       =";
+  a_lines[2] = "\r\n=                                                                    =";
+  a_lines[3] = "\r\n=  STM32F2xx In-Application Programming Application  (Version 1.0.0) =";
+  a_lines[4] = "\r\n=                                                                    =";
+  a_lines[5] = "\r\n=                                                     By Jason       =";
+  a_lines[6] = "\r\n======================================================================";
+  a_lines[7] = "\r\n\r\n";
+  Serial_PutStringV(a_lines, 8);
 
 #if IAP_FLASH_WRITE_PROTECT
   /* Test if any sector of Flash memory where user application will be loaded is write protected */
@@ -184,53 +310,72 @@ void Main_Menu(void)
   {
     if(EL_FIND_SUCCESS == read_iap_status(&iap_data))
     {
-      Serial_PutString("\r\n==========================================================\r\n\n");
+      lines = 0;
+      a_lines[lines++] = "\r\n==========================================================\r\n\n";
       switch (iap_data.iap_msg.status)
       {
       case IAP_NO_APP:
         key = '1';     
-        Serial_PutString(" * Here is no available app. Please load a new app.      \r\n\n");
+        a_lines[lines++] = " * Here is no available app. Please load a new app.      \r\n\n";
+        a_lines[lines++] = " * Ymodem starts in 5 seconds, press '5' for Zmodem.     \r\n\n";
 #if IAP_FLASH_WRITE_PROTECT
-				Serial_PutString("=================== Main Menu ============================\r\n\n");
+				a_lines[lines++] = "=================== Main Menu ============================\r\n\n";
 				if(FlashProtection != FLASHIF_PROTECTION_NONE)
 				{
-					Serial_PutString("  Disable the write protection ------------------------- 4\r\n\n");
+					a_lines[lines++] = "  Disable the write protection ------------------------- 4\r\n\n";
 				}
 				else
 				{
-					Serial_PutString("  Enable the write protection -------------------------- 4\r\n\n");
+					a_lines[lines++] = "  Enable the write protection -------------------------- 4\r\n\n";
 				}
 #endif
-        Serial_PutString("==========================================================\r\n\n");
+        a_lines[lines++] = "==========================================================\r\n\n";
+        Serial_PutStringV(a_lines, lines);
+        /* Receive key */
+        iapInterface.ReceiveFunction( &key, 1, BL_TIMEOUT);
         break;
       case IAP_DOWNING_BIN:
-        //TODO: Add a message to inform the user that the binary is being downloaded
+        key = '5';
+        a_lines[lines++] = " * The last Zmodem download was interrupted.             \r\n\n";
+        a_lines[lines++] = " * Send the same file with Zmodem to resume it,          \r\n\n";
+        a_lines[lines++] = " * or press '1' within 5 seconds to use Ymodem.          \r\n\n";
+        a_lines[lines++] = "==========================================================\r\n\n";
+        Serial_PutStringV(a_lines, lines);
+        /* Receive key */
+        iapInterface.ReceiveFunction( &key, 1, BL_TIMEOUT);
         break;
       case IAP_APP_DONE:
         key = '3';  
-        Serial_PutString(" * Please press '1' to upgrade new app within 5 seconds,   \r\n\n");
-        Serial_PutString(" * or it will run the old app.                           \r\n\n");
-        Serial_PutString("=================== Main Menu ============================\r\n\n");
-        Serial_PutString("  Download image to the internal Flash ----------------- 1\r\n\n");
+        a_lines[lines++] = " * Please press '1' to upgrade new app within 5 seconds,   \r\n\n";
+        a_lines[lines++] = " * or it will run the old app.                           \r\n\n";
+        a_lines[lines++] = "=================== Main Menu ============================\r\n\n";
+        a_lines[lines++] = "  Download image to the internal Flash ----------------- 1\r\n\n";
 #if IAP_APP_READ	
-        Serial_PutString("  Upload image from the internal Flash ----------------- 2\r\n\n");
+        a_lines[lines++] = "  Upload image from the internal Flash ----------------- 2\r\n\n";
 #endif
-        Serial_PutString("  Execute the loaded application now---------------------3\r\n\n");
+        a_lines[lines++] = "  Execute the loaded application now---------------------3\r\n\n";
+        a_lines[lines++] = "  Download image with Zmodem (resumable) --------------- 5\r\n\n";
 #if IAP_FLASH_WRITE_PROTECT
 				if(FlashProtection != FLASHIF_PROTECTION_NONE)
 				{
-					Serial_PutString("  Disable the write protection ------------------------- 4\r\n\n");
+					a_lines[lines++] = "  Disable the write protection ------------------------- 4\r\n\n";
 				}
 				else
 				{
-					Serial_PutString("  Enable the write protection -------------------------- 4\r\n\n");
+					a_lines[lines++] = "  Enable the write protection -------------------------- 4\r\n\n";
 				}
 #endif
-        Serial_PutString("==========================================================\r\n\n");
+        a_lines[lines++] = "==========================================================\r\n\n";
+        Serial_PutStringV(a_lines, lines);
         /* Receive key */
         iapInterface.ReceiveFunction( &key, 1, BL_TIMEOUT);
         break;
       default:
+        /* unknown state (e.g. an interrupted copy): offer the download, never spin */
+        key = '1';
+        a_lines[lines++] = " * The app state is invalid. Please load a new app.       \r\n\n";
+        a_lines[lines++] = "==========================================================\r\n\n";
+        Serial_PutStringV(a_lines, lines);
         break;
       }
     }
@@ -248,7 +393,7 @@ void Main_Menu(void)
     {
     case '1' :
       /* Download user application in the Flash */
-      SerialDownload();
+      SerialDownload(0);
       break;
 #if IAP_APP_READ
 		case '2' :
@@ -256,6 +401,10 @@ void Main_Menu(void)
 		 SerialUpload();
 		 break;
 #endif
+    case '5' :
+      /* Download user application in the Flash, resumable */
+      SerialDownload(1);
+      break;
     case '3' :
       Serial_PutString("Start program execution......\r\n\n");
 			iapInterface.funtionJumpFunction();
@@ -294,7 +443,7 @@ void Main_Menu(void)
 		 break;
 #endif
 	default:
-		Serial_PutString("Invalid Number ! ==> The number should be either 1, 3\r");
+		Serial_PutString("Invalid Number ! ==> The number should be either 1, 3 or 5\r");
 	break;
     }
   }
@@ -0,0 +1,45 @@
+/******************************************************************************
+ * @file    ram_exec.c
+ * @brief   Vector table relocation to SRAM (IAP_RAM_EXEC build option).
+ * @author  Jason
+ * @version V1.0.0
+ * @date    2025-3
+ * @copyright (c) 2025, All rights reserved.
+ ******************************************************************************/
+
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+#include "main.h"
+#include "ram_exec.h"
+
+/* Private define ------------------------------------------------------------*/
+#define RAM_VECTOR_COUNT            (16u + (uint32_t)RNG_IRQn + 1u)        /* 97 */
+
+/* Private variables ---------------------------------------------------------*/
+#if IAP_RAM_EXEC
+/* VTOR 要求按表长向上取 2 的幂对齐：97 个向量 -> 512 字节 */
+static uint32_t aRamVectors[RAM_VECTOR_COUNT] __attribute__((aligned(512)));
+#endif
+
+/* Public functions ----------------------------------------------------------*/
+/**
+ * @brief  把向量表拷贝到 SRAM 并切换 VTOR
+ * @note   在 main() 最开始 (使能任何中断之前) 调用。向量里的中断处理地址由链接器给出，
+ *         已经是它们在 SRAM 中的运行地址。IAP_RAM_EXEC 为 0 时什么也不做。
+ * @retval None
+ */
+void RamExec_Init(void)
+{
+#if IAP_RAM_EXEC
+  extern const uint32_t __Vectors[];   /* startup_stm32f207xx.s */
+
+  __disable_irq();
+  memcpy(aRamVectors, __Vectors, sizeof(aRamVectors));
+  __DSB();
+  SCB->VTOR = (uint32_t)aRamVectors;
+  __DSB();
+  __enable_irq();
+#endif
+}
+
+/************************ (C) COPYRIGHT Jason *****END OF FILE****/
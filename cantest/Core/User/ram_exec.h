@@ -0,0 +1,34 @@
+/******************************************************************************
+ * @file    ram_exec.h
+ * @brief   Build option: vector table, CAN/USB interrupt path and flash driver
+ *          executed from SRAM while the flash is erased or programmed.
+ * @author  Jason
+ * @version V1.0.0
+ * @date    2025-3
+ * @copyright (c) 2025, All rights reserved.
+ ******************************************************************************/
+
+#ifndef __RAM_EXEC_H
+#define __RAM_EXEC_H
+
+/**
+ * F207 只有一个 FLASH bank，擦除/编程期间从 FLASH 取指会停顿到操作结束 (128 KB 扇区 1~2 s)，
+ * 这期间 CAN 接收 FIFO (3 级) 溢出、USB OUT 包被 NAK。IAP_RAM_EXEC 为 1 时：
+ *  - MDK-ARM/cantest.sct 把中断处理 (stm32f2xx_it)、CAN/ISO-TP 接收、USB 设备栈、接收暂存区 (iap_stage)、
+ *    HAL 的 CAN/PCD/FLASH/tick 代码和 flash_if / flash_async / flash_layout 放到 RW_IRAM1，启动时由 __scatterload 拷贝
+ *  - RamExec_Init() 把向量表拷贝到 SRAM 并设置 VTOR (FLASH 中的向量表取向量时同样会停顿)
+ * 这个文件也被分散加载文件预处理，只能放预处理指令。
+ */
+/* Exported constants --------------------------------------------------------*/
+#ifndef IAP_RAM_EXEC
+#define IAP_RAM_EXEC                0               /* 1: run the interrupt path from SRAM */
+#endif
+
+#ifndef RAM_EXEC_SCATTER
+/* Exported function prototypes ----------------------------------------------*/
+void RamExec_Init(void);
+#endif
+
+#endif /* __RAM_EXEC_H */
+
+/************************ (C) COPYRIGHT Jason *****END OF FILE****/
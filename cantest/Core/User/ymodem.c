@@ -35,112 +35,101 @@
 #include "main.h"
 #include "menu.h"
 #include "iap_user.h"
+#include "crc.h"
+#include "heatshrink.h"
+#include "app_update.h"
 
 /* Private typedef -----------------------------------------------------------*/
+/**
+  * @brief  Flash programming stage: one received packet waiting to be written
+  *         while the next packet is received into the other ping-pong buffer.
+  */
+typedef struct
+{
+  uint32_t destination;   /* next flash address to program */
+  uint32_t *p_source;     /* next word of the packet buffer */
+  uint32_t words_left;    /* words still to be programmed */
+  uint32_t status;        /* FLASHIF_OK or the first programming error */
+} FlashStage_TypeDef;
+
+/**
+  * @brief  Decompression stage of a compressed image: the packet payload is
+  *         decoded into one output buffer while the other one is programmed.
+  */
+typedef struct
+{
+  uint32_t in_left;       /* compressed bytes still expected (file size) */
+  uint32_t fill;          /* bytes in the active output buffer */
+  uint8_t  active;        /* output buffer being filled */
+  uint8_t  update;        /* YMODEM_UPDATE_xxx: output is not the image when != 0 */
+} InflateStage_TypeDef;
+
 /* Private define ------------------------------------------------------------*/
 #define CRC16_F       /* activate the CRC16 integrity */
+#if (YMODEM_XBLK_MAX_SIZE > 1024u)
+#define PACKET_BUFFER_SIZE      (YMODEM_XBLK_MAX_SIZE + PACKET_DATA_INDEX + PACKET_TRAILER_SIZE)
+#else
+#define PACKET_BUFFER_SIZE      (PACKET_1K_SIZE + PACKET_DATA_INDEX + PACKET_TRAILER_SIZE)
+#endif
+#define FLASH_STAGE_SLICE_WORDS ((uint32_t)128) /* words programmed per idle poll */
+#define YMODEM_RX_READ_SIZE     (PACKET_1K_SIZE + PACKET_DATA_INDEX + PACKET_TRAILER_SIZE) /* bytes per ReceiveAnyFunction */
+
+/* Receive parser framing states */
+#define YMODEM_STATE_START      ((uint8_t)0)  /* waiting for SOH/STX/EOT/CA */
+#define YMODEM_STATE_CA         ((uint8_t)1)  /* first CA seen, waiting for the second */
+#define YMODEM_STATE_BODY       ((uint8_t)2)  /* collecting number, data and CRC */
+#define YMODEM_STATE_DISCARD    ((uint8_t)3)  /* bad frame, drop bytes until the line is idle */
 /* Private macro -------------------------------------------------------------*/
 /* Private variables ---------------------------------------------------------*/
 /* @note ATTENTION - please keep this variable 32bit alligned */
-uint8_t aPacketData[PACKET_1K_SIZE + PACKET_DATA_INDEX + PACKET_TRAILER_SIZE];
+__ALIGNED(4) uint8_t aPacketData[PACKET_BUFFER_SIZE];
+/* second receive buffer, packets alternate between aPacketData and this one */
+__ALIGNED(4) static uint8_t aPacketDataPong[PACKET_BUFFER_SIZE];
+/* bytes read from the link, fed to the parser until it has used them all */
+static uint8_t aRxBytes[YMODEM_RX_READ_SIZE];
+static FlashStage_TypeDef FlashStage;
+static YMODEM_StatsTypeDef YmodemStats;
+static uint32_t srtt_x8;      /* SRTT * 8 */
+static uint32_t rttvar_x4;    /* RTTVAR * 4 */
+/* result of the last manifest (.mfs) */
+static uint8_t aManifestBitmap[APP_MANIFEST_BITMAP_SIZE];
+static uint32_t ManifestChunks;
+static uint32_t ManifestNeeded;
+static uint8_t ManifestReady;
+#if YMODEM_HS_ENABLE
+__ALIGNED(4) static uint8_t aInflateBuffer[2][YMODEM_HS_OUT_SIZE];
+static HEATSHRINK_DecoderTypeDef InflateDecoder;
+static InflateStage_TypeDef InflateStage;
+#endif
 
 /* Private function prototypes -----------------------------------------------*/
 static void PrepareIntialPacket(uint8_t *p_data, const uint8_t *p_file_name, uint32_t length);
 static void PreparePacket(uint8_t *p_source, uint8_t *p_packet, uint8_t pkt_nr, uint32_t size_blk);
-static HAL_StatusTypeDef ReceivePacket(uint8_t *p_data, uint32_t *p_length, uint32_t timeout);
-uint16_t UpdateCRC16(uint16_t crc_in, uint8_t byte);
 uint16_t Cal_CRC16(const uint8_t* p_data, uint32_t size);
 uint8_t CalcChecksum(const uint8_t *p_data, uint32_t size);
+static void Ymodem_SendPacket(uint8_t *p_packet, uint32_t size);
+static void FlashStage_Reset(void);
+static void FlashStage_Submit(uint32_t destination, uint32_t *p_source, uint32_t words);
+static uint32_t FlashStage_Flush(void);
+static COM_StatusTypeDef FlashStage_Error(void);
+static COM_StatusTypeDef InflateStage_Start(const YMODEM_RxTypeDef *p_rx);
+static COM_StatusTypeDef InflateStage_Write(uint32_t *p_destination, const uint8_t *p_data, uint32_t length);
+static COM_StatusTypeDef InflateStage_Finish(uint32_t *p_destination, uint32_t *p_size);
+static void Ymodem_RxReply(YMODEM_RxTypeDef *p_rx, uint8_t byte);
+static void Ymodem_RttReset(void);
+static void Ymodem_RttSample(uint32_t rtt);
+static void Ymodem_RttBackoff(void);
+static YMODEM_EventTypeDef Ymodem_RxPacketDone(YMODEM_RxTypeDef *p_rx);
+static void Ymodem_RxParseHeader(YMODEM_RxTypeDef *p_rx);
+static uint8_t *Ymodem_RxParseNumber(uint8_t *p_str, const uint8_t *p_end, uint32_t *p_value);
+static uint8_t Ymodem_NameHasExtension(const uint8_t *p_name, const char *p_extension);
+static COM_StatusTypeDef Ymodem_DeltaResult(eAPP_Update_Status_Def status);
+static eAPP_Update_Status_Def Ymodem_UpdateBegin(uint8_t update);
+static eAPP_Update_Status_Def Ymodem_UpdateWrite(uint8_t update, const uint8_t *p_data, uint32_t length);
+static eAPP_Update_Status_Def Ymodem_UpdateEnd(uint8_t update, uint32_t *p_size);
 
 /* Private functions ---------------------------------------------------------*/
 
-/**
-  * @brief  Receive a packet from sender
-  * @param  data
-  * @param  length
-  *     0: end of transmission
-  *     2: abort by sender
-  *    >0: packet length
-  * @param  timeout
-  * @retval HAL_OK: normally return
-  *         HAL_BUSY: abort by user
-  */
-static HAL_StatusTypeDef ReceivePacket(uint8_t *p_data, uint32_t *p_length, uint32_t timeout)
-{
-  uint32_t crc;
-  uint32_t packet_size = 0;
-  HAL_StatusTypeDef status;
-  uint8_t char1;
-
-  *p_length = 0;
-  status = iapInterface.ReceiveFunction (&char1, 1, timeout);
-
-  if (status == HAL_OK)
-  {
-    switch (char1)
-    {
-      case SOH:
-        packet_size = PACKET_SIZE;
-        break;
-      case STX:
-        packet_size = PACKET_1K_SIZE;
-        break;
-      case EOT:
-        break;
-      case CA:
-        if ((iapInterface.ReceiveFunction (&char1, 1, timeout) == HAL_OK) && (char1 == CA))
-        {
-          packet_size = 2;
-        }
-        else
-        {
-          status = HAL_ERROR;
-        }
-        break;
-      case ABORT1:
-      case ABORT2:
-        status = HAL_BUSY;
-        break;
-      default:
-        status = HAL_ERROR;
-        break;
-    }
-    *p_data = char1;
-
-    if (packet_size >= PACKET_SIZE )
-    {
-      status = iapInterface.ReceiveFunction(&p_data[PACKET_NUMBER_INDEX], packet_size + PACKET_OVERHEAD_SIZE, timeout);
-
-      /* Simple packet sanity check */
-      if (status == HAL_OK )
-      {
-        if (p_data[PACKET_NUMBER_INDEX] != ((p_data[PACKET_CNUMBER_INDEX]) ^ NEGATIVE_BYTE))
-        {
-          packet_size = 0;
-          status = HAL_ERROR;
-        }
-        else
-        {
-          /* Check packet CRC */
-          crc = p_data[ packet_size + PACKET_DATA_INDEX ] << 8;
-          crc += p_data[ packet_size + PACKET_DATA_INDEX + 1 ];
-          if (Cal_CRC16(&p_data[PACKET_DATA_INDEX], packet_size) != crc )
-          {
-            packet_size = 0;
-            status = HAL_ERROR;
-          }
-        }
-      }
-      else
-      {
-        packet_size = 0;
-      }
-    }
-  }
-  *p_length = packet_size;
-  return status;
-}
-
 /**
   * @brief  Prepare the first block
   * @param  p_data:  output buffer
@@ -223,50 +212,17 @@ static void PreparePacket(uint8_t *p_source, uint8_t *p_packet, uint8_t pkt_nr,
   }
 }
 
-/**
-  * @brief  Update CRC16 for input byte
-  * @param  crc_in input value 
-  * @param  input byte
-  * @retval None
-  */
-uint16_t UpdateCRC16(uint16_t crc_in, uint8_t byte)
-{
-  uint32_t crc = crc_in;
-  uint32_t in = byte | 0x100;
-
-  do
-  {
-    crc <<= 1;
-    in <<= 1;
-    if(in & 0x100)
-      ++crc;
-    if(crc & 0x10000)
-      crc ^= 0x1021;
-  }
-  
-  while(!(in & 0x10000));
-
-  return crc & 0xffffu;
-}
-
 /**
   * @brief  Cal CRC16 for YModem Packet
+  * @note   The CRC backend (bitwise / table / slice-by-4) is selected at
+  *         compile time with CRC16_BACKEND, see crc.h
   * @param  data
   * @param  length
   * @retval None
   */
 uint16_t Cal_CRC16(const uint8_t* p_data, uint32_t size)
 {
-  uint32_t crc = 0;
-  const uint8_t* dataEnd = p_data+size;
-
-  while(p_data < dataEnd)
-    crc = UpdateCRC16(crc, *p_data++);
- 
-  crc = UpdateCRC16(crc, 0);
-  crc = UpdateCRC16(crc, 0);
-
-  return crc&0xffffu;
+  return Crc16_Calc(p_data, size);
 }
 
 /**
@@ -288,157 +244,1096 @@ uint8_t CalcChecksum(const uint8_t *p_data, uint32_t size)
   return (sum & 0xffu);
 }
 
+/**
+  * @brief  Drop any pending programming job and clear the error status
+  * @param  None
+  * @retval None
+  */
+static void FlashStage_Reset(void)
+{
+  FlashStage.destination = 0;
+  FlashStage.p_source = NULL;
+  FlashStage.words_left = 0;
+  FlashStage.status = FLASHIF_OK;
+}
+
+/**
+  * @brief  Hand a received packet over to the flash programming stage
+  * @note   The previous job must have been completed with FlashStage_Flush()
+  *         and the source buffer must stay untouched until it is flushed.
+  * @param  destination: start address in flash
+  * @param  p_source: packet payload (32-bit aligned)
+  * @param  words: length of the payload in 32-bit words
+  * @retval None
+  */
+static void FlashStage_Submit(uint32_t destination, uint32_t *p_source, uint32_t words)
+{
+  FlashStage.destination = destination;
+  FlashStage.p_source = p_source;
+  FlashStage.words_left = words;
+}
+
+/**
+  * @brief  Finish the pending programming job
+  * @param  None
+  * @retval uint32_t FLASHIF_OK or the first error seen since the last reset
+  */
+static uint32_t FlashStage_Flush(void)
+{
+  while ((FlashStage.words_left > 0) && (FlashStage.status == FLASHIF_OK))
+  {
+    Ymodem_FlashPoll();
+  }
+  return FlashStage.status;
+}
+
+/**
+  * @brief  Transfer result for a failed flash stage
+  * @param  None
+  * @retval COM_ERROR if a sector could not be erased (as when the erase was
+  *         done before the transfer), COM_DATA for a programming error
+  */
+static COM_StatusTypeDef FlashStage_Error(void)
+{
+  return (FlashStage.status == FLASHIF_ERASEKO) ? COM_ERROR : COM_DATA;
+}
+
+/**
+  * @brief  Prepare the decompression stage for a compressed image
+  * @param  p_rx: receiver context after the FILE event (hs_window_bits != 0)
+  * @retval COM_OK, COM_ERROR if the parameters are not supported
+  */
+static COM_StatusTypeDef InflateStage_Start(const YMODEM_RxTypeDef *p_rx)
+{
+#if YMODEM_HS_ENABLE
+  if (Heatshrink_Init(&InflateDecoder, (uint8_t)p_rx->hs_window_bits, (uint8_t)p_rx->hs_lookahead_bits) != HEATSHRINK_OK)
+  {
+    return COM_ERROR;
+  }
+  InflateStage.in_left = p_rx->file_size;
+  InflateStage.fill = 0;
+  InflateStage.active = 0;
+  InflateStage.update = p_rx->update;
+  return COM_OK;
+#else
+  (void)p_rx;
+  return COM_ERROR;
+#endif
+}
+
+/**
+  * @brief  Decompress a packet payload and program every full output buffer
+  * @note   Bytes beyond the compressed file size (packet padding) are ignored.
+  *         A compressed patch, manifest or sparse file (.dlt.hs ...) is
+  *         passed on to the update instead, which writes synchronously: one
+  *         buffer is enough.
+  * @param  p_destination: next flash address, advanced by the data submitted
+  * @param  p_data: packet payload
+  * @param  length: payload length
+  * @retval COM_OK, COM_LIMIT if the image outgrows the application area,
+  *         COM_DATA on a programming error
+  */
+static COM_StatusTypeDef InflateStage_Write(uint32_t *p_destination, const uint8_t *p_data, uint32_t length)
+{
+#if YMODEM_HS_ENABLE
+  HEATSHRINK_StatusTypeDef decoded = HEATSHRINK_OK;
+  uint32_t used, produced;
+
+  if (length > InflateStage.in_left)
+  {
+    length = InflateStage.in_left;
+  }
+  InflateStage.in_left -= length;
+
+  /* a full output buffer may leave decoded bytes pending in the decoder */
+  while ((length > 0) || (decoded == HEATSHRINK_OUTPUT_FULL))
+  {
+    decoded = Heatshrink_Decode(&InflateDecoder, p_data, length, &used,
+                      &aInflateBuffer[InflateStage.active][InflateStage.fill],
+                      YMODEM_HS_OUT_SIZE - InflateStage.fill, &produced);
+    p_data += used;
+    length -= used;
+    InflateStage.fill += produced;
+
+    if ((InflateStage.fill == YMODEM_HS_OUT_SIZE) && (InflateStage.update != YMODEM_UPDATE_IMAGE))
+    {
+      /* compressed patch: the output feeds the update */
+      InflateStage.fill = 0;
+      if (Ymodem_UpdateWrite(InflateStage.update, aInflateBuffer[0], YMODEM_HS_OUT_SIZE) != APP_UPDATE_OK)
+      {
+        return COM_DATA;
+      }
+    }
+    else if (InflateStage.fill == YMODEM_HS_OUT_SIZE)
+    {
+      if ((*p_destination + YMODEM_HS_OUT_SIZE) > (APPLICATION_ADDRESS + USER_FLASH_SIZE))
+      {
+        return COM_LIMIT;
+      }
+      /* the other buffer must be in flash before it is filled again */
+      if (FlashStage_Flush() != FLASHIF_OK)
+      {
+        return FlashStage_Error();
+      }
+      FlashStage_Submit(*p_destination, (uint32_t*)aInflateBuffer[InflateStage.active], YMODEM_HS_OUT_SIZE / 4);
+      *p_destination += YMODEM_HS_OUT_SIZE;
+      InflateStage.active ^= 1;
+      InflateStage.fill = 0;
+    }
+  }
+  return COM_OK;
+#else
+  (void)p_destination;
+  (void)p_data;
+  (void)length;
+  return COM_ERROR;
+#endif
+}
+
+/**
+  * @brief  Program (or apply, for a patch) the last partial output buffer
+  *         and check the stream end
+  * @param  p_destination: next flash address, advanced by the data submitted
+  * @param  p_size: decompressed image size
+  * @retval COM_OK, COM_LIMIT, or COM_DATA if the stream is truncated
+  */
+static COM_StatusTypeDef InflateStage_Finish(uint32_t *p_destination, uint32_t *p_size)
+{
+#if YMODEM_HS_ENABLE
+  uint32_t size = InflateStage.fill;
+
+  if ((InflateStage.in_left != 0) || (Heatshrink_Finish(&InflateDecoder) != HEATSHRINK_OK))
+  {
+    return COM_DATA;
+  }
+  if (InflateStage.update != YMODEM_UPDATE_IMAGE)
+  {
+    InflateStage.fill = 0;
+    return (Ymodem_UpdateWrite(InflateStage.update, aInflateBuffer[0], size) == APP_UPDATE_OK) ? COM_OK : COM_DATA;
+  }
+  /* pad the tail to a whole word with erased flash content */
+  while ((size % 4) != 0)
+  {
+    aInflateBuffer[InflateStage.active][size++] = 0xFF;
+  }
+  if ((*p_destination + size) > (APPLICATION_ADDRESS + USER_FLASH_SIZE))
+  {
+    return COM_LIMIT;
+  }
+  if (FlashStage_Flush() != FLASHIF_OK)
+  {
+    return FlashStage_Error();
+  }
+  FlashStage_Submit(*p_destination, (uint32_t*)aInflateBuffer[InflateStage.active], size / 4);
+  *p_destination += size;
+  InflateStage.fill = 0;
+  *p_size = InflateDecoder.total;
+  return COM_OK;
+#else
+  (void)p_destination;
+  (void)p_size;
+  return COM_ERROR;
+#endif
+}
+
+/**
+  * @brief  Start a new session with the conservative initial timeout
+  * @param  None
+  * @retval None
+  */
+static void Ymodem_RttReset(void)
+{
+  memset(&YmodemStats, 0, sizeof(YmodemStats));
+  srtt_x8 = 0;
+  rttvar_x4 = 0;
+  YmodemStats.rto_ms = YMODEM_RTO_MAX;
+}
+
+/**
+  * @brief  Update SRTT/RTTVAR/RTO with one round-trip sample (RFC 6298)
+  * @param  rtt: measured round-trip time in ms
+  * @retval None
+  */
+static void Ymodem_RttSample(uint32_t rtt)
+{
+  uint32_t rto;
+  int32_t delta;
+
+  if (YmodemStats.rtt_samples == 0)
+  {
+    srtt_x8 = rtt << 3;
+    rttvar_x4 = rtt << 1;           /* RTTVAR = R / 2 */
+  }
+  else
+  {
+    /* RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|, SRTT = 7/8 SRTT + 1/8 R */
+    delta = (int32_t)rtt - (int32_t)(srtt_x8 >> 3);
+    if (delta < 0)
+    {
+      delta = -delta;
+    }
+    rttvar_x4 += (uint32_t)delta - (rttvar_x4 >> 2);
+    srtt_x8 += rtt - (srtt_x8 >> 3);
+  }
+
+  rto = (srtt_x8 >> 3) + rttvar_x4;   /* SRTT + 4 * RTTVAR */
+  if (rto < YMODEM_RTO_MIN)
+  {
+    rto = YMODEM_RTO_MIN;
+  }
+  if (rto > YMODEM_RTO_MAX)
+  {
+    rto = YMODEM_RTO_MAX;
+  }
+  YmodemStats.rto_ms = rto;
+  YmodemStats.srtt_ms = srtt_x8 >> 3;
+  YmodemStats.rttvar_ms = rttvar_x4 >> 2;
+  YmodemStats.last_rtt_ms = rtt;
+  YmodemStats.rtt_samples++;
+}
+
+/**
+  * @brief  A retry timeout expired: back off exponentially up to the ceiling
+  * @param  None
+  * @retval None
+  */
+static void Ymodem_RttBackoff(void)
+{
+  YmodemStats.timeouts++;
+  YmodemStats.rto_ms <<= 1;
+  if (YmodemStats.rto_ms > YMODEM_RTO_MAX)
+  {
+    YmodemStats.rto_ms = YMODEM_RTO_MAX;
+  }
+}
+
+/**
+  * @brief  Queue one byte to be sent back to the sender
+  * @param  p_rx: receiver context
+  * @param  byte: ACK, NAK, CRC16 or CA
+  * @retval None
+  */
+static void Ymodem_RxReply(YMODEM_RxTypeDef *p_rx, uint8_t byte)
+{
+  if (p_rx->reply_length < sizeof(p_rx->a_reply))
+  {
+    p_rx->a_reply[p_rx->reply_length++] = byte;
+  }
+}
+
+/**
+  * @brief  Extract file name and size from the file header packet
+  * @param  p_rx: receiver context, p_data points to the header payload
+  * @retval None
+  */
+static void Ymodem_RxParseHeader(YMODEM_RxTypeDef *p_rx)
+{
+  uint32_t i = 0;
+  uint8_t *file_ptr = p_rx->p_data;
+  uint8_t *file_end = p_rx->p_data + p_rx->length;
+  uint8_t file_size[FILE_SIZE_LENGTH];
+
+  /* File name extraction */
+  while ((file_ptr < file_end) && (*file_ptr != 0) && (i < (FILE_NAME_LENGTH - 1)))
+  {
+    p_rx->file_name[i++] = *file_ptr++;
+  }
+  p_rx->file_name[i] = '\0';
+  while ((file_ptr < file_end) && (*file_ptr != 0))
+  {
+    file_ptr++;
+  }
+  file_ptr++;
+
+  /* File size extraction */
+  i = 0;
+  while ((file_ptr < file_end) && (*file_ptr != ' ') && (*file_ptr != 0) && (i < (FILE_SIZE_LENGTH - 1)))
+  {
+    file_size[i++] = *file_ptr++;
+  }
+  file_size[i] = '\0';
+  p_rx->file_size = 0;
+  Str2Int(file_size, &p_rx->file_size);
+
+  /* Options after the NUL that ends the size field, one NUL terminated
+     token each (standard receivers ignore everything after it):
+     "YMX:<payload size>" extended packets, "HS:<W>,<L>" compressed image */
+  while ((file_ptr < file_end) && (*file_ptr != 0))
+  {
+    file_ptr++;
+  }
+  file_ptr++;
+  p_rx->xblk_request = 0;
+  p_rx->hs_window_bits = 0;
+  p_rx->hs_lookahead_bits = 0;
+  while ((file_ptr < file_end) && (*file_ptr != 0))
+  {
+    if (((file_ptr + sizeof(YMODEM_XBLK_TOKEN) - 1) < file_end) &&
+        (memcmp(file_ptr, YMODEM_XBLK_TOKEN, sizeof(YMODEM_XBLK_TOKEN) - 1) == 0))
+    {
+      file_ptr += sizeof(YMODEM_XBLK_TOKEN) - 1;
+      file_ptr = Ymodem_RxParseNumber(file_ptr, file_end, &p_rx->xblk_request);
+    }
+    else if (((file_ptr + sizeof(YMODEM_HS_TOKEN) - 1) < file_end) &&
+             (memcmp(file_ptr, YMODEM_HS_TOKEN, sizeof(YMODEM_HS_TOKEN) - 1) == 0))
+    {
+      file_ptr += sizeof(YMODEM_HS_TOKEN) - 1;
+      file_ptr = Ymodem_RxParseNumber(file_ptr, file_end, &p_rx->hs_window_bits);
+      if ((file_ptr < file_end) && (*file_ptr == ','))
+      {
+        file_ptr = Ymodem_RxParseNumber(file_ptr + 1, file_end, &p_rx->hs_lookahead_bits);
+      }
+    }
+    /* next token */
+    while ((file_ptr < file_end) && (*file_ptr != 0))
+    {
+      file_ptr++;
+    }
+    file_ptr++;
+  }
+
+  /* "app.bin.hs": compressed with the default parameters */
+  if ((p_rx->hs_window_bits == 0) && Ymodem_NameHasExtension(p_rx->file_name, YMODEM_HS_EXTENSION))
+  {
+    p_rx->hs_window_bits = YMODEM_HS_WINDOW_BITS;
+    p_rx->hs_lookahead_bits = YMODEM_HS_LOOKAHEAD_BITS;
+  }
+  p_rx->update = YMODEM_UPDATE_IMAGE;
+  if (Ymodem_NameHasExtension(p_rx->file_name, YMODEM_DELTA_EXTENSION) ||
+      Ymodem_NameHasExtension(p_rx->file_name, YMODEM_DELTA_EXTENSION YMODEM_HS_EXTENSION))
+  {
+    p_rx->update = YMODEM_UPDATE_DELTA;
+  }
+  else if (Ymodem_NameHasExtension(p_rx->file_name, YMODEM_MANIFEST_EXTENSION) ||
+           Ymodem_NameHasExtension(p_rx->file_name, YMODEM_MANIFEST_EXTENSION YMODEM_HS_EXTENSION))
+  {
+    p_rx->update = YMODEM_UPDATE_MANIFEST;
+  }
+  else if (Ymodem_NameHasExtension(p_rx->file_name, YMODEM_SPARSE_EXTENSION) ||
+           Ymodem_NameHasExtension(p_rx->file_name, YMODEM_SPARSE_EXTENSION YMODEM_HS_EXTENSION))
+  {
+    p_rx->update = YMODEM_UPDATE_SPARSE;
+  }
+}
+
+/**
+  * @brief  Check the extension of a received file name
+  * @param  p_name: NUL terminated file name
+  * @param  p_extension: extension including the dot
+  * @retval 1 if p_name ends with p_extension (and is longer), 0 otherwise
+  */
+static uint8_t Ymodem_NameHasExtension(const uint8_t *p_name, const char *p_extension)
+{
+  uint32_t name_length = strlen((const char *)p_name);
+  uint32_t extension_length = strlen(p_extension);
+
+  return ((name_length > extension_length) &&
+          (strcmp((const char *)&p_name[name_length - extension_length], p_extension) == 0)) ? 1 : 0;
+}
+
+/**
+  * @brief  Map a delta update result to the transfer result
+  * @param  status: result of an AppUpdate_xxx call
+  * @retval COM_OK, COM_LIMIT (image too large) or COM_DATA
+  */
+static COM_StatusTypeDef Ymodem_DeltaResult(eAPP_Update_Status_Def status)
+{
+  if (status == APP_UPDATE_OK)
+  {
+    return COM_OK;
+  }
+  return (status == APP_UPDATE_SIZE_ERR) ? COM_LIMIT : COM_DATA;
+}
+
+/**
+  * @brief  Start the update selected by the file name (App1 is not touched)
+  * @param  update: YMODEM_UPDATE_DELTA, _MANIFEST or _SPARSE
+  * @retval result of the AppUpdate_xxx call
+  */
+static eAPP_Update_Status_Def Ymodem_UpdateBegin(uint8_t update)
+{
+  if (update == YMODEM_UPDATE_MANIFEST)
+  {
+    ManifestReady = 0;
+    return AppUpdate_ManifestBegin();
+  }
+  return (update == YMODEM_UPDATE_SPARSE) ? AppUpdate_SparseBegin() : AppUpdate_DeltaBegin();
+}
+
+/**
+  * @brief  Pass file content to the update
+  * @param  update: YMODEM_UPDATE_DELTA, _MANIFEST or _SPARSE
+  * @param  p_data: file bytes, padding after the declared content is ignored
+  * @param  length: number of bytes
+  * @retval result of the AppUpdate_xxx call
+  */
+static eAPP_Update_Status_Def Ymodem_UpdateWrite(uint8_t update, const uint8_t *p_data, uint32_t length)
+{
+  if (update == YMODEM_UPDATE_MANIFEST)
+  {
+    return AppUpdate_ManifestWrite(p_data, length);
+  }
+  return (update == YMODEM_UPDATE_SPARSE) ? AppUpdate_SparseWrite(p_data, length) : AppUpdate_DeltaWrite(p_data, length);
+}
+
+/**
+  * @brief  End of file: verify the image staged in Backup, or compare the
+  *         manifest with App1
+  * @param  update: YMODEM_UPDATE_DELTA, _MANIFEST or _SPARSE
+  * @param  p_size: new image size (patch / sparse file)
+  * @retval result of the AppUpdate_xxx call
+  */
+static eAPP_Update_Status_Def Ymodem_UpdateEnd(uint8_t update, uint32_t *p_size)
+{
+  eAPP_Update_Status_Def status;
+
+  if (update == YMODEM_UPDATE_MANIFEST)
+  {
+    status = AppUpdate_ManifestEnd(aManifestBitmap, &ManifestChunks, &ManifestNeeded);
+    ManifestReady = (status == APP_UPDATE_OK) ? 1 : 0;
+    return status;
+  }
+  return (update == YMODEM_UPDATE_SPARSE) ? AppUpdate_SparseEnd(p_size) : AppUpdate_DeltaEnd(p_size);
+}
+
+/**
+  * @brief  Read a decimal number of a file header option
+  * @param  p_str: first digit
+  * @param  p_end: end of the header payload
+  * @param  p_value: parsed value, 0 if invalid
+  * @retval pointer to the character that ended the number (NUL or ',')
+  */
+static uint8_t *Ymodem_RxParseNumber(uint8_t *p_str, const uint8_t *p_end, uint32_t *p_value)
+{
+  uint8_t number[FILE_SIZE_LENGTH];
+  uint32_t i = 0;
+
+  while ((p_str < p_end) && (*p_str != 0) && (*p_str != ',') && (i < (FILE_SIZE_LENGTH - 1)))
+  {
+    number[i++] = *p_str++;
+  }
+  number[i] = '\0';
+  *p_value = 0;
+  if (Str2Int(number, p_value) == 0)
+  {
+    *p_value = 0;
+  }
+  return p_str;
+}
+
+/**
+  * @brief  Check a complete packet and turn it into an event
+  * @param  p_rx: receiver context
+  * @retval YMODEM_EventTypeDef
+  */
+static YMODEM_EventTypeDef Ymodem_RxPacketDone(YMODEM_RxTypeDef *p_rx)
+{
+  uint8_t *p_packet = p_rx->p_packet;
+  uint32_t crc;
+
+  p_rx->state = YMODEM_STATE_START;
+  p_rx->index = 0;
+
+  /* Simple packet sanity check */
+  crc = p_packet[p_rx->packet_size + PACKET_DATA_INDEX] << 8;
+  crc += p_packet[p_rx->packet_size + PACKET_DATA_INDEX + 1];
+  if ((p_packet[PACKET_NUMBER_INDEX] != (p_packet[PACKET_CNUMBER_INDEX] ^ NEGATIVE_BYTE)) ||
+      (Cal_CRC16(&p_packet[PACKET_DATA_INDEX], p_rx->packet_size) != crc))
+  {
+    return Ymodem_RxTimeout(p_rx);
+  }
+
+  if (p_packet[PACKET_NUMBER_INDEX] != p_rx->packets_received)
+  {
+    if ((p_rx->streaming != 0) && (p_rx->packets_received != 0))
+    {
+      /* Ymodem-G cannot ask for a resend */
+      return Ymodem_RxTimeout(p_rx);
+    }
+    p_rx->errors = 0;
+    Ymodem_RxReply(p_rx, NAK);
+    return YMODEM_EVT_NONE;
+  }
+  p_rx->errors = 0;
+
+  p_rx->p_data = &p_packet[PACKET_DATA_INDEX];
+  p_rx->length = p_rx->packet_size;
+  if (p_rx->packets_received != 0)
+  {
+    p_rx->pending = YMODEM_EVT_DATA;
+  }
+  else if (p_rx->p_data[0] != 0)
+  {
+    Ymodem_RxParseHeader(p_rx);
+    p_rx->pending = YMODEM_EVT_FILE;
+  }
+  else
+  {
+    /* File header packet is empty, end session */
+    Ymodem_RxReply(p_rx, ACK);
+    return YMODEM_EVT_END;
+  }
+  return (YMODEM_EventTypeDef)p_rx->pending;
+}
+
 /* Public functions ---------------------------------------------------------*/
+/**
+  * @brief  Initialize an incremental Ymodem receiver
+  * @param  p_rx: receiver context
+  * @param  p_buf0, p_buf1: two packet buffers (32-bit aligned, the largest
+  *         payload (PACKET_1K_SIZE or YMODEM_XBLK_MAX_SIZE) + PACKET_DATA_INDEX
+  *         + PACKET_TRAILER_SIZE bytes). Data packets alternate between them,
+  *         see Ymodem_RxAccept().
+  * @retval None
+  */
+void Ymodem_RxInit(YMODEM_RxTypeDef *p_rx, uint8_t *p_buf0, uint8_t *p_buf1)
+{
+  memset(p_rx, 0, sizeof(YMODEM_RxTypeDef));
+  p_rx->state = YMODEM_STATE_START;
+  p_rx->p_packet = p_buf0;
+  p_rx->p_spare = p_buf1;
+}
+
+/**
+  * @brief  Ask the sender for Ymodem-G streaming instead of plain Ymodem
+  * @note   Call right after Ymodem_RxInit(). The receiver handshakes with 'G';
+  *         if the sender does not answer after YMODEM_G_HANDSHAKE_TRIES
+  *         requests it falls back to 'C' (plain Ymodem with ACK per packet).
+  *         In streaming mode data packets are not ACKed and any CRC, sequence
+  *         or timeout error during a file cancels the session with CA CA.
+  * @param  p_rx: receiver context
+  * @param  enable: 1 for Ymodem-G, 0 for plain Ymodem
+  * @retval None
+  */
+void Ymodem_RxSetStreaming(YMODEM_RxTypeDef *p_rx, uint8_t enable)
+{
+  p_rx->streaming = enable;
+  p_rx->handshake_tries = 0;
+}
+
+/**
+  * @brief  Feed received bytes to the receiver.
+  * @note   Never blocks. Parsing stops at the first event so the caller can
+  *         handle it; feed the remaining bytes afterwards. FILE, DATA and EOT
+  *         events must be answered with Ymodem_RxAccept() before feeding more.
+  *         Bytes to send back are collected in a_reply / reply_length.
+  * @param  p_rx: receiver context
+  * @param  p_in: received bytes
+  * @param  length: number of received bytes
+  * @param  p_used: number of bytes consumed
+  * @retval YMODEM_EventTypeDef
+  */
+YMODEM_EventTypeDef Ymodem_RxFeed(YMODEM_RxTypeDef *p_rx, const uint8_t *p_in, uint32_t length, uint32_t *p_used)
+{
+  YMODEM_EventTypeDef event = YMODEM_EVT_NONE;
+  uint32_t used = 0;
+  uint32_t count;
+  uint8_t char1;
+
+  while ((used < length) && (event == YMODEM_EVT_NONE) && (p_rx->pending == YMODEM_EVT_NONE))
+  {
+    switch (p_rx->state)
+    {
+      case YMODEM_STATE_START:
+        char1 = p_in[used++];
+        p_rx->p_packet[PACKET_START_INDEX] = char1;
+        switch (char1)
+        {
+          case SOH:
+            p_rx->packet_size = PACKET_SIZE;
+            p_rx->index = PACKET_NUMBER_INDEX;
+            p_rx->state = YMODEM_STATE_BODY;
+            break;
+          case STX:
+            p_rx->packet_size = PACKET_1K_SIZE;
+            p_rx->index = PACKET_NUMBER_INDEX;
+            p_rx->state = YMODEM_STATE_BODY;
+            break;
+          case STX_X:
+            /* only after it was negotiated in the file header */
+            if (p_rx->xblk_size == 0)
+            {
+              p_rx->state = YMODEM_STATE_DISCARD;
+              break;
+            }
+            p_rx->packet_size = p_rx->xblk_size;
+            p_rx->index = PACKET_NUMBER_INDEX;
+            p_rx->state = YMODEM_STATE_BODY;
+            break;
+          case EOT:
+            p_rx->errors = 0;
+            p_rx->pending = YMODEM_EVT_EOT;
+            event = YMODEM_EVT_EOT;
+            break;
+          case CA:
+            p_rx->state = YMODEM_STATE_CA;
+            break;
+          case ABORT1:
+          case ABORT2:
+            Ymodem_RxReply(p_rx, CA);
+            Ymodem_RxReply(p_rx, CA);
+            event = YMODEM_EVT_USER_ABORT;
+            break;
+          default:
+            p_rx->state = YMODEM_STATE_DISCARD;
+            break;
+        }
+        break;
+
+      case YMODEM_STATE_CA:
+        if (p_in[used++] == CA)
+        {
+          /* Abort by sender */
+          Ymodem_RxReply(p_rx, ACK);
+          p_rx->state = YMODEM_STATE_START;
+          event = YMODEM_EVT_ABORT;
+        }
+        else
+        {
+          p_rx->state = YMODEM_STATE_DISCARD;
+        }
+        break;
+
+      case YMODEM_STATE_BODY:
+        count = p_rx->packet_size + PACKET_OVERHEAD_SIZE + PACKET_NUMBER_INDEX - p_rx->index;
+        if (count > (length - used))
+        {
+          count = length - used;
+        }
+        memcpy(&p_rx->p_packet[p_rx->index], &p_in[used], count);
+        p_rx->index += count;
+        used += count;
+        if (p_rx->index == (p_rx->packet_size + PACKET_OVERHEAD_SIZE + PACKET_NUMBER_INDEX))
+        {
+          event = Ymodem_RxPacketDone(p_rx);
+        }
+        break;
+
+      case YMODEM_STATE_DISCARD:
+      default:
+        /* Purge until the sender stops, then Ymodem_RxTimeout() asks again */
+        used = length;
+        break;
+    }
+  }
+
+  *p_used = used;
+  return event;
+}
+
+/**
+  * @brief  Tell the receiver that no byte arrived within the retry timeout
+  *         (or that a packet was corrupted).
+  * @param  p_rx: receiver context
+  * @retval YMODEM_EVT_ERROR when the error limit is exceeded (CA CA queued),
+  *         YMODEM_EVT_NONE otherwise ('C' queued to ask for the packet again)
+  */
+YMODEM_EventTypeDef Ymodem_RxTimeout(YMODEM_RxTypeDef *p_rx)
+{
+  p_rx->state = YMODEM_STATE_START;
+  p_rx->index = 0;
+
+  if (p_rx->session_begin > 0)
+  {
+    p_rx->errors++;
+  }
+  else if ((p_rx->streaming != 0) && (++p_rx->handshake_tries > YMODEM_G_HANDSHAKE_TRIES))
+  {
+    /* Sender does not understand 'G', fall back to plain Ymodem */
+    p_rx->streaming = 0;
+  }
+
+  if ((p_rx->errors > MAX_ERRORS) ||
+      ((p_rx->streaming != 0) && (p_rx->packets_received != 0)))
+  {
+    /* Abort communication */
+    Ymodem_RxReply(p_rx, CA);
+    Ymodem_RxReply(p_rx, CA);
+    return YMODEM_EVT_ERROR;
+  }
+  /* Ask for a packet */
+  Ymodem_RxReply(p_rx, (p_rx->streaming != 0) ? CRC16_G : CRC16);
+  return YMODEM_EVT_NONE;
+}
+
+/**
+  * @brief  Answer a pending FILE, DATA or EOT event.
+  * @note   Accepting a DATA packet switches reception to the other buffer, so
+  *         the payload (p_data) stays valid until the next DATA packet is
+  *         accepted.
+  * @param  p_rx: receiver context
+  * @param  accept: 1 to ACK the packet, 0 to cancel the session (CA CA)
+  * @retval None
+  */
+void Ymodem_RxAccept(YMODEM_RxTypeDef *p_rx, uint8_t accept)
+{
+  uint8_t *p_swap;
+
+  if (accept == 0)
+  {
+    /* End session */
+    Ymodem_RxReply(p_rx, CA);
+    Ymodem_RxReply(p_rx, CA);
+    p_rx->pending = YMODEM_EVT_NONE;
+    return;
+  }
+
+  switch (p_rx->pending)
+  {
+    case YMODEM_EVT_FILE:
+      /* Ymodem-G: no ACK, 'G' starts the data stream */
+      if (p_rx->streaming == 0)
+      {
+        Ymodem_RxReply(p_rx, ACK);
+      }
+      /* Extended packets: 'W' + granted payload in KB, never more than asked */
+      p_rx->xblk_size = 0;
+      if ((YMODEM_XBLK_MAX_SIZE >= (2 * PACKET_1K_SIZE)) && (p_rx->xblk_request >= (2 * PACKET_1K_SIZE)))
+      {
+        p_rx->xblk_size = (p_rx->xblk_request < YMODEM_XBLK_MAX_SIZE) ? p_rx->xblk_request : YMODEM_XBLK_MAX_SIZE;
+        p_rx->xblk_size -= p_rx->xblk_size % PACKET_1K_SIZE;
+        Ymodem_RxReply(p_rx, XACK);
+        Ymodem_RxReply(p_rx, (uint8_t)(p_rx->xblk_size / PACKET_1K_SIZE));
+      }
+      Ymodem_RxReply(p_rx, (p_rx->streaming != 0) ? CRC16_G : CRC16);
+      p_rx->packets_received++;
+      p_rx->session_begin = 1;
+      break;
+    case YMODEM_EVT_DATA:
+      if (p_rx->streaming == 0)
+      {
+        Ymodem_RxReply(p_rx, ACK);
+      }
+      p_rx->packets_received++;
+      p_swap = p_rx->p_packet;
+      p_rx->p_packet = p_rx->p_spare;
+      p_rx->p_spare = p_swap;
+      break;
+    case YMODEM_EVT_EOT:
+      /* EOT is ACKed in both modes, then ask for the next file header
+         (packet 0) right away instead of waiting for a timeout */
+      Ymodem_RxReply(p_rx, ACK);
+      Ymodem_RxReply(p_rx, (p_rx->streaming != 0) ? CRC16_G : CRC16);
+      p_rx->packets_received = 0;
+      break;
+    default:
+      break;
+  }
+  p_rx->pending = YMODEM_EVT_NONE;
+}
+
+/**
+  * @brief  Program the next slice of the pending packet.
+  * @note   Called from the receive wait loop (IAP_Interface IdleFunction) so
+  *         that flash programming of packet N overlaps reception of packet N+1.
+  *         With nothing to program, the next sector is erased ahead of the
+  *         write pointer.
+  * @param  None
+  * @retval None
+  */
+void Ymodem_FlashPoll(void)
+{
+  uint32_t words;
+
+  if (FlashStage.status != FLASHIF_OK)
+  {
+    return;
+  }
+  if (FlashStage.words_left == 0)
+  {
+    if (FLASH_If_EraseAhead_Poll() != HAL_OK)
+    {
+      FlashStage.status = FLASHIF_ERASEKO;
+    }
+    return;
+  }
+
+  words = FlashStage.words_left < FLASH_STAGE_SLICE_WORDS ? FlashStage.words_left : FLASH_STAGE_SLICE_WORDS;
+  FlashStage.status = FLASH_If_Write(FlashStage.destination, FlashStage.p_source, words);
+  FlashStage.destination += words * 4;
+  FlashStage.p_source += words;
+  FlashStage.words_left -= words;
+}
+
+/**
+  * @brief  Link statistics (RTT, retry timeout, packet interval) of the
+  *         current or last Ymodem_Receive session.
+  * @param  None
+  * @retval pointer to the statistics
+  */
+const YMODEM_StatsTypeDef *Ymodem_GetStats(void)
+{
+  return &YmodemStats;
+}
+
+/**
+  * @brief  Result of the last manifest (.mfs) received
+  * @param  p_chunks: number of chunks in the new image
+  * @param  p_needed: number of chunks that differ from App1
+  * @retval bitmap of the chunks to send, (chunks + 7) / 8 bytes, NULL if the
+  *         last file received was not a manifest
+  */
+const uint8_t *Ymodem_GetManifest(uint32_t *p_chunks, uint32_t *p_needed)
+{
+  if (ManifestReady == 0)
+  {
+    return NULL;
+  }
+  *p_chunks = ManifestChunks;
+  *p_needed = ManifestNeeded;
+  return aManifestBitmap;
+}
+
 /**
   * @brief  Receive a file using the ymodem protocol with CRC16.
+  * @note   Blocking wrapper around the incremental receiver (Ymodem_RxFeed)
+  *         that reads from iapInterface.ReceiveAnyFunction, up to a 1K packet
+  *         per call.
   * @param  p_size The size of the file.
   * @retval COM_StatusTypeDef result of reception/programming
   */
 COM_StatusTypeDef Ymodem_Receive ( uint32_t *p_size )
 {
-  uint32_t i, packet_length, session_done = 0, file_done, errors = 0, session_begin = 0;
-  uint32_t flashdestination, ramsource, filesize;
-  uint8_t *file_ptr;
-  uint8_t file_size[FILE_SIZE_LENGTH], tmp, packets_received;
+  static YMODEM_RxTypeDef rx;
+  uint32_t flashdestination, used;
+  const uint8_t *p_in = aRxBytes;
+  uint32_t in_length = 0;
+  YMODEM_EventTypeDef event;
   COM_StatusTypeDef result = COM_OK;
+  COM_StatusTypeDef status;
+  uint8_t session_done = 0;
+  uint8_t commit_ready = 0;
+  uint8_t rtt_pending = 0;
+  uint32_t timeout, now, reply_tick = 0, packet_tick = 0;
 
   /* Initialize flashdestination variable */
   flashdestination = APPLICATION_ADDRESS;
+  FlashStage_Reset();
+  Ymodem_RxInit(&rx, aPacketData, aPacketDataPong);
+  Ymodem_RxSetStreaming(&rx, YMODEM_G_ENABLE);
+  Ymodem_RttReset();
+  ManifestReady = 0;
+  /* flash stays unlocked for the whole transfer, closed on every exit below */
+  if (FLASH_If_Open() != HAL_OK)
+  {
+    return COM_ERROR;
+  }
 
   while ((session_done == 0) && (result == COM_OK))
   {
-    packets_received = 0;
-    file_done = 0;
-    while ((file_done == 0) && (result == COM_OK))
+    /* Fixed timeout while waiting for the user to start the transfer and in
+       Ymodem-G mode (a timeout cancels the stream, nothing to retry) */
+    timeout = ((rx.session_begin != 0) && (rx.streaming == 0)) ? YmodemStats.rto_ms : DOWNLOAD_TIMEOUT;
+    if (in_length == 0)
     {
-      switch (ReceivePacket(aPacketData, &packet_length, DOWNLOAD_TIMEOUT))
+      p_in = aRxBytes;
+      in_length = iapInterface.ReceiveAnyFunction(aRxBytes, sizeof(aRxBytes), timeout);
+      if ((in_length != 0) && (rtt_pending != 0))
       {
-        case HAL_OK:
-          errors = 0;
-          switch (packet_length)
-          {
-            case 2:
-              /* Abort by sender */
-              Serial_PutByte(ACK);
-              result = COM_ABORT;
-              break;
-            case 0:
-              /* End of transmission */
-              Serial_PutByte(ACK);
-              file_done = 1;
-              break;
-            default:
-              /* Normal packet */
-              if (aPacketData[PACKET_NUMBER_INDEX] != packets_received)
-              {
-                Serial_PutByte(NAK);
-              }
-              else
-              {
-                if (packets_received == 0)
-                {
-                  /* File name packet */
-                  if (aPacketData[PACKET_DATA_INDEX] != 0)
-                  {
-                    /* File name extraction */
-                    i = 0;
-                    file_ptr = aPacketData + PACKET_DATA_INDEX;
-                    while ( (*file_ptr != 0) && (i < FILE_NAME_LENGTH))
-                    {
-                      aFileName[i++] = *file_ptr++;
-                    }
-
-                    /* File size extraction */
-                    aFileName[i++] = '\0';
-                    i = 0;
-                    file_ptr ++;
-                    while ( (*file_ptr != ' ') && (i < FILE_SIZE_LENGTH))
-                    {
-                      file_size[i++] = *file_ptr++;
-                    }
-                    file_size[i++] = '\0';
-                    Str2Int(file_size, &filesize);
-
-                    /* Test the size of the image to be sent */
-                    /* Image size is greater than Flash size */
-                    if (*p_size > (USER_FLASH_SIZE + 1))
-                    {
-                      /* End session */
-                      tmp = CA;
-                      iapInterface.TransmitFunction(&tmp, 1, NAK_TIMEOUT);
-                      iapInterface.TransmitFunction(&tmp, 1, NAK_TIMEOUT);
-                      result = COM_LIMIT;
-                    }
-                    /* erase user application area */
-                    if(HAL_OK != FLASH_If_Erase_App_Space())
-										{
-												return COM_ERROR;
-										}
-                    *p_size = filesize;
-
-                    Serial_PutByte(ACK);
-                    Serial_PutByte(CRC16);
-                  }
-                  /* File header packet is empty, end session */
-                  else
-                  {
-                    Serial_PutByte(ACK);
-                    file_done = 1;
-                    session_done = 1;
-                    break;
-                  }
-                }
-                else /* Data packet */
-                {
-                  ramsource = (uint32_t) & aPacketData[PACKET_DATA_INDEX];
-
-                  /* Write received data in Flash */
-                  if (FLASH_If_Write(flashdestination, (uint32_t*) ramsource, packet_length/4) == FLASHIF_OK)                   
-                  {
-                    flashdestination += packet_length;
-                    Serial_PutByte(ACK);
-                  }
-                  else /* An error occurred while writing to Flash memory */
-                  {
-                    /* End session */
-                    Serial_PutByte(CA);
-                    Serial_PutByte(CA);
-                    result = COM_DATA;
-                  }
-                }
-                packets_received ++;
-                session_begin = 1;
-              }
-              break;
-          }
-          break;
-        case HAL_BUSY: /* Abort actually */
-          Serial_PutByte(CA);
-          Serial_PutByte(CA);
-          result = COM_ABORT;
-          break;
-        default:
-          if (session_begin > 0)
-          {
-            errors ++;
-          }
-          if (errors > MAX_ERRORS)
-          {
-            /* Abort communication */
-            Serial_PutByte(CA);
-            Serial_PutByte(CA);
-          }
-          else
+        Ymodem_RttSample(iapInterface.GetTickFunction() - reply_tick);
+        rtt_pending = 0;
+      }
+    }
+    if (in_length != 0)
+    {
+      /* bytes after an event stay in aRxBytes for the next pass */
+      event = Ymodem_RxFeed(&rx, p_in, in_length, &used);
+      p_in += used;
+      in_length -= used;
+    }
+    else
+    {
+      if (rx.session_begin != 0)
+      {
+        Ymodem_RttBackoff();
+      }
+      rtt_pending = 0;  /* Karn: no sample for a retried packet */
+      event = Ymodem_RxTimeout(&rx);
+    }
+
+    switch (event)
+    {
+      case YMODEM_EVT_FILE:
+        memcpy(aFileName, rx.file_name, FILE_NAME_LENGTH);
+        /* Test the size of the image to be sent */
+        /* Image size is greater than Flash size */
+        if (rx.file_size > USER_FLASH_SIZE)
+        {
+          Ymodem_RxAccept(&rx, 0);
+          result = COM_LIMIT;
+        }
+        /* compressed image: decoder parameters must be supported */
+        else if ((rx.hs_window_bits != 0) && (InflateStage_Start(&rx) != COM_OK))
+        {
+          Ymodem_RxAccept(&rx, 0);
+          result = COM_ERROR;
+        }
+        /* delta patch / sparse chunks: built in Backup, App1 is kept until
+           the result is verified. Manifest: App1 is only read */
+        else if ((rx.update != YMODEM_UPDATE_IMAGE) && (Ymodem_UpdateBegin(rx.update) != APP_UPDATE_OK))
+        {
+          Ymodem_RxAccept(&rx, 0);
+          result = COM_ERROR;
+        }
+        /* erase the sectors the image needs (all of App1 if the size is
+           unknown or the image is compressed) one by one, just ahead of
+           the data: the header is ACKed without waiting for any erase */
+        else if ((rx.update == YMODEM_UPDATE_IMAGE) &&
+                 (HAL_OK != FLASH_If_EraseAhead_Begin(APPLICATION_ADDRESS,
+                                                      ((rx.file_size != 0) && (rx.hs_window_bits == 0)) ? rx.file_size : USER_FLASH_SIZE)))
+        {
+          Ymodem_RxAccept(&rx, 0);
+          result = COM_ERROR;
+        }
+        else
+        {
+          *p_size = rx.file_size;
+          Ymodem_RxAccept(&rx, 1);
+        }
+        break;
+      case YMODEM_EVT_DATA:
+        /* Finish the previous packet (other buffer), then queue this one
+           and ACK at once so the sender streams while we program.
+           In Ymodem-G mode a programming error cancels the stream (CA CA) */
+        if ((rx.update != YMODEM_UPDATE_IMAGE) && (rx.hs_window_bits == 0))
+        {
+          /* Patch / manifest / chunks: padding after the content is ignored */
+          status = Ymodem_DeltaResult(Ymodem_UpdateWrite(rx.update, rx.p_data, rx.length));
+        }
+        else if (rx.hs_window_bits != 0)
+        {
+          /* Compressed image: decode, full output buffers go to the flash stage */
+          status = InflateStage_Write(&flashdestination, rx.p_data, rx.length);
+        }
+        else if (FlashStage_Flush() == FLASHIF_OK)
+        {
+          FlashStage_Submit(flashdestination, (uint32_t*)rx.p_data, rx.length / 4);
+          flashdestination += rx.length;
+          status = COM_OK;
+        }
+        else /* An error occurred while erasing / writing the previous packet to Flash memory */
+        {
+          status = FlashStage_Error();
+        }
+        if (status == COM_OK)
+        {
+          Ymodem_RxAccept(&rx, 1);
+          now = iapInterface.GetTickFunction();
+          if (YmodemStats.packets != 0)
           {
-            Serial_PutByte(CRC16); /* Ask for a packet */
+            /* interval = 7/8 interval + 1/8 sample */
+            YmodemStats.packet_interval_ms += (int32_t)((now - packet_tick) - YmodemStats.packet_interval_ms) / 8;
           }
-          break;
+          packet_tick = now;
+          YmodemStats.packets++;
+        }
+        else
+        {
+          Ymodem_RxAccept(&rx, 0);
+          result = status;
+        }
+        break;
+      case YMODEM_EVT_EOT:
+        /* End of transmission: the last packet must be in flash before the ACK */
+        status = COM_OK;
+        if (rx.hs_window_bits != 0)
+        {
+          status = InflateStage_Finish(&flashdestination, p_size);
+        }
+        if ((status == COM_OK) && (rx.update != YMODEM_UPDATE_IMAGE))
+        {
+          /* the new image must be complete and verified in Backup */
+          status = Ymodem_DeltaResult(Ymodem_UpdateEnd(rx.update, p_size));
+          commit_ready = ((status == COM_OK) && (rx.update != YMODEM_UPDATE_MANIFEST)) ? 1 : 0;
+        }
+        if ((status == COM_OK) && (FlashStage_Flush() != FLASHIF_OK))
+        {
+          status = FlashStage_Error();
+        }
+        if (status == COM_OK)
+        {
+          Ymodem_RxAccept(&rx, 1);
+        }
+        else
+        {
+          Ymodem_RxAccept(&rx, 0);
+          result = status;
+        }
+        break;
+      case YMODEM_EVT_END:
+        session_done = 1;
+        break;
+      case YMODEM_EVT_ABORT:
+      case YMODEM_EVT_USER_ABORT:
+        result = COM_ABORT;
+        break;
+      case YMODEM_EVT_ERROR:
+        result = COM_ERROR;
+        break;
+      default:
+        break;
+    }
+
+    if (rx.reply_length > 0)
+    {
+      iapInterface.TransmitFunction(rx.a_reply, rx.reply_length, NAK_TIMEOUT);
+      rx.reply_length = 0;
+      /* an accepted packet was ACKed: time until the next one starts */
+      if ((event == YMODEM_EVT_FILE) || (event == YMODEM_EVT_DATA))
+      {
+        reply_tick = iapInterface.GetTickFunction();
+        rtt_pending = (rx.streaming == 0) ? 1 : 0;
       }
     }
   }
+  /* Nothing may be left half programmed when reporting success */
+  if ((result == COM_OK) && (FlashStage_Flush() != FLASHIF_OK))
+  {
+    result = FlashStage_Error();
+  }
+  /* The image area must end up as after an erase-all, also on errors */
+  if ((FLASH_If_EraseAhead_End() != HAL_OK) && (result == COM_OK))
+  {
+    result = COM_ERROR;
+  }
+  FLASH_If_Close();
+  /* Delta / sparse update: replace the changed App1 sectors once the sender
+     is done (takes a few seconds) */
+  if ((result == COM_OK) && (commit_ready != 0))
+  {
+    result = Ymodem_DeltaResult(AppUpdate_Commit(*p_size));
+  }
   return result;
 }
 
+/**
+  * @brief  Send a prepared packet and its CRC (or checksum) as one transfer
+  * @param  p_packet: packet buffer prepared by PreparePacket/PrepareIntialPacket
+  * @param  size: payload size (PACKET_SIZE or PACKET_1K_SIZE)
+  * @retval None
+  */
+static void Ymodem_SendPacket(uint8_t *p_packet, uint32_t size)
+{
+  IAP_IoVec a_iov[2];
+  uint8_t a_trailer[2];
+#ifdef CRC16_F
+  uint16_t temp_crc;
+
+  temp_crc = Cal_CRC16(&p_packet[PACKET_DATA_INDEX], size);
+  a_trailer[0] = temp_crc >> 8;
+  a_trailer[1] = temp_crc & 0xFF;
+  a_iov[1].length = 2;
+#else /* CRC16_F */
+  a_trailer[0] = CalcChecksum(&p_packet[PACKET_DATA_INDEX], size);
+  a_iov[1].length = 1;
+#endif /* CRC16_F */
+
+  a_iov[0].p_base = &p_packet[PACKET_START_INDEX];
+  a_iov[0].length = size + PACKET_HEADER_SIZE;
+  a_iov[1].p_base = a_trailer;
+  iapInterface.TransmitVFunction(a_iov, 2, NAK_TIMEOUT);
+}
+
 /**
   * @brief  Transmit a file using the ymodem protocol
   * @param  p_buf: Address of the first byte
@@ -454,29 +1349,14 @@ COM_StatusTypeDef Ymodem_Transmit (uint8_t *p_buf, const uint8_t *p_file_name, u
   uint32_t blk_number = 1;
   uint8_t a_rx_ctrl[2];
   uint8_t i;
-#ifdef CRC16_F    
-  uint32_t temp_crc;
-#else /* CRC16_F */   
-  uint8_t temp_chksum;
-#endif /* CRC16_F */  
 
   /* Prepare first block - header */
   PrepareIntialPacket(aPacketData, p_file_name, file_size);
 
   while (( !ack_recpt ) && ( result == COM_OK ))
   {
-    /* Send Packet */
-    iapInterface.TransmitFunction(&aPacketData[PACKET_START_INDEX], PACKET_SIZE + PACKET_HEADER_SIZE, NAK_TIMEOUT);
-
-    /* Send CRC or Check Sum based on CRC16_F */
-#ifdef CRC16_F    
-    temp_crc = Cal_CRC16(&aPacketData[PACKET_DATA_INDEX], PACKET_SIZE);
-    Serial_PutByte(temp_crc >> 8);
-    Serial_PutByte(temp_crc & 0xFF);
-#else /* CRC16_F */   
-    temp_chksum = CalcChecksum (&aPacketData[PACKET_DATA_INDEX], PACKET_SIZE);
-    Serial_PutByte(temp_chksum);
-#endif /* CRC16_F */
+    /* Send Packet with CRC or Check Sum based on CRC16_F */
+    Ymodem_SendPacket(aPacketData, PACKET_SIZE);
 
     /* Wait for Ack and 'C' */
     if (iapInterface.ReceiveFunction(&a_rx_ctrl[0], 1, NAK_TIMEOUT) == HAL_OK)
@@ -530,17 +1410,8 @@ COM_StatusTypeDef Ymodem_Transmit (uint8_t *p_buf, const uint8_t *p_file_name, u
         pkt_size = PACKET_SIZE;
       }
 
-      iapInterface.TransmitFunction(&aPacketData[PACKET_START_INDEX], pkt_size + PACKET_HEADER_SIZE, NAK_TIMEOUT);
-      
-      /* Send CRC or Check Sum based on CRC16_F */
-#ifdef CRC16_F    
-      temp_crc = Cal_CRC16(&aPacketData[PACKET_DATA_INDEX], pkt_size);
-      Serial_PutByte(temp_crc >> 8);
-      Serial_PutByte(temp_crc & 0xFF);
-#else /* CRC16_F */   
-      temp_chksum = CalcChecksum (&aPacketData[PACKET_DATA_INDEX], pkt_size);
-      Serial_PutByte(temp_chksum);
-#endif /* CRC16_F */
+      /* with CRC or Check Sum based on CRC16_F, one transfer */
+      Ymodem_SendPacket(aPacketData, pkt_size);
       
       /* Wait for Ack */
       if (( iapInterface.ReceiveFunction(&a_rx_ctrl[0], 1, NAK_TIMEOUT) == HAL_OK) && (a_rx_ctrl[0] == ACK))
@@ -626,18 +1497,8 @@ COM_StatusTypeDef Ymodem_Transmit (uint8_t *p_buf, const uint8_t *p_file_name, u
       aPacketData [i] = 0x00;
     }
 
-    /* Send Packet */
-    iapInterface.TransmitFunction(&aPacketData[PACKET_START_INDEX], PACKET_SIZE + PACKET_HEADER_SIZE, NAK_TIMEOUT);
-
-    /* Send CRC or Check Sum based on CRC16_F */
-#ifdef CRC16_F    
-    temp_crc = Cal_CRC16(&aPacketData[PACKET_DATA_INDEX], PACKET_SIZE);
-    Serial_PutByte(temp_crc >> 8);
-    Serial_PutByte(temp_crc & 0xFF);
-#else /* CRC16_F */   
-    temp_chksum = CalcChecksum (&aPacketData[PACKET_DATA_INDEX], PACKET_SIZE);
-    Serial_PutByte(temp_chksum);
-#endif /* CRC16_F */
+    /* Send Packet with CRC or Check Sum based on CRC16_F */
+    Ymodem_SendPacket(aPacketData, PACKET_SIZE);
 
     /* Wait for Ack and 'C' */
     if (iapInterface.ReceiveFunction(&a_rx_ctrl[0], 1, NAK_TIMEOUT) == HAL_OK)
@@ -46,6 +46,21 @@ typedef enum
   * @}
   */
 
+/**
+  * @brief  Events reported by the incremental receiver (Ymodem_RxFeed)
+  */
+typedef enum
+{
+  YMODEM_EVT_NONE       = 0x00,   /* need more bytes */
+  YMODEM_EVT_FILE       = 0x01,   /* file header packet, answer with Ymodem_RxAccept */
+  YMODEM_EVT_DATA       = 0x02,   /* data packet in p_data/length, answer with Ymodem_RxAccept */
+  YMODEM_EVT_EOT        = 0x03,   /* end of file, answer with Ymodem_RxAccept */
+  YMODEM_EVT_END        = 0x04,   /* empty file header, session finished */
+  YMODEM_EVT_ABORT      = 0x05,   /* CA CA received from the sender */
+  YMODEM_EVT_USER_ABORT = 0x06,   /* 'a' or 'A' received */
+  YMODEM_EVT_ERROR      = 0x07    /* too many errors, session cancelled */
+} YMODEM_EventTypeDef;
+
 /* Exported constants --------------------------------------------------------*/
 /* Packet structure defines */
 #define PACKET_HEADER_SIZE      ((uint32_t)3)
@@ -70,11 +85,14 @@ typedef enum
 
 #define SOH                     ((uint8_t)0x01)  /* start of 128-byte data packet */
 #define STX                     ((uint8_t)0x02)  /* start of 1024-byte data packet */
+#define STX_X                   ((uint8_t)0x03)  /* start of extended data packet (negotiated size) */
 #define EOT                     ((uint8_t)0x04)  /* end of transmission */
 #define ACK                     ((uint8_t)0x06)  /* acknowledge */
 #define NAK                     ((uint8_t)0x15)  /* negative acknowledge */
 #define CA                      ((uint32_t)0x18) /* two of these in succession aborts transfer */
 #define CRC16                   ((uint8_t)0x43)  /* 'C' == 0x43, request 16-bit CRC */
+#define CRC16_G                 ((uint8_t)0x47)  /* 'G' == 0x47, request Ymodem-G streaming */
+#define XACK                    ((uint8_t)0x57)  /* 'W' == 0x57, extended packets granted, size in KB follows */
 #define NEGATIVE_BYTE           ((uint8_t)0xFF)
 
 #define ABORT1                  ((uint8_t)0x41)  /* 'A' == 0x41, abort by user */
@@ -84,8 +102,119 @@ typedef enum
 #define DOWNLOAD_TIMEOUT        ((uint32_t)1000) /* One second retry delay */
 #define MAX_ERRORS              ((uint32_t)5)
 
+/* Adaptive retry timeout (RFC 6298 style) once a session has begun:
+ * RTO = SRTT + 4 * RTTVAR, clamped to [YMODEM_RTO_MIN, YMODEM_RTO_MAX],
+ * doubled on every timeout. RTT = our ACK sent -> first byte of the next
+ * packet; samples after a retry are not used (Karn). */
+#define YMODEM_RTO_MIN          ((uint32_t)100)  /* ms, floor */
+#define YMODEM_RTO_MAX          DOWNLOAD_TIMEOUT /* ms, ceiling and initial value */
+
+#define YMODEM_G_ENABLE         ((uint8_t)1)     /* Ask for Ymodem-G first (USB CDC is error checked) */
+#define YMODEM_G_HANDSHAKE_TRIES ((uint32_t)3)   /* 'G' requests before falling back to 'C' */
+
+/* Extended packets (opt-in, sender side):
+ *  - the file header carries "YMX:<payload size>" after the NUL that ends
+ *    the size field, e.g. "app.bin\0" "51200\0" "YMX:8192\0"
+ *  - the receiver answers ACK 'W' <n> then 'C'/'G': n KB payloads granted
+ *    (n*1024 <= requested, <= YMODEM_XBLK_MAX_SIZE); no 'W' means 1 KB only
+ *  - data packets are then STX_X, number, ~number, n*1024 bytes, CRC16;
+ *    SOH/STX packets stay valid (e.g. for the tail of the file)
+ * 4 KB / 8 KB match the 16/64/128 KB sectors and cut the per-packet header,
+ * CRC and ACK turnaround by 4-8x. Set YMODEM_XBLK_MAX_SIZE to 0 to disable. */
+#ifndef YMODEM_XBLK_MAX_SIZE
+#define YMODEM_XBLK_MAX_SIZE    (8192u)          /* plain constant, also used in #if */
+#endif
+#define YMODEM_XBLK_TOKEN       "YMX:"
+
+/* Compressed images (heatshrink, see heatshrink.h), decompressed on the fly
+ * between the packet buffer and the flash programming stage:
+ *  - file name ending in ".hs": W/L = YMODEM_HS_WINDOW_BITS/LOOKAHEAD_BITS
+ *    (heatshrink -e -w 10 -l 4 app.bin app.bin.hs)
+ *  - or "HS:<W>,<L>" in the file header after the size field, like "YMX:"
+ * The size in the header is the compressed size; the reported size is the
+ * decompressed one. RAM: 1 KB window + 2 x YMODEM_HS_OUT_SIZE. */
+#ifndef YMODEM_HS_ENABLE
+#define YMODEM_HS_ENABLE        1
+#endif
+#define YMODEM_HS_EXTENSION     ".hs"
+#define YMODEM_HS_TOKEN         "HS:"
+#define YMODEM_HS_WINDOW_BITS   ((uint8_t)10)
+#define YMODEM_HS_LOOKAHEAD_BITS ((uint8_t)4)
+#define YMODEM_HS_OUT_SIZE      ((uint32_t)1024) /* decompressed bytes per flash job */
+
+/* Delta update (see app_update.h): a file name ending in ".dlt" is a patch
+ * against the installed App1 image. It is applied into the Backup region,
+ * verified, and copied to App1 once the session has ended. ".dlt.hs" is a
+ * heatshrink compressed patch. */
+#define YMODEM_DELTA_EXTENSION  ".dlt"
+
+/* Sector-diff update (see app_update.h): ".mfs" is a chunk manifest, App1 is
+ * left alone and the bitmap of the chunks that differ is reported by
+ * Ymodem_GetManifest(). ".sdf" then carries only those chunks and is
+ * committed like a patch. Both can be heatshrink compressed (".hs"). */
+#define YMODEM_MANIFEST_EXTENSION ".mfs"
+#define YMODEM_SPARSE_EXTENSION ".sdf"
+
+/* Content of the received file */
+#define YMODEM_UPDATE_IMAGE     ((uint8_t)0)    /* raw image, written to App1 */
+#define YMODEM_UPDATE_DELTA     ((uint8_t)1)    /* delta patch */
+#define YMODEM_UPDATE_MANIFEST  ((uint8_t)2)    /* chunk manifest */
+#define YMODEM_UPDATE_SPARSE    ((uint8_t)3)    /* chunks requested by the manifest */
+
+/**
+  * @brief  Incremental (non-blocking) Ymodem receiver context
+  */
+typedef struct
+{
+  uint8_t  state;                         /* framing state */
+  uint8_t  pending;                       /* event waiting for Ymodem_RxAccept */
+  uint8_t  packets_received;              /* expected packet number */
+  uint8_t  session_begin;                 /* file header has been accepted */
+  uint8_t  streaming;                     /* Ymodem-G: no ACK per data packet */
+  uint8_t  handshake_tries;               /* 'G' sent without answer */
+  uint8_t  *p_packet;                     /* buffer being filled */
+  uint8_t  *p_spare;                      /* other ping-pong buffer */
+  uint32_t index;                         /* next write index in p_packet */
+  uint32_t packet_size;                   /* payload size of the current packet */
+  uint32_t errors;                        /* consecutive errors */
+  uint8_t  *p_data;                       /* payload of the last FILE/DATA event */
+  uint32_t length;                        /* payload length of the last FILE/DATA event */
+  uint32_t file_size;                     /* from the file header packet */
+  uint32_t xblk_request;                  /* extended payload asked for in the header, 0 = none */
+  uint32_t xblk_size;                     /* extended payload granted, 0 = SOH/STX only */
+  uint32_t hs_window_bits;                /* compressed image: heatshrink W, 0 = raw image */
+  uint32_t hs_lookahead_bits;             /* compressed image: heatshrink L */
+  uint8_t  update;                        /* YMODEM_UPDATE_xxx, from the file name */
+  uint8_t  file_name[FILE_NAME_LENGTH];   /* from the file header packet */
+  uint8_t  a_reply[6];                    /* ACK/NAK/'C'/'W'/CA bytes to send */
+  uint32_t reply_length;                  /* caller sends a_reply and clears it */
+} YMODEM_RxTypeDef;
+
+/**
+  * @brief  Link statistics of the last Ymodem_Receive session
+  */
+typedef struct
+{
+  uint32_t srtt_ms;                       /* smoothed round-trip time */
+  uint32_t rttvar_ms;                     /* round-trip time variation */
+  uint32_t rto_ms;                        /* current retry timeout */
+  uint32_t last_rtt_ms;                   /* last sample */
+  uint32_t rtt_samples;                   /* number of samples */
+  uint32_t packet_interval_ms;            /* smoothed time between data packets */
+  uint32_t packets;                       /* data packets accepted */
+  uint32_t timeouts;                      /* retry timeouts during the session */
+} YMODEM_StatsTypeDef;
+
 /* Exported functions ------------------------------------------------------- */
+void Ymodem_RxInit(YMODEM_RxTypeDef *p_rx, uint8_t *p_buf0, uint8_t *p_buf1);
+void Ymodem_RxSetStreaming(YMODEM_RxTypeDef *p_rx, uint8_t enable);
+YMODEM_EventTypeDef Ymodem_RxFeed(YMODEM_RxTypeDef *p_rx, const uint8_t *p_in, uint32_t length, uint32_t *p_used);
+YMODEM_EventTypeDef Ymodem_RxTimeout(YMODEM_RxTypeDef *p_rx);
+void Ymodem_RxAccept(YMODEM_RxTypeDef *p_rx, uint8_t accept);
 COM_StatusTypeDef Ymodem_Receive(uint32_t *p_size);
+void Ymodem_FlashPoll(void);
+const YMODEM_StatsTypeDef *Ymodem_GetStats(void);
+const uint8_t *Ymodem_GetManifest(uint32_t *p_chunks, uint32_t *p_needed);
 COM_StatusTypeDef Ymodem_Transmit(uint8_t *p_buf, const uint8_t *p_file_name, uint32_t file_size);
 
 #endif  /* __YMODEM_H_ */
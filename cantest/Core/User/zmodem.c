@@ -0,0 +1,931 @@
+/******************************************************************************
+ * @file    zmodem.c
+ * @brief   Zmodem style receiver: streaming/windowed frames, CRC-32, resume.
+ * @author  Jason
+ * @version V1.0.0
+ * @date    2025-3
+ * @copyright (c) 2025, All rights reserved.
+ ******************************************************************************/
+
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+#include "zmodem.h"
+#include "crc.h"
+#include "common.h"
+#include "flash_if.h"
+#include "iap_user.h"
+#include "kv_store.h"
+
+/* Private typedef -----------------------------------------------------------*/
+/* KV_KEY_RESUME: the file an IAP_DOWNING_BIN status belongs to */
+typedef struct
+{
+  uint32_t file_size;                     /* size from the ZFILE header */
+  uint32_t file_id;                       /* CRC-32 of the ZFILE name, size and mtime */
+} ZMODEM_ResumeTypeDef;
+
+/* Private define ------------------------------------------------------------*/
+/* Receive parser framing states */
+#define ZM_STATE_HUNT           ((uint8_t)0)  /* waiting for ZPAD */
+#define ZM_STATE_PAD            ((uint8_t)1)  /* ZPAD seen, waiting for ZDLE */
+#define ZM_STATE_FORMAT         ((uint8_t)2)  /* ZPAD ZDLE seen, waiting for A/B/C */
+#define ZM_STATE_BIN_HEADER     ((uint8_t)3)  /* collecting an escaped binary header */
+#define ZM_STATE_HEX_HEADER     ((uint8_t)4)  /* collecting hex digits */
+#define ZM_STATE_SUBPACKET      ((uint8_t)5)  /* collecting escaped subpacket data */
+#define ZM_STATE_SUBPACKET_CRC  ((uint8_t)6)  /* collecting the subpacket CRC */
+
+/* Zmodem_Unescape() results besides a data byte (0..255) */
+#define ZM_ESC_MORE             ((int32_t)-1) /* byte consumed, nothing decoded */
+#define ZM_ESC_ERROR            ((int32_t)-2) /* invalid escape sequence */
+#define ZM_ESC_FRAMEEND         ((int32_t)0x100) /* | ZCRCE/G/Q/W */
+
+#define ZM_CAN_ABORT_COUNT      ((uint8_t)5)  /* CAN*5 cancels the session */
+#define ZM_CANCEL_LENGTH        ((uint32_t)10)
+#define ZM_HEX_HEADER_LENGTH    ((uint32_t)21) /* ** ZDLE B + 14 hex + CR LF XON */
+#define XON                     ((uint8_t)0x11)
+#define XOFF                    ((uint8_t)0x13)
+#define BS                      ((uint8_t)0x08)
+
+/* Private macro -------------------------------------------------------------*/
+/* ZRINIT: ZF0 (= ZP3) capabilities, ZP0/ZP1 = 0 means no receive buffer limit */
+#define ZM_RINIT_FLAGS          ((uint32_t)(CANFDX | CANOVIO | CANFC32) << 24)
+#define ZM_CRC_SIZE(frame_type) (((frame_type) == ZBIN32) ? 4u : 2u)
+
+/* Private variables ---------------------------------------------------------*/
+static const uint8_t aHexDigits[] = "0123456789abcdef";
+/* subpacket buffer, one decoded data subpacket */
+__ALIGNED(4) static uint8_t aZmodemSubpacket[ZMODEM_SUBPACKET_SIZE];
+/* flash program buffer, collects subpackets into ZMODEM_FLASH_CHUNK blocks */
+__ALIGNED(4) static uint8_t aZmodemChunk[ZMODEM_FLASH_CHUNK];
+
+/* Private function prototypes -----------------------------------------------*/
+static void Zmodem_RxReplyHeader(ZMODEM_RxTypeDef *p_rx, uint8_t type, uint32_t position);
+static ZMODEM_EventTypeDef Zmodem_RxError(ZMODEM_RxTypeDef *p_rx);
+static int32_t Zmodem_Unescape(ZMODEM_RxTypeDef *p_rx, uint8_t c);
+static ZMODEM_EventTypeDef Zmodem_RxHeader(ZMODEM_RxTypeDef *p_rx);
+static ZMODEM_EventTypeDef Zmodem_RxSubpacket(ZMODEM_RxTypeDef *p_rx);
+static ZMODEM_EventTypeDef Zmodem_RxByte(ZMODEM_RxTypeDef *p_rx, uint8_t c);
+static uint32_t Zmodem_ProgrammedLength(uint32_t file_size);
+static COM_StatusTypeDef Zmodem_PrepareFlash(uint32_t file_size, uint32_t file_id, uint32_t *p_offset);
+static void Zmodem_SetStatus(eIAP_Status_Def status, uint32_t file_size, uint32_t file_id);
+static uint8_t Zmodem_IsResumable(uint32_t file_size, uint32_t file_id);
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Queue a hex header (the receiver always answers with hex headers)
+  * @param  p_rx: receiver context
+  * @param  type: frame type
+  * @param  position: ZP0..ZP3 (little endian position or flags)
+  * @retval None
+  */
+static void Zmodem_RxReplyHeader(ZMODEM_RxTypeDef *p_rx, uint8_t type, uint32_t position)
+{
+  uint8_t header[ZMODEM_HEADER_SIZE + 2];
+  uint8_t *p_out;
+  uint16_t crc;
+  uint32_t i;
+
+  if ((p_rx->reply_length + ZM_HEX_HEADER_LENGTH) > ZMODEM_REPLY_SIZE)
+  {
+    return;
+  }
+
+  header[0] = type;
+  header[1] = (uint8_t)position;
+  header[2] = (uint8_t)(position >> 8);
+  header[3] = (uint8_t)(position >> 16);
+  header[4] = (uint8_t)(position >> 24);
+  crc = Crc16_Calc(header, ZMODEM_HEADER_SIZE);
+  header[5] = (uint8_t)(crc >> 8);
+  header[6] = (uint8_t)crc;
+
+  p_out = &p_rx->a_reply[p_rx->reply_length];
+  *p_out++ = ZPAD;
+  *p_out++ = ZPAD;
+  *p_out++ = ZDLE;
+  *p_out++ = ZHEX;
+  for (i = 0; i < sizeof(header); i++)
+  {
+    *p_out++ = aHexDigits[header[i] >> 4];
+    *p_out++ = aHexDigits[header[i] & 0x0F];
+  }
+  *p_out++ = '\r';
+  *p_out++ = 0x8A;  /* LF with parity bit, as sent by rz */
+  if ((type != ZFIN) && (type != ZACK))
+  {
+    *p_out++ = XON;
+  }
+  p_rx->reply_length = p_out - p_rx->a_reply;
+}
+
+/**
+  * @brief  Garbled frame: ask for a resend from the last good position
+  * @note   After ZRPOS everything up to the next header is dropped, so the
+  *         cost of an error is the data the sender already had in flight.
+  * @param  p_rx: receiver context
+  * @retval ZMODEM_EVT_ERROR after ZMODEM_MAX_ERRORS, else ZMODEM_EVT_NONE
+  */
+static ZMODEM_EventTypeDef Zmodem_RxError(ZMODEM_RxTypeDef *p_rx)
+{
+  p_rx->state = ZM_STATE_HUNT;
+  p_rx->escape = 0;
+
+  if (++p_rx->errors > ZMODEM_MAX_ERRORS)
+  {
+    Zmodem_RxCancel(p_rx);
+    return ZMODEM_EVT_ERROR;
+  }
+  if (p_rx->file_open != 0)
+  {
+    Zmodem_RxReplyHeader(p_rx, ZRPOS, p_rx->position);
+  }
+  else
+  {
+    Zmodem_RxReplyHeader(p_rx, ZNAK, 0);
+  }
+  return ZMODEM_EVT_NONE;
+}
+
+/**
+  * @brief  ZDLE decoding of binary headers, subpackets and CRCs
+  * @param  p_rx: receiver context
+  * @param  c: received byte
+  * @retval data byte, ZM_ESC_FRAMEEND | ZCRCx, ZM_ESC_MORE or ZM_ESC_ERROR
+  */
+static int32_t Zmodem_Unescape(ZMODEM_RxTypeDef *p_rx, uint8_t c)
+{
+  if (p_rx->escape != 0)
+  {
+    p_rx->escape = 0;
+    switch (c)
+    {
+      case ZCRCE:
+      case ZCRCG:
+      case ZCRCQ:
+      case ZCRCW:
+        return ZM_ESC_FRAMEEND | c;
+      case ZRUB0:
+        return 0x7F;
+      case ZRUB1:
+        return 0xFF;
+      default:
+        if ((c & 0x60) == 0x40)
+        {
+          return c ^ 0x40;
+        }
+        return ZM_ESC_ERROR;
+    }
+  }
+
+  if (c == ZDLE)
+  {
+    p_rx->escape = 1;
+    return ZM_ESC_MORE;
+  }
+  if (((c & 0x7F) == XON) || ((c & 0x7F) == XOFF))
+  {
+    /* flow control noise, real XON/XOFF data bytes are escaped */
+    return ZM_ESC_MORE;
+  }
+  return c;
+}
+
+/**
+  * @brief  A header with a good CRC has been received
+  * @param  p_rx: receiver context
+  * @retval event
+  */
+static ZMODEM_EventTypeDef Zmodem_RxHeader(ZMODEM_RxTypeDef *p_rx)
+{
+  uint32_t position;
+
+  position = (uint32_t)p_rx->header[1] | ((uint32_t)p_rx->header[2] << 8) |
+             ((uint32_t)p_rx->header[3] << 16) | ((uint32_t)p_rx->header[4] << 24);
+  p_rx->state = ZM_STATE_HUNT;
+  p_rx->session_begin = 1;
+
+  switch (p_rx->header[0])
+  {
+    case ZRQINIT:
+      Zmodem_RxReplyHeader(p_rx, ZRINIT, ZM_RINIT_FLAGS);
+      break;
+
+    case ZSINIT:
+    case ZFILE:
+      p_rx->state = ZM_STATE_SUBPACKET;
+      p_rx->index = 0;
+      break;
+
+    case ZDATA:
+      if (p_rx->file_open == 0)
+      {
+        break;
+      }
+      if (position != p_rx->position)
+      {
+        /* data from before the last ZRPOS, still in flight */
+        return Zmodem_RxError(p_rx);
+      }
+      p_rx->state = ZM_STATE_SUBPACKET;
+      p_rx->index = 0;
+      break;
+
+    case ZEOF:
+      /* a ZEOF at another offset belongs to data we asked to be resent */
+      if ((p_rx->file_open != 0) && (position == p_rx->position))
+      {
+        p_rx->file_open = 0;
+        p_rx->errors = 0;
+        Zmodem_RxReplyHeader(p_rx, ZRINIT, ZM_RINIT_FLAGS);
+        return ZMODEM_EVT_EOF;
+      }
+      break;
+
+    case ZFIN:
+      Zmodem_RxReplyHeader(p_rx, ZFIN, 0);
+      return ZMODEM_EVT_END;
+
+    case ZNAK:
+      /* our last header was garbled */
+      if (p_rx->file_open != 0)
+      {
+        Zmodem_RxReplyHeader(p_rx, ZRPOS, p_rx->position);
+      }
+      else
+      {
+        Zmodem_RxReplyHeader(p_rx, ZRINIT, ZM_RINIT_FLAGS);
+      }
+      break;
+
+    case ZCHALLENGE:
+      Zmodem_RxReplyHeader(p_rx, ZACK, position);
+      break;
+
+    case ZABORT:
+    case ZFERR:
+    case ZCAN:
+      Zmodem_RxReplyHeader(p_rx, ZFIN, 0);
+      return ZMODEM_EVT_ABORT;
+
+    default:
+      /* ZCOMMAND, ZFREECNT ... are not supported, ignore */
+      break;
+  }
+  return ZMODEM_EVT_NONE;
+}
+
+/**
+  * @brief  A subpacket with a good CRC has been received
+  * @param  p_rx: receiver context
+  * @retval event
+  */
+static ZMODEM_EventTypeDef Zmodem_RxSubpacket(ZMODEM_RxTypeDef *p_rx)
+{
+  uint8_t *p_field;
+  uint32_t size = 0;
+
+  p_rx->errors = 0;
+  p_rx->index = 0;
+  if ((p_rx->subpacket_end == ZCRCE) || (p_rx->subpacket_end == ZCRCW))
+  {
+    p_rx->state = ZM_STATE_HUNT;
+  }
+  else
+  {
+    p_rx->state = ZM_STATE_SUBPACKET;
+  }
+
+  switch (p_rx->header[0])
+  {
+    case ZDATA:
+      p_rx->p_data = p_rx->p_buffer;
+      p_rx->data_position = p_rx->position;
+      p_rx->position += p_rx->length;
+      if ((p_rx->subpacket_end == ZCRCQ) || (p_rx->subpacket_end == ZCRCW))
+      {
+        /* window acknowledge */
+        Zmodem_RxReplyHeader(p_rx, ZACK, p_rx->position);
+      }
+      /* caller uses p_data/length before feeding more bytes */
+      return ZMODEM_EVT_DATA;
+
+    case ZFILE:
+      p_rx->state = ZM_STATE_HUNT;
+      if (p_rx->length >= ZMODEM_SUBPACKET_SIZE)
+      {
+        p_rx->length = ZMODEM_SUBPACKET_SIZE - 1;
+      }
+      p_rx->p_buffer[p_rx->length] = '\0';
+      /* "name\0size mtime mode ..." */
+      strncpy((char *)p_rx->file_name, (char *)p_rx->p_buffer, FILE_NAME_LENGTH - 1);
+      p_rx->file_name[FILE_NAME_LENGTH - 1] = '\0';
+      p_field = p_rx->p_buffer + strlen((char *)p_rx->p_buffer) + 1;
+      while ((p_field < (p_rx->p_buffer + p_rx->length)) && (*p_field >= '0') && (*p_field <= '9'))
+      {
+        size = (size * 10) + (*p_field++ - '0');
+      }
+      p_rx->file_size = size;
+      /* mtime (octal) follows the size; name + size + mtime identify the file */
+      if ((p_field < (p_rx->p_buffer + p_rx->length)) && (*p_field == ' '))
+      {
+        p_field++;
+        while ((p_field < (p_rx->p_buffer + p_rx->length)) && (*p_field >= '0') && (*p_field <= '7'))
+        {
+          p_field++;
+        }
+      }
+      p_rx->file_id = Crc32_Calc(p_rx->p_buffer, (uint32_t)(p_field - p_rx->p_buffer));
+      return ZMODEM_EVT_FILE;
+
+    case ZSINIT:
+      /* Attn sequence is not used, just acknowledge */
+      p_rx->state = ZM_STATE_HUNT;
+      Zmodem_RxReplyHeader(p_rx, ZACK, 1);
+      break;
+
+    default:
+      break;
+  }
+  return ZMODEM_EVT_NONE;
+}
+
+/**
+  * @brief  Run the framing state machine on one byte
+  * @param  p_rx: receiver context
+  * @param  c: received byte
+  * @retval event
+  */
+static ZMODEM_EventTypeDef Zmodem_RxByte(ZMODEM_RxTypeDef *p_rx, uint8_t c)
+{
+  int32_t value;
+  uint32_t crc_size = ZM_CRC_SIZE(p_rx->frame_type);
+
+  /* CAN*5 cancels in any state (never valid inside escaped data) */
+  if (c == ZDLE)
+  {
+    if (++p_rx->can_count >= ZM_CAN_ABORT_COUNT)
+    {
+      p_rx->state = ZM_STATE_HUNT;
+      p_rx->can_count = 0;
+      return ZMODEM_EVT_ABORT;
+    }
+  }
+  else
+  {
+    p_rx->can_count = 0;
+  }
+
+  switch (p_rx->state)
+  {
+    case ZM_STATE_HUNT:
+      if (c == ZPAD)
+      {
+        p_rx->state = ZM_STATE_PAD;
+      }
+      else if ((p_rx->session_begin == 0) && ((c == ABORT1) || (c == ABORT2)))
+      {
+        return ZMODEM_EVT_USER_ABORT;
+      }
+      break;
+
+    case ZM_STATE_PAD:
+      if (c == ZDLE)
+      {
+        p_rx->state = ZM_STATE_FORMAT;
+      }
+      else if (c != ZPAD)
+      {
+        p_rx->state = ZM_STATE_HUNT;
+      }
+      break;
+
+    case ZM_STATE_FORMAT:
+      p_rx->index = 0;
+      p_rx->escape = 0;
+      if ((c == ZBIN) || (c == ZBIN32))
+      {
+        p_rx->frame_type = c;
+        p_rx->state = ZM_STATE_BIN_HEADER;
+      }
+      else if (c == ZHEX)
+      {
+        p_rx->frame_type = c;
+        p_rx->state = ZM_STATE_HEX_HEADER;
+      }
+      else
+      {
+        p_rx->state = ZM_STATE_HUNT;
+      }
+      break;
+
+    case ZM_STATE_BIN_HEADER:
+      value = Zmodem_Unescape(p_rx, c);
+      if (value == ZM_ESC_MORE)
+      {
+        break;
+      }
+      if ((value < 0) || (value > 0xFF))
+      {
+        return Zmodem_RxError(p_rx);
+      }
+      p_rx->header[p_rx->index++] = (uint8_t)value;
+      if (p_rx->index == (ZMODEM_HEADER_SIZE + crc_size))
+      {
+        if (((crc_size == 4) && (Crc32_Update(CRC32_INIT_VALUE, p_rx->header, ZMODEM_HEADER_SIZE + 4) != CRC32_RESIDUE)) ||
+            ((crc_size == 2) && (Crc16_Calc(p_rx->header, ZMODEM_HEADER_SIZE + 2) != 0)))
+        {
+          return Zmodem_RxError(p_rx);
+        }
+        return Zmodem_RxHeader(p_rx);
+      }
+      break;
+
+    case ZM_STATE_HEX_HEADER:
+      if (!ISVALIDHEX(c))
+      {
+        return Zmodem_RxError(p_rx);
+      }
+      value = CONVERTHEX(c);
+      if ((p_rx->index & 1) == 0)
+      {
+        p_rx->header[p_rx->index >> 1] = (uint8_t)(value << 4);
+      }
+      else
+      {
+        p_rx->header[p_rx->index >> 1] |= (uint8_t)value;
+      }
+      if (++p_rx->index == ((ZMODEM_HEADER_SIZE + 2) * 2))
+      {
+        if (Crc16_Calc(p_rx->header, ZMODEM_HEADER_SIZE + 2) != 0)
+        {
+          return Zmodem_RxError(p_rx);
+        }
+        return Zmodem_RxHeader(p_rx);
+      }
+      break;
+
+    case ZM_STATE_SUBPACKET:
+      value = Zmodem_Unescape(p_rx, c);
+      if (value == ZM_ESC_MORE)
+      {
+        break;
+      }
+      if (value == ZM_ESC_ERROR)
+      {
+        return Zmodem_RxError(p_rx);
+      }
+      if (value > 0xFF)
+      {
+        p_rx->subpacket_end = (uint8_t)value;
+        p_rx->length = p_rx->index;
+        p_rx->index = 0;
+        p_rx->state = ZM_STATE_SUBPACKET_CRC;
+      }
+      else if (p_rx->index >= ZMODEM_SUBPACKET_SIZE)
+      {
+        return Zmodem_RxError(p_rx);
+      }
+      else
+      {
+        p_rx->p_buffer[p_rx->index++] = (uint8_t)value;
+      }
+      break;
+
+    case ZM_STATE_SUBPACKET_CRC:
+      value = Zmodem_Unescape(p_rx, c);
+      if (value == ZM_ESC_MORE)
+      {
+        break;
+      }
+      if ((value < 0) || (value > 0xFF))
+      {
+        return Zmodem_RxError(p_rx);
+      }
+      p_rx->a_crc[p_rx->index++] = (uint8_t)value;
+      if (p_rx->index == crc_size)
+      {
+        /* the CRC covers the data and the ZCRCx end byte */
+        if (crc_size == 4)
+        {
+          uint32_t crc32 = Crc32_Update(CRC32_INIT_VALUE, p_rx->p_buffer, p_rx->length);
+          crc32 = Crc32_Update(crc32, &p_rx->subpacket_end, 1);
+          if (Crc32_Update(crc32, p_rx->a_crc, 4) != CRC32_RESIDUE)
+          {
+            return Zmodem_RxError(p_rx);
+          }
+        }
+        else
+        {
+          uint16_t crc16 = Crc16_Update(CRC16_INIT_VALUE, p_rx->p_buffer, p_rx->length);
+          crc16 = Crc16_Update(crc16, &p_rx->subpacket_end, 1);
+          if (Crc16_Update(crc16, p_rx->a_crc, 2) != 0)
+          {
+            return Zmodem_RxError(p_rx);
+          }
+        }
+        return Zmodem_RxSubpacket(p_rx);
+      }
+      break;
+
+    default:
+      p_rx->state = ZM_STATE_HUNT;
+      break;
+  }
+  return ZMODEM_EVT_NONE;
+}
+
+/**
+  * @brief  Bytes of the interrupted download that are already in flash
+  * @note   Scans back from the end of the image for the last programmed word
+  *         and rounds down to ZMODEM_FLASH_CHUNK. The last chunk is written
+  *         again; programming a word with the value it already holds is fine.
+  * @param  file_size: image size recorded when the download started
+  * @retval resume offset (multiple of ZMODEM_FLASH_CHUNK)
+  */
+static uint32_t Zmodem_ProgrammedLength(uint32_t file_size)
+{
+  uint32_t offset = (file_size + 3) & ~(uint32_t)3;
+
+  while (offset > 0)
+  {
+    offset -= 4;
+    if (*(__IO uint32_t *)(APPLICATION_ADDRESS + offset) != 0xFFFFFFFF)
+    {
+      return offset - (offset % ZMODEM_FLASH_CHUNK);
+    }
+  }
+  return 0;
+}
+
+/**
+  * @brief  Record the download state in the status area
+  * @note   The ZFILE identity goes to its own key (KV_KEY_RESUME), written
+  *         before the status so IAP_DOWNING_BIN never refers to an older file.
+  *         Any other status drops it.
+  * @param  status: IAP_DOWNING_BIN or IAP_NO_APP
+  * @param  file_size: image size
+  * @param  file_id: ZFILE identity (IAP_DOWNING_BIN only)
+  * @retval None
+  */
+static void Zmodem_SetStatus(eIAP_Status_Def status, uint32_t file_size, uint32_t file_id)
+{
+  save_data_t rw_data;
+  ZMODEM_ResumeTypeDef resume;
+
+  if (status == IAP_DOWNING_BIN)
+  {
+    resume.file_size = file_size;
+    resume.file_id = file_id;
+    (void)KV_Set(KV_KEY_RESUME, &resume, sizeof(resume));
+  }
+  else
+  {
+    (void)KV_Delete(KV_KEY_RESUME);
+  }
+
+  if (EL_FIND_SUCCESS != read_iap_status(&rw_data))
+  {
+    rw_data.iap_msg.version = 1;
+  }
+  rw_data.header = HEADER;
+  rw_data.iap_msg.status = status;
+  rw_data.iap_msg.transmitMethod = TRANSMIT_METHOD_USB;
+  rw_data.iap_msg.size = file_size;
+  rw_data.ender = ENDER;
+  write_iap_status(&rw_data);
+  commit_iap_status();          /* before the erase / at the end of the download */
+}
+
+/**
+  * @brief  Check that the interrupted download was this file
+  * @param  file_size: size from the ZFILE header
+  * @param  file_id: CRC-32 of the ZFILE name, size and mtime
+  * @retval 1 the status is IAP_DOWNING_BIN and KV_KEY_RESUME matches, 0 otherwise
+  */
+static uint8_t Zmodem_IsResumable(uint32_t file_size, uint32_t file_id)
+{
+  save_data_t rw_data;
+  ZMODEM_ResumeTypeDef resume;
+  uint16_t length = 0;
+
+  if ((EL_FIND_SUCCESS != read_iap_status(&rw_data)) ||
+      (IAP_DOWNING_BIN != rw_data.iap_msg.status) ||
+      (file_size != rw_data.iap_msg.size))
+  {
+    return 0;
+  }
+  if ((KV_Get(KV_KEY_RESUME, &resume, sizeof(resume), &length) != HAL_OK) ||
+      (length != sizeof(resume)))
+  {
+    return 0;
+  }
+  return ((resume.file_size == file_size) && (resume.file_id == file_id)) ? 1 : 0;
+}
+
+/**
+  * @brief  Decide where the download starts
+  * @note   Same file as the interrupted download (size and ZFILE identity
+  *         match): keep what is programmed and resume. Any other file, even
+  *         of the same size, erases the sectors it needs and starts at 0.
+  * @param  file_size: size from the ZFILE header
+  * @param  file_id: CRC-32 of the ZFILE name, size and mtime
+  * @param  p_offset: resume offset
+  * @retval COM_OK or COM_ERROR (erase failed)
+  */
+static COM_StatusTypeDef Zmodem_PrepareFlash(uint32_t file_size, uint32_t file_id, uint32_t *p_offset)
+{
+  *p_offset = 0;
+  if (Zmodem_IsResumable(file_size, file_id))
+  {
+    *p_offset = Zmodem_ProgrammedLength(file_size);
+  }
+
+  if (*p_offset == 0)
+  {
+    if (FLASH_If_Erase_Range(APPLICATION_ADDRESS, (file_size != 0) ? file_size : USER_FLASH_SIZE) != HAL_OK)
+    {
+      return COM_ERROR;
+    }
+    Zmodem_SetStatus(IAP_DOWNING_BIN, file_size, file_id);
+  }
+  return COM_OK;
+}
+
+/**
+  * @brief  Initialize the incremental receiver and queue the first ZRINIT
+  * @param  p_rx: receiver context
+  * @param  p_buffer: subpacket buffer of ZMODEM_SUBPACKET_SIZE bytes
+  * @retval None
+  */
+void Zmodem_RxInit(ZMODEM_RxTypeDef *p_rx, uint8_t *p_buffer)
+{
+  memset(p_rx, 0, sizeof(ZMODEM_RxTypeDef));
+  p_rx->state = ZM_STATE_HUNT;
+  p_rx->p_buffer = p_buffer;
+  /* ZP0/ZP1 = 0: no receive buffer limit, the sender may stream; the
+     sender's window is paced by ZACKs to ZCRCQ/ZCRCW subpackets */
+  Zmodem_RxReplyHeader(p_rx, ZRINIT, ZM_RINIT_FLAGS);
+}
+
+/**
+  * @brief  Feed received bytes to the receiver
+  * @note   Stops at the first event; the bytes not used must be fed again.
+  *         After an event the caller sends a_reply (if any) and clears
+  *         reply_length.
+  * @param  p_rx: receiver context
+  * @param  p_in: received bytes
+  * @param  length: number of bytes in p_in
+  * @param  p_used: number of bytes consumed
+  * @retval event
+  */
+ZMODEM_EventTypeDef Zmodem_RxFeed(ZMODEM_RxTypeDef *p_rx, const uint8_t *p_in, uint32_t length, uint32_t *p_used)
+{
+  ZMODEM_EventTypeDef event = ZMODEM_EVT_NONE;
+  uint32_t i;
+
+  for (i = 0; (i < length) && (event == ZMODEM_EVT_NONE); i++)
+  {
+    event = Zmodem_RxByte(p_rx, p_in[i]);
+  }
+  *p_used = i;
+  return event;
+}
+
+/**
+  * @brief  Nothing received for a while
+  * @note   Before the session begins ZRINIT is repeated without counting
+  *         errors (the user is still choosing the file).
+  * @param  p_rx: receiver context
+  * @retval ZMODEM_EVT_ERROR after ZMODEM_MAX_ERRORS, else ZMODEM_EVT_NONE
+  */
+ZMODEM_EventTypeDef Zmodem_RxTimeout(ZMODEM_RxTypeDef *p_rx)
+{
+  if (p_rx->session_begin == 0)
+  {
+    Zmodem_RxReplyHeader(p_rx, ZRINIT, ZM_RINIT_FLAGS);
+    return ZMODEM_EVT_NONE;
+  }
+  if ((p_rx->file_open == 0) && (p_rx->state == ZM_STATE_HUNT))
+  {
+    /* between files: ask again for the next header */
+    if (++p_rx->errors > ZMODEM_MAX_ERRORS)
+    {
+      Zmodem_RxCancel(p_rx);
+      return ZMODEM_EVT_ERROR;
+    }
+    Zmodem_RxReplyHeader(p_rx, ZRINIT, ZM_RINIT_FLAGS);
+    return ZMODEM_EVT_NONE;
+  }
+  return Zmodem_RxError(p_rx);
+}
+
+/**
+  * @brief  Answer a ZFILE event: receive the file starting at offset
+  * @param  p_rx: receiver context
+  * @param  offset: resume offset, 0 for a complete download
+  * @retval None
+  */
+void Zmodem_RxAccept(ZMODEM_RxTypeDef *p_rx, uint32_t offset)
+{
+  p_rx->position = offset;
+  p_rx->file_open = 1;
+  Zmodem_RxReplyHeader(p_rx, ZRPOS, offset);
+}
+
+/**
+  * @brief  Answer a ZFILE event: do not receive this file
+  * @param  p_rx: receiver context
+  * @retval None
+  */
+void Zmodem_RxSkip(ZMODEM_RxTypeDef *p_rx)
+{
+  p_rx->file_open = 0;
+  Zmodem_RxReplyHeader(p_rx, ZSKIP, 0);
+}
+
+/**
+  * @brief  Cancel the session (CAN*10 followed by backspaces, as rz does)
+  * @param  p_rx: receiver context
+  * @retval None
+  */
+void Zmodem_RxCancel(ZMODEM_RxTypeDef *p_rx)
+{
+  memset(p_rx->a_reply, ZDLE, ZM_CANCEL_LENGTH);
+  memset(&p_rx->a_reply[ZM_CANCEL_LENGTH], BS, ZM_CANCEL_LENGTH);
+  p_rx->reply_length = 2 * ZM_CANCEL_LENGTH;
+  p_rx->file_open = 0;
+  p_rx->state = ZM_STATE_HUNT;
+}
+
+/**
+  * @brief  Receive a file using the Zmodem protocol, resuming an interrupted
+  *         download of the same image when possible.
+  * @param  p_size The size of the file.
+  * @retval COM_StatusTypeDef result of reception/programming
+  */
+COM_StatusTypeDef Zmodem_Receive(uint32_t *p_size)
+{
+  ZMODEM_RxTypeDef rx;
+  ZMODEM_EventTypeDef event;
+  COM_StatusTypeDef result = COM_OK;
+  uint32_t used, offset, chunk_offset = 0, chunk_fill = 0;
+  uint32_t flash_status = FLASHIF_OK;
+  uint8_t c, session_done = 0, file_done = 0;
+
+  Zmodem_RxInit(&rx, aZmodemSubpacket);
+  /* flash stays unlocked for the whole transfer */
+  if (FLASH_If_Open() != HAL_OK)
+  {
+    return COM_ERROR;
+  }
+
+  while (session_done == 0)
+  {
+    if (rx.reply_length != 0)
+    {
+      iapInterface.TransmitFunction(rx.a_reply, rx.reply_length, NAK_TIMEOUT);
+      rx.reply_length = 0;
+    }
+
+    if (iapInterface.ReceiveFunction(&c, 1, DOWNLOAD_TIMEOUT) != HAL_OK)
+    {
+      event = Zmodem_RxTimeout(&rx);
+    }
+    else
+    {
+      event = Zmodem_RxFeed(&rx, &c, 1, &used);
+    }
+
+    switch (event)
+    {
+      case ZMODEM_EVT_FILE:
+        if (file_done != 0)
+        {
+          /* one image per session */
+          Zmodem_RxSkip(&rx);
+        }
+        else if (rx.file_size > USER_FLASH_SIZE)
+        {
+          Zmodem_RxCancel(&rx);
+          result = COM_LIMIT;
+          session_done = 1;
+        }
+        else if (Zmodem_PrepareFlash(rx.file_size, rx.file_id, &offset) != COM_OK)
+        {
+          Zmodem_RxCancel(&rx);
+          result = COM_ERROR;
+          session_done = 1;
+        }
+        else
+        {
+          memcpy(aFileName, rx.file_name, FILE_NAME_LENGTH);
+          chunk_offset = offset;
+          chunk_fill = 0;
+          Zmodem_RxAccept(&rx, offset);
+        }
+        break;
+
+      case ZMODEM_EVT_DATA:
+        /* subpackets arrive in order, collect them into flash chunks */
+        if ((rx.data_position + rx.length) > USER_FLASH_SIZE)
+        {
+          Zmodem_RxCancel(&rx);
+          result = COM_LIMIT;
+          session_done = 1;
+          break;
+        }
+        used = 0;
+        while ((used < rx.length) && (flash_status == FLASHIF_OK))
+        {
+          offset = ZMODEM_FLASH_CHUNK - chunk_fill;
+          if (offset > (rx.length - used))
+          {
+            offset = rx.length - used;
+          }
+          memcpy(&aZmodemChunk[chunk_fill], &rx.p_data[used], offset);
+          chunk_fill += offset;
+          used += offset;
+          if (chunk_fill == ZMODEM_FLASH_CHUNK)
+          {
+            flash_status = FLASH_If_Write(APPLICATION_ADDRESS + chunk_offset,
+                                          (uint32_t *)aZmodemChunk, ZMODEM_FLASH_CHUNK / 4);
+            chunk_offset += ZMODEM_FLASH_CHUNK;
+            chunk_fill = 0;
+          }
+        }
+        if (flash_status != FLASHIF_OK)
+        {
+          Zmodem_RxCancel(&rx);
+          result = COM_DATA;
+          session_done = 1;
+        }
+        break;
+
+      case ZMODEM_EVT_EOF:
+        if (chunk_fill != 0)
+        {
+          /* pad the tail to a whole word */
+          memset(&aZmodemChunk[chunk_fill], 0xFF, (4u - (chunk_fill & 3u)) & 3u);
+          flash_status = FLASH_If_Write(APPLICATION_ADDRESS + chunk_offset,
+                                        (uint32_t *)aZmodemChunk, (chunk_fill + 3) / 4);
+          chunk_fill = 0;
+        }
+        if (flash_status != FLASHIF_OK)
+        {
+          Zmodem_RxCancel(&rx);
+          result = COM_DATA;
+          session_done = 1;
+        }
+        else
+        {
+          *p_size = rx.position;
+          file_done = 1;
+        }
+        break;
+
+      case ZMODEM_EVT_END:
+        result = (file_done != 0) ? COM_OK : COM_ABORT;
+        session_done = 1;
+        break;
+
+      case ZMODEM_EVT_ABORT:
+      case ZMODEM_EVT_USER_ABORT:
+        result = COM_ABORT;
+        session_done = 1;
+        break;
+
+      case ZMODEM_EVT_ERROR:
+        result = COM_ERROR;
+        session_done = 1;
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  if (rx.reply_length != 0)
+  {
+    iapInterface.TransmitFunction(rx.a_reply, rx.reply_length, NAK_TIMEOUT);
+    rx.reply_length = 0;
+  }
+  if (event == ZMODEM_EVT_END)
+  {
+    /* drop the sender's "OO" (over and out) so it is not taken as a menu key */
+    iapInterface.ReceiveFunction(rx.a_crc, 2, DOWNLOAD_TIMEOUT);
+  }
+  if (result == COM_DATA)
+  {
+    /* flash content cannot be trusted, next download starts from scratch */
+    Zmodem_SetStatus(IAP_NO_APP, 0, 0);
+  }
+  else if (result == COM_OK)
+  {
+    (void)KV_Delete(KV_KEY_RESUME);     /* image complete, the caller records IAP_APP_DONE */
+  }
+  FLASH_If_Close();
+  return result;
+}
+
+/************************ (C) COPYRIGHT Jason *****END OF FILE****/
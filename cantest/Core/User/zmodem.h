@@ -0,0 +1,137 @@
+/******************************************************************************
+ * @file    zmodem.h
+ * @brief   Zmodem style receiver: streaming/windowed frames, CRC-32, resume.
+ * @author  Jason
+ * @version V1.0.0
+ * @date    2025-3
+ * @copyright (c) 2025, All rights reserved.
+ ******************************************************************************/
+
+#ifndef __ZMODEM_H
+#define __ZMODEM_H
+
+/* Private Includes ----------------------------------------------------------*/
+#include <stdint.h>
+#include "ymodem.h"
+
+/**
+ * 与 Ymodem 的区别：
+ *  - 发送端连续发送数据子包，不等每包应答；接收端只在 ZCRCQ/ZCRCW 子包后回 ZACK，
+ *    发送端据此维持一个滑动窗口（lrzsz 的 sz -w / TeraTerm 都支持）。
+ *  - 出错时接收端回 ZRPOS(已接收的字节偏移)，发送端从该位置重发，
+ *    重传代价最多是一个窗口，而不是整个文件。
+ *  - ZFILE 后接收端用 ZRPOS 告诉发送端从哪里开始，用来做断点续传：
+ *    状态区记录 IAP_DOWNING_BIN + 文件大小，再次下载同样大小的文件时，
+ *    根据 flash 中已经写入的内容计算续传位置，不再擦除整个 App 区。
+ *
+ * 只实现接收端需要的帧：ZRQINIT ZSINIT ZFILE ZDATA ZEOF ZFIN ZNAK ZCHALLENGE。
+ * 接收端始终发送 hex 头，数据帧支持 ZBIN (CRC16) 和 ZBIN32 (CRC-32)。
+ */
+/* Exported constants --------------------------------------------------------*/
+#define ZPAD                    ((uint8_t)'*')   /* pad character, begins frames */
+#define ZDLE                    ((uint8_t)0x18)  /* ctrl-X, Zmodem escape */
+#define ZDLEE                   ((uint8_t)(ZDLE ^ 0x40))
+#define ZBIN                    ((uint8_t)'A')   /* binary frame, CRC16 */
+#define ZHEX                    ((uint8_t)'B')   /* hex frame, CRC16 */
+#define ZBIN32                  ((uint8_t)'C')   /* binary frame, CRC-32 */
+
+/* Frame types */
+#define ZRQINIT                 ((uint8_t)0)     /* request receive init */
+#define ZRINIT                  ((uint8_t)1)     /* receive init */
+#define ZSINIT                  ((uint8_t)2)     /* send init sequence (optional) */
+#define ZACK                    ((uint8_t)3)     /* ACK to above */
+#define ZFILE                   ((uint8_t)4)     /* file name from sender */
+#define ZSKIP                   ((uint8_t)5)     /* to sender: skip this file */
+#define ZNAK                    ((uint8_t)6)     /* last packet was garbled */
+#define ZABORT                  ((uint8_t)7)     /* abort batch transfers */
+#define ZFIN                    ((uint8_t)8)     /* finish session */
+#define ZRPOS                   ((uint8_t)9)     /* resume data trans at this position */
+#define ZDATA                   ((uint8_t)10)    /* data packet(s) follow */
+#define ZEOF                    ((uint8_t)11)    /* end of file */
+#define ZFERR                   ((uint8_t)12)    /* fatal read or write error detected */
+#define ZCRC                    ((uint8_t)13)    /* request for file CRC and response */
+#define ZCHALLENGE              ((uint8_t)14)    /* receiver's challenge */
+#define ZCOMPL                  ((uint8_t)15)    /* request is complete */
+#define ZCAN                    ((uint8_t)16)    /* other end canned session with CAN*5 */
+#define ZFREECNT                ((uint8_t)17)    /* request for free bytes on filesystem */
+#define ZCOMMAND                ((uint8_t)18)    /* command from sending program */
+
+/* ZDLE sequences */
+#define ZCRCE                   ((uint8_t)'h')   /* CRC next, frame ends, header packet follows */
+#define ZCRCG                   ((uint8_t)'i')   /* CRC next, frame continues nonstop */
+#define ZCRCQ                   ((uint8_t)'j')   /* CRC next, frame continues, ZACK expected */
+#define ZCRCW                   ((uint8_t)'k')   /* CRC next, ZACK expected, end of frame */
+#define ZRUB0                   ((uint8_t)'l')   /* translate to rubout 0177 */
+#define ZRUB1                   ((uint8_t)'m')   /* translate to rubout 0377 */
+
+/* ZRINIT ZF0 capabilities */
+#define CANFDX                  ((uint8_t)0x01)  /* rx can send and receive true FDX */
+#define CANOVIO                 ((uint8_t)0x02)  /* rx can receive data during disk I/O */
+#define CANFC32                 ((uint8_t)0x20)  /* receiver can use 32 bit frame check */
+
+#define ZMODEM_HEADER_SIZE      ((uint32_t)5)    /* type + 4 position/flag bytes */
+#define ZMODEM_SUBPACKET_SIZE   ((uint32_t)1024) /* largest data subpacket accepted */
+#define ZMODEM_REPLY_SIZE       ((uint32_t)48)   /* two hex headers */
+#define ZMODEM_MAX_ERRORS       ((uint32_t)10)   /* consecutive errors before cancel */
+#define ZMODEM_FLASH_CHUNK      ((uint32_t)1024) /* program unit, resume offsets are aligned to it */
+
+/* Exported types ------------------------------------------------------------*/
+/**
+  * @brief  Events reported by the incremental receiver (Zmodem_RxFeed)
+  */
+typedef enum
+{
+  ZMODEM_EVT_NONE       = 0x00,   /* need more bytes */
+  ZMODEM_EVT_FILE       = 0x01,   /* ZFILE: file_name/file_size valid, answer with Zmodem_RxAccept */
+  ZMODEM_EVT_DATA       = 0x02,   /* good subpacket in p_data/length at offset position */
+  ZMODEM_EVT_EOF        = 0x03,   /* ZEOF at the expected offset, file complete */
+  ZMODEM_EVT_END        = 0x04,   /* ZFIN, session finished */
+  ZMODEM_EVT_ABORT      = 0x05,   /* sender cancelled (CAN*5, ZABORT, ZFERR) */
+  ZMODEM_EVT_USER_ABORT = 0x06,   /* 'a' or 'A' received before the session began */
+  ZMODEM_EVT_ERROR      = 0x07    /* too many errors, session cancelled */
+} ZMODEM_EventTypeDef;
+
+/**
+  * @brief  Incremental (non-blocking) Zmodem receiver context
+  */
+typedef struct
+{
+  uint8_t  state;                         /* framing state */
+  uint8_t  frame_type;                    /* ZBIN/ZHEX/ZBIN32 of the last header */
+  uint8_t  escape;                        /* previous byte was ZDLE */
+  uint8_t  can_count;                     /* consecutive CAN (ZDLE) bytes */
+  uint8_t  session_begin;                 /* a valid header has been received */
+  uint8_t  file_open;                     /* ZFILE accepted, ZDATA allowed */
+  uint8_t  subpacket_end;                 /* ZCRCE/G/Q/W of the current subpacket */
+  uint8_t  header[ZMODEM_HEADER_SIZE + 4];/* header being received (+ CRC) */
+  uint8_t  a_crc[4];                      /* CRC of the current subpacket */
+  uint32_t index;                         /* bytes collected in header/hex/subpacket/CRC */
+  uint32_t errors;                        /* consecutive errors */
+  uint32_t position;                      /* file offset of the next expected byte */
+  uint8_t  *p_buffer;                     /* subpacket buffer, ZMODEM_SUBPACKET_SIZE */
+  uint8_t  *p_data;                       /* payload of the last DATA event */
+  uint32_t length;                        /* length of the last complete subpacket */
+  uint32_t data_position;                 /* file offset of p_data */
+  uint32_t file_size;                     /* from the ZFILE subpacket */
+  uint8_t  file_name[FILE_NAME_LENGTH];   /* from the ZFILE subpacket */
+  uint32_t file_id;                       /* CRC-32 of ZFILE name, size and mtime */
+  uint8_t  a_reply[ZMODEM_REPLY_SIZE];    /* headers to send */
+  uint32_t reply_length;                  /* caller sends a_reply and clears it */
+} ZMODEM_RxTypeDef;
+
+/* Exported macro ------------------------------------------------------------*/
+
+/* Exported variables --------------------------------------------------------*/
+
+/* Exported function prototypes ----------------------------------------------*/
+void Zmodem_RxInit(ZMODEM_RxTypeDef *p_rx, uint8_t *p_buffer);
+ZMODEM_EventTypeDef Zmodem_RxFeed(ZMODEM_RxTypeDef *p_rx, const uint8_t *p_in, uint32_t length, uint32_t *p_used);
+ZMODEM_EventTypeDef Zmodem_RxTimeout(ZMODEM_RxTypeDef *p_rx);
+void Zmodem_RxAccept(ZMODEM_RxTypeDef *p_rx, uint32_t offset);
+void Zmodem_RxSkip(ZMODEM_RxTypeDef *p_rx);
+void Zmodem_RxCancel(ZMODEM_RxTypeDef *p_rx);
+COM_StatusTypeDef Zmodem_Receive(uint32_t *p_size);
+
+#endif /* __ZMODEM_H */
+
+/************************ (C) COPYRIGHT Jason *****END OF FILE****/
@@ -0,0 +1,255 @@
+/******************************************************************************
+ * @file    crc_bench.c
+ * @brief   Host benchmark for the CRC16 backends in Core/User/crc.c.
+ *          Checks that every backend gives the same result as the original
+ *          Ymodem bit-serial algorithm and reports the cost per KB.
+ *          Also checks Crc32_UpdateWords (software image CRC, the fallback of
+ *          image_crc.c) against a bit-serial model of the STM32 CRC unit.
+ * @author  Jason
+ * @version V1.0.0
+ * @date    2025-3
+ * @copyright (c) 2025, All rights reserved.
+ ******************************************************************************/
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "crc.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAVE_TSC      1
+#endif
+
+/* Private define ------------------------------------------------------------*/
+#define BENCH_PACKET_SIZE   (1024u)         /* Ymodem STX packet */
+#define BENCH_ROUNDS        (20000u)
+#define CHECK_ROUNDS        (2000u)
+#define CHECK_MAX_SIZE      (1100u)
+
+/* Private typedef -----------------------------------------------------------*/
+typedef uint16_t (*crc16_fn_t)(uint16_t crc, const uint8_t *p_data, uint32_t size);
+
+typedef struct
+{
+    const char *name;
+    crc16_fn_t  fn;
+} backend_t;
+
+/* Private variables ---------------------------------------------------------*/
+static const backend_t backends[] =
+{
+    {"bitwise", Crc16_UpdateBitwise},
+    {"table",   Crc16_UpdateTable},
+    {"slice4",  Crc16_UpdateSlice4},
+};
+
+/* Private functions ---------------------------------------------------------*/
+
+/* Copy of the original ymodem.c algorithm (augmented, two trailing zeros) */
+static uint16_t legacy_update(uint16_t crc_in, uint8_t byte)
+{
+    uint32_t crc = crc_in;
+    uint32_t in = byte | 0x100;
+
+    do
+    {
+        crc <<= 1;
+        in <<= 1;
+        if (in & 0x100)
+            ++crc;
+        if (crc & 0x10000)
+            crc ^= 0x1021;
+    } while (!(in & 0x10000));
+
+    return crc & 0xffffu;
+}
+
+static uint16_t legacy_crc16(const uint8_t *p_data, uint32_t size)
+{
+    uint32_t crc = 0;
+
+    while (size--)
+        crc = legacy_update(crc, *p_data++);
+    crc = legacy_update(crc, 0);
+    crc = legacy_update(crc, 0);
+    return crc & 0xffffu;
+}
+
+/* Bit-serial model of the STM32 CRC unit: one 32-bit word, MSB first */
+static uint32_t stm32_crc_word(uint32_t crc, uint32_t word)
+{
+    int bit;
+
+    crc ^= word;
+    for (bit = 0; bit < 32; bit++)
+        crc = (crc & 0x80000000u) ? ((crc << 1) ^ 0x04C11DB7u) : (crc << 1);
+    return crc;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int check_backends(void)
+{
+    static uint8_t buf[CHECK_MAX_SIZE + 4];
+    uint32_t round, i, size, offset;
+    uint16_t expect, got, split;
+
+    for (i = 0; i < sizeof(buf); i++)
+        buf[i] = (uint8_t)rand();
+
+    /* Standard check value of CRC-16/XMODEM */
+    for (i = 0; i < sizeof(backends) / sizeof(backends[0]); i++)
+    {
+        got = backends[i].fn(CRC16_INIT_VALUE, (const uint8_t *)"123456789", 9);
+        if (got != 0x31C3)
+        {
+            printf("FAIL %s: check value 0x%04X != 0x31C3\n", backends[i].name, got);
+            return -1;
+        }
+    }
+
+    for (round = 0; round < CHECK_ROUNDS; round++)
+    {
+        size   = (uint32_t)rand() % CHECK_MAX_SIZE;
+        offset = (uint32_t)rand() % 4;          /* exercise unaligned heads */
+        expect = legacy_crc16(&buf[offset], size);
+
+        for (i = 0; i < sizeof(backends) / sizeof(backends[0]); i++)
+        {
+            got = backends[i].fn(CRC16_INIT_VALUE, &buf[offset], size);
+            /* incremental use must match the single-shot result */
+            split = backends[i].fn(CRC16_INIT_VALUE, &buf[offset], size / 3);
+            split = backends[i].fn(split, &buf[offset + size / 3], size - size / 3);
+            if ((got != expect) || (split != expect))
+            {
+                printf("FAIL %s: size %u offset %u: 0x%04X/0x%04X != 0x%04X\n",
+                       backends[i].name, size, offset, got, split, expect);
+                return -1;
+            }
+        }
+    }
+    printf("all backends match the legacy Ymodem CRC (%u random buffers)\n", CHECK_ROUNDS);
+    return 0;
+}
+
+static int check_words(void)
+{
+    static uint32_t words[CHECK_MAX_SIZE / 4];
+    uint32_t round, i, count, expect, got, split;
+    const uint32_t check = 0x12345678u;
+
+    /* Check value of the F2 reference manual: one word 0x12345678 after reset */
+    got = Crc32_UpdateWords(CRC32_WORD_INIT_VALUE, &check, 1);
+    if (got != 0xDF8A8A2Bu)
+    {
+        printf("FAIL words: check value 0x%08X != 0xDF8A8A2B\n", got);
+        return -1;
+    }
+
+    for (i = 0; i < sizeof(words) / sizeof(words[0]); i++)
+        words[i] = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+
+    for (round = 0; round < CHECK_ROUNDS; round++)
+    {
+        count  = (uint32_t)rand() % (sizeof(words) / sizeof(words[0]));
+        expect = CRC32_WORD_INIT_VALUE;
+        for (i = 0; i < count; i++)
+            expect = stm32_crc_word(expect, words[i]);
+
+        got   = Crc32_UpdateWords(CRC32_WORD_INIT_VALUE, words, count);
+        split = Crc32_UpdateWords(CRC32_WORD_INIT_VALUE, words, count / 3);
+        split = Crc32_UpdateWords(split, &words[count / 3], count - count / 3);
+        if ((got != expect) || (split != expect))
+        {
+            printf("FAIL words: count %u: 0x%08X/0x%08X != 0x%08X\n", count, got, split, expect);
+            return -1;
+        }
+    }
+    printf("Crc32_UpdateWords matches the STM32 CRC unit model (%u random buffers)\n", CHECK_ROUNDS);
+    return 0;
+}
+
+static void bench_words(void)
+{
+    static uint32_t packet_words[BENCH_PACKET_SIZE / 4];
+    volatile uint32_t sink = 0;
+    uint64_t t0, t1;
+    uint32_t i;
+
+    for (i = 0; i < BENCH_PACKET_SIZE / 4; i++)
+        packet_words[i] = (uint32_t)rand();
+
+    t0 = now_ns();
+    for (i = 0; i < BENCH_ROUNDS; i++)
+        sink ^= Crc32_UpdateWords(CRC32_WORD_INIT_VALUE, packet_words, BENCH_PACKET_SIZE / 4);
+    t1 = now_ns();
+    (void)sink;
+    printf("%-8s %10.1f ns/KB  (image CRC, software; the CRC unit takes 4 AHB cycles per word)\n",
+           "words", (double)(t1 - t0) / BENCH_ROUNDS);
+}
+
+static void bench_backend(const char *name, crc16_fn_t fn)
+{
+    static uint32_t packet_words[BENCH_PACKET_SIZE / 4];
+    const uint8_t *packet = (const uint8_t *)packet_words;
+    volatile uint16_t sink = 0;
+    uint64_t t0, t1;
+#ifdef BENCH_HAVE_TSC
+    uint64_t c0, c1;
+#endif
+    uint32_t i;
+
+    for (i = 0; i < BENCH_PACKET_SIZE / 4; i++)
+        packet_words[i] = (uint32_t)rand();
+
+    t0 = now_ns();
+#ifdef BENCH_HAVE_TSC
+    c0 = __rdtsc();
+#endif
+    for (i = 0; i < BENCH_ROUNDS; i++)
+        sink ^= fn(CRC16_INIT_VALUE, packet, BENCH_PACKET_SIZE);
+#ifdef BENCH_HAVE_TSC
+    c1 = __rdtsc();
+#endif
+    t1 = now_ns();
+    (void)sink;
+
+#ifdef BENCH_HAVE_TSC
+    printf("%-8s %10.1f ns/KB %10.1f cycles/KB\n", name,
+           (double)(t1 - t0) / BENCH_ROUNDS, (double)(c1 - c0) / BENCH_ROUNDS);
+#else
+    printf("%-8s %10.1f ns/KB\n", name, (double)(t1 - t0) / BENCH_ROUNDS);
+#endif
+}
+
+static uint16_t legacy_fn(uint16_t crc, const uint8_t *p_data, uint32_t size)
+{
+    (void)crc;
+    return legacy_crc16(p_data, size);
+}
+
+int main(void)
+{
+    uint32_t i;
+
+    srand(1);
+    if ((check_backends() != 0) || (check_words() != 0))
+        return 1;
+
+    bench_backend("legacy", legacy_fn);
+    for (i = 0; i < sizeof(backends) / sizeof(backends[0]); i++)
+        bench_backend(backends[i].name, backends[i].fn);
+    bench_words();
+    return 0;
+}
+
+/************************ (C) COPYRIGHT Jason *****END OF FILE****/
@@ -0,0 +1,231 @@
+/******************************************************************************
+ * @file    delta_make.c
+ * @brief   Host tool: build a delta patch (Core/User/app_update.h format)
+ *          that turns the installed image into the new one.
+ *          Usage: delta_make old.bin new.bin patch.dlt
+ *          Compress further with "heatshrink -e -w 10 -l 4 patch.dlt
+ *          patch.dlt.hs" for Ymodem (ADD blocks are mostly zero).
+ * @author  Jason
+ * @version V1.0.0
+ * @date    2025-3
+ * @copyright (c) 2025, All rights reserved.
+ ******************************************************************************/
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "crc.h"
+#include "app_update.h"
+
+/* Private define ------------------------------------------------------------*/
+#define BLOCK_SIZE          (16u)           /* hashed window */
+#define MIN_COPY            (24u)           /* shorter matches are not worth a COPY (9 bytes) */
+#define HASH_BITS           (16u)
+#define MAX_CHAIN           (32u)           /* candidates checked per position */
+
+/* Private typedef -----------------------------------------------------------*/
+typedef struct
+{
+    uint8_t  *data;
+    uint32_t  size;
+} blob_t;
+
+/* Private variables ---------------------------------------------------------*/
+static int32_t  hash_head[1u << HASH_BITS];
+static int32_t *hash_next;
+static FILE    *patch;
+static uint32_t patch_size;
+static uint32_t stat_copy, stat_add, stat_insert;
+
+/* Private functions ---------------------------------------------------------*/
+static int read_file(const char *name, blob_t *p_blob)
+{
+    FILE *f = fopen(name, "rb");
+    long size;
+
+    if (f == NULL)
+        return -1;
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    rewind(f);
+    p_blob->data = malloc(size > 0 ? (size_t)size : 1u);
+    p_blob->size = (uint32_t)size;
+    if ((p_blob->data == NULL) || (fread(p_blob->data, 1, (size_t)size, f) != (size_t)size))
+    {
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    return 0;
+}
+
+static uint32_t hash_block(const uint8_t *p)
+{
+    uint32_t h = 2166136261u;
+    uint32_t i;
+
+    for (i = 0; i < BLOCK_SIZE; i++)
+        h = (h ^ p[i]) * 16777619u;
+    return h >> (32u - HASH_BITS);
+}
+
+static void put_u8(uint8_t v)
+{
+    fputc(v, patch);
+    patch_size++;
+}
+
+static void put_u32(uint32_t v)
+{
+    put_u8((uint8_t)v);
+    put_u8((uint8_t)(v >> 8));
+    put_u8((uint8_t)(v >> 16));
+    put_u8((uint8_t)(v >> 24));
+}
+
+static uint32_t match_length(const blob_t *p_old, uint32_t old_pos, const blob_t *p_new, uint32_t new_pos)
+{
+    uint32_t n = 0;
+
+    while ((old_pos + n < p_old->size) && (new_pos + n < p_new->size) &&
+           (p_old->data[old_pos + n] == p_new->data[new_pos + n]))
+        n++;
+    return n;
+}
+
+/* Longest match for new[pos...]: continuation of the last COPY first, then the hash chain */
+static uint32_t best_match(const blob_t *p_old, const blob_t *p_new, uint32_t pos,
+                           uint32_t old_ptr, uint32_t *p_offset)
+{
+    uint32_t best = 0, n, chain = 0;
+    int32_t cand;
+
+    if (old_ptr < p_old->size)
+    {
+        best = match_length(p_old, old_ptr, p_new, pos);
+        *p_offset = old_ptr;
+    }
+    if (pos + BLOCK_SIZE > p_new->size)
+        return best;
+
+    for (cand = hash_head[hash_block(&p_new->data[pos])]; (cand >= 0) && (chain < MAX_CHAIN);
+         cand = hash_next[cand], chain++)
+    {
+        n = match_length(p_old, (uint32_t)cand, p_new, pos);
+        if (n > best)
+        {
+            best = n;
+            *p_offset = (uint32_t)cand;
+        }
+    }
+    return best;
+}
+
+/* Bytes with no good match: ADD against the old bytes at old_ptr if they are
+   similar (code shifted, constants changed), INSERT otherwise */
+static void flush_literal(const blob_t *p_old, const blob_t *p_new, uint32_t start, uint32_t end,
+                          uint32_t *p_old_ptr)
+{
+    uint32_t length = end - start;
+    uint32_t base = *p_old_ptr;
+    uint32_t i, same = 0;
+
+    if (length == 0)
+        return;
+
+    if ((base <= p_old->size) && (length <= p_old->size - base))
+    {
+        for (i = 0; i < length; i++)
+            same += (p_old->data[base + i] == p_new->data[start + i]);
+    }
+    if (same * 2 >= length && same > 0)
+    {
+        put_u8(APP_DELTA_OP_ADD);
+        put_u32(base);
+        put_u32(length);
+        for (i = 0; i < length; i++)
+            put_u8((uint8_t)(p_new->data[start + i] - p_old->data[base + i]));
+        *p_old_ptr = base + length;
+        stat_add += length;
+    }
+    else
+    {
+        put_u8(APP_DELTA_OP_INSERT);
+        put_u32(length);
+        for (i = 0; i < length; i++)
+            put_u8(p_new->data[start + i]);
+        stat_insert += length;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    blob_t old_img, new_img;
+    uint32_t i, pos, literal, length, offset = 0, old_ptr = 0;
+
+    if (argc != 4)
+    {
+        fprintf(stderr, "usage: %s old.bin new.bin patch.dlt\n", argv[0]);
+        return 2;
+    }
+    if ((read_file(argv[1], &old_img) != 0) || (read_file(argv[2], &new_img) != 0))
+    {
+        fprintf(stderr, "cannot read input files\n");
+        return 1;
+    }
+    patch = fopen(argv[3], "wb");
+    if (patch == NULL)
+    {
+        fprintf(stderr, "cannot create %s\n", argv[3]);
+        return 1;
+    }
+
+    /* index every position of the old image, the first occurrence is tried first */
+    hash_next = malloc(sizeof(int32_t) * (old_img.size + 1u));
+    memset(hash_head, 0xFF, sizeof(hash_head));
+    for (i = old_img.size >= BLOCK_SIZE ? old_img.size - BLOCK_SIZE + 1u : 0u; i-- > 0;)
+    {
+        uint32_t h = hash_block(&old_img.data[i]);
+        hash_next[i] = hash_head[h];
+        hash_head[h] = (int32_t)i;
+    }
+
+    fwrite(APP_DELTA_MAGIC, 1, 4, patch);
+    patch_size = 4;
+    put_u32(old_img.size);
+    put_u32(Crc32_Calc(old_img.data, old_img.size));
+    put_u32(new_img.size);
+    put_u32(Crc32_Calc(new_img.data, new_img.size));
+
+    literal = 0;
+    pos = 0;
+    while (pos < new_img.size)
+    {
+        length = best_match(&old_img, &new_img, pos, old_ptr, &offset);
+        if (length >= MIN_COPY)
+        {
+            flush_literal(&old_img, &new_img, literal, pos, &old_ptr);
+            put_u8(APP_DELTA_OP_COPY);
+            put_u32(offset);
+            put_u32(length);
+            stat_copy += length;
+            old_ptr = offset + length;
+            pos += length;
+            literal = pos;
+        }
+        else
+        {
+            pos++;
+        }
+    }
+    flush_literal(&old_img, &new_img, literal, pos, &old_ptr);
+    put_u8(APP_DELTA_OP_END);
+    fclose(patch);
+
+    printf("old %u bytes, new %u bytes -> patch %u bytes (copy %u, add %u, insert %u)\n",
+           old_img.size, new_img.size, patch_size, stat_copy, stat_add, stat_insert);
+    return 0;
+}
+
+/************************ (C) COPYRIGHT Jason *****END OF FILE****/
@@ -0,0 +1,553 @@
+/******************************************************************************
+ * @file    flash_bench.c
+ * @brief   Simulated update time of the flash strategies in Core/User/flash_if.c
+ *          (erase all / erase range / erase ahead / sector update) and of the
+ *          status log in flash_e_level.c, on the flash simulator (flash_sim.c).
+ *          The status log lookup is timed on the host: full backward scan
+ *          (el_flash_scan) against mount (el_flash_mount) and cached reads,
+ *          by fill level, and the key/value store (kv_store.c) that replaced
+ *          it: write cost, erases and read / mount time with several keys,
+ *          and power cuts in the middle of a compaction.
+ *          flash_bench [-max] [-w us] [-e16 ms] [-e64 ms] [-e128 ms]
+ *                      [-link KB/s] [size_KB ...]
+ * @author  Jason
+ * @version V1.0.0
+ * @date    2025-3
+ * @copyright (c) 2025, All rights reserved.
+ ******************************************************************************/
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "iap_user.h"
+#include "flash_if.h"
+#include "flash_e_level.h"
+#include "kv_store.h"
+#include "flash_sim.h"
+
+/* Private define ------------------------------------------------------------*/
+#define BENCH_PACKET_SIZE   (1024u)         /* Ymodem STX packet */
+#define BENCH_MAX_SIZES     (16u)
+#define BENCH_LOG_WRITES    (1000u)
+#define BENCH_LOOKUPS       (20000u)        /* host timing, per lookup method */
+#define BENCH_KV_WRITES     (5000u)
+#define BENCH_KV_KEYS       (5u)
+#define BENCH_KV_RECORD(len) (4u + (((uint32_t)(len) + 3u) & ~3u) + 4u)   /* kv_store.c record size */
+#define BENCH_LEGACY_RECORDS (100u)
+#define BENCH_LEGACY_RECORD  (24u)          /* baseline save_data_t */
+#define BENCH_LEGACY_PER_PART ((0x400u - 8u) / BENCH_LEGACY_RECORD)
+
+/* Private typedef -----------------------------------------------------------*/
+typedef enum
+{
+    STRATEGY_ERASE_ALL,         /* FLASH_If_Erase_App_Space, then receive */
+    STRATEGY_ERASE_RANGE,       /* FLASH_If_Erase_Range(image size), then receive */
+    STRATEGY_ERASE_AHEAD,       /* FLASH_If_EraseAhead_*, erases spread over the transfer (same total, one bank) */
+    STRATEGY_UPDATE_SAME,       /* FLASH_If_Update from Backup, image unchanged */
+    STRATEGY_UPDATE_ONE,        /* FLASH_If_Update from Backup, one word changed */
+    STRATEGY_COUNT
+} strategy_t;
+
+/* Private variables ---------------------------------------------------------*/
+static const char *const strategy_names[STRATEGY_COUNT] =
+{
+    "erase app + write",
+    "erase range + write",
+    "erase ahead",
+    "update, unchanged",
+    "update, 1 word changed",
+};
+
+static flash_sim_timing_t timing = FLASH_SIM_TIMING_TYP;
+static uint32_t link_us_per_packet;
+static uint32_t image[USER_FLASH_SIZE / 4u];
+static uint8_t old_image[USER_FLASH_SIZE];
+
+/* Private functions ---------------------------------------------------------*/
+/* Receive the image packet by packet as ymodem.c does */
+static uint32_t receive(uint32_t size, int erase_ahead)
+{
+    uint32_t offset, words, status = FLASHIF_OK;
+
+    for (offset = 0; (offset < size) && (status == FLASHIF_OK); offset += BENCH_PACKET_SIZE)
+    {
+        if (erase_ahead)
+            FLASH_If_EraseAhead_Poll();
+        flash_sim_idle(link_us_per_packet);
+        words = ((size - offset < BENCH_PACKET_SIZE) ? (size - offset) : BENCH_PACKET_SIZE) / 4u;
+        status = FLASH_If_Write(APPLICATION_ADDRESS + offset, &image[offset / 4u], words);
+    }
+    return status;
+}
+
+static uint32_t run_strategy(strategy_t strategy, uint32_t size)
+{
+    uint32_t status = FLASHIF_OK;
+
+    switch (strategy)
+    {
+        case STRATEGY_ERASE_ALL:
+        case STRATEGY_ERASE_RANGE:
+            FLASH_If_Open();
+            if (((strategy == STRATEGY_ERASE_ALL) ? FLASH_If_Erase_App_Space() :
+                 FLASH_If_Erase_Range(APPLICATION_ADDRESS, size)) != HAL_OK)
+                status = FLASHIF_ERASEKO;
+            else
+                status = receive(size, 0);
+            FLASH_If_Close();
+            break;
+        case STRATEGY_ERASE_AHEAD:
+            FLASH_If_Open();
+            FLASH_If_EraseAhead_Begin(APPLICATION_ADDRESS, size);
+            status = receive(size, 1);
+            if ((FLASH_If_EraseAhead_End() != HAL_OK) && (status == FLASHIF_OK))
+                status = FLASHIF_ERASEKO;
+            FLASH_If_Close();
+            break;
+        case STRATEGY_UPDATE_SAME:
+        case STRATEGY_UPDATE_ONE:
+            status = FLASH_If_Update(APPLICATION_ADDRESS, (const uint32_t *)BACKUP_ADDRESS, size / 4u);
+            break;
+        default:
+            break;
+    }
+    return status;
+}
+
+static void bench_size(uint32_t size)
+{
+    const flash_sim_stats_t *p_stats;
+    uint64_t t0;
+    uint32_t i, status;
+    strategy_t strategy;
+
+    for (i = 0; i < size / 4u; i++)
+        image[i] = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+
+    for (strategy = STRATEGY_ERASE_ALL; strategy < STRATEGY_COUNT; strategy++)
+    {
+        /* Backup is one sector with two status banks */
+        if ((strategy >= STRATEGY_UPDATE_SAME) && (size > BACKUP_FLASH_SIZE))
+            continue;
+        if (flash_sim_init(&timing) != 0)
+            exit(1);
+        /* App1 holds an older image, Backup the new one for the update strategies */
+        flash_sim_load(APPLICATION_ADDRESS, old_image, USER_FLASH_SIZE);
+        if (strategy >= STRATEGY_UPDATE_SAME)
+        {
+            flash_sim_load(APPLICATION_ADDRESS, image, size);
+            if (strategy == STRATEGY_UPDATE_ONE)
+                image[size / 8u] ^= 1u;
+            flash_sim_load(BACKUP_ADDRESS, image, size);
+        }
+        flash_sim_reset_stats();
+        FLASH_If_ResetStats();
+        t0 = flash_sim_now_us();
+
+        status = run_strategy(strategy, size);
+
+        p_stats = flash_sim_stats();
+        printf("%6u KB  %-24s %9.1f %9.1f %7u %10u %7u  %s\n", size / 1024u, strategy_names[strategy],
+               (double)(flash_sim_now_us() - t0) / 1000.0, (double)p_stats->busy_us / 1000.0,
+               p_stats->erased_sectors, p_stats->programmed_words, p_stats->errors,
+               ((status == FLASHIF_OK) && (memcmp((const void *)APPLICATION_ADDRESS, image, size) == 0)) ? "OK" : "BAD");
+    }
+}
+
+static void bench_status_log(void)
+{
+    const flash_sim_stats_t *p_stats;
+    save_data_t data, read;
+    uint32_t i;
+    int ok = 1;
+
+    if (flash_sim_init(&timing) != 0)
+        exit(1);
+    /* the map word of each sub-area is programmed again to clear its next bit */
+    flash_sim_allow_reprogram(1);
+    memset(&data, 0, sizeof(data));
+    data.header = HEADER;
+    data.ender = ENDER;
+    for (i = 0; i < BENCH_LOG_WRITES; i++)
+    {
+        data.iap_msg.version = (uint16_t)i;
+        el_flash_write(&data);
+        if ((el_flash_read(&read) != EL_FIND_SUCCESS) || (read.iap_msg.version != (uint16_t)i))
+            ok = 0;
+    }
+    p_stats = flash_sim_stats();
+    printf("\nstatus log: %u writes of %u bytes, %.3f ms/write, %u sector erases, %u words (%u re-programmed), %u errors  %s\n",
+           BENCH_LOG_WRITES, (uint32_t)sizeof(data), (double)flash_sim_now_us() / 1000.0 / BENCH_LOG_WRITES,
+           p_stats->erased_sectors, p_stats->programmed_words, p_stats->reprogrammed_words, p_stats->errors,
+           ok ? "OK" : "BAD");
+}
+
+static double host_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/* ns per call of lookup(), and the version of the record it found */
+static double time_lookup(eFIND_Status_Def (*lookup)(void), uint16_t *p_version)
+{
+    save_data_t read;
+    double t0 = host_ns();
+    uint32_t i;
+
+    for (i = 0; i < BENCH_LOOKUPS; i++)
+        (void)lookup();
+    t0 = (host_ns() - t0) / BENCH_LOOKUPS;
+    *p_version = (el_flash_read(&read) == EL_FIND_SUCCESS) ? read.iap_msg.version : 0xFFFFu;
+    return t0;
+}
+
+static eFIND_Status_Def cached_read(void)
+{
+    save_data_t read;
+
+    return el_flash_read(&read);
+}
+
+static void bench_status_lookup(void)
+{
+    static const uint32_t fill_percent[] = { 0u, 1u, 25u, 50u, 75u, 100u };
+    const uint32_t capacity = EL_AREA_SON_SUM * EL_SON2DATA_SUM;
+    save_data_t data;
+    uint16_t v_scan, v_mount, v_read;
+    double ns_scan, ns_mount, ns_read;
+    uint32_t f, i, records;
+
+    printf("\nstatus log lookup (%u records of %u bytes, host ns per call)\n", capacity, (uint32_t)sizeof(data));
+    printf("%6s %8s %10s %10s %12s\n", "fill", "records", "scan", "mount", "cached read");
+    memset(&data, 0, sizeof(data));
+    data.header = HEADER;
+    data.ender = ENDER;
+    for (f = 0; f < sizeof(fill_percent) / sizeof(fill_percent[0]); f++)
+    {
+        if (flash_sim_init(&timing) != 0)
+            exit(1);
+        flash_sim_allow_reprogram(1);
+        el_flash_mount();
+        records = capacity * fill_percent[f] / 100u;
+        for (i = 0; i < records; i++)
+        {
+            data.iap_msg.version = (uint16_t)i;
+            el_flash_write(&data);
+        }
+        ns_scan = time_lookup(el_flash_scan, &v_scan);
+        ns_mount = time_lookup(el_flash_mount, &v_mount);
+        ns_read = time_lookup(cached_read, &v_read);
+        printf("%5u%% %8u %10.1f %10.1f %12.1f  %s\n", fill_percent[f], records, ns_scan, ns_mount, ns_read,
+               ((v_scan == v_mount) && (v_mount == v_read) &&
+                ((records == 0) ? (v_read == 0xFFFFu) : (v_read == (uint16_t)(records - 1)))) ? "OK" : "BAD");
+    }
+}
+
+/* Values of different lengths written round robin, as the bootloader items would be */
+static void bench_kv_value(uint32_t n, uint8_t *p_value, uint16_t *p_length)
+{
+    uint16_t i;
+
+    *p_length = (uint16_t)(4u + 8u * (n % BENCH_KV_KEYS));
+    for (i = 0; i < *p_length; i++)
+        p_value[i] = (uint8_t)(n + i);
+}
+
+/* status sector as the IAP before the key/value store wrote it (flash_e_level.c
+   with the 16-byte iap_msg_t): 1 KB parts, table {map, dataSize = 24}, then
+   24-byte records {header, status, transmitMethod, version, size, ender} */
+static void bench_legacy_sector(uint8_t *p_sector, uint32_t records)
+{
+    uint32_t i, part, n, map, word;
+    uint8_t *p_record;
+
+    memset(p_sector, 0xFF, IAP_STATUS_SIZE);
+    for (i = 0; i < records; i++)
+    {
+        part = i / BENCH_LEGACY_PER_PART;
+        n = i % BENCH_LEGACY_PER_PART;
+        memcpy(&map, &p_sector[part * 0x400u], 4);
+        map &= ~(1u << (n / 2u));                       /* one map bit per two records */
+        memcpy(&p_sector[part * 0x400u], &map, 4);
+        word = BENCH_LEGACY_RECORD;
+        memcpy(&p_sector[part * 0x400u + 4u], &word, 4);
+
+        p_record = &p_sector[part * 0x400u + 8u + n * BENCH_LEGACY_RECORD];
+        word = HEADER;
+        memcpy(&p_record[0], &word, 2);
+        word = (i + 1u == records) ? IAP_APP_DONE : IAP_DOWNING_BIN;
+        memcpy(&p_record[4], &word, 4);
+        word = TRANSMIT_METHOD_CAN;
+        memcpy(&p_record[8], &word, 4);
+        word = i;
+        memcpy(&p_record[12], &word, 2);
+        word = 0x12340u + i;
+        memcpy(&p_record[16], &word, 4);
+        word = ENDER;
+        memcpy(&p_record[20], &word, 2);
+    }
+}
+
+/* the last baseline record, migrated to KV_KEY_IAP_STATUS */
+static int bench_legacy_migrated(uint32_t records)
+{
+    save_data_t data;
+    uint16_t length;
+
+    return (KV_Get(KV_KEY_IAP_STATUS, &data, sizeof(data), &length) == HAL_OK) &&
+           (length == sizeof(save_data_t)) && (data.header == HEADER) && (data.ender == ENDER) &&
+           ((uint32_t)data.iap_msg.status == IAP_APP_DONE) &&
+           ((uint32_t)data.iap_msg.transmitMethod == TRANSMIT_METHOD_CAN) &&
+           (data.iap_msg.version == (uint16_t)(records - 1u)) && (data.iap_msg.size == 0x12340u + records - 1u);
+}
+
+static void bench_kv_legacy(void)
+{
+    static uint8_t sector[IAP_STATUS_SIZE];
+    uint8_t value[4] = { 1, 2, 3, 4 };
+    uint32_t cut, left = 0, erases;
+    int ok = 1, kept;
+
+    /* a status sector in the baseline format is migrated at mount */
+    bench_legacy_sector(sector, BENCH_LEGACY_RECORDS);
+    for (cut = 0; ok && (left == 0); cut++)
+    {
+        if (flash_sim_init(&timing) != 0)
+            exit(1);
+        flash_sim_load(IAP_STATUS_ADDRESS, sector, IAP_STATUS_SIZE);
+        flash_sim_power_cut(cut);
+        KV_Mount();
+        left = flash_sim_power_cut(FLASH_SIM_POWER_ON);
+        /* cut in the middle: the next mount still finds the old record or the migrated one */
+        KV_Mount();
+        ok = bench_legacy_migrated(BENCH_LEGACY_RECORDS);
+    }
+    ok = ok && (KV_Set(KV_KEY_NODE_ID, value, sizeof(value)) == HAL_OK);
+    KV_Mount();
+    ok = ok && bench_legacy_migrated(BENCH_LEGACY_RECORDS);
+
+    /* anything else is not erased at mount, only by the first write */
+    memset(sector, 0xFF, sizeof(sector));
+    memcpy(sector, "not a status record", 20);
+    if (flash_sim_init(&timing) != 0)
+        exit(1);
+    flash_sim_load(IAP_STATUS_ADDRESS, sector, IAP_STATUS_SIZE);
+    erases = flash_sim_stats()->erased_sectors;
+    KV_Mount();
+    kept = (flash_sim_stats()->erased_sectors == erases) &&
+           (memcmp((const void *)IAP_STATUS_ADDRESS, sector, sizeof(sector)) == 0) &&
+           (KV_Get(KV_KEY_IAP_STATUS, value, sizeof(value), NULL) != HAL_OK);
+    ok = ok && kept && (KV_Set(KV_KEY_NODE_ID, value, sizeof(value)) == HAL_OK);
+    KV_Mount();
+    ok = ok && (KV_Get(KV_KEY_NODE_ID, value, sizeof(value), NULL) == HAL_OK);
+    printf("\nkv store: baseline status sector (%u records) migrated at mount, power cut after each of "
+           "%u flash operations keeps it, other content kept until the first write  %s\n",
+           BENCH_LEGACY_RECORDS, cut - 1u, ok ? "OK" : "BAD");
+}
+
+static void bench_kv(void)
+{
+    const flash_sim_stats_t *p_stats;
+    KV_StatsTypeDef kv_stats;
+    uint8_t value[KV_MAX_VALUE], read[KV_MAX_VALUE];
+    uint16_t length, read_length;
+    uint32_t i, k, erases, inline_erases = 0;
+    uint64_t write_us = 0, max_us = 0, t;
+    double ns_get, ns_mount, t0;
+    int ok = 1;
+
+    if (flash_sim_init(&timing) != 0)
+        exit(1);
+    /* the store never programs a word twice: keep the simulator strict */
+    flash_sim_allow_reprogram(0);
+    KV_Mount();
+    for (i = 0; i < BENCH_KV_WRITES; i++)
+    {
+        bench_kv_value(i, value, &length);
+        erases = flash_sim_stats()->erased_sectors;
+        t = flash_sim_now_us();
+        if (KV_Set((uint16_t)(KV_KEY_IAP_STATUS + i % BENCH_KV_KEYS), value, length) != HAL_OK)
+            ok = 0;
+        t = flash_sim_now_us() - t;
+        write_us += t;
+        max_us = (t > max_us) ? t : max_us;
+        inline_erases += flash_sim_stats()->erased_sectors - erases;
+        /* the IAP idle loop between two status writes erases the old bank */
+        KV_Idle();
+        flash_sim_idle(timing.erase_128k_us);
+        KV_Idle();
+    }
+    p_stats = flash_sim_stats();
+    erases = p_stats->erased_sectors;
+    printf("\nkv store: %u writes over %u keys (4..%u bytes), %.3f ms/write (max %.3f ms), "
+           "%u sector erases (%u in a write), %u words, %u errors\n",
+           BENCH_KV_WRITES, BENCH_KV_KEYS, 4u + 8u * (BENCH_KV_KEYS - 1u),
+           (double)write_us / 1000.0 / BENCH_KV_WRITES, (double)max_us / 1000.0,
+           erases, inline_erases, p_stats->programmed_words, p_stats->errors);
+
+    t0 = host_ns();
+    for (i = 0; i < BENCH_LOOKUPS; i++)
+        (void)KV_Get(KV_KEY_IAP_STATUS, read, sizeof(read), &read_length);
+    ns_get = (host_ns() - t0) / BENCH_LOOKUPS;
+    t0 = host_ns();
+    for (i = 0; i < BENCH_LOOKUPS; i++)
+        (void)KV_Mount();
+    ns_mount = (host_ns() - t0) / BENCH_LOOKUPS;
+
+    /* after a remount every key holds its last value */
+    for (k = 0; k < BENCH_KV_KEYS; k++)
+    {
+        i = BENCH_KV_WRITES - BENCH_KV_KEYS + k;
+        bench_kv_value(i, value, &length);
+        if ((KV_Get((uint16_t)(KV_KEY_IAP_STATUS + i % BENCH_KV_KEYS), read, sizeof(read), &read_length) != HAL_OK) ||
+            (read_length != length) || (memcmp(read, value, length) != 0))
+            ok = 0;
+    }
+    /* rewriting the same value (the last one read) does not touch the flash */
+    k = flash_sim_stats()->programmed_words;
+    (void)KV_Set((uint16_t)(KV_KEY_IAP_STATUS + i % BENCH_KV_KEYS), read, read_length);
+    if (flash_sim_stats()->programmed_words != k)
+        ok = 0;
+    KV_GetStats(&kv_stats);
+    printf("kv store: get %.1f ns, mount %.1f ns (host), %u keys, %u of %u bytes used, %u live, format #%u  %s\n",
+           ns_get, ns_mount, kv_stats.keys, kv_stats.used, KV_AREA_SIZE, kv_stats.live, kv_stats.erase_count,
+           /* one bank: compactions erase Sector 3 in the write, the idle loop only the stage */
+           (ok && (p_stats->errors == 0) &&
+            (kv_stats.erase_count == ((FLASH_LAYOUT_STATUS_BANKS > 1u) ? erases : inline_erases)) &&
+            ((FLASH_LAYOUT_STATUS_BANKS == 1u) || (inline_erases == 0))) ? "OK" : "BAD");
+}
+
+/* A power cut after each flash operation of a compaction: after the reset
+   (remount) every key holds its last value, the interrupted write its old
+   or new one, and the store takes writes again. One bank goes through a
+   stage slot before Sector 3 is erased, two banks through the other bank */
+static void bench_kv_power_cut(void)
+{
+    static uint8_t flash_copy[FLASH_LAYOUT_SIZE];
+    uint8_t last[BENCH_KV_KEYS][KV_MAX_VALUE], value[KV_MAX_VALUE], other[KV_MAX_VALUE], read[KV_MAX_VALUE];
+    uint16_t last_length[BENCH_KV_KEYS], length, other_length, read_length;
+    KV_StatsTypeDef before, after;
+    uint32_t n, k, cut, left = 0;
+    int ok = 1;
+
+    for (k = 0; k < BENCH_KV_KEYS; k++)
+        if (KV_Get((uint16_t)(KV_KEY_IAP_STATUS + k), last[k], KV_MAX_VALUE, &last_length[k]) != HAL_OK)
+            ok = 0;
+    /* fill the bank until the next write of the first key compacts */
+    for (n = BENCH_KV_WRITES * BENCH_KV_KEYS; ; n += BENCH_KV_KEYS)
+    {
+        bench_kv_value(n, value, &length);
+        KV_GetStats(&before);
+        if (before.used + BENCH_KV_RECORD(length) > KV_AREA_SIZE)
+            break;
+        if (KV_Set(KV_KEY_IAP_STATUS, value, length) != HAL_OK)
+            ok = 0;
+        memcpy(last[0], value, length);
+        last_length[0] = length;
+    }
+    KV_Idle();
+    flash_sim_idle(timing.erase_128k_us);
+    KV_Idle();
+    KV_GetStats(&before);
+    (void)flash_sim_stats();
+    memcpy(flash_copy, (const void *)FLASH_LAYOUT_BASE, FLASH_LAYOUT_SIZE);
+
+    for (cut = 0; ok && (left == 0); cut++)
+    {
+        flash_sim_load(FLASH_LAYOUT_BASE, flash_copy, FLASH_LAYOUT_SIZE);
+        KV_Mount();
+        flash_sim_power_cut(cut);
+        (void)KV_Set(KV_KEY_IAP_STATUS, value, length);
+        left = flash_sim_power_cut(FLASH_SIM_POWER_ON);
+        KV_Mount();
+        for (k = 0; k < BENCH_KV_KEYS; k++)
+        {
+            if ((KV_Get((uint16_t)(KV_KEY_IAP_STATUS + k), read, sizeof(read), &read_length) != HAL_OK) ||
+                (((read_length != last_length[k]) || (memcmp(read, last[k], read_length) != 0)) &&
+                 ((k != 0) || (read_length != length) || (memcmp(read, value, length) != 0))))
+                ok = 0;
+        }
+        bench_kv_value(n + 1u, other, &other_length);
+        if ((KV_Set(KV_KEY_IAP_STATUS + 1u, other, other_length) != HAL_OK) ||
+            (KV_Get(KV_KEY_IAP_STATUS + 1u, read, sizeof(read), &read_length) != HAL_OK) ||
+            (read_length != other_length) || (memcmp(read, other, other_length) != 0))
+            ok = 0;
+    }
+    /* the last run was not cut: the write went through a compaction */
+    flash_sim_load(FLASH_LAYOUT_BASE, flash_copy, FLASH_LAYOUT_SIZE);
+    KV_Mount();
+    ok = ok && (KV_Set(KV_KEY_IAP_STATUS, value, length) == HAL_OK);
+    KV_Mount();
+    KV_GetStats(&after);
+    ok = ok && (after.erase_count == before.erase_count + 1u) &&
+         ((FLASH_LAYOUT_STATUS_BANKS > 1u) || (after.stage_used == before.stage_used + 1u));
+    printf("kv store: power cut after each of %u flash operations of a compaction (%s), "
+           "remount keeps every value  %s\n", cut - 1u,
+           (FLASH_LAYOUT_STATUS_BANKS > 1u) ? "other bank" : "stage slot, then Sector 3", ok ? "OK" : "BAD");
+}
+
+static int usage(void)
+{
+    printf("usage: flash_bench [-max] [-w us] [-e16 ms] [-e64 ms] [-e128 ms] [-link KB/s] [size_KB ...]\n");
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    static const flash_sim_timing_t max = FLASH_SIM_TIMING_MAX;
+    uint32_t sizes[BENCH_MAX_SIZES] = { 16u * 1024u, 64u * 1024u, 128u * 1024u, USER_FLASH_SIZE };
+    uint32_t size_count = 0, link_kbps = 100u, i;
+    int a;
+
+    for (a = 1; a < argc; a++)
+    {
+        if (strcmp(argv[a], "-max") == 0)
+            timing = max;
+        else if ((a + 1 < argc) && (strcmp(argv[a], "-w") == 0))
+            timing.word_program_us = (uint32_t)atoi(argv[++a]);
+        else if ((a + 1 < argc) && (strcmp(argv[a], "-e16") == 0))
+            timing.erase_16k_us = 1000u * (uint32_t)atoi(argv[++a]);
+        else if ((a + 1 < argc) && (strcmp(argv[a], "-e64") == 0))
+            timing.erase_64k_us = 1000u * (uint32_t)atoi(argv[++a]);
+        else if ((a + 1 < argc) && (strcmp(argv[a], "-e128") == 0))
+            timing.erase_128k_us = 1000u * (uint32_t)atoi(argv[++a]);
+        else if ((a + 1 < argc) && (strcmp(argv[a], "-link") == 0))
+            link_kbps = (uint32_t)atoi(argv[++a]);
+        else if ((argv[a][0] != '-') && (size_count < BENCH_MAX_SIZES) && (atoi(argv[a]) > 0))
+            sizes[size_count++] = 1024u * (uint32_t)atoi(argv[a]);
+        else
+            return usage();
+    }
+    if (size_count == 0)
+        size_count = 4;
+    link_us_per_packet = (link_kbps != 0) ? (1000000u / link_kbps) : 0;
+
+    printf("word program %u us, sector erase 16/64/128 KB %u/%u/%u ms, link %u KB/s\n",
+           timing.word_program_us, timing.erase_16k_us / 1000u, timing.erase_64k_us / 1000u,
+           timing.erase_128k_us / 1000u, link_kbps);
+    printf("%9s  %-24s %9s %9s %7s %10s %7s\n", "image", "strategy", "total ms", "flash ms", "erases", "words", "errors");
+    srand(1);
+    memset(old_image, 0x5A, sizeof(old_image));
+    for (i = 0; i < size_count; i++)
+    {
+        if ((sizes[i] > USER_FLASH_SIZE) || ((sizes[i] % BENCH_PACKET_SIZE) != 0))
+        {
+            printf("%u KB: image must be a multiple of 1 KB up to %u KB\n", sizes[i] / 1024u, USER_FLASH_SIZE / 1024u);
+            return 1;
+        }
+        bench_size(sizes[i]);
+    }
+    bench_status_log();
+    bench_status_lookup();
+    bench_kv_legacy();
+    bench_kv();
+    bench_kv_power_cut();
+    return 0;
+}
+
+/************************ (C) COPYRIGHT Jason *****END OF FILE****/
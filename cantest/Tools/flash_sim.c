@@ -0,0 +1,451 @@
+/******************************************************************************
+ * @file    flash_sim.c
+ * @brief   Host-side STM32F2 flash simulator with a timing model. Replaces
+ *          the HAL flash / NVIC / tick functions so that Core/User/flash_if.c,
+ *          flash_async.c and flash_e_level.c run unchanged on Linux.
+ * @author  Jason
+ * @version V1.0.0
+ * @date    2025-3
+ * @copyright (c) 2025, All rights reserved.
+ ******************************************************************************/
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "stm32f2xx_hal.h"
+#include "flash_layout.h"
+#include "flash_async.h"
+#include "flash_sim.h"
+
+/* Private define ------------------------------------------------------------*/
+#define SIM_WORDS           (FLASH_LAYOUT_SIZE / 4u)
+#define SIM_BLOCK_WORDS     (1024u)                 /* compare granularity */
+#define SIM_REG_PAGE        (FLASH_R_BASE & ~0xFFFu)
+#define SIM_SR_ERRORS       (FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR | \
+                             FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR)
+#define SIM_SR_MARK         (0x80000000u)           /* reserved bit: a firmware write to SR clears it */
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE MAP_FIXED
+#endif
+
+/* Private typedef -----------------------------------------------------------*/
+typedef enum
+{
+    SIM_IT_NONE,
+    SIM_IT_ERASE,
+    SIM_IT_PROGRAM
+} sim_it_t;
+
+/* Private variables ---------------------------------------------------------*/
+static volatile uint32_t *const flash_mem = (volatile uint32_t *)FLASH_LAYOUT_BASE;
+static uint32_t *shadow;                    /* real content of the cells */
+static flash_sim_timing_t timing;
+static flash_sim_stats_t stats;
+static uint64_t now_us;                     /* CPU time */
+static uint64_t busy_until_us;              /* end of the running erase / program */
+static uint32_t sr_state;                   /* SR as the simulator sees it */
+static int allow_reprogram;
+static uint32_t power_ops = FLASH_SIM_POWER_ON;   /* erases / programs left before the cut */
+
+static sim_it_t it_op;                      /* interrupt driven operation not reported yet */
+static uint32_t it_address;
+static uint32_t it_error;
+static int irq_enabled;
+static int in_irq;
+
+/* Private functions ---------------------------------------------------------*/
+static uint32_t erase_time_us(uint32_t size)
+{
+    if (size <= 0x4000u)
+        return timing.erase_16k_us;
+    if (size <= 0x10000u)
+        return timing.erase_64k_us;
+    return timing.erase_128k_us;
+}
+
+/* Start an operation of `us` after the current one, the flash is busy until then */
+static void start_busy(uint64_t us)
+{
+    if (busy_until_us < now_us)
+        busy_until_us = now_us;
+    busy_until_us += us;
+    stats.busy_us += us;
+}
+
+static int is_locked(void)
+{
+    return (FLASH->CR & FLASH_CR_LOCK) != 0;
+}
+
+/* Firmware writes to SR are write-1-to-clear, BSY follows the simulated time */
+static void sync_sr(void)
+{
+    uint32_t sr = FLASH->SR;
+
+    if ((sr & SIM_SR_MARK) == 0)
+        sr_state &= ~(sr & (SIM_SR_ERRORS | FLASH_FLAG_EOP));
+    sr_state &= ~FLASH_FLAG_BSY;
+    if (now_us < busy_until_us)
+        sr_state |= FLASH_FLAG_BSY;
+    FLASH->SR = sr_state | SIM_SR_MARK;
+}
+
+static void set_error(uint32_t flag)
+{
+    sr_state |= flag;
+    stats.errors++;
+}
+
+/* One word store: returns 0 if programmed, the SR error flag otherwise */
+static uint32_t program_word(uint32_t index, uint32_t value, int check_cr)
+{
+    uint32_t old = shadow[index];
+
+    if (power_ops == 0)
+        return 0;               /* lost, the cell keeps its content */
+    if (is_locked())
+        return FLASH_FLAG_WRPERR;
+    if (check_cr && (((FLASH->CR & FLASH_CR_PG) == 0) || ((FLASH->CR & FLASH_CR_PSIZE) != FLASH_PSIZE_WORD)))
+        return ((FLASH->CR & FLASH_CR_PG) == 0) ? FLASH_FLAG_PGSERR : FLASH_FLAG_PGPERR;
+    if (old != 0xFFFFFFFFu)
+    {
+        /* bits can only be cleared; a second program is refused unless allowed */
+        if (!allow_reprogram || ((value & ~old) != 0))
+            return FLASH_FLAG_PGSERR;
+        stats.reprogrammed_words++;
+    }
+    shadow[index] = value;
+    flash_mem[index] = value;
+    stats.programmed_words++;
+    if (power_ops != FLASH_SIM_POWER_ON)
+        power_ops--;
+    start_busy(timing.word_program_us);
+    return 0;
+}
+
+/* Apply the stores the firmware made since the last call */
+static void commit_stores(void)
+{
+    uint32_t block, i, value, error;
+
+    for (block = 0; block < SIM_WORDS; block += SIM_BLOCK_WORDS)
+    {
+        if (memcmp((const void *)&flash_mem[block], &shadow[block], SIM_BLOCK_WORDS * 4u) == 0)
+            continue;
+        for (i = block; i < block + SIM_BLOCK_WORDS; i++)
+        {
+            value = flash_mem[i];
+            if (value == shadow[i])
+                continue;
+            flash_mem[i] = shadow[i];
+            /* a store while the previous word is programmed stalls the bus */
+            if (now_us < busy_until_us)
+                now_us = busy_until_us;
+            error = program_word(i, value, 1);
+            if (error != 0)
+            {
+                set_error(error);
+                fprintf(stderr, "flash_sim: store 0x%08X to 0x%08X rejected (SR 0x%02X)\n",
+                        value, FLASH_LAYOUT_BASE + 4u * i, error);
+            }
+        }
+    }
+}
+
+static void sync(void)
+{
+    commit_stores();
+    sync_sr();
+}
+
+static void erase_sector(uint32_t sector)
+{
+    const FLASH_Layout_SectorTypeDef *p_sector = FLASH_Layout_GetSectorByIndex(sector);
+    uint32_t first;
+
+    if (p_sector == NULL)
+    {
+        set_error(FLASH_FLAG_PGSERR);
+        return;
+    }
+    if (is_locked())
+    {
+        set_error(FLASH_FLAG_WRPERR);
+        return;
+    }
+    if (power_ops == 0)
+        return;
+    if (power_ops != FLASH_SIM_POWER_ON)
+        power_ops--;
+    first = (p_sector->start - FLASH_LAYOUT_BASE) / 4u;
+    memset(&shadow[first], 0xFF, p_sector->size);
+    memset((void *)&flash_mem[first], 0xFF, p_sector->size);
+    stats.erased_sectors++;
+    start_busy(erase_time_us(p_sector->size));
+}
+
+/* FLASH_IRQHandler (stm32f2xx_it.c) once the interrupt driven operation ended */
+static void deliver_irq(void)
+{
+    if (irq_enabled && !in_irq && (it_op != SIM_IT_NONE) && (now_us >= busy_until_us))
+    {
+        in_irq = 1;
+        FLASH_Async_IRQHandler();
+        in_irq = 0;
+    }
+}
+
+/* Public functions ----------------------------------------------------------*/
+/**
+ * @brief  Maps the flash and the FLASH registers, erases everything, locks.
+ * @param  p_timing: timing model, NULL for the typical datasheet values
+ * @retval 0, -1 if the fixed addresses could not be mapped
+ */
+int flash_sim_init(const flash_sim_timing_t *p_timing)
+{
+    static const flash_sim_timing_t typ = FLASH_SIM_TIMING_TYP;
+    static int mapped;
+
+    if (!mapped)
+    {
+        if ((mmap((void *)FLASH_LAYOUT_BASE, FLASH_LAYOUT_SIZE, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0) != (void *)FLASH_LAYOUT_BASE) ||
+            (mmap((void *)SIM_REG_PAGE, 0x1000, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0) != (void *)SIM_REG_PAGE) ||
+            ((shadow = malloc(FLASH_LAYOUT_SIZE)) == NULL))
+        {
+            perror("flash_sim: mmap");
+            return -1;
+        }
+        mapped = 1;
+    }
+    timing = (p_timing != NULL) ? *p_timing : typ;
+    memset(shadow, 0xFF, FLASH_LAYOUT_SIZE);
+    memset((void *)flash_mem, 0xFF, FLASH_LAYOUT_SIZE);
+    memset(&stats, 0, sizeof(stats));
+    now_us = 0;
+    busy_until_us = 0;
+    sr_state = 0;
+    allow_reprogram = 0;
+    power_ops = FLASH_SIM_POWER_ON;
+    it_op = SIM_IT_NONE;
+    FLASH->CR = FLASH_CR_LOCK;
+    sync_sr();
+    return 0;
+}
+
+/**
+ * @brief  Writes flash content directly (no rules, no time), e.g. an
+ *         installed image.
+ */
+void flash_sim_load(uint32_t address, const void *data, uint32_t size)
+{
+    sync();
+    memcpy(&shadow[(address - FLASH_LAYOUT_BASE) / 4u], data, size);
+    memcpy((void *)&flash_mem[(address - FLASH_LAYOUT_BASE) / 4u], data, size);
+}
+
+/**
+ * @brief  Accepts programming a word that is not erased as long as no bit is
+ *         set (F2 silicon behaviour). Off after flash_sim_init().
+ */
+void flash_sim_allow_reprogram(int allow)
+{
+    allow_reprogram = allow;
+}
+
+/**
+ * @brief  The CPU does something else for `us` (transport, processing):
+ *         interrupt driven operations complete and the FLASH interrupt runs.
+ */
+void flash_sim_idle(uint32_t us)
+{
+    uint64_t target = now_us + us;
+
+    sync();
+    while (irq_enabled && (it_op != SIM_IT_NONE) && (busy_until_us <= target))
+    {
+        if (now_us < busy_until_us)
+            now_us = busy_until_us;
+        sync_sr();
+        deliver_irq();
+        sync();
+    }
+    now_us = target;
+    sync_sr();
+}
+
+/**
+ * @brief  Cuts the power after `ops` more erases / word programs, the later
+ *         ones are dropped silently. FLASH_SIM_POWER_ON restores it.
+ * @retval operations that were still left before the call
+ */
+uint32_t flash_sim_power_cut(uint32_t ops)
+{
+    uint32_t left;
+
+    sync();
+    left = power_ops;
+    power_ops = ops;
+    return left;
+}
+
+uint64_t flash_sim_now_us(void)
+{
+    return now_us;
+}
+
+const flash_sim_stats_t *flash_sim_stats(void)
+{
+    sync();
+    return &stats;
+}
+
+void flash_sim_reset_stats(void)
+{
+    sync();
+    memset(&stats, 0, sizeof(stats));
+}
+
+/* HAL replacements ----------------------------------------------------------*/
+uint32_t HAL_GetTick(void)
+{
+    sync();
+    /* the CPU only polls the tick while waiting: for the flash if it is busy */
+    if (now_us < busy_until_us)
+        now_us = busy_until_us;
+    else
+        now_us++;
+    sync_sr();
+    return (uint32_t)(now_us / 1000u);
+}
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void)
+{
+    sync();
+    FLASH->CR &= ~FLASH_CR_LOCK;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Lock(void)
+{
+    sync();
+    FLASH->CR |= FLASH_CR_LOCK;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef FLASH_WaitForLastOperation(uint32_t Timeout)
+{
+    sync();
+    if (busy_until_us > now_us + (uint64_t)Timeout * 1000u)
+    {
+        /* still busy when the HAL gives up */
+        now_us += (uint64_t)Timeout * 1000u;
+        sync_sr();
+        return HAL_TIMEOUT;
+    }
+    if (now_us < busy_until_us)
+        now_us = busy_until_us;
+    sync_sr();
+    sr_state &= ~FLASH_FLAG_EOP;
+    if ((sr_state & SIM_SR_ERRORS) != 0)
+    {
+        /* FLASH_SetErrorCode() clears the flags */
+        sr_state &= ~SIM_SR_ERRORS;
+        sync_sr();
+        return HAL_ERROR;
+    }
+    sync_sr();
+    return HAL_OK;
+}
+
+void FLASH_Erase_Sector(uint32_t Sector, uint8_t VoltageRange)
+{
+    (void)VoltageRange;
+    sync();
+    erase_sector(Sector);
+    sync_sr();
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_Erase_IT(FLASH_EraseInitTypeDef *pEraseInit)
+{
+    uint32_t errors, i;
+
+    sync();
+    errors = stats.errors;
+    for (i = 0; i < pEraseInit->NbSectors; i++)
+        erase_sector(pEraseInit->Sector + i);
+    it_op = SIM_IT_ERASE;
+    it_address = 0xFFFFFFFFu;
+    it_error = (stats.errors != errors);
+    sync_sr();
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Program_IT(uint32_t TypeProgram, uint32_t Address, uint64_t Data)
+{
+    uint32_t error = FLASH_FLAG_PGPERR;
+
+    sync();
+    if (TypeProgram == FLASH_TYPEPROGRAM_WORD)
+        error = ((Address & 3u) != 0) ? FLASH_FLAG_PGAERR :
+                program_word((Address - FLASH_LAYOUT_BASE) / 4u, (uint32_t)Data, 0);
+    if (error != 0)
+        set_error(error);
+    it_op = SIM_IT_PROGRAM;
+    it_address = Address;
+    it_error = (error != 0);
+    sync_sr();
+    return HAL_OK;
+}
+
+void HAL_FLASH_IRQHandler(void)
+{
+    sim_it_t op = it_op;
+
+    sync();
+    if ((op == SIM_IT_NONE) || (now_us < busy_until_us))
+        return;
+    it_op = SIM_IT_NONE;
+    if (it_error)
+    {
+        sr_state &= ~SIM_SR_ERRORS;
+        HAL_FLASH_OperationErrorCallback(it_address);
+    }
+    else
+    {
+        HAL_FLASH_EndOfOperationCallback(it_address);
+    }
+}
+
+void HAL_NVIC_SetPriority(IRQn_Type IRQn, uint32_t PreemptPriority, uint32_t SubPriority)
+{
+    (void)IRQn;
+    (void)PreemptPriority;
+    (void)SubPriority;
+}
+
+void HAL_NVIC_EnableIRQ(IRQn_Type IRQn)
+{
+    if (IRQn == FLASH_IRQn)
+    {
+        irq_enabled = 1;
+        deliver_irq();
+    }
+}
+
+void HAL_NVIC_DisableIRQ(IRQn_Type IRQn)
+{
+    if (IRQn == FLASH_IRQn)
+        irq_enabled = 0;
+}
+
+void HAL_NVIC_ClearPendingIRQ(IRQn_Type IRQn)
+{
+    (void)IRQn;
+}
+
+/************************ (C) COPYRIGHT Jason *****END OF FILE****/
@@ -0,0 +1,78 @@
+/******************************************************************************
+ * @file    flash_sim.h
+ * @brief   Host-side STM32F2 flash simulator with a timing model. Replaces
+ *          the HAL flash / NVIC / tick functions so that Core/User/flash_if.c,
+ *          flash_async.c and flash_e_level.c run unchanged on Linux.
+ * @author  Jason
+ * @version V1.0.0
+ * @date    2025-3
+ * @copyright (c) 2025, All rights reserved.
+ ******************************************************************************/
+
+#ifndef __FLASH_SIM_H
+#define __FLASH_SIM_H
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+/**
+ * The flash (FLASH_LAYOUT_BASE) and the FLASH registers (FLASH_R_BASE) are
+ * mapped at their real addresses, so the firmware reads and stores them
+ * directly. A shadow copy holds what the cells really contain; at every
+ * HAL call (wait, lock, erase, tick...) the stores made since the last call
+ * are checked against the F2 rules and the shadow:
+ *  - erase sets a whole sector to 0xFF, only while unlocked
+ *  - a store programs a word only while unlocked with PG set and PSIZE = word
+ *  - programming can only clear bits; programming a word that is not erased
+ *    is an error unless flash_sim_allow_reprogram(1) (the F2 has no ECC and
+ *    accepts it as long as no bit goes 0 -> 1, the wear-leveling map relies
+ *    on that)
+ * A rejected store is undone and reported through the SR error flags, as the
+ * HAL would see them.
+ *
+ * flash_sim_power_cut(n) lets n more erases / word programs through and
+ * drops the rest without an error, as if the supply failed after them; the
+ * flash keeps what was done, the caller then remounts as after a reset.
+ *
+ * Time is simulated: erases and programs keep the flash busy for the time
+ * of the timing model, the CPU waits for it in FLASH_WaitForLastOperation()
+ * and HAL_GetTick(), flash_sim_idle() lets time pass (transport) while
+ * interrupt driven operations complete in the background.
+ */
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+    uint32_t word_program_us;   /* one 32-bit word, x32 parallelism */
+    uint32_t erase_16k_us;      /* sector erase by size */
+    uint32_t erase_64k_us;
+    uint32_t erase_128k_us;
+} flash_sim_timing_t;
+
+typedef struct
+{
+    uint64_t busy_us;               /* time the flash was busy */
+    uint32_t erased_sectors;
+    uint32_t programmed_words;
+    uint32_t reprogrammed_words;    /* programmed while not erased */
+    uint32_t errors;                /* rejected operations (rule violations) */
+} flash_sim_stats_t;
+
+/* Exported constants --------------------------------------------------------*/
+/* STM32F205/207 datasheet, 2.7 - 3.6 V (x32): typical and maximum */
+#define FLASH_SIM_TIMING_TYP    { 16u, 250000u, 550000u, 1000000u }
+#define FLASH_SIM_TIMING_MAX    { 100u, 500000u, 1100000u, 2000000u }
+#define FLASH_SIM_POWER_ON      (0xFFFFFFFFu)   /* flash_sim_power_cut(): no cut */
+
+/* Exported function prototypes ----------------------------------------------*/
+int flash_sim_init(const flash_sim_timing_t *timing);
+void flash_sim_load(uint32_t address, const void *data, uint32_t size);
+void flash_sim_allow_reprogram(int allow);
+void flash_sim_idle(uint32_t us);
+uint32_t flash_sim_power_cut(uint32_t ops);
+uint64_t flash_sim_now_us(void);
+const flash_sim_stats_t *flash_sim_stats(void);
+void flash_sim_reset_stats(void);
+
+#endif /* __FLASH_SIM_H */
+
+/************************ (C) COPYRIGHT Jason *****END OF FILE****/
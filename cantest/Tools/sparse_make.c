@@ -0,0 +1,183 @@
+/******************************************************************************
+ * @file    sparse_make.c
+ * @brief   Host tool for the sector-diff update (Core/User/app_update.h):
+ *            sparse_make manifest new.bin app.mfs
+ *                writes the per-4 KB chunk manifest of the new image
+ *            sparse_make chunks new.bin app.mfs <bitmap> app.sdf
+ *                writes the chunks requested by the bootloader, <bitmap> is
+ *                the hex string printed after the manifest (Ymodem) or the
+ *                bytes after 71 01 FF 02 (UDS)
+ * @author  Jason
+ * @version V1.0.0
+ * @date    2025-3
+ * @copyright (c) 2025, All rights reserved.
+ ******************************************************************************/
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "crc.h"
+#include "app_update.h"
+
+/* Private typedef -----------------------------------------------------------*/
+typedef struct
+{
+    uint8_t  *data;
+    uint32_t  size;
+} blob_t;
+
+/* Private functions ---------------------------------------------------------*/
+static int read_file(const char *name, blob_t *p_blob)
+{
+    FILE *f = fopen(name, "rb");
+    long size;
+
+    if (f == NULL)
+        return -1;
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    rewind(f);
+    p_blob->data = malloc(size > 0 ? (size_t)size : 1u);
+    p_blob->size = (uint32_t)size;
+    if ((p_blob->data == NULL) || (fread(p_blob->data, 1, (size_t)size, f) != (size_t)size))
+    {
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    return 0;
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t chunk_count(uint32_t size)
+{
+    return (size + APP_MANIFEST_CHUNK_SIZE - 1u) / APP_MANIFEST_CHUNK_SIZE;
+}
+
+static uint32_t chunk_length(uint32_t size, uint32_t chunk)
+{
+    uint32_t left = size - chunk * APP_MANIFEST_CHUNK_SIZE;
+
+    return (left < APP_MANIFEST_CHUNK_SIZE) ? left : APP_MANIFEST_CHUNK_SIZE;
+}
+
+/* Manifest of the image: "MFS1", size, CRC-32 of every chunk */
+static uint32_t build_manifest(const blob_t *p_img, uint8_t *p_out)
+{
+    uint32_t i, chunks = chunk_count(p_img->size);
+
+    memcpy(p_out, APP_MANIFEST_MAGIC, 4);
+    put_u32(&p_out[4], p_img->size);
+    for (i = 0; i < chunks; i++)
+        put_u32(&p_out[APP_MANIFEST_HEADER_SIZE + 4u * i],
+                Crc32_Calc(&p_img->data[i * APP_MANIFEST_CHUNK_SIZE], chunk_length(p_img->size, i)));
+    return APP_MANIFEST_HEADER_SIZE + 4u * chunks;
+}
+
+static int hex_digit(char c)
+{
+    if ((c >= '0') && (c <= '9'))
+        return c - '0';
+    if ((c >= 'a') && (c <= 'f'))
+        return c - 'a' + 10;
+    if ((c >= 'A') && (c <= 'F'))
+        return c - 'A' + 10;
+    return -1;
+}
+
+static int write_file(const char *name, const uint8_t *p_data, uint32_t size)
+{
+    FILE *f = fopen(name, "wb");
+
+    if ((f == NULL) || (fwrite(p_data, 1, size, f) != size))
+    {
+        fprintf(stderr, "cannot write %s\n", name);
+        return 1;
+    }
+    fclose(f);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static uint8_t manifest[APP_MANIFEST_MAX_SIZE];
+    blob_t img;
+    uint8_t header[APP_SPARSE_HEADER_SIZE];
+    uint32_t i, chunks, length, sent = 0, bytes = APP_SPARSE_HEADER_SIZE;
+    const char *bits;
+    FILE *f;
+    int hi, lo;
+
+    if ((argc < 4) || ((strcmp(argv[1], "manifest") != 0) && (strcmp(argv[1], "chunks") != 0)) ||
+        ((strcmp(argv[1], "chunks") == 0) && (argc != 6)))
+    {
+        fprintf(stderr, "usage: %s manifest new.bin app.mfs\n"
+                        "       %s chunks new.bin app.mfs <bitmap hex> app.sdf\n", argv[0], argv[0]);
+        return 2;
+    }
+    if (read_file(argv[2], &img) != 0)
+    {
+        fprintf(stderr, "cannot read %s\n", argv[2]);
+        return 1;
+    }
+    chunks = chunk_count(img.size);
+    if ((img.size == 0) || (chunks > APP_MANIFEST_MAX_CHUNKS))
+    {
+        fprintf(stderr, "image must be 1..%u bytes\n", APP_MANIFEST_MAX_CHUNKS * APP_MANIFEST_CHUNK_SIZE);
+        return 1;
+    }
+    length = build_manifest(&img, manifest);
+
+    if (strcmp(argv[1], "manifest") == 0)
+    {
+        printf("%u bytes, %u chunks -> manifest %u bytes\n", img.size, chunks, length);
+        return write_file(argv[3], manifest, length);
+    }
+
+    bits = argv[4];
+    if (strlen(bits) != 2u * ((chunks + 7u) / 8u))
+    {
+        fprintf(stderr, "bitmap must be %u hex digits\n", 2u * ((chunks + 7u) / 8u));
+        return 1;
+    }
+    f = fopen(argv[5], "wb");
+    if (f == NULL)
+    {
+        fprintf(stderr, "cannot create %s\n", argv[5]);
+        return 1;
+    }
+    memcpy(header, APP_SPARSE_MAGIC, 4);
+    put_u32(&header[4], img.size);
+    put_u32(&header[8], Crc32_Calc(manifest, length));
+    fwrite(header, 1, sizeof(header), f);
+    for (i = 0; i < chunks; i++)
+    {
+        hi = hex_digit(bits[2u * (i / 8u)]);
+        lo = hex_digit(bits[2u * (i / 8u) + 1u]);
+        if ((hi < 0) || (lo < 0))
+        {
+            fprintf(stderr, "bad bitmap\n");
+            fclose(f);
+            return 1;
+        }
+        if ((((hi << 4) | lo) & (1 << (i % 8u))) != 0)
+        {
+            fwrite(&img.data[i * APP_MANIFEST_CHUNK_SIZE], 1, chunk_length(img.size, i), f);
+            bytes += chunk_length(img.size, i);
+            sent++;
+        }
+    }
+    fclose(f);
+    printf("%u of %u chunks -> %u bytes\n", sent, chunks, bytes);
+    return 0;
+}
+
+/************************ (C) COPYRIGHT Jason *****END OF FILE****/
@@ -23,6 +23,7 @@
 
 /* USER CODE BEGIN INCLUDE */
 #include "iap_user.h"
+#include "iap_stage.h"
 /* USER CODE END INCLUDE */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -276,24 +277,22 @@ static int8_t CDC_Control_FS(uint8_t cmd, uint8_t* pbuf, uint16_t length)
 static int8_t CDC_Receive_FS(uint8_t* Buf, uint32_t *Len)
 {
   /* USER CODE BEGIN 6 */
-  USBD_CDC_SetRxBuffer(&hUsbDeviceFS, &Buf[0]);
-  USBD_CDC_ReceivePacket(&hUsbDeviceFS);
+  // 每个包作为一个块追加到 SRAM2 暂存区 (iap_stage.h)，由 ReceiveAdapter 按字节流读取；
+  // 只有暂存区能再放下一整包 (64 bytes) 时端点才重新打开，所以这里一定放得下
+  (void)IAP_Stage_Put(&IAP_StageUsb, Buf, (uint16_t)*Len, 0);
 
-  if (64 == *Len)
+  // 暂存区满了 (8 KB) 端点才保持关闭，主机会收到 NAK 自动暂停发送（流控），
+  // 等应用读走数据后调用 CDC_ResumeReceive_FS() 再继续
+  USBD_CDC_SetRxBuffer(&hUsbDeviceFS, &Buf[0]);
+  if (NULL != IAP_Stage_Reserve(&IAP_StageUsb, CDC_DATA_FS_MAX_PACKET_SIZE))
   {
-      // 意味接受的数据大于 64 bytes，被分包了，或者是 正好64字节
-      //（在之后的地方进行超时判断，一定时间内几 ms 内没新数据到来 就判断为结束）
-      memcpy(&iap_recive.recivebuf[iap_recive.pack64_cnt * 64], Buf, 64);
-      iap_recive.pack64_cnt++;
-      iap_recive.iap_pkgtatus = PKG_NOT_DONE;
+      USBD_CDC_ReceivePacket(&hUsbDeviceFS);
   }
   else
   {
-      memcpy(&iap_recive.recivebuf[iap_recive.pack64_cnt * 64], Buf, *Len);
-      iap_recive.iap_pkgtatus = PKG_COMPLETE;
+      iap_recive.rx_paused = 1;
   }
-  iap_recive.length += *Len;
-   
+
   return (USBD_OK);
   /* USER CODE END 6 */
 }
@@ -325,6 +324,16 @@ uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len)
 
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_IMPLEMENTATION */
 
+/**
+  * @brief  Re-arm the OUT endpoint after CDC_Receive_FS paused it (staging FIFO full).
+  * @note   Called from thread context with the USB interrupt masked.
+  * @retval None
+  */
+void CDC_ResumeReceive_FS(void)
+{
+  USBD_CDC_ReceivePacket(&hUsbDeviceFS);
+}
+
 /* USER CODE END PRIVATE_FUNCTIONS_IMPLEMENTATION */
 
 /**